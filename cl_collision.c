@@ -876,12 +876,40 @@ finished:
 	return cliptrace;
 }
 
+/*
+==================
+CL_Cache_EntitiesInBox
+
+gathers the entities CL_Cache_TraceLineSurfaces may hit in a box, this is
+done once on the main thread so that the traces can run on other threads
+==================
+*/
+int CL_Cache_EntitiesInBox(const vec3_t mins, const vec3_t maxs, int maxedicts, prvm_edict_t **edicts)
+{
+	prvm_prog_t *prog = CLVM_prog;
+	int numtouchedicts;
+	// note: if prog is NULL then there won't be any linked entities
+	if (prog == NULL)
+		return 0;
+	numtouchedicts = World_EntitiesInBox(&cl.world, mins, maxs, maxedicts, edicts);
+	if (numtouchedicts > maxedicts)
+	{
+		// this never happens
+		Con_Printf("CL_EntitiesInBox returned %i edicts, max was %i\n", numtouchedicts, maxedicts);
+		numtouchedicts = maxedicts;
+	}
+	return numtouchedicts;
+}
+
 /*
 ==================
 CL_Cache_TraceLine
+
+touchedicts comes from CL_Cache_EntitiesInBox, each thread tracing at the
+same time must pass its own cache
 ==================
 */
-trace_t CL_Cache_TraceLineSurfaces(const vec3_t start, const vec3_t end, int type, int hitsupercontentsmask)
+trace_t CL_Cache_TraceLineSurfaces(collision_cache_t *cache, const vec3_t start, const vec3_t end, int type, int hitsupercontentsmask, int numtouchedicts, prvm_edict_t **touchedicts)
 {
 	prvm_prog_t *prog = CLVM_prog;
 	int i;
@@ -897,9 +925,6 @@ trace_t CL_Cache_TraceLineSurfaces(const vec3_t start, const vec3_t end, int typ
 	matrix4x4_t matrix, imatrix;
 	// model of other entity
 	dp_model_t *model;
-	// list of entities to test for collisions
-	int numtouchedicts;
-	static prvm_edict_t *touchedicts[MAX_EDICTS];
 
 	VectorCopy(start, clipstart);
 	VectorCopy(end, clipend);
@@ -908,7 +933,7 @@ trace_t CL_Cache_TraceLineSurfaces(const vec3_t start, const vec3_t end, int typ
 #endif
 
 	// clip to world
-	Collision_Cache_ClipLineToWorldSurfaces(&cliptrace, cl.worldmodel, clipstart, clipend, hitsupercontentsmask);
+	Collision_Cache_ClipLineToWorldSurfaces(cache, &cliptrace, cl.worldmodel, clipstart, clipend, hitsupercontentsmask);
 	cliptrace.worldstartsolid = cliptrace.bmodelstartsolid = cliptrace.startsolid;
 	if (cliptrace.startsolid || cliptrace.fraction < 1)
 		cliptrace.ent = prog ? prog->edicts : NULL;
@@ -932,28 +957,17 @@ trace_t CL_Cache_TraceLineSurfaces(const vec3_t start, const vec3_t end, int typ
 		entity_render_t *ent = &cl.entities[cl.brushmodel_entities[i]].render;
 		if (!BoxesOverlap(clipboxmins, clipboxmaxs, ent->mins, ent->maxs))
 			continue;
-		Collision_Cache_ClipLineToGenericEntitySurfaces(&trace, ent->model, &ent->matrix, &ent->inversematrix, start, end, hitsupercontentsmask);
+		Collision_Cache_ClipLineToGenericEntitySurfaces(cache, &trace, ent->model, &ent->matrix, &ent->inversematrix, start, end, hitsupercontentsmask);
 		Collision_CombineTraces(&cliptrace, &trace, NULL, true);
 	}
 
 	// clip to entities
-	// because this uses World_EntitiestoBox, we know all entity boxes overlap
-	// the clip region, so we can skip culling checks in the loop below
-	// note: if prog is NULL then there won't be any linked entities
-	numtouchedicts = 0;
-	if (prog != NULL)
-	{
-		numtouchedicts = World_EntitiesInBox(&cl.world, clipboxmins, clipboxmaxs, MAX_EDICTS, touchedicts);
-		if (numtouchedicts > MAX_EDICTS)
-		{
-			// this never happens
-			Con_Printf("CL_EntitiesInBox returned %i edicts, max was %i\n", numtouchedicts, MAX_EDICTS);
-			numtouchedicts = MAX_EDICTS;
-		}
-	}
+	// the list covers a larger area than this move, so cull them here
 	for (i = 0;i < numtouchedicts;i++)
 	{
 		touch = touchedicts[i];
+		if (!BoxesOverlap(clipboxmins, clipboxmaxs, touch->priv.server->areamins, touch->priv.server->areamaxs))
+			continue;
 		// might interact, so do an exact clip
 		// only hit entity models, not collision shapes
 		model = CL_GetModelFromEdict(touch);
@@ -966,7 +980,7 @@ trace_t CL_Cache_TraceLineSurfaces(const vec3_t start, const vec3_t end, int typ
 			continue;
 		Matrix4x4_CreateFromQuakeEntity(&matrix, PRVM_clientedictvector(touch, origin)[0], PRVM_clientedictvector(touch, origin)[1], PRVM_clientedictvector(touch, origin)[2], PRVM_clientedictvector(touch, angles)[0], PRVM_clientedictvector(touch, angles)[1], PRVM_clientedictvector(touch, angles)[2], 1);
 		Matrix4x4_Invert_Simple(&imatrix, &matrix);
-		Collision_Cache_ClipLineToGenericEntitySurfaces(&trace, model, &matrix, &imatrix, clipstart, clipend, hitsupercontentsmask);
+		Collision_Cache_ClipLineToGenericEntitySurfaces(cache, &trace, model, &matrix, &imatrix, clipstart, clipend, hitsupercontentsmask);
 		Collision_CombineTraces(&cliptrace, &trace, (void *)touch, PRVM_clientedictfloat(touch, solid) == SOLID_BSP);
 	}
 
@@ -23,6 +23,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "cl_collision.h"
 #include "image.h"
 #include "r_shadow.h"
+#ifdef SSE_PRESENT
+#include <xmmintrin.h>
+#endif
 
 // must match ptype_t values
 particletype_t particletype[pt_total] =
@@ -297,6 +300,7 @@ cvar_t cl_particles_sparks = {CVAR_SAVE, "cl_particles_sparks", "1", "enables sp
 cvar_t cl_particles_bubbles = {CVAR_SAVE, "cl_particles_bubbles", "1", "enables bubbles (used by multiple effects)"};
 cvar_t cl_particles_visculling = {CVAR_SAVE, "cl_particles_visculling", "0", "perform a costly check if each particle is visible before drawing"};
 cvar_t cl_particles_collisions = {CVAR_SAVE, "cl_particles_collisions", "1", "allow costly collision detection on particles (sparks that bounce, particles not going through walls, blood hitting surfaces, etc)"};
+cvar_t cl_particles_sse = {CVAR_SAVE, "cl_particles_sse", "1", "integrate particle motion 4 particles at a time with SSE (in builds that have SSE)"};
 cvar_t cl_particles_forcetraileffects = {0, "cl_particles_forcetraileffects", "0", "force trails to be displayed even if a non-trail draw primitive was used (debug/compat feature)"};
 cvar_t cl_decals = {CVAR_SAVE, "cl_decals", "1", "enables decals (bullet holes, blood, etc)"};
 cvar_t cl_decals_visculling = {CVAR_SAVE, "cl_decals_visculling", "1", "perform a very cheap check if each decal is visible before drawing"};
@@ -615,6 +619,7 @@ void CL_Particles_Init (void)
 	Cvar_RegisterVariable (&cl_particles_bubbles);
 	Cvar_RegisterVariable (&cl_particles_visculling);
 	Cvar_RegisterVariable (&cl_particles_collisions);
+	Cvar_RegisterVariable (&cl_particles_sse);
 	Cvar_RegisterVariable (&cl_particles_forcetraileffects);
 	Cvar_RegisterVariable (&cl_decals);
 	Cvar_RegisterVariable (&cl_decals_visculling);
@@ -2925,17 +2930,177 @@ static void R_DrawParticle_TransparentCallback(const entity_render_t *ent, const
 	}
 }
 
+// particles that moved this frame and need a collision trace, the traces are
+// done in one batch after all particles have been integrated
+typedef struct particlecollision_s
+{
+	int index;
+	float oldorg[3];
+}
+particlecollision_t;
+
+// structure of arrays holding the motion state of the particles that move
+// this frame, filled by the fade pass and integrated in one sweep so the
+// integration loop touches only the data it needs
+typedef struct particlemotion_s
+{
+	int *index; // which particle in cl.particles
+	float *org[3];
+	float *vel[3];
+	float *friction; // velocity scale for this frame
+	float *fall; // velocity lost to gravity this frame
+}
+particlemotion_t;
+
+static void R_Particles_AllocMotion(particlemotion_t *m, int count)
+{
+	float *f;
+	int k;
+	m->index = (int *)R_FrameData_Alloc(count * sizeof(int));
+	f = (float *)R_FrameData_Alloc(count * 8 * sizeof(float));
+	for (k = 0;k < 3;k++)
+	{
+		m->org[k] = f;f += count;
+		m->vel[k] = f;f += count;
+	}
+	m->friction = f;f += count;
+	m->fall = f;
+}
+
+static void R_Particles_Integrate(particlemotion_t *m, int count, float frametime)
+{
+	int i = 0;
+	float f;
+#ifdef SSE_PRESENT
+	if (cl_particles_sse.integer)
+	{
+		__m128 dt = _mm_set1_ps(frametime);
+		__m128 scale, vx, vy, vz;
+		for (;i + 4 <= count;i += 4)
+		{
+			scale = _mm_loadu_ps(m->friction + i);
+			vx = _mm_mul_ps(_mm_loadu_ps(m->vel[0] + i), scale);
+			vy = _mm_mul_ps(_mm_loadu_ps(m->vel[1] + i), scale);
+			vz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(m->vel[2] + i), _mm_loadu_ps(m->fall + i)), scale);
+			_mm_storeu_ps(m->vel[0] + i, vx);
+			_mm_storeu_ps(m->vel[1] + i, vy);
+			_mm_storeu_ps(m->vel[2] + i, vz);
+			_mm_storeu_ps(m->org[0] + i, _mm_add_ps(_mm_loadu_ps(m->org[0] + i), _mm_mul_ps(vx, dt)));
+			_mm_storeu_ps(m->org[1] + i, _mm_add_ps(_mm_loadu_ps(m->org[1] + i), _mm_mul_ps(vy, dt)));
+			_mm_storeu_ps(m->org[2] + i, _mm_add_ps(_mm_loadu_ps(m->org[2] + i), _mm_mul_ps(vz, dt)));
+		}
+	}
+#endif
+	// leftover particles (or all of them without SSE)
+	for (;i < count;i++)
+	{
+		f = m->friction[i];
+		m->vel[0][i] *= f;
+		m->vel[1][i] *= f;
+		m->vel[2][i] = (m->vel[2][i] - m->fall[i]) * f;
+		m->org[0][i] += m->vel[0][i] * frametime;
+		m->org[1][i] += m->vel[1][i] * frametime;
+		m->org[2][i] += m->vel[2][i] * frametime;
+	}
+}
+
+// returns false if the particle should be removed
+static qboolean R_Particles_Collide(particle_t *p, const float *oldorg)
+{
+	int a;
+	int hitent;
+	float dist, decaldir[3];
+	trace_t trace;
+
+	trace = CL_TraceLine(oldorg, p->org, MOVE_NOMONSTERS, NULL, SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | ((p->typeindex == pt_rain || p->typeindex == pt_snow) ? SUPERCONTENTS_LIQUIDSMASK : 0), collision_extendmovelength.value, true, false, &hitent, false, false);
+	// if the trace started in or hit something of SUPERCONTENTS_NODROP
+	// or if the trace hit something flagged as NOIMPACT
+	// then remove the particle
+	if (trace.hitq3surfaceflags & Q3SURFACEFLAG_NOIMPACT || ((trace.startsupercontents | trace.hitsupercontents) & SUPERCONTENTS_NODROP) || (trace.startsupercontents & SUPERCONTENTS_SOLID))
+		return false;
+	VectorCopy(trace.endpos, p->org);
+	// react if the particle hit something
+	if (trace.fraction < 1)
+	{
+		VectorCopy(trace.endpos, p->org);
+
+		if (p->staintexnum >= 0)
+		{
+			// blood - splash on solid
+			if (!(trace.hitq3surfaceflags & Q3SURFACEFLAG_NOMARKS))
+			{
+				R_Stain(p->org, 16,
+					p->staincolor[0], p->staincolor[1], p->staincolor[2], (int)(p->stainalpha * p->stainsize * (1.0f / 160.0f)),
+					p->staincolor[0], p->staincolor[1], p->staincolor[2], (int)(p->stainalpha * p->stainsize * (1.0f / 160.0f)));
+				if (cl_decals.integer)
+				{
+					// create a decal for the blood splat
+					a = 0xFFFFFF ^ (p->staincolor[0]*65536+p->staincolor[1]*256+p->staincolor[2]);
+					if (cl_decals_newsystem_bloodsmears.integer)
+					{
+						VectorCopy(p->vel, decaldir);
+						VectorNormalize(decaldir);
+					}
+					else
+						VectorCopy(trace.plane.normal, decaldir);
+					CL_SpawnDecalParticleForSurface(hitent, p->org, decaldir, a, a, p->staintexnum, p->stainsize, p->stainalpha); // staincolor needs to be inverted for decals!
+				}
+			}
+		}
+
+		if (p->typeindex == pt_blood)
+		{
+			// blood - splash on solid
+			if (trace.hitq3surfaceflags & Q3SURFACEFLAG_NOMARKS)
+				return false;
+			if(p->staintexnum == -1) // staintex < -1 means no stains at all
+			{
+				R_Stain(p->org, 16, 64, 16, 16, (int)(p->alpha * p->size * (1.0f / 80.0f)), 64, 32, 32, (int)(p->alpha * p->size * (1.0f / 80.0f)));
+				if (cl_decals.integer)
+				{
+					// create a decal for the blood splat
+					if (cl_decals_newsystem_bloodsmears.integer)
+					{
+						VectorCopy(p->vel, decaldir);
+						VectorNormalize(decaldir);
+					}
+					else
+						VectorCopy(trace.plane.normal, decaldir);
+					CL_SpawnDecalParticleForSurface(hitent, p->org, decaldir, p->color[0] * 65536 + p->color[1] * 256 + p->color[2], p->color[0] * 65536 + p->color[1] * 256 + p->color[2], tex_blooddecal[rand()&7], p->size * lhrandom(cl_particles_blood_decal_scalemin.value, cl_particles_blood_decal_scalemax.value), cl_particles_blood_decal_alpha.value * 768);
+				}
+			}
+			return false;
+		}
+		else if (p->bounce < 0)
+		{
+			// bounce -1 means remove on impact
+			return false;
+		}
+		else
+		{
+			// anything else - bounce off solid
+			dist = DotProduct(p->vel, trace.plane.normal) * -p->bounce;
+			VectorMA(p->vel, dist, trace.plane.normal, p->vel);
+		}
+	}
+	return true;
+}
+
 void R_DrawParticles (void)
 {
-	int i, a;
+	int i, j, a;
 	int drawparticles = r_drawparticles.integer;
+	int numcollisions;
+	int nummoving;
+	int oldnumparticles;
 	float minparticledist_start;
-	particle_t *p;
-	float gravity, frametime, f, dist, oldorg[3], decaldir[3];
+	particle_t *p, *packed;
+	particlemotion_t motion;
+	float gravity, frametime, f, fall;
 	float drawdist2;
-	int hitent;
-	trace_t trace;
 	qboolean update;
+	qboolean collisions = cl_particles_collisions.integer != 0;
+	particlecollision_t *collisionlist = NULL;
 
 	frametime = bound(0, cl.time - cl.particles_updatetime, 1);
 	cl.particles_updatetime = bound(cl.time - 1, cl.particles_updatetime + frametime, cl.time + 1);
@@ -2950,215 +3115,195 @@ void R_DrawParticles (void)
 	drawdist2 = r_drawparticles_drawdistance.value * r_refdef.view.quality;
 	drawdist2 = drawdist2*drawdist2;
 
-	for (i = 0, p = cl.particles;i < cl.num_particles;i++, p++)
+	// pass 1: fade all the particles and gather the moving ones into the
+	// motion arrays
+	numcollisions = 0;
+	nummoving = 0;
+	if (update)
 	{
-		if (!p->typeindex)
+		R_Particles_AllocMotion(&motion, cl.num_particles);
+		for (i = 0, p = cl.particles;i < cl.num_particles;i++, p++)
 		{
-			if (cl.free_particle > i)
-				cl.free_particle = i;
-			continue;
-		}
-
-		if (update)
-		{
-			if (p->delayedspawn > cl.time)
+			if (!p->typeindex || p->delayedspawn > cl.time)
 				continue;
 
 			p->size += p->sizeincrease * frametime;
 			p->alpha -= p->alphafade * frametime;
 
 			if (p->alpha <= 0 || p->die <= cl.time)
-				goto killparticle;
+			{
+				p->typeindex = 0;
+				continue;
+			}
+
+			if (p->orientation == PARTICLE_VBEAM || p->orientation == PARTICLE_HBEAM)
+				continue;
 
-			if (p->orientation != PARTICLE_VBEAM && p->orientation != PARTICLE_HBEAM && frametime > 0)
+			if (p->liquidfriction && collisions && (CL_PointSuperContents(p->org) & SUPERCONTENTS_LIQUIDSMASK))
 			{
-				if (p->liquidfriction && cl_particles_collisions.integer && (CL_PointSuperContents(p->org) & SUPERCONTENTS_LIQUIDSMASK))
+				if (p->typeindex == pt_blood)
 				{
-					if (p->typeindex == pt_blood)
-						p->size += frametime * 8;
-					else
-						p->vel[2] -= p->gravity * gravity;
-					f = 1.0f - min(p->liquidfriction * frametime, 1);
-					VectorScale(p->vel, f, p->vel);
+					p->size += frametime * 8;
+					fall = 0;
 				}
 				else
-				{
-					p->vel[2] -= p->gravity * gravity;
-					if (p->airfriction)
-					{
-						f = 1.0f - min(p->airfriction * frametime, 1);
-						VectorScale(p->vel, f, p->vel);
-					}
-				}
+					fall = p->gravity * gravity;
+				f = 1.0f - min(p->liquidfriction * frametime, 1);
+			}
+			else
+			{
+				fall = p->gravity * gravity;
+				f = p->airfriction ? 1.0f - min(p->airfriction * frametime, 1) : 1.0f;
+			}
 
-				VectorCopy(p->org, oldorg);
-				VectorMA(p->org, frametime, p->vel, p->org);
-//				if (p->bounce && cl.time >= p->delayedcollisions)
-				if (p->bounce && cl_particles_collisions.integer && VectorLength(p->vel))
-				{
-					trace = CL_TraceLine(oldorg, p->org, MOVE_NOMONSTERS, NULL, SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | ((p->typeindex == pt_rain || p->typeindex == pt_snow) ? SUPERCONTENTS_LIQUIDSMASK : 0), collision_extendmovelength.value, true, false, &hitent, false, false);
-					// if the trace started in or hit something of SUPERCONTENTS_NODROP
-					// or if the trace hit something flagged as NOIMPACT
-					// then remove the particle
-					if (trace.hitq3surfaceflags & Q3SURFACEFLAG_NOIMPACT || ((trace.startsupercontents | trace.hitsupercontents) & SUPERCONTENTS_NODROP) || (trace.startsupercontents & SUPERCONTENTS_SOLID))
-						goto killparticle;
-					VectorCopy(trace.endpos, p->org);
-					// react if the particle hit something
-					if (trace.fraction < 1)
-					{
-						VectorCopy(trace.endpos, p->org);
+			motion.index[nummoving] = i;
+			motion.org[0][nummoving] = p->org[0];
+			motion.org[1][nummoving] = p->org[1];
+			motion.org[2][nummoving] = p->org[2];
+			motion.vel[0][nummoving] = p->vel[0];
+			motion.vel[1][nummoving] = p->vel[1];
+			motion.vel[2][nummoving] = p->vel[2];
+			motion.friction[nummoving] = f;
+			motion.fall[nummoving] = fall;
+			nummoving++;
+		}
 
-						if (p->staintexnum >= 0)
-						{
-							// blood - splash on solid
-							if (!(trace.hitq3surfaceflags & Q3SURFACEFLAG_NOMARKS))
-							{
-								R_Stain(p->org, 16,
-									p->staincolor[0], p->staincolor[1], p->staincolor[2], (int)(p->stainalpha * p->stainsize * (1.0f / 160.0f)),
-									p->staincolor[0], p->staincolor[1], p->staincolor[2], (int)(p->stainalpha * p->stainsize * (1.0f / 160.0f)));
-								if (cl_decals.integer)
-								{
-									// create a decal for the blood splat
-									a = 0xFFFFFF ^ (p->staincolor[0]*65536+p->staincolor[1]*256+p->staincolor[2]);
-									if (cl_decals_newsystem_bloodsmears.integer)
-									{
-										VectorCopy(p->vel, decaldir);
-										VectorNormalize(decaldir);
-									}
-									else
-										VectorCopy(trace.plane.normal, decaldir);
-									CL_SpawnDecalParticleForSurface(hitent, p->org, decaldir, a, a, p->staintexnum, p->stainsize, p->stainalpha); // staincolor needs to be inverted for decals!
-								}
-							}
-						}
+		// pass 2: integrate the motion arrays in one sweep and write the
+		// results back, noting which particles need a collision trace
+		R_Particles_Integrate(&motion, nummoving, frametime);
+		if (collisions)
+			collisionlist = (particlecollision_t *)R_FrameData_Alloc(nummoving * sizeof(particlecollision_t));
+		for (i = 0;i < nummoving;i++)
+		{
+			p = cl.particles + motion.index[i];
+			p->vel[0] = motion.vel[0][i];
+			p->vel[1] = motion.vel[1][i];
+			p->vel[2] = motion.vel[2][i];
+			if (p->bounce && collisions && VectorLength2(p->vel))
+			{
+				collisionlist[numcollisions].index = motion.index[i];
+				VectorCopy(p->org, collisionlist[numcollisions].oldorg);
+				numcollisions++;
+			}
+			p->org[0] = motion.org[0][i];
+			p->org[1] = motion.org[1][i];
+			p->org[2] = motion.org[2][i];
+		}
+	}
 
-						if (p->typeindex == pt_blood)
-						{
-							// blood - splash on solid
-							if (trace.hitq3surfaceflags & Q3SURFACEFLAG_NOMARKS)
-								goto killparticle;
-							if(p->staintexnum == -1) // staintex < -1 means no stains at all
-							{
-								R_Stain(p->org, 16, 64, 16, 16, (int)(p->alpha * p->size * (1.0f / 80.0f)), 64, 32, 32, (int)(p->alpha * p->size * (1.0f / 80.0f)));
-								if (cl_decals.integer)
-								{
-									// create a decal for the blood splat
-									if (cl_decals_newsystem_bloodsmears.integer)
-									{
-										VectorCopy(p->vel, decaldir);
-										VectorNormalize(decaldir);
-									}
-									else
-										VectorCopy(trace.plane.normal, decaldir);
-									CL_SpawnDecalParticleForSurface(hitent, p->org, decaldir, p->color[0] * 65536 + p->color[1] * 256 + p->color[2], p->color[0] * 65536 + p->color[1] * 256 + p->color[2], tex_blooddecal[rand()&7], p->size * lhrandom(cl_particles_blood_decal_scalemin.value, cl_particles_blood_decal_scalemax.value), cl_particles_blood_decal_alpha.value * 768);
-								}
-							}
-							goto killparticle;
-						}
-						else if (p->bounce < 0)
-						{
-							// bounce -1 means remove on impact
-							goto killparticle;
-						}
-						else
-						{
-							// anything else - bounce off solid
-							dist = DotProduct(p->vel, trace.plane.normal) * -p->bounce;
-							VectorMA(p->vel, dist, trace.plane.normal, p->vel);
-						}
-					}
-				}
+	// pass 3: trace the moves of the particles that collide with the world
+	for (i = 0;i < numcollisions;i++)
+	{
+		p = cl.particles + collisionlist[i].index;
+		if (!R_Particles_Collide(p, collisionlist[i].oldorg))
+			p->typeindex = 0;
+	}
 
-				if (VectorLength2(p->vel) < 0.03)
-				{
-					if(p->orientation == PARTICLE_SPARK) // sparks are virtually invisible if very slow, so rather let them go off
-						goto killparticle;
-					VectorClear(p->vel);
-				}
+	// pass 4: per-type behavior, then pack the surviving particles to the
+	// front of the array (keeping their order) and queue them for drawing
+	oldnumparticles = cl.num_particles;
+	for (i = 0, j = 0, p = cl.particles;i < oldnumparticles;i++, p++)
+	{
+		if (!p->typeindex)
+			continue;
+
+		if (p->delayedspawn > cl.time)
+		{
+			if (j != i)
+				cl.particles[j] = *p;
+			j++;
+			continue;
+		}
+
+		if (update)
+		{
+			if (p->orientation != PARTICLE_VBEAM && p->orientation != PARTICLE_HBEAM && VectorLength2(p->vel) < 0.03)
+			{
+				if(p->orientation == PARTICLE_SPARK) // sparks are virtually invisible if very slow, so rather let them go off
+					continue;
+				VectorClear(p->vel);
 			}
 
-			if (p->typeindex != pt_static)
+			switch (p->typeindex)
 			{
-				switch (p->typeindex)
+			case pt_entityparticle:
+				// particle that removes itself after one rendered frame
+				if (p->time2)
+					continue;
+				else
+					p->time2 = 1;
+				break;
+			case pt_blood:
+				a = CL_PointSuperContents(p->org);
+				if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_LAVA | SUPERCONTENTS_NODROP))
+					continue;
+				break;
+			case pt_bubble:
+				a = CL_PointSuperContents(p->org);
+				if (!(a & (SUPERCONTENTS_WATER | SUPERCONTENTS_SLIME)))
+					continue;
+				break;
+			case pt_rain:
+				a = CL_PointSuperContents(p->org);
+				if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | SUPERCONTENTS_LIQUIDSMASK))
+					continue;
+				break;
+			case pt_snow:
+				if (cl.time > p->time2)
 				{
-				case pt_entityparticle:
-					// particle that removes itself after one rendered frame
-					if (p->time2)
-						goto killparticle;
-					else
-						p->time2 = 1;
-					break;
-				case pt_blood:
-					a = CL_PointSuperContents(p->org);
-					if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_LAVA | SUPERCONTENTS_NODROP))
-						goto killparticle;
-					break;
-				case pt_bubble:
-					a = CL_PointSuperContents(p->org);
-					if (!(a & (SUPERCONTENTS_WATER | SUPERCONTENTS_SLIME)))
-						goto killparticle;
-					break;
-				case pt_rain:
-					a = CL_PointSuperContents(p->org);
-					if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | SUPERCONTENTS_LIQUIDSMASK))
-						goto killparticle;
-					break;
-				case pt_snow:
-					if (cl.time > p->time2)
-					{
-						// snow flutter
-						p->time2 = cl.time + (rand() & 3) * 0.1;
-						p->vel[0] = p->vel[0] * 0.9f + lhrandom(-32, 32);
-						p->vel[1] = p->vel[0] * 0.9f + lhrandom(-32, 32);
-					}
-					a = CL_PointSuperContents(p->org);
-					if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | SUPERCONTENTS_LIQUIDSMASK))
-						goto killparticle;
-					break;
-				default:
-					break;
+					// snow flutter
+					p->time2 = cl.time + (rand() & 3) * 0.1;
+					p->vel[0] = p->vel[0] * 0.9f + lhrandom(-32, 32);
+					p->vel[1] = p->vel[0] * 0.9f + lhrandom(-32, 32);
 				}
+				a = CL_PointSuperContents(p->org);
+				if (a & (SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY | SUPERCONTENTS_LIQUIDSMASK))
+					continue;
+				break;
+			default:
+				break;
 			}
 		}
-		else if (p->delayedspawn > cl.time)
-			continue;
+
+		// the particle survived, move it down to its packed slot
+		// (p stays on the loop cursor, the rest of this uses the packed copy)
+		if (j != i)
+			cl.particles[j] = *p;
+		packed = cl.particles + j++;
+
 		if (!drawparticles)
 			continue;
 		// don't render particles too close to the view (they chew fillrate)
 		// also don't render particles behind the view (useless)
 		// further checks to cull to the frustum would be too slow here
-		switch(p->typeindex)
+		switch(packed->typeindex)
 		{
 		case pt_beam:
 			// beams have no culling
-			R_MeshQueue_AddTransparent(TRANSPARENTSORT_DISTANCE, p->sortorigin, R_DrawParticle_TransparentCallback, NULL, i, NULL);
+			R_MeshQueue_AddTransparent(TRANSPARENTSORT_DISTANCE, packed->sortorigin, R_DrawParticle_TransparentCallback, NULL, j - 1, NULL);
 			break;
 		default:
 			if(cl_particles_visculling.integer)
 				if (!r_refdef.viewcache.world_novis)
 					if(r_refdef.scene.worldmodel && r_refdef.scene.worldmodel->brush.PointInLeaf)
 					{
-						mleaf_t *leaf = r_refdef.scene.worldmodel->brush.PointInLeaf(r_refdef.scene.worldmodel, p->org);
+						mleaf_t *leaf = r_refdef.scene.worldmodel->brush.PointInLeaf(r_refdef.scene.worldmodel, packed->org);
 						if(leaf)
 							if(!CHECKPVSBIT(r_refdef.viewcache.world_pvsbits, leaf->clusterindex))
 								continue;
 					}
 			// anything else just has to be in front of the viewer and visible at this distance
-			if (DotProduct(p->org, r_refdef.view.forward) >= minparticledist_start && VectorDistance2(p->org, r_refdef.view.origin) < drawdist2 * (p->size * p->size))
-				R_MeshQueue_AddTransparent(TRANSPARENTSORT_DISTANCE, p->sortorigin, R_DrawParticle_TransparentCallback, NULL, i, NULL);
+			if (DotProduct(packed->org, r_refdef.view.forward) >= minparticledist_start && VectorDistance2(packed->org, r_refdef.view.origin) < drawdist2 * (packed->size * packed->size))
+				R_MeshQueue_AddTransparent(TRANSPARENTSORT_DISTANCE, packed->sortorigin, R_DrawParticle_TransparentCallback, NULL, j - 1, NULL);
 			break;
 		}
-
-		continue;
-killparticle:
-		p->typeindex = 0;
-		if (cl.free_particle > i)
-			cl.free_particle = i;
 	}
 
-	// reduce cl.num_particles if possible
-	while (cl.num_particles > 0 && cl.particles[cl.num_particles - 1].typeindex == 0)
-		cl.num_particles--;
+	// everything past the packed particles is free now
+	for (i = j;i < oldnumparticles;i++)
+		cl.particles[i].typeindex = 0;
+	cl.num_particles = j;
+	cl.free_particle = j;
 
 	if (cl.num_particles == cl.max_particles && cl.max_particles < MAX_PARTICLES)
 	{
@@ -46,6 +46,10 @@ typedef enum r_stat_e
 	r_stat_draws,
 	r_stat_draws_vertices,
 	r_stat_draws_elements,
+	r_stat_state_shaderswitches,
+	r_stat_state_texturebinds,
+	r_stat_renderqueue_items,
+	r_stat_renderqueue_entityswitches,
 	r_stat_lights,
 	r_stat_lights_clears,
 	r_stat_lights_scissored,
@@ -397,6 +401,8 @@ typedef struct rtlight_s
 	/// (important on big surfaces such as terrain)
 	int static_numlighttrispvsbytes;
 	unsigned char *static_lighttrispvs;
+	/// record of this light in the compiled light cache + 1 (0 if none)
+	int static_compilecacherecord;
 	/// masks of all shadowmap sides that have any potential static receivers or casters
 	int static_shadowmap_receivers;
 	int static_shadowmap_casters;
@@ -797,6 +803,7 @@ cl_downloadack_t;
 typedef struct cl_soundstats_s
 {
 	int mixedsounds;
+	int virtualsounds;
 	int totalsounds;
 	int latency_milliseconds;
 }
@@ -1895,6 +1895,7 @@ static void VM_CL_copyentity (prvm_prog_t *prog)
 		return;
 	}
 	memcpy(out->fields.fp, in->fields.fp, prog->entityfields * sizeof(prvm_vec_t));
+	PRVM_FindIndex_Touch(prog, PRVM_NUM_FOR_EDICT(out));
 	CL_LinkEdict(out);
 }
 
@@ -2615,6 +2616,7 @@ static void VM_CL_gettaginfo (prvm_prog_t *prog)
 
 	PRVM_clientglobalfloat(gettaginfo_parent) = parentindex;
 	PRVM_clientglobalstring(gettaginfo_name) = tagname ? PRVM_SetTempString(prog, tagname) : 0;
+	PRVM_TempStrings_Keep(prog);
 	VectorCopy(forward, PRVM_clientglobalvector(gettaginfo_forward));
 	VectorScale(left, -1, PRVM_clientglobalvector(gettaginfo_right));
 	VectorCopy(up, PRVM_clientglobalvector(gettaginfo_up));
@@ -5000,6 +5002,24 @@ VM_digest_hex,						// #639
 VM_CL_V_CalcRefdef,					// #640 void(entity e) V_CalcRefdef (DP_CSQC_V_CALCREFDEF)
 NULL,							// #641
 VM_coverage,						// #642
+NULL,							// #643
+VM_hashtable_create,					// #644 float() hashtable_create (DP_QC_HASHTABLES)
+VM_hashtable_delete,					// #645 void(float table) hashtable_delete (DP_QC_HASHTABLES)
+VM_hashtable_clear,					// #646 void(float table) hashtable_clear (DP_QC_HASHTABLES)
+VM_hashtable_count,					// #647 float(float table) hashtable_count (DP_QC_HASHTABLES)
+VM_hashtable_gettype,					// #648 float(float table, string key) hashtable_gettype (DP_QC_HASHTABLES)
+VM_hashtable_remove,					// #649 float(float table, string key) hashtable_remove (DP_QC_HASHTABLES)
+VM_hashtable_getkey,					// #650 string(float table, float index) hashtable_getkey (DP_QC_HASHTABLES)
+VM_hashtable_setstring,					// #651 void(float table, string key, string value) hashtable_setstring (DP_QC_HASHTABLES)
+VM_hashtable_setfloat,					// #652 void(float table, string key, float value) hashtable_setfloat (DP_QC_HASHTABLES)
+VM_hashtable_setvector,					// #653 void(float table, string key, vector value) hashtable_setvector (DP_QC_HASHTABLES)
+VM_hashtable_setentity,					// #654 void(float table, string key, entity value) hashtable_setentity (DP_QC_HASHTABLES)
+VM_hashtable_getstring,					// #655 string(float table, string key) hashtable_getstring (DP_QC_HASHTABLES)
+VM_hashtable_getfloat,					// #656 float(float table, string key) hashtable_getfloat (DP_QC_HASHTABLES)
+VM_hashtable_getvector,					// #657 vector(float table, string key) hashtable_getvector (DP_QC_HASHTABLES)
+VM_hashtable_getentity,					// #658 entity(float table, string key) hashtable_getentity (DP_QC_HASHTABLES)
+VM_hashtable_writefile,					// #659 float(float filehandle, float table) hashtable_writefile (DP_QC_HASHTABLES)
+VM_hashtable_loadfile,					// #660 float(string filename, float table) hashtable_loadfile (DP_QC_HASHTABLES)
 NULL
 };
 
@@ -1424,47 +1424,79 @@ typedef struct collision_cachedtrace_s
 }
 collision_cachedtrace_t;
 
+struct collision_cache_s
+{
+	collision_cachedtrace_t *array;
+	int firstfree;
+	int lastused;
+	int max;
+	unsigned char sequence;
+	int hashsize;
+	int *hash;
+	unsigned int *arrayfullhashindex;
+	unsigned int *arrayhashindex;
+	unsigned int *arraynext;
+	unsigned char *arrayused;
+	qboolean rebuildhash;
+	// counted here instead of r_refdef.stats so threads don't share them
+	int stat_cached;
+	int stat_traced;
+};
+
 static mempool_t *collision_cachedtrace_mempool;
-static collision_cachedtrace_t *collision_cachedtrace_array;
-static int collision_cachedtrace_firstfree;
-static int collision_cachedtrace_lastused;
-static int collision_cachedtrace_max;
-static unsigned char collision_cachedtrace_sequence;
-static int collision_cachedtrace_hashsize;
-static int *collision_cachedtrace_hash;
-static unsigned int *collision_cachedtrace_arrayfullhashindex;
-static unsigned int *collision_cachedtrace_arrayhashindex;
-static unsigned int *collision_cachedtrace_arraynext;
-static unsigned char *collision_cachedtrace_arrayused;
-static qboolean collision_cachedtrace_rebuildhash;
+// arrays are only allocated for caches that are used
+static collision_cache_t collision_caches[COLLISION_MAXCACHES];
+
+static void Collision_Cache_Free(collision_cache_t *c)
+{
+	if (c->hash)
+		Mem_Free(c->hash);
+	if (c->array)
+		Mem_Free(c->array);
+	if (c->arrayfullhashindex)
+		Mem_Free(c->arrayfullhashindex);
+	if (c->arrayhashindex)
+		Mem_Free(c->arrayhashindex);
+	if (c->arraynext)
+		Mem_Free(c->arraynext);
+	if (c->arrayused)
+		Mem_Free(c->arrayused);
+	c->hash = NULL;
+	c->array = NULL;
+	c->arrayfullhashindex = NULL;
+	c->arrayhashindex = NULL;
+	c->arraynext = NULL;
+	c->arrayused = NULL;
+}
+
+// empties the cache and allocates it at its current size
+static void Collision_Cache_Alloc(collision_cache_t *c)
+{
+	Collision_Cache_Free(c);
+	c->firstfree = 1;
+	c->lastused = 0;
+	c->hashsize = c->max;
+	c->array = (collision_cachedtrace_t *)Mem_Alloc(collision_cachedtrace_mempool, c->max * sizeof(collision_cachedtrace_t));
+	c->hash = (int *)Mem_Alloc(collision_cachedtrace_mempool, c->hashsize * sizeof(int));
+	c->arrayfullhashindex = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, c->max * sizeof(unsigned int));
+	c->arrayhashindex = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, c->max * sizeof(unsigned int));
+	c->arraynext = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, c->max * sizeof(unsigned int));
+	c->arrayused = (unsigned char *)Mem_Alloc(collision_cachedtrace_mempool, c->max * sizeof(unsigned char));
+	c->sequence = 1;
+	c->rebuildhash = false;
+}
 
 void Collision_Cache_Reset(qboolean resetlimits)
 {
-	if (collision_cachedtrace_hash)
-		Mem_Free(collision_cachedtrace_hash);
-	if (collision_cachedtrace_array)
-		Mem_Free(collision_cachedtrace_array);
-	if (collision_cachedtrace_arrayfullhashindex)
-		Mem_Free(collision_cachedtrace_arrayfullhashindex);
-	if (collision_cachedtrace_arrayhashindex)
-		Mem_Free(collision_cachedtrace_arrayhashindex);
-	if (collision_cachedtrace_arraynext)
-		Mem_Free(collision_cachedtrace_arraynext);
-	if (collision_cachedtrace_arrayused)
-		Mem_Free(collision_cachedtrace_arrayused);
-	if (resetlimits || !collision_cachedtrace_max)
-		collision_cachedtrace_max = collision_cache.integer ? 128 : 1;
-	collision_cachedtrace_firstfree = 1;
-	collision_cachedtrace_lastused = 0;
-	collision_cachedtrace_hashsize = collision_cachedtrace_max;
-	collision_cachedtrace_array = (collision_cachedtrace_t *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_max * sizeof(collision_cachedtrace_t));
-	collision_cachedtrace_hash = (int *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_hashsize * sizeof(int));
-	collision_cachedtrace_arrayfullhashindex = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_max * sizeof(unsigned int));
-	collision_cachedtrace_arrayhashindex = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_max * sizeof(unsigned int));
-	collision_cachedtrace_arraynext = (unsigned int *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_max * sizeof(unsigned int));
-	collision_cachedtrace_arrayused = (unsigned char *)Mem_Alloc(collision_cachedtrace_mempool, collision_cachedtrace_max * sizeof(unsigned char));
-	collision_cachedtrace_sequence = 1;
-	collision_cachedtrace_rebuildhash = false;
+	int i;
+	collision_cache_t *c;
+	for (i = 0, c = collision_caches;i < COLLISION_MAXCACHES;i++, c++)
+	{
+		if (resetlimits || !c->max)
+			c->max = collision_cache.integer ? 128 : 1;
+		if (c->array)
+			Collision_Cache_Alloc(c);
+	}
 }
 
 void Collision_Cache_Init(mempool_t *mempool)
@@ -1473,22 +1505,35 @@ void Collision_Cache_Init(mempool_t *mempool)
 	Collision_Cache_Reset(true);
 }
 
-static void Collision_Cache_RebuildHash(void)
+collision_cache_t *Collision_Cache_Get(int index)
+{
+	return collision_caches + index;
+}
+
+void Collision_Cache_FlushStats(collision_cache_t *c)
+{
+	r_refdef.stats[r_stat_photoncache_cached] += c->stat_cached;
+	r_refdef.stats[r_stat_photoncache_traced] += c->stat_traced;
+	c->stat_cached = 0;
+	c->stat_traced = 0;
+}
+
+static void Collision_Cache_RebuildHash(collision_cache_t *c)
 {
 	int index;
-	int range = collision_cachedtrace_lastused + 1;
-	unsigned char sequence = collision_cachedtrace_sequence;
-	int firstfree = collision_cachedtrace_max;
+	int range = c->lastused + 1;
+	unsigned char sequence = c->sequence;
+	int firstfree = c->max;
 	int lastused = 0;
-	int *hash = collision_cachedtrace_hash;
+	int *hash = c->hash;
 	unsigned int hashindex;
-	unsigned int *arrayhashindex = collision_cachedtrace_arrayhashindex;
-	unsigned int *arraynext = collision_cachedtrace_arraynext;
-	collision_cachedtrace_rebuildhash = false;
-	memset(collision_cachedtrace_hash, 0, collision_cachedtrace_hashsize * sizeof(int));
+	unsigned int *arrayhashindex = c->arrayhashindex;
+	unsigned int *arraynext = c->arraynext;
+	c->rebuildhash = false;
+	memset(c->hash, 0, c->hashsize * sizeof(int));
 	for (index = 1;index < range;index++)
 	{
-		if (collision_cachedtrace_arrayused[index] == sequence)
+		if (c->arrayused[index] == sequence)
 		{
 			hashindex = arrayhashindex[index];
 			arraynext[index] = hash[hashindex];
@@ -1499,35 +1544,48 @@ static void Collision_Cache_RebuildHash(void)
 		{
 			if (firstfree > index)
 				firstfree = index;
-			collision_cachedtrace_arrayused[index] = 0;
+			c->arrayused[index] = 0;
 		}
 	}
-	collision_cachedtrace_firstfree = firstfree;
-	collision_cachedtrace_lastused = lastused;
+	c->firstfree = firstfree;
+	c->lastused = lastused;
 }
 
 void Collision_Cache_NewFrame(void)
 {
-	if (collision_cache.integer)
-	{
-		if (collision_cachedtrace_max < 128)
-			Collision_Cache_Reset(true);
-	}
-	else
-	{
-		if (collision_cachedtrace_max > 1)
-			Collision_Cache_Reset(true);
-	}
-	// rebuild hash if sequence would overflow byte, otherwise increment
-	if (collision_cachedtrace_sequence == 255)
-	{
-		Collision_Cache_RebuildHash();
-		collision_cachedtrace_sequence = 1;
-	}
-	else
+	int i;
+	collision_cache_t *c;
+	for (i = 0, c = collision_caches;i < COLLISION_MAXCACHES;i++, c++)
 	{
-		collision_cachedtrace_rebuildhash = true;
-		collision_cachedtrace_sequence++;
+		if (!c->array)
+			continue;
+		if (collision_cache.integer)
+		{
+			if (c->max < 128)
+			{
+				c->max = 128;
+				Collision_Cache_Alloc(c);
+			}
+		}
+		else
+		{
+			if (c->max > 1)
+			{
+				c->max = 1;
+				Collision_Cache_Alloc(c);
+			}
+		}
+		// rebuild hash if sequence would overflow byte, otherwise increment
+		if (c->sequence == 255)
+		{
+			Collision_Cache_RebuildHash(c);
+			c->sequence = 1;
+		}
+		else
+		{
+			c->rebuildhash = true;
+			c->sequence++;
+		}
 	}
 }
 
@@ -1541,21 +1599,28 @@ static unsigned int Collision_Cache_HashIndexForArray(unsigned int *array, unsig
 	return hashindex;
 }
 
-static collision_cachedtrace_t *Collision_Cache_Lookup(dp_model_t *model, const matrix4x4_t *matrix, const matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
+static collision_cachedtrace_t *Collision_Cache_Lookup(collision_cache_t *c, dp_model_t *model, const matrix4x4_t *matrix, const matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
 {
 	int hashindex = 0;
 	unsigned int fullhashindex;
 	int index = 0;
 	int range;
-	unsigned char sequence = collision_cachedtrace_sequence;
-	int *hash = collision_cachedtrace_hash;
-	unsigned int *arrayfullhashindex = collision_cachedtrace_arrayfullhashindex;
-	unsigned int *arraynext = collision_cachedtrace_arraynext;
-	collision_cachedtrace_t *cached = collision_cachedtrace_array + index;
+	unsigned char sequence;
+	int *hash;
+	unsigned int *arrayfullhashindex;
+	unsigned int *arraynext;
+	collision_cachedtrace_t *cached;
 	collision_cachedtrace_parameters_t params;
+	if (!c->array)
+		Collision_Cache_Alloc(c);
+	sequence = c->sequence;
+	hash = c->hash;
+	arrayfullhashindex = c->arrayfullhashindex;
+	arraynext = c->arraynext;
+	cached = c->array + index;
 	// all non-cached traces use the same index
 	if (!collision_cache.integer)
-		r_refdef.stats[r_stat_photoncache_traced]++;
+		c->stat_traced++;
 	else
 	{
 		// cached trace lookup
@@ -1566,12 +1631,12 @@ static collision_cachedtrace_t *Collision_Cache_Lookup(dp_model_t *model, const
 		params.hitsupercontentsmask = hitsupercontentsmask;
 		params.matrix = *matrix;
 		fullhashindex = Collision_Cache_HashIndexForArray((unsigned int *)&params, sizeof(params) / sizeof(unsigned int));
-		hashindex = (int)(fullhashindex % (unsigned int)collision_cachedtrace_hashsize);
+		hashindex = (int)(fullhashindex % (unsigned int)c->hashsize);
 		for (index = hash[hashindex];index;index = arraynext[index])
 		{
 			if (arrayfullhashindex[index] != fullhashindex)
 				continue;
-			cached = collision_cachedtrace_array + index;
+			cached = c->array + index;
 			//if (memcmp(&cached->p, &params, sizeof(params)))
 			if (cached->p.model != params.model
 			 || cached->p.end[0] != params.end[0]
@@ -1600,54 +1665,54 @@ static collision_cachedtrace_t *Collision_Cache_Lookup(dp_model_t *model, const
 			)
 				continue;
 			// found a matching trace in the cache
-			r_refdef.stats[r_stat_photoncache_cached]++;
+			c->stat_cached++;
 			cached->valid = true;
-			collision_cachedtrace_arrayused[index] = collision_cachedtrace_sequence;
+			c->arrayused[index] = c->sequence;
 			return cached;
 		}
-		r_refdef.stats[r_stat_photoncache_traced]++;
+		c->stat_traced++;
 		// find an unused cache entry
-		for (index = collision_cachedtrace_firstfree, range = collision_cachedtrace_max;index < range;index++)
-			if (collision_cachedtrace_arrayused[index] == 0)
+		for (index = c->firstfree, range = c->max;index < range;index++)
+			if (c->arrayused[index] == 0)
 				break;
 		if (index == range)
 		{
 			// all claimed, but probably some are stale...
-			for (index = 1, range = collision_cachedtrace_max;index < range;index++)
-				if (collision_cachedtrace_arrayused[index] != sequence)
+			for (index = 1, range = c->max;index < range;index++)
+				if (c->arrayused[index] != sequence)
 					break;
 			if (index < range)
 			{
 				// found a stale one, rebuild the hash
-				Collision_Cache_RebuildHash();
+				Collision_Cache_RebuildHash(c);
 			}
 			else
 			{
 				// we need to grow the cache
-				collision_cachedtrace_max *= 2;
-				Collision_Cache_Reset(false);
+				c->max *= 2;
+				Collision_Cache_Alloc(c);
 				index = 1;
 			}
 		}
 		// link the new cache entry into the hash bucket
-		collision_cachedtrace_firstfree = index + 1;
-		if (collision_cachedtrace_lastused < index)
-			collision_cachedtrace_lastused = index;
-		cached = collision_cachedtrace_array + index;
-		collision_cachedtrace_arraynext[index] = collision_cachedtrace_hash[hashindex];
-		collision_cachedtrace_hash[hashindex] = index;
-		collision_cachedtrace_arrayhashindex[index] = hashindex;
+		c->firstfree = index + 1;
+		if (c->lastused < index)
+			c->lastused = index;
+		cached = c->array + index;
+		c->arraynext[index] = c->hash[hashindex];
+		c->hash[hashindex] = index;
+		c->arrayhashindex[index] = hashindex;
 		cached->valid = false;
 		cached->p = params;
-		collision_cachedtrace_arrayfullhashindex[index] = fullhashindex;
-		collision_cachedtrace_arrayused[index] = collision_cachedtrace_sequence;
+		c->arrayfullhashindex[index] = fullhashindex;
+		c->arrayused[index] = c->sequence;
 	}
 	return cached;
 }
 
-void Collision_Cache_ClipLineToGenericEntitySurfaces(trace_t *trace, dp_model_t *model, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
+void Collision_Cache_ClipLineToGenericEntitySurfaces(collision_cache_t *cache, trace_t *trace, dp_model_t *model, matrix4x4_t *matrix, matrix4x4_t *inversematrix, const vec3_t start, const vec3_t end, int hitsupercontentsmask)
 {
-	collision_cachedtrace_t *cached = Collision_Cache_Lookup(model, matrix, inversematrix, start, end, hitsupercontentsmask);
+	collision_cachedtrace_t *cached = Collision_Cache_Lookup(cache, model, matrix, inversematrix, start, end, hitsupercontentsmask);
 	if (cached->valid)
 	{
 		*trace = cached->result;
@@ -1659,9 +1724,9 @@ void Collision_Cache_ClipLineToGenericEntitySurfaces(trace_t *trace, dp_model_t
 	cached->result = *trace;
 }
 
-void Collision_Cache_ClipLineToWorldSurfaces(trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents)
+void Collision_Cache_ClipLineToWorldSurfaces(collision_cache_t *cache, trace_t *trace, dp_model_t *model, const vec3_t start, const vec3_t end, int hitsupercontents)
 {
-	collision_cachedtrace_t *cached = Collision_Cache_Lookup(model, &identitymatrix, &identitymatrix, start, end, hitsupercontents);
+	collision_cachedtrace_t *cached = Collision_Cache_Lookup(cache, model, &identitymatrix, &identitymatrix, start, end, hitsupercontents);
 	if (cached->valid)
 	{
 		*trace = cached->result;
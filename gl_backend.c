@@ -3873,6 +3873,8 @@ void R_Mesh_TexBind(unsigned int unitnum, rtexture_t *tex)
 	int tex2d, tex3d, texcubemap, texnum;
 	if (unitnum >= vid.teximageunits)
 		return;
+	if (unit->texture != tex)
+		r_refdef.stats[r_stat_state_texturebinds]++;
 //	if (unit->texture == tex)
 //		return;
 	switch(vid.renderpath)
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_shadow.h"
 #include "polygon.h"
 #include "image.h"
+#include "thread.h"
 #include "ft2.h"
 #include "csprogs.h"
 #include "cl_video.h"
@@ -119,7 +120,7 @@ cvar_t r_cullentities_trace_samples = {0, "r_cullentities_trace_samples", "2", "
 cvar_t r_cullentities_trace_tempentitysamples = {0, "r_cullentities_trace_tempentitysamples", "-1", "number of samples to test for entity culling of temp entities (including all CSQC entities), -1 disables trace culling on these entities to prevent flicker (pvs still applies)"};
 cvar_t r_cullentities_trace_enlarge = {0, "r_cullentities_trace_enlarge", "0", "box enlargement for entity culling"};
 cvar_t r_cullentities_trace_delay = {0, "r_cullentities_trace_delay", "1", "number of seconds until the entity gets actually culled"};
-cvar_t r_sortentities = {0, "r_sortentities", "0", "sort entities before drawing (might be faster)"};
+cvar_t r_sortentities = {0, "r_sortentities", "0", "sort entities before drawing (might be faster), 2 = also draw opaque surfaces of all models as one queue sorted by texture and model to reduce state changes"};
 cvar_t r_speeds = {0, "r_speeds","0", "displays rendering statistics and per-subsystem timings"};
 cvar_t r_fullbright = {0, "r_fullbright","0", "makes map very bright and renders faster"};
 
@@ -173,6 +174,8 @@ cvar_t gl_skyclip = {0, "gl_skyclip", "4608", "nehahra farclip distance - the re
 
 cvar_t r_texture_dds_load = {CVAR_SAVE, "r_texture_dds_load", "0", "load compressed dds/filename.dds texture instead of filename.tga, if the file exists (requires driver support)"};
 cvar_t r_texture_dds_save = {CVAR_SAVE, "r_texture_dds_save", "0", "save compressed dds/filename.dds texture when filename.tga is loaded, so that it can be loaded instead next time"};
+cvar_t r_texture_async = {CVAR_SAVE, "r_texture_async", "0", "decode external skin images on a loader thread, mipmapped skins are drawn grey until they have been uploaded (avoids long stalls when loading texture heavy maps)"};
+cvar_t r_texture_async_uploadtime = {CVAR_SAVE, "r_texture_async_uploadtime", "2", "milliseconds per frame spent uploading skins decoded by r_texture_async (at least one is uploaded per frame)"};
 
 cvar_t r_textureunits = {0, "r_textureunits", "32", "number of texture units to use in GL 1.1 and GL 1.3 rendering paths"};
 static cvar_t gl_combine = {CVAR_READONLY, "gl_combine", "1", "indicates whether the OpenGL 1.3 rendering path is active"};
@@ -1509,6 +1512,7 @@ static void R_SetupShader_SetPermutationGLSL(unsigned int mode, unsigned int per
 	r_glsl_permutation_t *perm = R_GLSL_FindPermutation(mode, permutation);
 	if (r_glsl_permutation != perm)
 	{
+		r_refdef.stats[r_stat_state_shaderswitches]++;
 		r_glsl_permutation = perm;
 		if (!r_glsl_permutation->program)
 		{
@@ -1983,6 +1987,7 @@ void R_SetupShader_SetPermutationHLSL(unsigned int mode, unsigned int permutatio
 	r_hlsl_permutation_t *perm = R_HLSL_FindPermutation(mode, permutation);
 	if (r_hlsl_permutation != perm)
 	{
+		r_refdef.stats[r_stat_state_shaderswitches]++;
 		r_hlsl_permutation = perm;
 		if (!r_hlsl_permutation->vertexshader && !r_hlsl_permutation->pixelshader)
 		{
@@ -2024,6 +2029,14 @@ void R_SetupShader_SetPermutationHLSL(unsigned int mode, unsigned int permutatio
 
 static void R_SetupShader_SetPermutationSoft(unsigned int mode, unsigned int permutation)
 {
+	// dpsoftrast has no permutation objects, remember the last one for r_speeds
+	static unsigned int lastmode = (unsigned int)-1, lastpermutation = (unsigned int)-1;
+	if (lastmode != mode || lastpermutation != permutation)
+	{
+		r_refdef.stats[r_stat_state_shaderswitches]++;
+		lastmode = mode;
+		lastpermutation = permutation;
+	}
 	DPSOFTRAST_SetShader(mode, permutation, r_shadow_glossexact.integer);
 	DPSOFTRAST_UniformMatrix4fv(DPSOFTRAST_UNIFORM_ModelViewProjectionMatrixM1, 1, false, gl_modelviewprojection16f);
 	DPSOFTRAST_UniformMatrix4fv(DPSOFTRAST_UNIFORM_ModelViewMatrixM1, 1, false, gl_modelview16f);
@@ -3634,25 +3647,393 @@ skinframe_t *R_SkinFrame_Find(const char *name, int textureflags, int comparewid
 		skinframe->avgcolor[3] = avgcolor[4] / (255.0 * cnt); \
 	}
 
-extern cvar_t gl_picmip;
-skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboolean baseonly, qboolean complain)
+// images of one skinframe decoded to BGRA pixels, filled in by
+// R_SkinFrame_DecodeExternal (which may run on the loader thread) and turned
+// into textures by R_SkinFrame_UploadExternal on the render thread
+typedef enum r_skinframe_layer_e
+{
+	SKINFRAME_LAYER_BASE,
+	SKINFRAME_LAYER_FOG,
+	SKINFRAME_LAYER_NMAP,
+	SKINFRAME_LAYER_GLOW,
+	SKINFRAME_LAYER_GLOSS,
+	SKINFRAME_LAYER_PANTS,
+	SKINFRAME_LAYER_SHIRT,
+	SKINFRAME_LAYER_REFLECT,
+	SKINFRAME_LAYER_COUNT
+}
+r_skinframe_layer_t;
+
+typedef struct r_skinframe_image_s
+{
+	unsigned char *pixels;
+	int width;
+	int height;
+	int miplevel;
+	qboolean sRGB;
+}
+r_skinframe_image_t;
+
+typedef struct r_skinframe_decode_s
+{
+	struct r_skinframe_decode_s *next;
+	skinframe_t *skinframe;
+	char name[MAX_QPATH];
+	char basename[MAX_QPATH];
+	int textureflags;
+	int miplevel;
+	qboolean baseonly;
+	qboolean complain;
+	qboolean threaded;
+	qboolean hasddsbase;
+	qboolean hasalpha;
+	r_skinframe_image_t image[SKINFRAME_LAYER_COUNT];
+}
+r_skinframe_decode_t;
+
+// loader thread for r_texture_async, jobs go from pending to decoded and are
+// uploaded a few per frame by R_SkinFrame_UploadAsync
+typedef struct r_skinframe_loader_s
+{
+	void *thread;
+	void *mutex;
+	void *cond;
+	qboolean quit;
+	r_skinframe_decode_t *pending;
+	r_skinframe_decode_t **pendingtail;
+	r_skinframe_decode_t *decoded;
+	r_skinframe_decode_t **decodedtail;
+}
+r_skinframe_loader_t;
+static r_skinframe_loader_t r_skinframe_loader;
+
+static qboolean R_SkinFrame_DecodeLayer(r_skinframe_decode_t *decode, r_skinframe_layer_t layer, const char *suffix, qboolean allowFixtrans, qboolean complain)
+{
+	r_skinframe_image_t *image = decode->image + layer;
+	char vabuf[1024];
+	const char *name = layer == SKINFRAME_LAYER_BASE ? decode->name : va(vabuf, sizeof(vabuf), "%s%s", decode->basename, suffix);
+	image->miplevel = decode->miplevel;
+	image->sRGB = false;
+	if (decode->threaded)
+		image->pixels = loadimagepixelsbgra_threaded(name, complain, allowFixtrans, false, &image->sRGB, &image->miplevel);
+	else
+		image->pixels = loadimagepixelsbgra(name, complain, allowFixtrans, false, &image->sRGB, &image->miplevel);
+	if (!image->pixels)
+		return false;
+	image->width = image_width;
+	image->height = image_height;
+	return true;
+}
+
+static qboolean R_SkinFrame_HasDDSLayer(r_skinframe_decode_t *decode, const char *suffix)
+{
+	char vabuf[1024];
+	// R_SkinFrame_UploadExternal loads these instead
+	return r_loaddds && FS_FileExists(va(vabuf, sizeof(vabuf), "dds/%s%s.dds", decode->basename, suffix));
+}
+
+// does all the file reading, decoding and pixel processing for a skinframe,
+// touches no textures so it can run on the loader thread
+static void R_SkinFrame_DecodeExternal(r_skinframe_decode_t *decode)
 {
 	int j;
 	unsigned char *pixels;
-	unsigned char *bumppixels;
-	unsigned char *basepixels = NULL;
-	qboolean sRGBcolorspace;
-	int basepixels_width = 0;
-	int basepixels_height = 0;
+	r_skinframe_image_t *base = decode->image + SKINFRAME_LAYER_BASE;
+	r_skinframe_image_t *image;
+
+	if (!decode->hasddsbase)
+	{
+		if (!R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_BASE, "", true, decode->complain))
+			return;
+		if (decode->textureflags & TEXF_ALPHA)
+		{
+			for (j = 3;j < base->width * base->height * 4;j += 4)
+			{
+				if (base->pixels[j] < 255)
+				{
+					decode->hasalpha = true;
+					break;
+				}
+			}
+			if (r_loadfog && decode->hasalpha)
+			{
+				// has transparent pixels
+				image = decode->image + SKINFRAME_LAYER_FOG;
+				*image = *base;
+				image->sRGB = false;
+				image->pixels = (unsigned char *)Mem_Alloc(tempmempool, base->width * base->height * 4);
+				for (j = 0;j < base->width * base->height * 4;j += 4)
+				{
+					image->pixels[j+0] = 255;
+					image->pixels[j+1] = 255;
+					image->pixels[j+2] = 255;
+					image->pixels[j+3] = base->pixels[j+3];
+				}
+			}
+		}
+	}
+
+	if (decode->baseonly)
+		return;
+
+	// _norm is the name used by tenebrae and has been adopted as standard
+	if (r_loadnormalmap && !R_SkinFrame_HasDDSLayer(decode, "_norm"))
+	{
+		image = decode->image + SKINFRAME_LAYER_NMAP;
+		if (R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_NMAP, "_norm", false, false))
+		{
+			// Vortex: show warning for sRGB colorspace normalmaps
+			if (image->sRGB)
+				Con_Printf("normalmap image \"%s\" is using sRGB colorspace, should be linear RGB\n", decode->name);
+		}
+		else if (r_shadow_bumpscale_bumpmap.value > 0 && R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_NMAP, "_bump", false, false))
+		{
+			pixels = (unsigned char *)Mem_Alloc(tempmempool, image->width * image->height * 4);
+			Image_HeightmapToNormalmap_BGRA(image->pixels, pixels, image->width, image->height, false, r_shadow_bumpscale_bumpmap.value);
+			Mem_Free(image->pixels);
+			image->pixels = pixels;
+		}
+		else if (r_shadow_bumpscale_basetexture.value > 0 && base->pixels)
+		{
+			// fixme: what if basetexture is using sRGB colorspace?
+			image->width = base->width;
+			image->height = base->height;
+			image->miplevel = decode->miplevel;
+			image->sRGB = false;
+			image->pixels = (unsigned char *)Mem_Alloc(tempmempool, base->width * base->height * 4);
+			Image_HeightmapToNormalmap_BGRA(base->pixels, image->pixels, base->width, base->height, false, r_shadow_bumpscale_basetexture.value);
+		}
+	}
+
+	// _luma is supported only for tenebrae compatibility
+	// _glow is the preferred name
+	if (!R_SkinFrame_HasDDSLayer(decode, "_glow") && !R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_GLOW, "_glow", false, false))
+		R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_GLOW, "_luma", false, false);
+	if (r_loadgloss && !R_SkinFrame_HasDDSLayer(decode, "_gloss"))
+		R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_GLOSS, "_gloss", false, false);
+	if (!R_SkinFrame_HasDDSLayer(decode, "_pants"))
+		R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_PANTS, "_pants", false, false);
+	if (!R_SkinFrame_HasDDSLayer(decode, "_shirt"))
+		R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_SHIRT, "_shirt", false, false);
+	if (!R_SkinFrame_HasDDSLayer(decode, "_reflect"))
+		R_SkinFrame_DecodeLayer(decode, SKINFRAME_LAYER_REFLECT, "_reflect", false, false);
+}
+
+static void R_SkinFrame_FreeDecode(r_skinframe_decode_t *decode)
+{
+	int i;
+	for (i = 0;i < SKINFRAME_LAYER_COUNT;i++)
+	{
+		if (decode->image[i].pixels)
+			Mem_Free(decode->image[i].pixels);
+		decode->image[i].pixels = NULL;
+	}
+}
+
+static rtexture_t *R_SkinFrame_UploadLayer(skinframe_t *skinframe, r_skinframe_image_t *image, const char *suffix, const char *ddssuffix, textype_t textype, int textureflags, qboolean ddshasalpha, float *ddsavgcolor)
+{
+	rtexture_t *rt;
+	char vabuf[1024];
+	if (!image->pixels)
+		return NULL;
+	rt = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s%s", skinframe->basename, suffix), image->width, image->height, image->pixels, textype, textureflags, image->miplevel, NULL);
+#ifndef USE_GLES2
+	if (r_savedds && qglGetCompressedTexImageARB && rt)
+		R_SaveTextureDDSFile(rt, va(vabuf, sizeof(vabuf), "dds/%s%s.dds", skinframe->basename, ddssuffix), r_texture_dds_save.integer < 2, ddshasalpha, ddsavgcolor);
+#endif
+	return rt;
+}
+
+// creates the textures of a skinframe from decoded images, preferring dds
+// files for the additional layers like the images are
+static void R_SkinFrame_UploadExternal(skinframe_t *skinframe, r_skinframe_decode_t *decode)
+{
+	int textureflags = decode->textureflags;
+	int miplevel = decode->miplevel;
+	r_skinframe_image_t *base = decode->image + SKINFRAME_LAYER_BASE;
+	r_skinframe_image_t *image;
+
+	if (base->pixels)
+	{
+		skinframe->hasalpha = decode->hasalpha;
+		R_SKINFRAME_LOAD_AVERAGE_COLORS(base->width * base->height, base->pixels[4 * pix + comp]);
+		//Con_Printf("Texture %s has average colors %f %f %f alpha %f\n", decode->name, skinframe->avgcolor[0], skinframe->avgcolor[1], skinframe->avgcolor[2], skinframe->avgcolor[3]);
+		skinframe->base = R_SkinFrame_UploadLayer(skinframe, base, "", "", (vid.sRGB3D || base->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), skinframe->hasalpha, skinframe->avgcolor);
+		skinframe->fog = R_SkinFrame_UploadLayer(skinframe, decode->image + SKINFRAME_LAYER_FOG, "_mask", "_mask", TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), true, NULL);
+	}
+
+	// load up _norm, _glow, _gloss, _pants, _shirt, _reflect
+	if (decode->baseonly)
+		return;
+
+	if (r_loaddds)
+	{
+		if (r_loadnormalmap)
+			skinframe->nmap = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_norm", false, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP), NULL, NULL, miplevel, true);
+		skinframe->glow = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_glow", vid.sRGB3D, textureflags, NULL, NULL, miplevel, true);
+		if (r_loadgloss)
+			skinframe->gloss = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_gloss", vid.sRGB3D, textureflags, NULL, NULL, miplevel, true);
+		skinframe->pants = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_pants", vid.sRGB3D, textureflags, NULL, NULL, miplevel, true);
+		skinframe->shirt = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_shirt", vid.sRGB3D, textureflags, NULL, NULL, miplevel, true);
+		skinframe->reflect = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_reflect", vid.sRGB3D, textureflags, NULL, NULL, miplevel, true);
+	}
+
+	image = decode->image + SKINFRAME_LAYER_NMAP;
+	if (!skinframe->nmap)
+		skinframe->nmap = R_SkinFrame_UploadLayer(skinframe, image, "_nmap", "_norm", image->sRGB ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP) & (gl_texturecompression_normal.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), true, NULL);
+	image = decode->image + SKINFRAME_LAYER_GLOW;
+	if (!skinframe->glow)
+		skinframe->glow = R_SkinFrame_UploadLayer(skinframe, image, "_glow", "_glow", (vid.sRGB3D || image->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_glow.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), true, NULL);
+	image = decode->image + SKINFRAME_LAYER_GLOSS;
+	if (!skinframe->gloss)
+		skinframe->gloss = R_SkinFrame_UploadLayer(skinframe, image, "_gloss", "_gloss", (vid.sRGB3D || image->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (gl_texturecompression_gloss.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), true, NULL);
+	image = decode->image + SKINFRAME_LAYER_PANTS;
+	if (!skinframe->pants)
+		skinframe->pants = R_SkinFrame_UploadLayer(skinframe, image, "_pants", "_pants", (vid.sRGB3D || image->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), false, NULL);
+	image = decode->image + SKINFRAME_LAYER_SHIRT;
+	if (!skinframe->shirt)
+		skinframe->shirt = R_SkinFrame_UploadLayer(skinframe, image, "_shirt", "_shirt", (vid.sRGB3D || image->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), false, NULL);
+	image = decode->image + SKINFRAME_LAYER_REFLECT;
+	if (!skinframe->reflect)
+		skinframe->reflect = R_SkinFrame_UploadLayer(skinframe, image, "_reflect", "_reflect", (vid.sRGB3D || image->sRGB) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_reflectmask.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), true, NULL);
+}
+
+static int R_SkinFrame_LoaderThread(void *data)
+{
+	r_skinframe_decode_t *decode;
+	Thread_LockMutex(r_skinframe_loader.mutex);
+	for (;;)
+	{
+		while (!r_skinframe_loader.quit && !r_skinframe_loader.pending)
+			Thread_CondWait(r_skinframe_loader.cond, r_skinframe_loader.mutex);
+		if (r_skinframe_loader.quit)
+			break;
+		decode = r_skinframe_loader.pending;
+		r_skinframe_loader.pending = decode->next;
+		if (!r_skinframe_loader.pending)
+			r_skinframe_loader.pendingtail = &r_skinframe_loader.pending;
+		Thread_UnlockMutex(r_skinframe_loader.mutex);
+
+		R_SkinFrame_DecodeExternal(decode);
+
+		Thread_LockMutex(r_skinframe_loader.mutex);
+		decode->next = NULL;
+		*r_skinframe_loader.decodedtail = decode;
+		r_skinframe_loader.decodedtail = &decode->next;
+	}
+	Thread_UnlockMutex(r_skinframe_loader.mutex);
+	return 0;
+}
+
+static qboolean R_SkinFrame_StartLoader(void)
+{
+	if (r_skinframe_loader.thread)
+		return true;
+	if (!Thread_HasThreads())
+		return false;
+	r_skinframe_loader.quit = false;
+	r_skinframe_loader.pending = NULL;
+	r_skinframe_loader.pendingtail = &r_skinframe_loader.pending;
+	r_skinframe_loader.decoded = NULL;
+	r_skinframe_loader.decodedtail = &r_skinframe_loader.decoded;
+	r_skinframe_loader.mutex = Thread_CreateMutex();
+	r_skinframe_loader.cond = Thread_CreateCond();
+	r_skinframe_loader.thread = Thread_CreateThread(R_SkinFrame_LoaderThread, NULL);
+	if (!r_skinframe_loader.thread)
+	{
+		Thread_DestroyCond(r_skinframe_loader.cond);
+		Thread_DestroyMutex(r_skinframe_loader.mutex);
+		r_skinframe_loader.cond = NULL;
+		r_skinframe_loader.mutex = NULL;
+		return false;
+	}
+	return true;
+}
+
+// stops the loader thread and throws away everything not yet uploaded, the
+// skinframes involved keep their placeholder
+static void R_SkinFrame_StopLoader(void)
+{
+	r_skinframe_decode_t *decode, *next;
+	if (!r_skinframe_loader.thread)
+		return;
+	Thread_LockMutex(r_skinframe_loader.mutex);
+	r_skinframe_loader.quit = true;
+	Thread_CondBroadcast(r_skinframe_loader.cond);
+	Thread_UnlockMutex(r_skinframe_loader.mutex);
+	Thread_WaitThread(r_skinframe_loader.thread, 0);
+	for (decode = r_skinframe_loader.pending;decode;decode = next)
+	{
+		next = decode->next;
+		Mem_Free(decode);
+	}
+	for (decode = r_skinframe_loader.decoded;decode;decode = next)
+	{
+		next = decode->next;
+		R_SkinFrame_FreeDecode(decode);
+		Mem_Free(decode);
+	}
+	Thread_DestroyCond(r_skinframe_loader.cond);
+	Thread_DestroyMutex(r_skinframe_loader.mutex);
+	memset(&r_skinframe_loader, 0, sizeof(r_skinframe_loader));
+}
+
+void R_SkinFrame_UploadAsync(void)
+{
+	double starttime;
+	skinframe_t *skinframe;
+	r_skinframe_decode_t *decode;
+
+	if (!r_skinframe_loader.thread)
+		return;
+	starttime = Sys_DirtyTime();
+	for (;;)
+	{
+		Thread_LockMutex(r_skinframe_loader.mutex);
+		decode = r_skinframe_loader.decoded;
+		if (decode)
+		{
+			r_skinframe_loader.decoded = decode->next;
+			if (!r_skinframe_loader.decoded)
+				r_skinframe_loader.decodedtail = &r_skinframe_loader.decoded;
+		}
+		Thread_UnlockMutex(r_skinframe_loader.mutex);
+		if (!decode)
+			break;
+
+		// if the skinframe was purged or reloaded while this was decoding,
+		// the result is no longer wanted
+		skinframe = decode->skinframe;
+		if (skinframe->base == r_texture_grey128)
+		{
+			skinframe->base = NULL;
+			if (decode->image[SKINFRAME_LAYER_BASE].pixels)
+				R_SkinFrame_UploadExternal(skinframe, decode);
+			else
+			{
+				Con_Printf("failed to decode skin \"%s\"\n", decode->name);
+				skinframe->base = r_texture_notexture;
+			}
+		}
+		R_SkinFrame_FreeDecode(decode);
+		Mem_Free(decode);
+
+		// always make some progress, even with a tiny budget
+		if ((Sys_DirtyTime() - starttime) * 1000.0 >= r_texture_async_uploadtime.value)
+			break;
+	}
+}
+
+extern cvar_t gl_picmip;
+skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboolean baseonly, qboolean complain)
+{
 	skinframe_t *skinframe;
 	rtexture_t *ddsbase = NULL;
 	qboolean ddshasalpha = false;
+	qboolean async = false;
+	qboolean mayhavealpha = true;
 	float ddsavgcolor[4];
-	char basename[MAX_QPATH];
-	int miplevel = R_PicmipForFlags(textureflags);
-	int savemiplevel = miplevel;
-	int mymiplevel;
-	char vabuf[1024];
+	r_skinframe_decode_t decode;
 
 	if (cls.state == ca_dedicated)
 		return NULL;
@@ -3664,15 +4045,34 @@ skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboole
 	if (skinframe && skinframe->base)
 		return skinframe;
 
-	Image_StripImageExtension(name, basename, sizeof(basename));
+	memset(&decode, 0, sizeof(decode));
+	strlcpy(decode.name, name, sizeof(decode.name));
+	Image_StripImageExtension(name, decode.basename, sizeof(decode.basename));
+	decode.textureflags = textureflags & ~TEXF_FORCE_RELOAD;
+	decode.miplevel = R_PicmipForFlags(textureflags);
+	decode.baseonly = baseonly;
+	decode.complain = complain;
 
 	// check for DDS texture file first
-	sRGBcolorspace = false;
-	if (!r_loaddds || !(ddsbase = R_LoadTextureDDSFile(r_main_texturepool, basename, "", vid.sRGB3D, textureflags, &ddshasalpha, ddsavgcolor, miplevel, false)))
+	if (r_loaddds && (ddsbase = R_LoadTextureDDSFile(r_main_texturepool, decode.basename, "", vid.sRGB3D, textureflags, &ddshasalpha, ddsavgcolor, decode.miplevel, false)))
+		decode.hasddsbase = true;
+	else if (r_texture_async.integer && (textureflags & TEXF_MIPMAP) && Image_FileExists(name, &mayhavealpha) && (!mayhavealpha || !(textureflags & TEXF_ALPHA)) && R_SkinFrame_StartLoader())
+	{
+		// mipmapped skins (world, models, sprites) can show a placeholder
+		// for a few frames, anything else is still loaded immediately
+		// the model loaders pick material flags from hasalpha as soon as
+		// this returns, so only skins that can't turn out transparent are
+		// deferred, their placeholder's hasalpha = false is already right
+		async = true;
+	}
+	else
 	{
-		basepixels = loadimagepixelsbgra(name, complain, true, false, &sRGBcolorspace, &miplevel);
-		if (basepixels == NULL)
+		R_SkinFrame_DecodeExternal(&decode);
+		if (decode.image[SKINFRAME_LAYER_BASE].pixels == NULL)
+		{
+			R_SkinFrame_FreeDecode(&decode);
 			return NULL;
+		}
 	}
 
 	// FIXME handle miplevel
@@ -3683,7 +4083,6 @@ skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboole
 	// we've got some pixels to store, so really allocate this new texture now
 	if (!skinframe)
 		skinframe = R_SkinFrame_Find(name, textureflags, 0, 0, 0, true);
-	textureflags &= ~TEXF_FORCE_RELOAD;
 	skinframe->stain = NULL;
 	skinframe->merged = NULL;
 	skinframe->base = NULL;
@@ -3697,6 +4096,23 @@ skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboole
 	skinframe->hasalpha = false;
 	// we could store the q2animname here too
 
+	if (async)
+	{
+		r_skinframe_decode_t *job = (r_skinframe_decode_t *)Mem_Alloc(r_main_mempool, sizeof(*job));
+		*job = decode;
+		job->skinframe = skinframe;
+		job->threaded = true;
+		// the placeholder also keeps R_SkinFrame_Find from queuing it again
+		skinframe->base = r_texture_grey128;
+		Vector4Set(skinframe->avgcolor, 0.5f, 0.5f, 0.5f, 1.0f);
+		Thread_LockMutex(r_skinframe_loader.mutex);
+		*r_skinframe_loader.pendingtail = job;
+		r_skinframe_loader.pendingtail = &job->next;
+		Thread_CondSignal(r_skinframe_loader.cond);
+		Thread_UnlockMutex(r_skinframe_loader.mutex);
+		return skinframe;
+	}
+
 	// load up additional textures
 	if (ddsbase)
 	{
@@ -3704,164 +4120,12 @@ skinframe_t *R_SkinFrame_LoadExternal(const char *name, int textureflags, qboole
 		skinframe->hasalpha = ddshasalpha;
 		VectorCopy(ddsavgcolor, skinframe->avgcolor);
 		if (r_loadfog && skinframe->hasalpha)
-			skinframe->fog = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_mask", false, textureflags | TEXF_ALPHA, NULL, NULL, miplevel, true);
-		//Con_Printf("Texture %s has average colors %f %f %f alpha %f\n", name, skinframe->avgcolor[0], skinframe->avgcolor[1], skinframe->avgcolor[2], skinframe->avgcolor[3]);
-	}
-	else
-	{
-		basepixels_width = image_width;
-		basepixels_height = image_height;
-		skinframe->base = R_LoadTexture2D (r_main_texturepool, skinframe->basename, basepixels_width, basepixels_height, basepixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), miplevel, NULL);
-		if (textureflags & TEXF_ALPHA)
-		{
-			for (j = 3;j < basepixels_width * basepixels_height * 4;j += 4)
-			{
-				if (basepixels[j] < 255)
-				{
-					skinframe->hasalpha = true;
-					break;
-				}
-			}
-			if (r_loadfog && skinframe->hasalpha)
-			{
-				// has transparent pixels
-				pixels = (unsigned char *)Mem_Alloc(tempmempool, image_width * image_height * 4);
-				for (j = 0;j < image_width * image_height * 4;j += 4)
-				{
-					pixels[j+0] = 255;
-					pixels[j+1] = 255;
-					pixels[j+2] = 255;
-					pixels[j+3] = basepixels[j+3];
-				}
-				skinframe->fog = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_mask", skinframe->basename), image_width, image_height, pixels, TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), miplevel, NULL);
-				Mem_Free(pixels);
-			}
-		}
-		R_SKINFRAME_LOAD_AVERAGE_COLORS(basepixels_width * basepixels_height, basepixels[4 * pix + comp]);
-#ifndef USE_GLES2
+			skinframe->fog = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_mask", false, decode.textureflags | TEXF_ALPHA, NULL, NULL, decode.miplevel, true);
 		//Con_Printf("Texture %s has average colors %f %f %f alpha %f\n", name, skinframe->avgcolor[0], skinframe->avgcolor[1], skinframe->avgcolor[2], skinframe->avgcolor[3]);
-		if (r_savedds && qglGetCompressedTexImageARB && skinframe->base)
-			R_SaveTextureDDSFile(skinframe->base, va(vabuf, sizeof(vabuf), "dds/%s.dds", skinframe->basename), r_texture_dds_save.integer < 2, skinframe->hasalpha, skinframe->avgcolor);
-		if (r_savedds && qglGetCompressedTexImageARB && skinframe->fog)
-			R_SaveTextureDDSFile(skinframe->fog, va(vabuf, sizeof(vabuf), "dds/%s_mask.dds", skinframe->basename), r_texture_dds_save.integer < 2, true, NULL);
-#endif
 	}
 
-	// load up _norm, _glow, _gloss, _pants, _shirt, _reflect
-	if (!baseonly)
-	{
-		if (r_loaddds)
-		{
-			mymiplevel = savemiplevel;
-			if (r_loadnormalmap)
-				skinframe->nmap = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_norm", false, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP), NULL, NULL, mymiplevel, true);
-			skinframe->glow = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_glow", vid.sRGB3D, textureflags, NULL, NULL, mymiplevel, true);
-			if (r_loadgloss)
-				skinframe->gloss = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_gloss", vid.sRGB3D, textureflags, NULL, NULL, mymiplevel, true);
-			skinframe->pants = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_pants", vid.sRGB3D, textureflags, NULL, NULL, mymiplevel, true);
-			skinframe->shirt = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_shirt", vid.sRGB3D, textureflags, NULL, NULL, mymiplevel, true);
-			skinframe->reflect = R_LoadTextureDDSFile(r_main_texturepool, skinframe->basename, "_reflect", vid.sRGB3D, textureflags, NULL, NULL, mymiplevel, true);
-		}
-
-		// _norm is the name used by tenebrae and has been adopted as standard
-		if (r_loadnormalmap && skinframe->nmap == NULL)
-		{
-			mymiplevel = savemiplevel;
-			if ((pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_norm", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)) != NULL)
-			{
-				// Vortex: show warning for sRGB colorspace normalmaps
-				if (sRGBcolorspace)
-					Con_Printf("normalmap image \"%s\" is using sRGB colorspace, should be linear RGB\n", name);
-				skinframe->nmap = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_nmap", skinframe->basename), image_width, image_height, pixels, sRGBcolorspace ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP) & (gl_texturecompression_normal.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-				Mem_Free(pixels);
-				pixels = NULL;
-			}
-			else if (r_shadow_bumpscale_bumpmap.value > 0 && (bumppixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_bump", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)) != NULL)
-			{
-				pixels = (unsigned char *)Mem_Alloc(tempmempool, image_width * image_height * 4);
-				Image_HeightmapToNormalmap_BGRA(bumppixels, pixels, image_width, image_height, false, r_shadow_bumpscale_bumpmap.value);
-				skinframe->nmap = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_nmap", skinframe->basename), image_width, image_height, pixels, sRGBcolorspace ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP) & (gl_texturecompression_normal.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-				Mem_Free(pixels);
-				Mem_Free(bumppixels);
-			}
-			else if (r_shadow_bumpscale_basetexture.value > 0)
-			{
-				// fixme: what if basetexture is using sRGB colorspace?
-				pixels = (unsigned char *)Mem_Alloc(tempmempool, basepixels_width * basepixels_height * 4);
-				Image_HeightmapToNormalmap_BGRA(basepixels, pixels, basepixels_width, basepixels_height, false, r_shadow_bumpscale_basetexture.value);
-				skinframe->nmap = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_nmap", skinframe->basename), basepixels_width, basepixels_height, pixels, TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (r_mipnormalmaps.integer ? ~0 : ~TEXF_MIPMAP) & (gl_texturecompression_normal.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-				Mem_Free(pixels);
-			}
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->nmap)
-				R_SaveTextureDDSFile(skinframe->nmap, va(vabuf, sizeof(vabuf), "dds/%s_norm.dds", skinframe->basename), r_texture_dds_save.integer < 2, true, NULL);
-	#endif
-		}
-
-		// _luma is supported only for tenebrae compatibility
-		// _glow is the preferred name
-		mymiplevel = savemiplevel;
-		if (skinframe->glow == NULL && ((pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_glow",  skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)) || (pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_luma", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel))))
-		{
-			skinframe->glow = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_glow", skinframe->basename), image_width, image_height, pixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_glow.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->glow)
-				R_SaveTextureDDSFile(skinframe->glow, va(vabuf, sizeof(vabuf), "dds/%s_glow.dds", skinframe->basename), r_texture_dds_save.integer < 2, true, NULL);
-	#endif
-			Mem_Free(pixels);pixels = NULL;
-		}
-
-		mymiplevel = savemiplevel;
-		if (skinframe->gloss == NULL && r_loadgloss && (pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_gloss", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)))
-		{
-			skinframe->gloss = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_gloss", skinframe->basename), image_width, image_height, pixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, (TEXF_ALPHA | textureflags) & (gl_texturecompression_gloss.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->gloss)
-				R_SaveTextureDDSFile(skinframe->gloss, va(vabuf, sizeof(vabuf), "dds/%s_gloss.dds", skinframe->basename), r_texture_dds_save.integer < 2, true, NULL);
-	#endif
-			Mem_Free(pixels);
-			pixels = NULL;
-		}
-
-		mymiplevel = savemiplevel;
-		if (skinframe->pants == NULL && (pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_pants", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)))
-		{
-			skinframe->pants = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_pants", skinframe->basename), image_width, image_height, pixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->pants)
-				R_SaveTextureDDSFile(skinframe->pants, va(vabuf, sizeof(vabuf), "dds/%s_pants.dds", skinframe->basename), r_texture_dds_save.integer < 2, false, NULL);
-	#endif
-			Mem_Free(pixels);
-			pixels = NULL;
-		}
-
-		mymiplevel = savemiplevel;
-		if (skinframe->shirt == NULL && (pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_shirt", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)))
-		{
-			skinframe->shirt = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_shirt", skinframe->basename), image_width, image_height, pixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_color.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->shirt)
-				R_SaveTextureDDSFile(skinframe->shirt, va(vabuf, sizeof(vabuf), "dds/%s_shirt.dds", skinframe->basename), r_texture_dds_save.integer < 2, false, NULL);
-	#endif
-			Mem_Free(pixels);
-			pixels = NULL;
-		}
-
-		mymiplevel = savemiplevel;
-		if (skinframe->reflect == NULL && (pixels = loadimagepixelsbgra(va(vabuf, sizeof(vabuf), "%s_reflect", skinframe->basename), false, false, false, &sRGBcolorspace, &mymiplevel)))
-		{
-			skinframe->reflect = R_LoadTexture2D (r_main_texturepool, va(vabuf, sizeof(vabuf), "%s_reflect", skinframe->basename), image_width, image_height, pixels, (vid.sRGB3D || sRGBcolorspace) ? TEXTYPE_SRGB_BGRA : TEXTYPE_BGRA, textureflags & (gl_texturecompression_reflectmask.integer && gl_texturecompression.integer ? ~0 : ~TEXF_COMPRESS), mymiplevel, NULL);
-	#ifndef USE_GLES2
-			if (r_savedds && qglGetCompressedTexImageARB && skinframe->reflect)
-				R_SaveTextureDDSFile(skinframe->reflect, va(vabuf, sizeof(vabuf), "dds/%s_reflect.dds", skinframe->basename), r_texture_dds_save.integer < 2, true, NULL);
-	#endif
-			Mem_Free(pixels);
-			pixels = NULL;
-		}
-	}
-
-	if (basepixels)
-		Mem_Free(basepixels);
+	R_SkinFrame_UploadExternal(skinframe, &decode);
+	R_SkinFrame_FreeDecode(&decode);
 
 	return skinframe;
 }
@@ -4494,6 +4758,9 @@ static void gl_main_shutdown(void)
 	r_qwskincache = NULL;
 	r_qwskincache_size = 0;
 
+	// the loader thread holds skinframe pointers
+	R_SkinFrame_StopLoader();
+
 	// clear out the r_skinframe state
 	Mem_ExpandableArray_FreeArray(&r_skinframe.array);
 	memset(&r_skinframe, 0, sizeof(r_skinframe));
@@ -4669,6 +4936,8 @@ void GL_Main_Init(void)
 	Cvar_RegisterVariable(&r_transparent_sortarraysize);
 	Cvar_RegisterVariable(&r_texture_dds_load);
 	Cvar_RegisterVariable(&r_texture_dds_save);
+	Cvar_RegisterVariable(&r_texture_async);
+	Cvar_RegisterVariable(&r_texture_async_uploadtime);
 	Cvar_RegisterVariable(&r_textureunits);
 	Cvar_RegisterVariable(&gl_combine);
 	Cvar_RegisterVariable(&r_usedepthtextures);
@@ -5636,10 +5905,19 @@ static int R_DrawBrushModelsSky (void)
 }
 
 static void R_DrawNoModel(entity_render_t *ent);
+static qboolean R_RenderQueue_CanQueueEntity(const entity_render_t *ent);
+static void R_RenderQueue_DrawEntities(entity_render_t **entities, int numentities);
 static void R_DrawModels(void)
 {
-	int i;
+	int i, numqueued;
 	entity_render_t *ent;
+	entity_render_t **queued;
+
+	// gather the entities that can share one sorted render queue
+	numqueued = 0;
+	queued = NULL;
+	if (r_sortentities.integer >= 2 && (!r_showsurfaces.integer || r_showsurfaces.integer == 3))
+		queued = (entity_render_t **)R_FrameData_Alloc(r_refdef.scene.numentities * sizeof(*queued));
 
 	for (i = 0;i < r_refdef.scene.numentities;i++)
 	{
@@ -5647,6 +5925,11 @@ static void R_DrawModels(void)
 			continue;
 		ent = r_refdef.scene.entities[i];
 		r_refdef.stats[r_stat_entities]++;
+		if (queued && R_RenderQueue_CanQueueEntity(ent))
+		{
+			queued[numqueued++] = ent;
+			continue;
+		}
 		/*
 		if (ent->model && !strncmp(ent->model->name, "models/proto_", 13))
 		{
@@ -5663,6 +5946,9 @@ static void R_DrawModels(void)
 		else
 			R_DrawNoModel(ent);
 	}
+
+	if (numqueued)
+		R_RenderQueue_DrawEntities(queued, numqueued);
 }
 
 static void R_DrawModelsDepth(qboolean postprocessdepth)
@@ -13189,12 +13475,41 @@ void R_DrawWorldSurfaces(qboolean skysurfaces, qboolean writedepth, qboolean dep
 	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
 }
 
+static void R_DrawModelSurfaces_UpdateLightStyles(dp_model_t *model)
+{
+	int i, j;
+	unsigned char *update = model->brushq1.lightmapupdateflags;
+	model_brush_lightstyleinfo_t *style;
+	if (!model->brushq1.num_lightstyles || r_refdef.lightmapintensity <= 0)
+		return;
+	for (i = 0, style = model->brushq1.data_lightstyleinfo;i < model->brushq1.num_lightstyles;i++, style++)
+	{
+		if (style->value != r_refdef.scene.lightstylevalue[style->style])
+		{
+			int *list = style->surfacelist;
+			style->value = r_refdef.scene.lightstylevalue[style->style];
+			for (j = 0;j < style->numsurfaces;j++)
+				update[list[j]] = true;
+		}
+	}
+}
+
+static void R_DrawModelSurfaces_UpdateLightmaps(entity_render_t *ent, dp_model_t *model)
+{
+	int j, endj;
+	unsigned char *update = model->brushq1.lightmapupdateflags;
+	if (!update)
+		return;
+	for (j = model->firstmodelsurface, endj = model->firstmodelsurface + model->nummodelsurfaces;j < endj;j++)
+		if (update[j])
+			R_BuildLightMap(ent, model->data_surfaces + j);
+}
+
 void R_DrawModelSurfaces(entity_render_t *ent, qboolean skysurfaces, qboolean writedepth, qboolean depthonly, qboolean debug, qboolean prepass, qboolean postprocessdepth)
 {
-	int i, j, endj, flagsmask;
+	int i, j, flagsmask;
 	dp_model_t *model = ent->model;
 	msurface_t *surfaces;
-	unsigned char *update;
 	int numsurfacelist = 0;
 	if (model == NULL)
 		return;
@@ -13256,23 +13571,10 @@ void R_DrawModelSurfaces(entity_render_t *ent, qboolean skysurfaces, qboolean wr
 	}
 
 	surfaces = model->data_surfaces;
-	update = model->brushq1.lightmapupdateflags;
 
 	// update light styles
-	if (!skysurfaces && !depthonly && !prepass && model->brushq1.num_lightstyles && r_refdef.lightmapintensity > 0)
-	{
-		model_brush_lightstyleinfo_t *style;
-		for (i = 0, style = model->brushq1.data_lightstyleinfo;i < model->brushq1.num_lightstyles;i++, style++)
-		{
-			if (style->value != r_refdef.scene.lightstylevalue[style->style])
-			{
-				int *list = style->surfacelist;
-				style->value = r_refdef.scene.lightstylevalue[style->style];
-				for (j = 0;j < style->numsurfaces;j++)
-					update[list[j]] = true;
-			}
-		}
-	}
+	if (!skysurfaces && !depthonly && !prepass)
+		R_DrawModelSurfaces_UpdateLightStyles(model);
 
 	flagsmask = skysurfaces ? MATERIALFLAG_SKY : MATERIALFLAG_WALL;
 
@@ -13299,18 +13601,7 @@ void R_DrawModelSurfaces(entity_render_t *ent, qboolean skysurfaces, qboolean wr
 		return;
 	}
 	// update lightmaps if needed
-	if (update)
-	{
-		int updated = 0;
-		for (j = model->firstmodelsurface, endj = model->firstmodelsurface + model->nummodelsurfaces;j < endj;j++)
-		{
-			if (update[j])
-			{
-				updated++;
-				R_BuildLightMap(ent, surfaces + j);
-			}
-		}
-	}
+	R_DrawModelSurfaces_UpdateLightmaps(ent, model);
 
 	R_QueueModelSurfaceList(ent, numsurfacelist, r_surfacelist, flagsmask, writedepth, depthonly, prepass, postprocessdepth);
 
@@ -13325,6 +13616,214 @@ void R_DrawModelSurfaces(entity_render_t *ent, qboolean skysurfaces, qboolean wr
 	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
 }
 
+/*
+================
+opaque render queue
+
+with r_sortentities 2 the opaque surfaces of all eligible entities are
+gathered into one list of texture batches and sorted by material, texture,
+lightmap and model so consecutive batches share as much state as possible,
+rather than each entity drawing its own surfaces in turn
+
+each entity is activated once while it is added, the resulting rsurface
+state is kept so switching back to it while drawing is a copy instead of
+another RSurf_ActiveModelEntity
+================
+*/
+typedef struct r_renderqueueitem_s
+{
+	entity_render_t *ent;
+	const rsurfacestate_t *entitystate; // rsurface as set up for ent
+	texture_t *texture; // base texture, R_GetCurrentTexture is called again when drawing
+	texture_t *currenttexture; // only used for sorting
+	rtexture_t *lightmaptexture;
+	rtexture_t *deluxemaptexture;
+	int materialflags;
+	int firstsurface; // index into r_renderqueue_surfacelist
+	int numsurfaces;
+}
+r_renderqueueitem_t;
+
+static r_renderqueueitem_t *r_renderqueue_items;
+static int r_renderqueue_numitems;
+static const msurface_t **r_renderqueue_surfacelist;
+static int r_renderqueue_numsurfaces;
+
+static qboolean R_RenderQueue_CanQueueEntity(const entity_render_t *ent)
+{
+	dp_model_t *model = ent->model;
+	if (!model || model->Draw != R_Q1BSP_Draw || ent == r_refdef.scene.worldentity)
+		return false;
+	// activating an animated entity without a cached mesh would animate
+	// it again every time the queue switches back to it
+	if (model->surfmesh.isanimated && model->AnimateVertices && !ent->animcache_vertex3f && !ent->animcache_skeletaltransform3x4)
+		return false;
+	return true;
+}
+
+static void R_RenderQueue_ActivateEntity(entity_render_t *ent)
+{
+	switch (vid.renderpath)
+	{
+	case RENDERPATH_GL20:
+	case RENDERPATH_D3D9:
+	case RENDERPATH_D3D10:
+	case RENDERPATH_D3D11:
+	case RENDERPATH_SOFT:
+	case RENDERPATH_GLES2:
+		RSurf_ActiveModelEntity(ent, true, true, false);
+		break;
+	case RENDERPATH_GL11:
+	case RENDERPATH_GL13:
+	case RENDERPATH_GLES1:
+		RSurf_ActiveModelEntity(ent, true, false, false);
+		break;
+	}
+}
+
+static void R_RenderQueue_AddEntity(entity_render_t *ent, rsurfacestate_t *entitystate)
+{
+	int i, j, numsurfaces;
+	dp_model_t *model = ent->model;
+	const msurface_t **surfacelist;
+	texture_t *texture;
+	rtexture_t *lightmaptexture;
+	r_renderqueueitem_t *item;
+
+	R_RenderQueue_ActivateEntity(ent);
+	rsurface.rtlight = NULL;
+	*entitystate = rsurface;
+	R_DrawModelSurfaces_UpdateLightStyles(model);
+	R_DrawModelSurfaces_UpdateLightmaps(ent, model);
+
+	numsurfaces = model->nummodelsurfaces;
+	surfacelist = r_renderqueue_surfacelist + r_renderqueue_numsurfaces;
+	for (i = 0;i < numsurfaces;i++)
+		surfacelist[i] = model->data_surfaces + model->sortedmodelsurfaces[i];
+
+	// break the surface list down into batches the same way
+	// R_QueueModelSurfaceList does
+	for (i = 0;i < numsurfaces;i = j)
+	{
+		j = i + 1;
+		texture = surfacelist[i]->texture;
+		rsurface.texture = R_GetCurrentTexture(texture);
+		if (!(rsurface.texture->currentmaterialflags & MATERIALFLAG_WALL) || (rsurface.texture->currentmaterialflags & MATERIALFLAG_NODRAW))
+		{
+			for (;j < numsurfaces && texture == surfacelist[j]->texture;j++)
+				;
+			continue;
+		}
+		if (FAKELIGHT_ENABLED)
+		{
+			lightmaptexture = NULL;
+			for (;j < numsurfaces && texture == surfacelist[j]->texture;j++)
+				;
+		}
+		else
+		{
+			lightmaptexture = surfacelist[i]->lightmaptexture;
+			for (;j < numsurfaces && texture == surfacelist[j]->texture && lightmaptexture == surfacelist[j]->lightmaptexture;j++)
+				;
+		}
+		item = r_renderqueue_items + r_renderqueue_numitems++;
+		item->ent = ent;
+		item->entitystate = entitystate;
+		item->texture = texture;
+		item->currenttexture = rsurface.texture;
+		item->lightmaptexture = lightmaptexture;
+		item->deluxemaptexture = lightmaptexture ? surfacelist[i]->deluxemaptexture : NULL;
+		item->materialflags = rsurface.texture->currentmaterialflags;
+		item->firstsurface = r_renderqueue_numsurfaces + i;
+		item->numsurfaces = j - i;
+	}
+	r_renderqueue_numsurfaces += numsurfaces;
+
+	if (r_speeds.integer)
+	{
+		r_refdef.stats[r_stat_entities_surfaces] += numsurfaces;
+		for (j = 0;j < numsurfaces;j++)
+			r_refdef.stats[r_stat_entities_triangles] += surfacelist[j]->num_triangles;
+	}
+
+	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
+}
+
+static int R_RenderQueue_CompareItems(const void *ap, const void *bp)
+{
+	const r_renderqueueitem_t *a = (const r_renderqueueitem_t *)ap;
+	const r_renderqueueitem_t *b = (const r_renderqueueitem_t *)bp;
+
+	// 1. material flags decide most of the shader permutation and blend state
+	if (a->materialflags != b->materialflags)
+		return a->materialflags < b->materialflags ? -1 : 1;
+	// 2. textures
+	if (a->currenttexture != b->currenttexture)
+		return a->currenttexture < b->currenttexture ? -1 : 1;
+	if (a->lightmaptexture != b->lightmaptexture)
+		return a->lightmaptexture < b->lightmaptexture ? -1 : 1;
+	// 3. vertex buffer
+	if (a->ent->model != b->ent->model)
+		return a->ent->model < b->ent->model ? -1 : 1;
+	// 4. entity, then original order so the sort is deterministic
+	if (a->ent != b->ent)
+		return a->ent < b->ent ? -1 : 1;
+	return a->firstsurface - b->firstsurface;
+}
+
+static void R_RenderQueue_DrawEntities(entity_render_t **entities, int numentities)
+{
+	int i, maxsurfaces;
+	entity_render_t *ent;
+	rsurfacestate_t *entitystates;
+	r_renderqueueitem_t *item;
+
+	maxsurfaces = 0;
+	for (i = 0;i < numentities;i++)
+		maxsurfaces += entities[i]->model->nummodelsurfaces;
+	if (!maxsurfaces)
+		return;
+
+	// these live until the end of the frame, the mark below keeps them safe
+	// from the per-batch allocations
+	r_renderqueue_items = (r_renderqueueitem_t *)R_FrameData_Alloc(maxsurfaces * sizeof(*r_renderqueue_items));
+	r_renderqueue_surfacelist = (const msurface_t **)R_FrameData_Alloc(maxsurfaces * sizeof(*r_renderqueue_surfacelist));
+	entitystates = (rsurfacestate_t *)R_FrameData_Alloc(numentities * sizeof(*entitystates));
+	r_renderqueue_numitems = 0;
+	r_renderqueue_numsurfaces = 0;
+
+	for (i = 0;i < numentities;i++)
+		R_RenderQueue_AddEntity(entities[i], entitystates + i);
+
+	if (r_renderqueue_numitems > 1)
+		qsort(r_renderqueue_items, r_renderqueue_numitems, sizeof(*r_renderqueue_items), R_RenderQueue_CompareItems);
+	r_refdef.stats[r_stat_renderqueue_items] += r_renderqueue_numitems;
+
+	R_FrameData_SetMark();
+	ent = NULL;
+	for (i = 0, item = r_renderqueue_items;i < r_renderqueue_numitems;i++, item++)
+	{
+		if (ent != item->ent)
+		{
+			// the saved state only points at data that lives for the whole
+			// frame (entities with animated meshes are not queued unless
+			// they are in the animcache), the entity matrix has to be set
+			// again though
+			ent = item->ent;
+			rsurface = *item->entitystate;
+			R_EntityMatrix(&rsurface.matrix);
+			r_refdef.stats[r_stat_renderqueue_entityswitches]++;
+		}
+		rsurface.texture = R_GetCurrentTexture(item->texture);
+		rsurface.lightmaptexture = item->lightmaptexture;
+		rsurface.deluxemaptexture = item->deluxemaptexture;
+		rsurface.uselightmaptexture = item->lightmaptexture != NULL;
+		R_ProcessModelTextureSurfaceList(item->numsurfaces, r_renderqueue_surfacelist + item->firstsurface, true, false, false, false);
+		R_FrameData_ReturnToMark();
+	}
+	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
+}
+
 void R_DrawCustomSurface(skinframe_t *skinframe, const matrix4x4_t *texmatrix, int materialflags, int firstvertex, int numvertices, int firsttriangle, int numtriangles, qboolean writedepth, qboolean prepass)
 {
 	static texture_t texture;
@@ -712,11 +712,25 @@ typedef struct r_q1bsp_getlightinfo_s
 	qboolean svbsp_insertoccluder;
 	int numfrustumplanes;
 	const mplane_t *frustumplanes;
+	// r_svbsp on the main thread, or one owned by a compile thread
+	svbsp_t *svbsp;
+	// currentmaterialflags of each model texture made on the main thread (when
+	// compiling on other threads R_GetCurrentTexture can not be called)
+	const int *materialflags;
+	// compiling a static light (no frustum culling)
+	qboolean compiling;
 }
 r_q1bsp_getlightinfo_t;
 
 #define GETLIGHTINFO_MAXNODESTACK 4096
 
+static int R_Q1BSP_GetLightInfo_MaterialFlags(r_q1bsp_getlightinfo_t *info, const msurface_t *surface)
+{
+	if (info->materialflags)
+		return info->materialflags[surface->texture - info->model->data_textures];
+	return R_GetCurrentTexture(surface->texture)->currentmaterialflags;
+}
+
 static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboolean skipsurfaces)
 {
 	// nodestack
@@ -747,7 +761,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 	qboolean addedtris;
 	int i;
 	mportal_t *portal;
-	static float points[128][3];
+	float points[128][3];
 	// push the root node onto our nodestack
 	nodestack[nodestackpos++] = info->model->brush.data_nodes;
 	// we'll be done when the nodestack is empty
@@ -838,7 +852,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 				continue;
 #endif
 #if 1
-			if (!r_shadow_compilingrtlight && R_CullBoxCustomPlanes(leaf->mins, leaf->maxs, info->numfrustumplanes, info->frustumplanes))
+			if (!info->compiling && R_CullBoxCustomPlanes(leaf->mins, leaf->maxs, info->numfrustumplanes, info->frustumplanes))
 				continue;
 #endif
 
@@ -851,7 +865,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 				{
 					for (i = 0;i < portal->numpoints;i++)
 						VectorCopy(portal->points[i].position, points[i]);
-					if (SVBSP_AddPolygon(&r_svbsp, portal->numpoints, points[0], false, NULL, NULL, 0) & 2)
+					if (SVBSP_AddPolygon(info->svbsp, portal->numpoints, points[0], false, NULL, NULL, 0) & 2)
 						break;
 				}
 				if (leaf->portals && portal == NULL)
@@ -895,7 +909,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 					surface = surfaces + surfaceindex;
 					if (!BoxesOverlap(info->lightmins, info->lightmaxs, surface->mins, surface->maxs))
 						continue;
-					currentmaterialflags = R_GetCurrentTexture(surface->texture)->currentmaterialflags;
+					currentmaterialflags = R_Q1BSP_GetLightInfo_MaterialFlags(info, surface);
 					castshadow = !(currentmaterialflags & MATERIALFLAG_NOSHADOW);
 					if (!castshadow || !info->model->brush.shadowmesh)
 						continue;
@@ -909,7 +923,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 						VectorCopy(v[1], v2[1]);
 						VectorCopy(v[2], v2[2]);
 						if (insidebox || TriangleBBoxOverlapsBox(v2[0], v2[1], v2[2], info->lightmins, info->lightmaxs))
-							SVBSP_AddPolygon(&r_svbsp, 3, v2[0], true, NULL, NULL, 0);
+							SVBSP_AddPolygon(info->svbsp, 3, v2[0], true, NULL, NULL, 0);
 					}
 				}
 			}
@@ -925,7 +939,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 					if (!BoxesOverlap(info->lightmins, info->lightmaxs, surface->mins, surface->maxs))
 						continue;
 					addedtris = false;
-					currentmaterialflags = R_GetCurrentTexture(surface->texture)->currentmaterialflags;
+					currentmaterialflags = R_Q1BSP_GetLightInfo_MaterialFlags(info, surface);
 					castshadow = !(currentmaterialflags & MATERIALFLAG_NOSHADOW);
 					if (!info->model->brush.shadowmesh)
 					{
@@ -944,7 +958,7 @@ static void R_Q1BSP_RecursiveGetLightInfo_BSP(r_q1bsp_getlightinfo_t *info, qboo
 						VectorCopy(v[2], v2[2]);
 						if (!insidebox && !TriangleBBoxOverlapsBox(v2[0], v2[1], v2[2], info->lightmins, info->lightmaxs))
 							continue;
-						if (svbspactive && !(SVBSP_AddPolygon(&r_svbsp, 3, v2[0], false, NULL, NULL, 0) & 2))
+						if (svbspactive && !(SVBSP_AddPolygon(info->svbsp, 3, v2[0], false, NULL, NULL, 0) & 2))
 							continue;
 						// we don't omit triangles from lighting even if they are
 						// backfacing, because when using shadowmapping they are often
@@ -1027,12 +1041,12 @@ static void R_Q1BSP_RecursiveGetLightInfo_BIH(r_q1bsp_getlightinfo_t *info, cons
 					continue;
 #endif
 #if 1
-				if (!r_shadow_compilingrtlight && R_CullBoxCustomPlanes(leaf->mins, leaf->maxs, info->numfrustumplanes, info->frustumplanes))
+				if (!info->compiling && R_CullBoxCustomPlanes(leaf->mins, leaf->maxs, info->numfrustumplanes, info->frustumplanes))
 					continue;
 #endif
 				surfaceindex = leaf->surfaceindex;
 				surface = info->model->data_surfaces + surfaceindex;
-				currentmaterialflags = R_GetCurrentTexture(surface->texture)->currentmaterialflags;
+				currentmaterialflags = R_Q1BSP_GetLightInfo_MaterialFlags(info, surface);
 				castshadow = !(currentmaterialflags & MATERIALFLAG_NOSHADOW);
 				t = leaf->itemindex + surface->num_firstshadowmeshtriangle - surface->num_firsttriangle;
 				e = info->model->brush.shadowmesh->element3i + t * 3;
@@ -1045,10 +1059,10 @@ static void R_Q1BSP_RecursiveGetLightInfo_BIH(r_q1bsp_getlightinfo_t *info, cons
 				if (info->svbsp_insertoccluder)
 				{
 					if (castshadow)
-						SVBSP_AddPolygon(&r_svbsp, 3, v2[0], true, NULL, NULL, 0);
+						SVBSP_AddPolygon(info->svbsp, 3, v2[0], true, NULL, NULL, 0);
 					continue;
 				}
-				if (info->svbsp_active && !(SVBSP_AddPolygon(&r_svbsp, 3, v2[0], false, NULL, NULL, 0) & 2))
+				if (info->svbsp_active && !(SVBSP_AddPolygon(info->svbsp, 3, v2[0], false, NULL, NULL, 0) & 2))
 					continue;
 				// we don't occlude triangles from lighting even
 				// if they are backfacing, because when using
@@ -1115,31 +1129,43 @@ static void R_Q1BSP_RecursiveGetLightInfo_BIH(r_q1bsp_getlightinfo_t *info, cons
 	}
 }
 
+// r_svbsp uses temporary frame data, the svbsp of a compile thread keeps its
+// nodes in tempmempool until the owner frees them
+static void R_Q1BSP_GetLightInfo_AllocSVBSPNodes(svbsp_t *b, int maxnodes)
+{
+	if (b == &r_svbsp)
+		b->nodes = (svbsp_node_t*) R_FrameData_Alloc(maxnodes * sizeof(svbsp_node_t));
+	else if (!b->nodes || b->maxnodes != maxnodes)
+	{
+		if (b->nodes)
+			Mem_Free(b->nodes);
+		b->nodes = (svbsp_node_t*) Mem_Alloc(tempmempool, maxnodes * sizeof(svbsp_node_t));
+	}
+	b->maxnodes = maxnodes;
+}
+
 static void R_Q1BSP_CallRecursiveGetLightInfo(r_q1bsp_getlightinfo_t *info, qboolean use_svbsp)
 {
 	extern cvar_t r_shadow_usebihculling;
+	svbsp_t *svbsp = info->svbsp;
 	if (use_svbsp)
 	{
 		float origin[3];
 		VectorCopy(info->relativelightorigin, origin);
-		r_svbsp.maxnodes = max(r_svbsp.maxnodes, 1<<12);
-		r_svbsp.nodes = (svbsp_node_t*) R_FrameData_Alloc(r_svbsp.maxnodes * sizeof(svbsp_node_t));
+		R_Q1BSP_GetLightInfo_AllocSVBSPNodes(svbsp, max(svbsp->maxnodes, 1<<12));
 		info->svbsp_active = true;
 		info->svbsp_insertoccluder = true;
 		for (;;)
 		{
-			SVBSP_Init(&r_svbsp, origin, r_svbsp.maxnodes, r_svbsp.nodes);
+			SVBSP_Init(svbsp, origin, svbsp->maxnodes, svbsp->nodes);
 			R_Q1BSP_RecursiveGetLightInfo_BSP(info, false);
 			// if that failed, retry with more nodes
-			if (r_svbsp.ranoutofnodes)
+			if (svbsp->ranoutofnodes)
 			{
 				// an upper limit is imposed
-				if (r_svbsp.maxnodes >= 2<<22)
+				if (svbsp->maxnodes >= 2<<22)
 					break;
-				r_svbsp.maxnodes *= 2;
-				r_svbsp.nodes = (svbsp_node_t*) R_FrameData_Alloc(r_svbsp.maxnodes * sizeof(svbsp_node_t));
-				//Mem_Free(r_svbsp.nodes);
-				//r_svbsp.nodes = (svbsp_node_t*) Mem_Alloc(tempmempool, r_svbsp.maxnodes * sizeof(svbsp_node_t));
+				R_Q1BSP_GetLightInfo_AllocSVBSPNodes(svbsp, svbsp->maxnodes * 2);
 			}
 			else
 				break;
@@ -1194,88 +1220,71 @@ static void R_Q1BSP_CallRecursiveGetLightInfo(r_q1bsp_getlightinfo_t *info, qboo
 	else
 		R_Q1BSP_RecursiveGetLightInfo_BSP(info, false);
 	// we're using temporary framedata memory, so this pointer will be invalid soon, clear it
-	r_svbsp.nodes = NULL;
+	if (svbsp == &r_svbsp)
+		r_svbsp.nodes = NULL;
 	if (developer_extra.integer && use_svbsp)
 	{
-		Con_DPrintf("GetLightInfo: svbsp built with %i nodes, polygon stats:\n", r_svbsp.numnodes);
-		Con_DPrintf("occluders: %i accepted, %i rejected, %i fragments accepted, %i fragments rejected.\n", r_svbsp.stat_occluders_accepted, r_svbsp.stat_occluders_rejected, r_svbsp.stat_occluders_fragments_accepted, r_svbsp.stat_occluders_fragments_rejected);
-		Con_DPrintf("queries  : %i accepted, %i rejected, %i fragments accepted, %i fragments rejected.\n", r_svbsp.stat_queries_accepted, r_svbsp.stat_queries_rejected, r_svbsp.stat_queries_fragments_accepted, r_svbsp.stat_queries_fragments_rejected);
+		Con_DPrintf("GetLightInfo: svbsp built with %i nodes, polygon stats:\n", svbsp->numnodes);
+		Con_DPrintf("occluders: %i accepted, %i rejected, %i fragments accepted, %i fragments rejected.\n", svbsp->stat_occluders_accepted, svbsp->stat_occluders_rejected, svbsp->stat_occluders_fragments_accepted, svbsp->stat_occluders_fragments_rejected);
+		Con_DPrintf("queries  : %i accepted, %i rejected, %i fragments accepted, %i fragments rejected.\n", svbsp->stat_queries_accepted, svbsp->stat_queries_rejected, svbsp->stat_queries_fragments_accepted, svbsp->stat_queries_fragments_rejected);
 	}
 }
 
-static msurface_t *r_q1bsp_getlightinfo_surfaces;
-
-static int R_Q1BSP_GetLightInfo_comparefunc(const void *ap, const void *bp)
-{
-	int a = *(int*)ap;
-	int b = *(int*)bp;
-	const msurface_t *as = r_q1bsp_getlightinfo_surfaces + a;
-	const msurface_t *bs = r_q1bsp_getlightinfo_surfaces + b;
-	if (as->texture < bs->texture)
-		return -1;
-	if (as->texture > bs->texture)
-		return 1;
-	return a - b;
-}
-
-extern cvar_t r_shadow_sortsurfaces;
-
-void R_Q1BSP_GetLightInfo(entity_render_t *ent, vec3_t relativelightorigin, float lightradius, vec3_t outmins, vec3_t outmaxs, int *outleaflist, unsigned char *outleafpvs, int *outnumleafspointer, int *outsurfacelist, unsigned char *outsurfacepvs, int *outnumsurfacespointer, unsigned char *outshadowtrispvs, unsigned char *outlighttrispvs, unsigned char *visitingleafpvs, int numfrustumplanes, const mplane_t *frustumplanes)
+// does the work of R_Q1BSP_GetLightInfo and R_Q1BSP_CompileLightInfo, the
+// caller fills in info->model, svbsp, materialflags and compiling
+static void R_Q1BSP_GetLightInfo_Run(r_q1bsp_getlightinfo_t *info, vec3_t relativelightorigin, float lightradius, vec3_t outmins, vec3_t outmaxs, int *outleaflist, unsigned char *outleafpvs, int *outnumleafspointer, int *outsurfacelist, unsigned char *outsurfacepvs, int *outnumsurfacespointer, unsigned char *outshadowtrispvs, unsigned char *outlighttrispvs, unsigned char *visitingleafpvs, int numfrustumplanes, const mplane_t *frustumplanes)
 {
-	r_q1bsp_getlightinfo_t info;
-	VectorCopy(relativelightorigin, info.relativelightorigin);
-	info.lightradius = lightradius;
-	info.lightmins[0] = info.relativelightorigin[0] - info.lightradius;
-	info.lightmins[1] = info.relativelightorigin[1] - info.lightradius;
-	info.lightmins[2] = info.relativelightorigin[2] - info.lightradius;
-	info.lightmaxs[0] = info.relativelightorigin[0] + info.lightradius;
-	info.lightmaxs[1] = info.relativelightorigin[1] + info.lightradius;
-	info.lightmaxs[2] = info.relativelightorigin[2] + info.lightradius;
-	if (ent->model == NULL)
+	VectorCopy(relativelightorigin, info->relativelightorigin);
+	info->lightradius = lightradius;
+	info->lightmins[0] = info->relativelightorigin[0] - info->lightradius;
+	info->lightmins[1] = info->relativelightorigin[1] - info->lightradius;
+	info->lightmins[2] = info->relativelightorigin[2] - info->lightradius;
+	info->lightmaxs[0] = info->relativelightorigin[0] + info->lightradius;
+	info->lightmaxs[1] = info->relativelightorigin[1] + info->lightradius;
+	info->lightmaxs[2] = info->relativelightorigin[2] + info->lightradius;
+	if (info->model == NULL)
 	{
-		VectorCopy(info.lightmins, outmins);
-		VectorCopy(info.lightmaxs, outmaxs);
+		VectorCopy(info->lightmins, outmins);
+		VectorCopy(info->lightmaxs, outmaxs);
 		*outnumleafspointer = 0;
 		*outnumsurfacespointer = 0;
 		return;
 	}
-	info.model = ent->model;
-	info.outleaflist = outleaflist;
-	info.outleafpvs = outleafpvs;
-	info.outnumleafs = 0;
-	info.visitingleafpvs = visitingleafpvs;
-	info.outsurfacelist = outsurfacelist;
-	info.outsurfacepvs = outsurfacepvs;
-	info.outshadowtrispvs = outshadowtrispvs;
-	info.outlighttrispvs = outlighttrispvs;
-	info.outnumsurfaces = 0;
-	info.numfrustumplanes = numfrustumplanes;
-	info.frustumplanes = frustumplanes;
-	VectorCopy(info.relativelightorigin, info.outmins);
-	VectorCopy(info.relativelightorigin, info.outmaxs);
-	memset(visitingleafpvs, 0, (info.model->brush.num_leafs + 7) >> 3);
-	memset(outleafpvs, 0, (info.model->brush.num_leafs + 7) >> 3);
-	memset(outsurfacepvs, 0, (info.model->nummodelsurfaces + 7) >> 3);
-	if (info.model->brush.shadowmesh)
-		memset(outshadowtrispvs, 0, (info.model->brush.shadowmesh->numtriangles + 7) >> 3);
+	info->outleaflist = outleaflist;
+	info->outleafpvs = outleafpvs;
+	info->outnumleafs = 0;
+	info->visitingleafpvs = visitingleafpvs;
+	info->outsurfacelist = outsurfacelist;
+	info->outsurfacepvs = outsurfacepvs;
+	info->outshadowtrispvs = outshadowtrispvs;
+	info->outlighttrispvs = outlighttrispvs;
+	info->outnumsurfaces = 0;
+	info->numfrustumplanes = numfrustumplanes;
+	info->frustumplanes = frustumplanes;
+	VectorCopy(info->relativelightorigin, info->outmins);
+	VectorCopy(info->relativelightorigin, info->outmaxs);
+	memset(visitingleafpvs, 0, (info->model->brush.num_leafs + 7) >> 3);
+	memset(outleafpvs, 0, (info->model->brush.num_leafs + 7) >> 3);
+	memset(outsurfacepvs, 0, (info->model->nummodelsurfaces + 7) >> 3);
+	if (info->model->brush.shadowmesh)
+		memset(outshadowtrispvs, 0, (info->model->brush.shadowmesh->numtriangles + 7) >> 3);
 	else
-		memset(outshadowtrispvs, 0, (info.model->surfmesh.num_triangles + 7) >> 3);
-	memset(outlighttrispvs, 0, (info.model->surfmesh.num_triangles + 7) >> 3);
-	if (info.model->brush.GetPVS && r_shadow_frontsidecasting.integer)
-		info.pvs = info.model->brush.GetPVS(info.model, info.relativelightorigin);
+		memset(outshadowtrispvs, 0, (info->model->surfmesh.num_triangles + 7) >> 3);
+	memset(outlighttrispvs, 0, (info->model->surfmesh.num_triangles + 7) >> 3);
+	if (info->model->brush.GetPVS && r_shadow_frontsidecasting.integer)
+		info->pvs = info->model->brush.GetPVS(info->model, info->relativelightorigin);
 	else
-		info.pvs = NULL;
-	RSurf_ActiveWorldEntity();
+		info->pvs = NULL;
 
-	if (r_shadow_frontsidecasting.integer && r_shadow_compilingrtlight && r_shadow_realtime_world_compileportalculling.integer && info.model->brush.data_portals)
+	if (r_shadow_frontsidecasting.integer && info->compiling && r_shadow_realtime_world_compileportalculling.integer && info->model->brush.data_portals)
 	{
 		// use portal recursion for exact light volume culling, and exact surface checking
-		Portal_Visibility(info.model, info.relativelightorigin, info.outleaflist, info.outleafpvs, &info.outnumleafs, info.outsurfacelist, info.outsurfacepvs, &info.outnumsurfaces, NULL, 0, true, info.lightmins, info.lightmaxs, info.outmins, info.outmaxs, info.outshadowtrispvs, info.outlighttrispvs, info.visitingleafpvs);
+		Portal_Visibility(info->model, info->relativelightorigin, info->outleaflist, info->outleafpvs, &info->outnumleafs, info->outsurfacelist, info->outsurfacepvs, &info->outnumsurfaces, NULL, 0, true, info->lightmins, info->lightmaxs, info->outmins, info->outmaxs, info->outshadowtrispvs, info->outlighttrispvs, info->visitingleafpvs);
 	}
-	else if (r_shadow_frontsidecasting.integer && r_shadow_realtime_dlight_portalculling.integer && info.model->brush.data_portals)
+	else if (r_shadow_frontsidecasting.integer && r_shadow_realtime_dlight_portalculling.integer && info->model->brush.data_portals)
 	{
 		// use portal recursion for exact light volume culling, but not the expensive exact surface checking
-		Portal_Visibility(info.model, info.relativelightorigin, info.outleaflist, info.outleafpvs, &info.outnumleafs, info.outsurfacelist, info.outsurfacepvs, &info.outnumsurfaces, NULL, 0, r_shadow_realtime_dlight_portalculling.integer >= 2, info.lightmins, info.lightmaxs, info.outmins, info.outmaxs, info.outshadowtrispvs, info.outlighttrispvs, info.visitingleafpvs);
+		Portal_Visibility(info->model, info->relativelightorigin, info->outleaflist, info->outleafpvs, &info->outnumleafs, info->outsurfacelist, info->outsurfacepvs, &info->outnumsurfaces, NULL, 0, r_shadow_realtime_dlight_portalculling.integer >= 2, info->lightmins, info->lightmaxs, info->outmins, info->outmaxs, info->outshadowtrispvs, info->outlighttrispvs, info->visitingleafpvs);
 	}
 	else
 	{
@@ -1283,21 +1292,51 @@ void R_Q1BSP_GetLightInfo(entity_render_t *ent, vec3_t relativelightorigin, floa
 		// optionally using svbsp for exact culling of compiled lights
 		// (or if the user enables dlight svbsp culling, which is mostly for
 		//  debugging not actual use)
-		R_Q1BSP_CallRecursiveGetLightInfo(&info, (r_shadow_compilingrtlight ? r_shadow_realtime_world_compilesvbsp.integer : r_shadow_realtime_dlight_svbspculling.integer) != 0);
+		R_Q1BSP_CallRecursiveGetLightInfo(info, (info->compiling ? r_shadow_realtime_world_compilesvbsp.integer : r_shadow_realtime_dlight_svbspculling.integer) != 0);
 	}
 
-	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
-
 	// limit combined leaf box to light boundaries
-	outmins[0] = max(info.outmins[0] - 1, info.lightmins[0]);
-	outmins[1] = max(info.outmins[1] - 1, info.lightmins[1]);
-	outmins[2] = max(info.outmins[2] - 1, info.lightmins[2]);
-	outmaxs[0] = min(info.outmaxs[0] + 1, info.lightmaxs[0]);
-	outmaxs[1] = min(info.outmaxs[1] + 1, info.lightmaxs[1]);
-	outmaxs[2] = min(info.outmaxs[2] + 1, info.lightmaxs[2]);
+	outmins[0] = max(info->outmins[0] - 1, info->lightmins[0]);
+	outmins[1] = max(info->outmins[1] - 1, info->lightmins[1]);
+	outmins[2] = max(info->outmins[2] - 1, info->lightmins[2]);
+	outmaxs[0] = min(info->outmaxs[0] + 1, info->lightmaxs[0]);
+	outmaxs[1] = min(info->outmaxs[1] + 1, info->lightmaxs[1]);
+	outmaxs[2] = min(info->outmaxs[2] + 1, info->lightmaxs[2]);
+
+	*outnumleafspointer = info->outnumleafs;
+	*outnumsurfacespointer = info->outnumsurfaces;
+}
 
-	*outnumleafspointer = info.outnumleafs;
-	*outnumsurfacespointer = info.outnumsurfaces;
+static msurface_t *r_q1bsp_getlightinfo_surfaces;
+
+static int R_Q1BSP_GetLightInfo_comparefunc(const void *ap, const void *bp)
+{
+	int a = *(int*)ap;
+	int b = *(int*)bp;
+	const msurface_t *as = r_q1bsp_getlightinfo_surfaces + a;
+	const msurface_t *bs = r_q1bsp_getlightinfo_surfaces + b;
+	if (as->texture < bs->texture)
+		return -1;
+	if (as->texture > bs->texture)
+		return 1;
+	return a - b;
+}
+
+extern cvar_t r_shadow_sortsurfaces;
+
+void R_Q1BSP_GetLightInfo(entity_render_t *ent, vec3_t relativelightorigin, float lightradius, vec3_t outmins, vec3_t outmaxs, int *outleaflist, unsigned char *outleafpvs, int *outnumleafspointer, int *outsurfacelist, unsigned char *outsurfacepvs, int *outnumsurfacespointer, unsigned char *outshadowtrispvs, unsigned char *outlighttrispvs, unsigned char *visitingleafpvs, int numfrustumplanes, const mplane_t *frustumplanes)
+{
+	r_q1bsp_getlightinfo_t info;
+	info.model = ent->model;
+	info.svbsp = &r_svbsp;
+	info.materialflags = NULL;
+	info.compiling = r_shadow_compilingrtlight != NULL;
+	if (info.model)
+		RSurf_ActiveWorldEntity();
+	R_Q1BSP_GetLightInfo_Run(&info, relativelightorigin, lightradius, outmins, outmaxs, outleaflist, outleafpvs, outnumleafspointer, outsurfacelist, outsurfacepvs, outnumsurfacespointer, outshadowtrispvs, outlighttrispvs, visitingleafpvs, numfrustumplanes, frustumplanes);
+	if (info.model == NULL)
+		return;
+	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
 
 	// now sort surfaces by texture for faster rendering
 	r_q1bsp_getlightinfo_surfaces = info.model->data_surfaces;
@@ -1305,6 +1344,38 @@ void R_Q1BSP_GetLightInfo(entity_render_t *ent, vec3_t relativelightorigin, floa
 		qsort(info.outsurfacelist, info.outnumsurfaces, sizeof(*info.outsurfacelist), R_Q1BSP_GetLightInfo_comparefunc);
 }
 
+static int R_Q1BSP_CompileLightInfo_comparefunc(const void *ap, const void *bp)
+{
+	unsigned long long a = *(const unsigned long long *)ap;
+	unsigned long long b = *(const unsigned long long *)bp;
+	return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+void R_Q1BSP_CompileLightInfo(dp_model_t *model, svbsp_t *svbsp, const int *materialflags, vec3_t relativelightorigin, float lightradius, vec3_t outmins, vec3_t outmaxs, int *outleaflist, unsigned char *outleafpvs, int *outnumleafspointer, int *outsurfacelist, unsigned char *outsurfacepvs, int *outnumsurfacespointer, unsigned char *outshadowtrispvs, unsigned char *outlighttrispvs, unsigned char *visitingleafpvs)
+{
+	r_q1bsp_getlightinfo_t info;
+	unsigned long long *keys;
+	int i, numsurfaces;
+	info.model = model;
+	info.svbsp = svbsp;
+	info.materialflags = materialflags;
+	info.compiling = true;
+	R_Q1BSP_GetLightInfo_Run(&info, relativelightorigin, lightradius, outmins, outmaxs, outleaflist, outleafpvs, outnumleafspointer, outsurfacelist, outsurfacepvs, outnumsurfacespointer, outshadowtrispvs, outlighttrispvs, visitingleafpvs, 0, NULL);
+
+	// sort surfaces by texture like R_Q1BSP_GetLightInfo, but with the
+	// texture index in the sort key instead of a shared surfaces pointer
+	numsurfaces = *outnumsurfacespointer;
+	if (model == NULL || !r_shadow_sortsurfaces.integer || numsurfaces < 2)
+		return;
+	keys = (unsigned long long *)Mem_Alloc(tempmempool, numsurfaces * sizeof(*keys));
+	for (i = 0;i < numsurfaces;i++)
+		keys[i] = ((unsigned long long)(model->data_surfaces[outsurfacelist[i]].texture - model->data_textures) << 32) | (unsigned int)outsurfacelist[i];
+	qsort(keys, numsurfaces, sizeof(*keys), R_Q1BSP_CompileLightInfo_comparefunc);
+	for (i = 0;i < numsurfaces;i++)
+		outsurfacelist[i] = (int)(keys[i] & 0xFFFFFFFF);
+	Mem_Free(keys);
+}
+
 void R_Q1BSP_CompileShadowVolume(entity_render_t *ent, vec3_t relativelightorigin, vec3_t relativelightdirection, float lightradius, int numsurfaces, const int *surfacelist)
 {
 	dp_model_t *model = ent->model;
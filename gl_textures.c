@@ -9,6 +9,10 @@ extern LPDIRECT3DDEVICE9 vid_d3d9dev;
 #include "image_png.h"
 #include "intoverflow.h"
 #include "dpsoftrast.h"
+#include "thread.h"
+#ifdef SSE2_PRESENT
+#include <emmintrin.h>
+#endif
 
 #ifndef GL_TEXTURE_3D
 #define GL_TEXTURE_3D				0x806F
@@ -44,6 +48,7 @@ cvar_t r_texture_dds_load_logfailure = {0, "r_texture_dds_load_logfailure", "0",
 cvar_t r_texture_dds_load_etc1 = {0, "r_texture_dds_load_etc1", "0", "try load Ericsson Texture Compression (ETC1) compressed DDS files from etc1/ folder before trying default dds/ path, if supported by hardware"};
 cvar_t r_texture_dds_load_etc2 = {0, "r_texture_dds_load_etc2", "0", "try load Ericsson Texture Compression 2 (ETC2) compressed DDS files from etc2/ folder before trying default dds/ path, if supported by hardware"};
 cvar_t r_texture_dds_swdecode = {0, "r_texture_dds_swdecode", "0", "0: don't software decode DDS, 1: software decode DDS if unsupported, 2: always software decode DDS"};
+cvar_t r_texture_dds_build_threads = {CVAR_SAVE, "r_texture_dds_build_threads", "4", "number of threads used by r_texture_dds_build"};
 extern cvar_t r_texture_png_iccmode;
 extern cvar_t r_texture_jpeg_iccmode;
 extern cvar_t r_texture_tga_load_alphamode;
@@ -1037,6 +1042,7 @@ void R_Textures_Init (void)
 	Cvar_RegisterVariable (&r_texture_dds_load_etc1);
 	Cvar_RegisterVariable (&r_texture_dds_load_etc2);
 	Cvar_RegisterVariable (&r_texture_dds_swdecode);
+	R_Textures_InitCommands();
 	Cvar_RegisterVariable (&r_texture_png_iccmode);
 	Cvar_RegisterVariable (&r_texture_jpeg_iccmode);
 	Cvar_RegisterVariable (&r_texture_tga_load_alphamode);
@@ -2249,6 +2255,391 @@ int R_SaveTextureDDSFile(rtexture_t *rt, const char *filename, qboolean skipunco
 #endif
 }
 
+// CPU DXT1/DXT5 block encoder used by r_texture_dds_build, this is the
+// bounding box method with an inset (as in J.M.P. van Waveren's "Real-Time
+// DXT Compression"), quality is a little below the driver compressors but it
+// needs no GL context so the dds cache can be built on a dedicated server
+
+#define DDSBUILD_MAXTHREADS 32
+
+// pack 8 bit BGR into 565
+#define DXT_565(c) ((((c)[2] >> 3) << 11) | (((c)[1] >> 2) << 5) | ((c)[0] >> 3))
+
+static void R_DXT_GetMinMaxColors(const unsigned char *block, unsigned char *mincolor, unsigned char *maxcolor)
+{
+	int i, inset;
+#ifdef SSE2_PRESENT
+	__m128i p0 = _mm_loadu_si128((const __m128i *)block);
+	__m128i p1 = _mm_loadu_si128((const __m128i *)(block + 16));
+	__m128i p2 = _mm_loadu_si128((const __m128i *)(block + 32));
+	__m128i p3 = _mm_loadu_si128((const __m128i *)(block + 48));
+	__m128i mn = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+	__m128i mx = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+	// fold the 4 remaining pixels into one
+	mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+	mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+	mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+	mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+	*(int *)mincolor = _mm_cvtsi128_si32(mn);
+	*(int *)maxcolor = _mm_cvtsi128_si32(mx);
+#else
+	mincolor[0] = mincolor[1] = mincolor[2] = mincolor[3] = 255;
+	maxcolor[0] = maxcolor[1] = maxcolor[2] = maxcolor[3] = 0;
+	for (i = 0;i < 16;i++, block += 4)
+	{
+		mincolor[0] = min(mincolor[0], block[0]);maxcolor[0] = max(maxcolor[0], block[0]);
+		mincolor[1] = min(mincolor[1], block[1]);maxcolor[1] = max(maxcolor[1], block[1]);
+		mincolor[2] = min(mincolor[2], block[2]);maxcolor[2] = max(maxcolor[2], block[2]);
+		mincolor[3] = min(mincolor[3], block[3]);maxcolor[3] = max(maxcolor[3], block[3]);
+	}
+#endif
+	// pull the ends in a little, this reduces the error for the middle
+	// values which most pixels use
+	for (i = 0;i < 3;i++)
+	{
+		inset = (maxcolor[i] - mincolor[i]) >> 4;
+		mincolor[i] = (unsigned char)min(255, mincolor[i] + inset);
+		maxcolor[i] = (unsigned char)max(0, maxcolor[i] - inset);
+	}
+}
+
+static void R_DXT_EmitColorBlock(const unsigned char *block, const unsigned char *mincolor, const unsigned char *maxcolor, unsigned char *out)
+{
+	int i, j, c0, c1, best, bestdist, dist, d;
+	unsigned int indices = 0;
+	int palette[4][3];
+
+	c0 = DXT_565(maxcolor);
+	c1 = DXT_565(mincolor);
+	if (c0 < c1)
+	{
+		i = c0;c0 = c1;c1 = i;
+	}
+	out[0] = (unsigned char)(c0 & 0xFF);
+	out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xFF);
+	out[3] = (unsigned char)(c1 >> 8);
+	if (c0 != c1)
+	{
+		// expand back to 8 bits the way the hardware does
+		palette[0][0] = ((c0      ) & 0x1F) * 255 / 31;
+		palette[0][1] = ((c0 >>  5) & 0x3F) * 255 / 63;
+		palette[0][2] = ((c0 >> 11) & 0x1F) * 255 / 31;
+		palette[1][0] = ((c1      ) & 0x1F) * 255 / 31;
+		palette[1][1] = ((c1 >>  5) & 0x3F) * 255 / 63;
+		palette[1][2] = ((c1 >> 11) & 0x1F) * 255 / 31;
+		for (j = 0;j < 3;j++)
+		{
+			palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+			palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+		}
+		for (i = 0;i < 16;i++, block += 4)
+		{
+			best = 0;
+			bestdist = 0x7FFFFFFF;
+			for (j = 0;j < 4;j++)
+			{
+				d = block[0] - palette[j][0];dist  = d * d;
+				d = block[1] - palette[j][1];dist += d * d;
+				d = block[2] - palette[j][2];dist += d * d;
+				if (bestdist > dist)
+				{
+					bestdist = dist;
+					best = j;
+				}
+			}
+			indices |= (unsigned int)best << (i * 2);
+		}
+	}
+	StoreLittleLong(out + 4, indices);
+}
+
+static void R_DXT_EmitAlphaBlock(const unsigned char *block, int minalpha, int maxalpha, unsigned char *out)
+{
+	int i, j, best, bestdist, dist;
+	int palette[8];
+	unsigned int bits = 0;
+	int numbits = 0;
+	unsigned char *bitout = out + 2;
+
+	out[0] = (unsigned char)maxalpha;
+	out[1] = (unsigned char)minalpha;
+	memset(bitout, 0, 6);
+	if (maxalpha == minalpha)
+		return;
+	palette[0] = maxalpha;
+	palette[1] = minalpha;
+	for (j = 1;j < 7;j++)
+		palette[j + 1] = ((7 - j) * maxalpha + j * minalpha) / 7;
+	for (i = 0;i < 16;i++)
+	{
+		best = 0;
+		bestdist = 256;
+		for (j = 0;j < 8;j++)
+		{
+			dist = abs(block[i * 4 + 3] - palette[j]);
+			if (bestdist > dist)
+			{
+				bestdist = dist;
+				best = j;
+			}
+		}
+		// 3 bit indices packed little endian into 6 bytes
+		bits |= (unsigned int)best << numbits;
+		numbits += 3;
+		while (numbits >= 8)
+		{
+			*bitout++ = (unsigned char)(bits & 0xFF);
+			bits >>= 8;
+			numbits -= 8;
+		}
+	}
+}
+
+// encodes one BGRA image into DXT1 (bytesperblock 8) or DXT5 (16) blocks,
+// partial blocks at the edges repeat the last row/column
+static void R_DXT_CompressImage(const unsigned char *pixels, int width, int height, int bytesperblock, unsigned char *out)
+{
+	int bx, by, x, y, sx, sy;
+	unsigned char block[64];
+	unsigned char mincolor[4], maxcolor[4];
+	for (by = 0;by < height;by += 4)
+	{
+		for (bx = 0;bx < width;bx += 4, out += bytesperblock)
+		{
+			for (y = 0;y < 4;y++)
+			{
+				sy = min(by + y, height - 1);
+				for (x = 0;x < 4;x++)
+				{
+					sx = min(bx + x, width - 1);
+					memcpy(block + (y * 4 + x) * 4, pixels + (sy * width + sx) * 4, 4);
+				}
+			}
+			R_DXT_GetMinMaxColors(block, mincolor, maxcolor);
+			if (bytesperblock == 16)
+			{
+				R_DXT_EmitAlphaBlock(block, mincolor[3], maxcolor[3], out);
+				R_DXT_EmitColorBlock(block, mincolor, maxcolor, out + 8);
+			}
+			else
+				R_DXT_EmitColorBlock(block, mincolor, maxcolor, out);
+		}
+	}
+}
+
+// writes dds/<name>.dds for one image with a full mip chain, returns the
+// size of the file or 0 if the image could not be loaded
+static int R_BuildDDSFile(const char *name, void *writemutex)
+{
+	int i, mip, mipmaps, width, height, depth, ddssize, bytesperblock;
+	int mipinfo[16][4];
+	qboolean hasalpha = false;
+	qboolean sRGBcolorspace;
+	unsigned char *pixels, *dds;
+	char vabuf[1024];
+	qboolean ret;
+
+	if (!(pixels = loadimagepixelsbgra_threaded(name, false, false, false, &sRGBcolorspace, NULL)))
+		return 0;
+	width = image_width;
+	height = image_height;
+	for (i = 3;i < width * height * 4;i += 4)
+	{
+		if (pixels[i] < 255)
+		{
+			hasalpha = true;
+			break;
+		}
+	}
+	bytesperblock = hasalpha ? 16 : 8;
+
+	// same mip layout as R_SaveTextureDDSFile
+	memset(mipinfo, 0, sizeof(mipinfo));
+	mipinfo[0][0] = width;
+	mipinfo[0][1] = height;
+	for (mip = 1;mip < 16 && (mipinfo[mip-1][0] > 1 || mipinfo[mip-1][1] > 1);mip++)
+	{
+		mipinfo[mip][0] = mipinfo[mip-1][0] > 1 ? mipinfo[mip-1][0] >> 1 : 1;
+		mipinfo[mip][1] = mipinfo[mip-1][1] > 1 ? mipinfo[mip-1][1] >> 1 : 1;
+	}
+	mipmaps = mip;
+	ddssize = 128;
+	for (mip = 0;mip < mipmaps;mip++)
+	{
+		mipinfo[mip][2] = ((mipinfo[mip][0]+3)/4)*((mipinfo[mip][1]+3)/4)*bytesperblock;
+		mipinfo[mip][3] = ddssize;
+		ddssize += mipinfo[mip][2];
+	}
+	dds = (unsigned char *)Mem_Alloc(tempmempool, ddssize);
+	memcpy(dds, "DDS ", 4);
+	StoreLittleLong(dds+4, 124);
+	StoreLittleLong(dds+8, 0xA1007); // DDSD_CAPS | DDSD_PIXELFORMAT | DDSD_WIDTH | DDSD_HEIGHT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE
+	StoreLittleLong(dds+12, height);
+	StoreLittleLong(dds+16, width);
+	StoreLittleLong(dds+20, mipinfo[0][2]); // linear size
+	StoreLittleLong(dds+28, mipmaps);
+	StoreLittleLong(dds+76, 32); // format size
+	StoreLittleLong(dds+80, hasalpha ? 0x5 : 0x4); // DDPF_FOURCC, DDPF_ALPHAPIXELS
+	memcpy(dds+84, hasalpha ? "DXT5" : "DXT1", 4);
+	StoreLittleLong(dds+108, 0x401008); // DDSCAPS_TEXTURE | DDSCAPS_MIPMAP | DDSCAPS_COMPLEX
+
+	// the mips are built in place, each one from the previous
+	for (mip = 0;mip < mipmaps;mip++)
+	{
+		if (mip)
+		{
+			depth = 1;
+			Image_MipReduce32(pixels, pixels, &width, &height, &depth, 1, 1, 1);
+		}
+		R_DXT_CompressImage(pixels, mipinfo[mip][0], mipinfo[mip][1], bytesperblock, dds + mipinfo[mip][3]);
+	}
+	Mem_Free(pixels);
+
+	if (writemutex) Thread_LockMutex(writemutex);
+	ret = FS_WriteFile(va(vabuf, sizeof(vabuf), "dds/%s.dds", name), dds, ddssize);
+	if (writemutex) Thread_UnlockMutex(writemutex);
+	Mem_Free(dds);
+	return ret ? ddssize : 0;
+}
+
+typedef struct ddsbuild_s
+{
+	void *mutex;
+	char **names;
+	int numnames;
+	int nextname;
+	int numwritten;
+	double byteswritten;
+}
+ddsbuild_t;
+
+static int R_BuildDDSCache_Thread(void *data)
+{
+	ddsbuild_t *build = (ddsbuild_t *)data;
+	int i, size;
+	for (;;)
+	{
+		if (build->mutex) Thread_LockMutex(build->mutex);
+		i = build->nextname++;
+		if (build->mutex) Thread_UnlockMutex(build->mutex);
+		if (i >= build->numnames)
+			break;
+		size = R_BuildDDSFile(build->names[i], build->mutex);
+		if (build->mutex) Thread_LockMutex(build->mutex);
+		if (size)
+		{
+			build->numwritten++;
+			build->byteswritten += size;
+		}
+		else
+			Con_Printf("r_texture_dds_build: could not load %s\n", build->names[i]);
+		if (build->mutex) Thread_UnlockMutex(build->mutex);
+	}
+	return 0;
+}
+
+static int R_BuildDDSCache_SortNames(const void *a, const void *b)
+{
+	return strcmp(*(char **)a, *(char **)b);
+}
+
+static void R_BuildDDSCache_f(void)
+{
+	static const char *defaultpatterns[] = {"textures/*", "textures/*/*", "textures/*/*/*", "models/*", "models/*/*", "models/*/*/*", "progs/*", NULL};
+	int i, j, argi, numthreads, maxnames;
+	qboolean force = false;
+	const char *ext;
+	const char *pattern;
+	fssearch_t *search;
+	ddsbuild_t build;
+	void *threads[DDSBUILD_MAXTHREADS];
+	char basename[MAX_QPATH];
+	char vabuf[1024];
+	double starttime = Sys_DirtyTime();
+
+	argi = 1;
+	if (Cmd_Argc() > argi && !strcmp(Cmd_Argv(argi), "force"))
+	{
+		force = true;
+		argi++;
+	}
+
+	// the image libraries are normally opened by the renderer
+	JPEG_OpenLibrary();
+	PNG_OpenLibrary();
+
+	// gather the base names of every image, one entry per texture even if
+	// it exists in several formats
+	memset(&build, 0, sizeof(build));
+	maxnames = 0;
+	for (i = 0;;i++)
+	{
+		pattern = Cmd_Argc() > argi ? (argi + i < Cmd_Argc() ? Cmd_Argv(argi + i) : NULL) : defaultpatterns[i];
+		if (!pattern)
+			break;
+		if (!(search = FS_Search(pattern, true, true)))
+			continue;
+		for (j = 0;j < search->numfilenames;j++)
+		{
+			ext = FS_FileExtension(search->filenames[j]);
+			if (strcasecmp(ext, "tga") && strcasecmp(ext, "png") && strcasecmp(ext, "jpg") && strcasecmp(ext, "pcx"))
+				continue;
+			Image_StripImageExtension(search->filenames[j], basename, sizeof(basename));
+			// the jpeg alpha companions are merged in by the image loader
+			if (strlen(basename) > 6 && !strcmp(basename + strlen(basename) - 6, "_alpha"))
+				continue;
+			if (!force && FS_FileExists(va(vabuf, sizeof(vabuf), "dds/%s.dds", basename)))
+				continue;
+			if (build.numnames >= maxnames)
+			{
+				maxnames = max(1024, maxnames * 2);
+				build.names = (char **)Mem_Realloc(tempmempool, build.names, maxnames * sizeof(char *));
+			}
+			build.names[build.numnames++] = Mem_strdup(tempmempool, basename);
+		}
+		FS_FreeSearch(search);
+	}
+	if (build.numnames)
+		qsort(build.names, build.numnames, sizeof(char *), R_BuildDDSCache_SortNames);
+	for (i = 0, j = 0;i < build.numnames;i++)
+	{
+		if (j && !strcmp(build.names[j-1], build.names[i]))
+			Mem_Free(build.names[i]);
+		else
+			build.names[j++] = build.names[i];
+	}
+	build.numnames = j;
+	Con_Printf("r_texture_dds_build: %i textures to compress\n", build.numnames);
+
+	numthreads = Thread_HasThreads() ? bound(1, r_texture_dds_build_threads.integer, DDSBUILD_MAXTHREADS) : 1;
+	if (numthreads > 1)
+	{
+		build.mutex = Thread_CreateMutex();
+		for (i = 0;i < numthreads;i++)
+			threads[i] = Thread_CreateThread(R_BuildDDSCache_Thread, &build);
+		for (i = 0;i < numthreads;i++)
+			if (threads[i])
+				Thread_WaitThread(threads[i], 0);
+		Thread_DestroyMutex(build.mutex);
+	}
+	// also picks up anything left if a thread could not be created
+	build.mutex = NULL;
+	R_BuildDDSCache_Thread(&build);
+
+	for (i = 0;i < build.numnames;i++)
+		Mem_Free(build.names[i]);
+	if (build.names)
+		Mem_Free(build.names);
+	Con_Printf("r_texture_dds_build: wrote %i dds files (%.3fMB) in %.1f seconds using %i threads\n", build.numwritten, build.byteswritten / 1048576.0, Sys_DirtyTime() - starttime, numthreads);
+}
+
+void R_Textures_InitCommands(void)
+{
+	Cvar_RegisterVariable (&r_texture_dds_build_threads);
+	Cmd_AddCommand("r_texture_dds_build", R_BuildDDSCache_f, "compress the game's textures (default textures/, models/ and progs/, or the given search patterns) into dds/*.dds with full mipmaps on the cpu, does not need a renderer so it can be run on a dedicated server; skips textures that already have a dds file unless the first argument is force");
+}
+
 #ifdef __ANDROID__
 // ELUAN: FIXME: separate this code
 #include "ktx10/include/ktx.h"
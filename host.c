@@ -1064,6 +1064,7 @@ void Host_Main(void)
 		if (developer_memorydebug.integer)
 			Mem_CheckSentinelsGlobal();
 #endif
+		Mem_EndFrame();
 
 		// if there is some time remaining from this frame, reset the timers
 		if (cl_timer >= 0)
@@ -1281,7 +1282,11 @@ static void Host_Init (void)
 	Thread_Init();
 
 	if (cls.state == ca_dedicated)
+	{
 		Cmd_AddCommand ("disconnect", CL_Disconnect_f, "disconnect from server (or disconnect all clients if running a server)");
+		// the dds cache can be built without a renderer
+		R_Textures_InitCommands();
+	}
 	else
 	{
 		Con_DPrintf("Initializing client\n");
@@ -956,6 +956,7 @@ static void Host_Loadgame_f (void)
 				PRVM_MEM_IncreaseEdicts(prog);
 			ent = PRVM_EDICT_NUM(entnum);
 			memset(ent->fields.fp, 0, prog->entityfields * sizeof(prvm_vec_t));
+			PRVM_FindIndex_Touch(prog, entnum);
 			ent->priv.server->free = false;
 
 			if(developer_entityparsing.integer)
@@ -998,6 +999,8 @@ static void Host_Loadgame_f (void)
 			memset(sv.lightstyles[0], 0, sizeof(sv.lightstyles));
 			memset(sv.model_precache[0], 0, sizeof(sv.model_precache));
 			memset(sv.sound_precache[0], 0, sizeof(sv.sound_precache));
+			memset(sv.model_precachehash, 0, sizeof(sv.model_precachehash));
+			memset(sv.sound_precachehash, 0, sizeof(sv.sound_precachehash));
 			BufStr_Flush(prog);
 
 			while (COM_ParseToken_Simple(&t, false, false, true))
@@ -1020,6 +1023,9 @@ static void Host_Loadgame_f (void)
 					if (i >= 0 && i < MAX_MODELS)
 					{
 						strlcpy(sv.model_precache[i], com_token, sizeof(sv.model_precache[i]));
+						// SV_ModelIndex does not look up the world model (slot 1)
+						if (i >= 2 && sv.model_precache[i][0])
+							SV_PrecacheHash_Link(sv.model_precachehash, sv.model_precachenext, sv.model_precache, i);
 						sv.models[i] = Mod_ForName (sv.model_precache[i], true, false, sv.model_precache[i][0] == '*' ? sv.worldname : NULL);
 					}
 					else
@@ -1031,7 +1037,11 @@ static void Host_Loadgame_f (void)
 					i = atoi(com_token);
 					COM_ParseToken_Simple(&t, false, false, true);
 					if (i >= 0 && i < MAX_SOUNDS)
+					{
 						strlcpy(sv.sound_precache[i], com_token, sizeof(sv.sound_precache[i]));
+						if (i >= 1 && sv.sound_precache[i][0])
+							SV_PrecacheHash_Link(sv.sound_precachehash, sv.sound_precachenext, sv.sound_precache, i);
+					}
 					else
 						Con_Printf("unsupported sound %i \"%s\"\n", i, com_token);
 				}
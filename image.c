@@ -5,8 +5,9 @@
 #include "image_png.h"
 #include "r_shadow.h"
 
-int		image_width;
-int		image_height;
+// per thread, see loadimagepixelsbgra_threaded
+THREAD_LOCAL int	image_width;
+THREAD_LOCAL int	image_height;
 
 static void Image_CopyAlphaFromBlueBGRA(unsigned char *outpixels, const unsigned char *inpixels, int w, int h)
 {
@@ -963,7 +964,7 @@ imageformat_t imageformats_other[] =
 };
 
 int fixtransparentpixels(unsigned char *data, int w, int h);
-unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel)
+static unsigned char *loadimagepixelsbgra_internal (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel, qboolean mainthread)
 {
 	fs_offset_t filesize;
 	imageformat_t *firstformat, *format;
@@ -973,7 +974,7 @@ unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qbo
 
 	//if (developer_memorydebug.integer)
 	//	Mem_CheckSentinelsGlobal();
-	if (developer_texturelogging.integer)
+	if (developer_texturelogging.integer && mainthread)
 		Log_Printf("textures.log", "%s\n", filename);
 	Image_StripImageExtension(filename, basename, sizeof(basename)); // strip filename extensions to allow replacement by other types
 	// replace *'s with #, so commandline utils don't get confused when dealing with the external files
@@ -1081,13 +1082,122 @@ unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qbo
 	}
 
 	// texture loading can take a while, so make sure we're sending keepalives
-	CL_KeepaliveMessage(false);
+	if (mainthread)
+		CL_KeepaliveMessage(false);
 
 	//if (developer_memorydebug.integer)
 	//	Mem_CheckSentinelsGlobal();
 	return NULL;
 }
 
+unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel)
+{
+	return loadimagepixelsbgra_internal(filename, complain, allowFixtrans, convertsRGB, sRGBcolorspace, miplevel, true);
+}
+
+unsigned char *loadimagepixelsbgra_threaded (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel)
+{
+	return loadimagepixelsbgra_internal(filename, complain, allowFixtrans, convertsRGB, sRGBcolorspace, miplevel, false);
+}
+
+// looks at the header of an image file to tell whether decoding it could
+// give any transparent pixels, formats that can't rule it out cheaply say yes
+static qboolean Image_FileMayHaveAlpha (const char *name, const imageformat_t *format, const char *basename)
+{
+	qfile_t *file;
+	unsigned char header[33];
+	unsigned char chunk[8];
+	qboolean mayhavealpha = true;
+	char name2[MAX_QPATH];
+	char vabuf[1024];
+
+	if (format->loadfunc == JPEG_LoadImage_BGRA)
+	{
+		// jpeg has no alpha, unless loadimagepixelsbgra finds an _alpha image
+		dpsnprintf (name2, sizeof(name2), format->formatstring, va(vabuf, sizeof(vabuf), "%s_alpha", basename));
+		return FS_FileExists(name2);
+	}
+	if (format->loadfunc != LoadTGA_BGRA && format->loadfunc != PNG_LoadImage_BGRA)
+		return true;
+	file = FS_OpenVirtualFile(name, true);
+	if (!file)
+		return true;
+	if (format->loadfunc == LoadTGA_BGRA)
+	{
+		// opaque unless it has 32bit pixels, alpha bits or a 32bit colormap
+		if (FS_Read(file, header, 18) == 18)
+			mayhavealpha = header[16] == 32 || (header[17] & 0x0F) || (header[1] && header[7] == 32);
+	}
+	else
+	{
+		// png color types 0 (grey) and 2 (rgb) have no alpha channel, but a
+		// tRNS chunk before the image data still makes a color transparent
+		if (FS_Read(file, header, 33) == 33 && !memcmp(header + 12, "IHDR", 4) && (header[25] == 0 || header[25] == 2))
+		{
+			mayhavealpha = false;
+			while (FS_Read(file, chunk, 8) == 8)
+			{
+				if (!memcmp(chunk + 4, "tRNS", 4))
+				{
+					mayhavealpha = true;
+					break;
+				}
+				if (!memcmp(chunk + 4, "IDAT", 4) || !memcmp(chunk + 4, "IEND", 4))
+					break;
+				// skip the chunk data and its crc
+				if (FS_Seek(file, ((chunk[0] << 24) | (chunk[1] << 16) | (chunk[2] << 8) | chunk[3]) + 4, SEEK_CUR))
+				{
+					mayhavealpha = true;
+					break;
+				}
+			}
+		}
+	}
+	FS_Close(file);
+	return mayhavealpha;
+}
+
+qboolean Image_FileExists (const char *filename, qboolean *mayhavealpha)
+{
+	imageformat_t *firstformat, *format;
+	char basename[MAX_QPATH], name[MAX_QPATH], *c;
+
+	// same search as loadimagepixelsbgra, without reading anything
+	Image_StripImageExtension(filename, basename, sizeof(basename));
+	for (c = basename;*c;c++)
+		if (*c == '*')
+			*c = '#';
+	name[0] = 0;
+	if (strchr(basename, '/'))
+	{
+		int i;
+		for (i = 0;i < (int)sizeof(name)-1 && basename[i] != '/';i++)
+			name[i] = basename[i];
+		name[i] = 0;
+	}
+	if (gamemode == GAME_TENEBRAE)
+		firstformat = imageformats_tenebrae;
+	else if (!strcasecmp(name, "textures"))
+		firstformat = imageformats_textures;
+	else if (!strcasecmp(name, "gfx"))
+		firstformat = imageformats_gfx;
+	else if (!strchr(basename, '/'))
+		firstformat = imageformats_nopath;
+	else
+		firstformat = imageformats_other;
+	for (format = firstformat;format->formatstring;format++)
+	{
+		dpsnprintf (name, sizeof(name), format->formatstring, basename);
+		if (FS_FileExists(name))
+		{
+			if (mayhavealpha)
+				*mayhavealpha = Image_FileMayHaveAlpha(name, format, basename);
+			return true;
+		}
+	}
+	return false;
+}
+
 extern cvar_t gl_picmip;
 rtexture_t *loadtextureimage (rtexturepool_t *pool, const char *filename, qboolean complain, int flags, qboolean allowFixtrans, qboolean force_sRGB)
 {
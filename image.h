@@ -2,7 +2,8 @@
 #ifndef IMAGE_H
 #define IMAGE_H
 
-extern int image_width, image_height;
+// per thread, so the values seen after a load are always from that load
+extern THREAD_LOCAL int image_width, image_height;
 
 
 // swizzle components (even converting number of components) and flip images
@@ -25,6 +26,15 @@ unsigned char *LoadTGA_BGRA (const unsigned char *f, int filesize, int *miplevel
 // loads a texture, as pixel data
 unsigned char *loadimagepixelsbgra (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel);
 
+// same as loadimagepixelsbgra but safe to call from a loader thread (no
+// keepalives or texture logging)
+unsigned char *loadimagepixelsbgra_threaded (const char *filename, qboolean complain, qboolean allowFixtrans, qboolean convertsRGB, qboolean *sRGBcolorspace, int *miplevel);
+
+// returns true if loadimagepixelsbgra would find a file for this name,
+// mayhavealpha (if not NULL) is set to false only when the file header shows
+// the decoded image will be fully opaque
+qboolean Image_FileExists (const char *filename, qboolean *mayhavealpha);
+
 // loads an 8bit pcx image into a 296x194x8bit buffer, with cropping as needed
 qboolean LoadPCX_QWSkin(const unsigned char *f, int filesize, unsigned char *pixels, int outwidth, int outheight);
 
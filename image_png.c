@@ -244,7 +244,8 @@ void PNG_CloseLibrary (void)
 #define PNG_INFO_sRGB 0x0800
 
 // this struct is only used for status information during loading
-static struct
+// (per thread so that skins can be decoded on the loader thread)
+static THREAD_LOCAL struct
 {
 	const unsigned char	*tmpBuf;
 	int		tmpBuflength;
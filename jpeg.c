@@ -473,8 +473,9 @@ qboolean jpeg_tried_loading = 0;
 #endif
 
 static unsigned char jpeg_eoi_marker [2] = {0xFF, JPEG_EOI};
-static jmp_buf error_in_jpeg;
-static qboolean jpeg_toolarge;
+// per thread so that skins can be decoded on the loader thread
+static THREAD_LOCAL jmp_buf error_in_jpeg;
+static THREAD_LOCAL qboolean jpeg_toolarge;
 
 // Our own output manager for JPEG compression
 typedef struct
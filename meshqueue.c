@@ -4,33 +4,81 @@
 
 typedef struct meshqueue_s
 {
-	struct meshqueue_s *next;
 	void (*callback)(const entity_render_t *ent, const rtlight_t *rtlight, int numsurfaces, int *surfaceindices, qboolean depthonly);
 	const entity_render_t *ent;
 	int surfacenumber;
 	const rtlight_t *rtlight;
 	float dist;
 	dptransparentsortcategory_t category;
+	int callbackindex;
 }
 meshqueue_t;
 
-int trans_sortarraysize;
-meshqueue_t **trans_hash = NULL;
-meshqueue_t ***trans_hashpointer = NULL;
+// sort key for one queued mesh, sorted ascending with a stable LSD radix
+// sort so that meshes with equal keys keep their submission order
+//
+// bits 56-63: unused
+// bits 48-55: category order (sky first, then distance, then hud)
+// bits 32-47: unused
+// bits 16-31: depth layer, inverted so that farther meshes come first
+// bits  8-15: unused
+// bits  0-7 : callback index, groups identical callbacks within a layer
+typedef struct meshqueuesort_s
+{
+	unsigned long long key;
+	int index;
+}
+meshqueuesort_t;
+
+#define MESHQUEUE_KEY_CATEGORY_SHIFT 48
+#define MESHQUEUE_KEY_DEPTH_SHIFT 16
+#define MESHQUEUE_KEY_CALLBACK_SHIFT 0
+#define MESHQUEUE_KEY_BYTES 8
+#define MESHQUEUE_MAXCALLBACKS 256
 
 float mqt_viewplanedist;
 float mqt_viewmaxdist;
 meshqueue_t *mqt_array;
+meshqueuesort_t *mqt_sort;
+meshqueuesort_t *mqt_sorttemp;
 int mqt_count;
 int mqt_total;
 
+// callbacks seen this frame, the index becomes part of the sort key
+static void (*mqt_callbacks[MESHQUEUE_MAXCALLBACKS])(const entity_render_t *ent, const rtlight_t *rtlight, int numsurfaces, int *surfaceindices, qboolean depthonly);
+static int mqt_numcallbacks;
+static int mqt_lastcallbackindex;
+
 void R_MeshQueue_BeginScene(void)
 {
 	mqt_count = 0;
+	mqt_numcallbacks = 0;
+	mqt_lastcallbackindex = 0;
 	mqt_viewplanedist = DotProduct(r_refdef.view.origin, r_refdef.view.forward);
 	mqt_viewmaxdist = 0;
 }
 
+static int R_MeshQueue_CallbackIndex(void (*callback)(const entity_render_t *ent, const rtlight_t *rtlight, int numsurfaces, int *surfaceindices, qboolean depthonly))
+{
+	int i;
+	// consecutive submissions almost always share a callback
+	if (mqt_lastcallbackindex < mqt_numcallbacks && mqt_callbacks[mqt_lastcallbackindex] == callback)
+		return mqt_lastcallbackindex;
+	for (i = 0;i < mqt_numcallbacks;i++)
+		if (mqt_callbacks[i] == callback)
+			break;
+	if (i == mqt_numcallbacks)
+	{
+		// if the table is full the remaining callbacks share the last
+		// index and are simply drawn in submission order
+		if (mqt_numcallbacks >= MESHQUEUE_MAXCALLBACKS)
+			return MESHQUEUE_MAXCALLBACKS - 1;
+		mqt_callbacks[mqt_numcallbacks++] = callback;
+	}
+	mqt_lastcallbackindex = i;
+	return i;
+}
+
 void R_MeshQueue_AddTransparent(dptransparentsortcategory_t category, const vec3_t center, void (*callback)(const entity_render_t *ent, const rtlight_t *rtlight, int numsurfaces, int *surfacelist, qboolean depthonly), const entity_render_t *ent, int surfacenumber, const rtlight_t *rtlight)
 {
 	meshqueue_t *mq;
@@ -45,9 +93,16 @@ void R_MeshQueue_AddTransparent(dptransparentsortcategory_t category, const vec3
 		}
 		mqt_array = newarray;
 		mqt_total = newtotal;
+		// the sort arrays are only used in R_MeshQueue_RenderTransparent
+		// so they don't need their contents preserved
+		if (mqt_sort)
+			Mem_Free(mqt_sort);
+		mqt_sort = (meshqueuesort_t *)Mem_Alloc(cls.permanentmempool, newtotal * sizeof(meshqueuesort_t) * 2);
+		mqt_sorttemp = mqt_sort + newtotal;
 	}
 	mq = &mqt_array[mqt_count++];
 	mq->callback = callback;
+	mq->callbackindex = R_MeshQueue_CallbackIndex(callback);
 	mq->ent = ent;
 	mq->surfacenumber = surfacenumber;
 	mq->rtlight = rtlight;
@@ -56,13 +111,51 @@ void R_MeshQueue_AddTransparent(dptransparentsortcategory_t category, const vec3
 		mq->dist = DotProduct(center, r_refdef.view.forward) - mqt_viewplanedist;
 	else
 		mq->dist = VectorDistance(center, r_refdef.view.origin);
-	mq->next = NULL;
 	mqt_viewmaxdist = max(mqt_viewmaxdist, mq->dist);
 }
 
+// stable LSD radix sort of mqt_sort by key, one byte per pass, passes where
+// every key has the same byte are skipped (which is most of them)
+static void R_MeshQueue_SortTransparent(void)
+{
+	int i, pass, sum, count;
+	int counts[MESHQUEUE_KEY_BYTES][256];
+	meshqueuesort_t *in, *out, *swap;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0;i < mqt_count;i++)
+	{
+		unsigned long long key = mqt_sort[i].key;
+		for (pass = 0;pass < MESHQUEUE_KEY_BYTES;pass++)
+			counts[pass][(key >> (pass * 8)) & 0xFF]++;
+	}
+
+	in = mqt_sort;
+	out = mqt_sorttemp;
+	for (pass = 0;pass < MESHQUEUE_KEY_BYTES;pass++)
+	{
+		int *c = counts[pass];
+		int shift = pass * 8;
+		if (c[(in[0].key >> shift) & 0xFF] == mqt_count)
+			continue;
+		for (i = 0, sum = 0;i < 256;i++)
+		{
+			count = c[i];
+			c[i] = sum;
+			sum += count;
+		}
+		for (i = 0;i < mqt_count;i++)
+			out[c[(in[i].key >> shift) & 0xFF]++] = in[i];
+		swap = in;in = out;out = swap;
+	}
+	// make sure the result ends up in mqt_sort
+	if (in != mqt_sort)
+		memcpy(mqt_sort, in, mqt_count * sizeof(meshqueuesort_t));
+}
+
 void R_MeshQueue_RenderTransparent(qboolean depthonly)
 {
-	int i, hashindex, maxhashindex, batchnumsurfaces;
+	int i, layer, maxlayer, category, batchnumsurfaces;
 	float distscale;
 	const entity_render_t *ent;
 	const rtlight_t *rtlight;
@@ -81,69 +174,55 @@ void R_MeshQueue_RenderTransparent(qboolean depthonly)
 	if (r_transparent_sortmaxdist.integer < r_transparent_sortmindist.integer || r_transparent_sortmaxdist.integer > 32768)
 		Cvar_SetValueQuick(&r_transparent_sortmaxdist, bound(r_transparent_sortmindist.integer, r_transparent_sortmaxdist.integer, 32768));
 
-	// update hash array
-	if (trans_sortarraysize != r_transparent_sortarraysize.integer)
-	{
-		trans_sortarraysize = r_transparent_sortarraysize.integer;
-		if (trans_hash)
-			Mem_Free(trans_hash);
-		trans_hash = (meshqueue_t **)Mem_Alloc(cls.permanentmempool, sizeof(meshqueue_t *) * trans_sortarraysize); 
-		if (trans_hashpointer)
-			Mem_Free(trans_hashpointer);
-		trans_hashpointer = (meshqueue_t ***)Mem_Alloc(cls.permanentmempool, sizeof(meshqueue_t **) * trans_sortarraysize); 
-	}
-
-	// build index
-	memset(trans_hash, 0, sizeof(meshqueue_t *) * trans_sortarraysize);
-	for (i = 0; i < trans_sortarraysize; i++)
-		trans_hashpointer[i] = &trans_hash[i];
-	distscale = (trans_sortarraysize - 1) / min(mqt_viewmaxdist, r_transparent_sortmaxdist.integer);
-	maxhashindex = trans_sortarraysize - 1;
+	// build sort keys
+	maxlayer = r_transparent_sortarraysize.integer - 1;
+	distscale = maxlayer / max(1.0f, min(mqt_viewmaxdist, r_transparent_sortmaxdist.integer));
 	for (i = 0, mqt = mqt_array; i < mqt_count; i++, mqt++)
 	{
 		switch(mqt->category)
 		{
 		default:
 		case TRANSPARENTSORT_HUD:
-			hashindex = 0;
+			category = 2;
+			layer = 0;
 			break;
 		case TRANSPARENTSORT_DISTANCE:
+			category = 1;
 			// this could use a reduced range if we need more categories
-			hashindex = bound(0, (int)(bound(0, mqt->dist - r_transparent_sortmindist.integer, r_transparent_sortmaxdist.integer) * distscale), maxhashindex);
+			layer = bound(0, (int)(bound(0, mqt->dist - r_transparent_sortmindist.integer, r_transparent_sortmaxdist.integer) * distscale), maxlayer);
 			break;
 		case TRANSPARENTSORT_SKY:
-			hashindex = maxhashindex;
+			category = 0;
+			layer = maxlayer;
 			break;
 		}
-		// link to tail of hash chain (to preserve render order)
-		mqt->next = NULL;
-		*trans_hashpointer[hashindex] = mqt;
-		trans_hashpointer[hashindex] = &mqt->next;
+		mqt_sort[i].key = ((unsigned long long)category << MESHQUEUE_KEY_CATEGORY_SHIFT)
+		                | ((unsigned long long)(maxlayer - layer) << MESHQUEUE_KEY_DEPTH_SHIFT)
+		                | ((unsigned long long)mqt->callbackindex << MESHQUEUE_KEY_CALLBACK_SHIFT);
+		mqt_sort[i].index = i;
 	}
+
+	R_MeshQueue_SortTransparent();
+
 	callback = NULL;
 	ent = NULL;
 	rtlight = NULL;
 	batchnumsurfaces = 0;
 
-	// draw
-	for (i = maxhashindex; i >= 0; i--)
+	// draw, merging runs of the same callback/entity/light into one call
+	for (i = 0; i < mqt_count; i++)
 	{
-		if (trans_hash[i])
+		mqt = mqt_array + mqt_sort[i].index;
+		if (ent != mqt->ent || rtlight != mqt->rtlight || callback != mqt->callback || batchnumsurfaces >= MESHQUEUE_TRANSPARENT_BATCHSIZE)
 		{
-			for (mqt = trans_hash[i]; mqt; mqt = mqt->next)
-			{
-				if (ent != mqt->ent || rtlight != mqt->rtlight || callback != mqt->callback || batchnumsurfaces >= MESHQUEUE_TRANSPARENT_BATCHSIZE)
-				{
-					if (batchnumsurfaces)
-						callback(ent, rtlight, batchnumsurfaces, batchsurfaceindex, depthonly);
-					batchnumsurfaces = 0;
-					ent = mqt->ent;
-					rtlight = mqt->rtlight;
-					callback = mqt->callback;
-				}
-				batchsurfaceindex[batchnumsurfaces++] = mqt->surfacenumber;
-			}
+			if (batchnumsurfaces)
+				callback(ent, rtlight, batchnumsurfaces, batchsurfaceindex, depthonly);
+			batchnumsurfaces = 0;
+			ent = mqt->ent;
+			rtlight = mqt->rtlight;
+			callback = mqt->callback;
 		}
+		batchsurfaceindex[batchnumsurfaces++] = mqt->surfacenumber;
 	}
 	if (batchnumsurfaces)
 		callback(ent, rtlight, batchnumsurfaces, batchsurfaceindex, depthonly);
@@ -30,6 +30,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 cvar_t mod_bsp_portalize = {0, "mod_bsp_portalize", "1", "enables portal generation from BSP tree (may take several seconds per map), used by r_drawportals, r_useportalculling, r_shadow_realtime_world_compileportalculling, sv_cullentities_portal"};
 cvar_t mod_bsp_createshadowmesh = {0, "mod_bsp_createshadowmesh", "1", "make a single combined shadow mesh of worldspawn (may take several seconds per map) to allow optimized shadow volume creation and shadowed surfaces culling for shadowmapped lights. A value of 2 will create shadowmesh but no neighbor triangles info (which is used by shadow volumes)."};
 cvar_t mod_bsp_qwchecksum = {0, "mod_bsp_qwchecksum", "1", "calculate checksums for maps (may take some miliseconds per map)."};
+cvar_t mod_bsp_cache = {CVAR_SAVE, "mod_bsp_cache", "0", "store generated Bounding Interval Hierarchy trees and shadow mesh triangle neighbors of maps in cache/ so later loads of the same map can skip building them, 2 = only read existing cache files"};
 cvar_t r_novis = {0, "r_novis", "0", "draws whole level, see also sv_cullentities_pvs 0"};
 cvar_t r_nosurftextures = {0, "r_nosurftextures", "0", "pretends there was no texture lump found in the q1bsp/hlbsp loading (useful for debugging this rare case)"};
 cvar_t r_subdivisions_tolerance = {0, "r_subdivisions_tolerance", "4", "maximum error tolerance on curve subdivision for rendering purposes (in other words, the curves will be given as many polygons as necessary to represent curves at this quality)"};
@@ -86,6 +87,7 @@ void Mod_BrushInit(void)
 	Cvar_RegisterVariable(&mod_bsp_portalize);
 	Cvar_RegisterVariable(&mod_bsp_createshadowmesh);
 	Cvar_RegisterVariable(&mod_bsp_qwchecksum);
+	Cvar_RegisterVariable(&mod_bsp_cache);
 	Cvar_RegisterVariable(&r_novis);
 	Cvar_RegisterVariable(&r_nosurftextures);
 	Cvar_RegisterVariable(&r_subdivisions_tolerance);
@@ -3793,6 +3795,113 @@ static void Mod_Q1BSP_RoundUpToHullSize(dp_model_t *cmodel, const vec3_t inmins,
 	VectorAdd(inmins, hull->clip_size, outmaxs);
 }
 
+/*
+=============
+BSP cache
+
+derived data that is slow to generate is stored in cache/<mapname>_<tag><index>.dat
+keyed on an md4 digest of the exact input it was built from, so any change to
+the map, shaders or cvars that alters the input simply misses the cache
+
+cache files are only read from the real gamedir (never from packs, which may
+have been downloaded), and everything they contain is range checked before use
+=============
+*/
+#define BSPCACHE_IDENT "DPBSPCA"
+#define BSPCACHE_VERSION 1
+#define BSPCACHE_HEADERSIZE 32
+
+static void Mod_BSPCache_FileName(char *filename, size_t filenamesize, const char *tag, int index)
+{
+	char basename[MAX_QPATH];
+	FS_StripExtension(loadmodel->name, basename, sizeof(basename));
+	dpsnprintf(filename, filenamesize, "cache/%s_%s%i.dat", basename, tag, index);
+}
+
+// returns data allocated from loadmodel->mempool, or NULL if there is no valid cache file
+static void *Mod_BSPCache_Load(const char *tag, int index, const void *input, size_t inputsize, size_t *outsize)
+{
+	char filename[MAX_QPATH];
+	char vabuf[MAX_OSPATH];
+	unsigned char digest[16];
+	unsigned char *filedata;
+	void *data;
+	fs_offset_t filesize;
+	size_t datasize;
+
+	*outsize = 0;
+	if (!mod_bsp_cache.integer || !input || !inputsize)
+		return NULL;
+	Mod_BSPCache_FileName(filename, sizeof(filename), tag, index);
+	// the same path FS_WriteFile stores to
+	filedata = FS_SysLoadFile(va(vabuf, sizeof(vabuf), "%s/%s", fs_gamedir, filename), tempmempool, true, &filesize);
+	if (!filedata)
+		return NULL;
+	Com_BlockFullChecksum((void *)input, (int)inputsize, digest);
+	if (filesize < BSPCACHE_HEADERSIZE
+	 || memcmp(filedata, BSPCACHE_IDENT, 8)
+	 || BuffLittleLong(filedata + 8) != BSPCACHE_VERSION
+	 || BuffLittleLong(filedata + 12) != (int)inputsize
+	 || memcmp(filedata + 16, digest, 16))
+	{
+		Con_DPrintf("%s: stale or invalid cache file %s\n", loadmodel->name, filename);
+		Mem_Free(filedata);
+		return NULL;
+	}
+	datasize = (size_t)(filesize - BSPCACHE_HEADERSIZE);
+	data = Mem_Alloc(loadmodel->mempool, max(datasize, (size_t)1));
+	memcpy(data, filedata + BSPCACHE_HEADERSIZE, datasize);
+	Mem_Free(filedata);
+	*outsize = datasize;
+	return data;
+}
+
+static void Mod_BSPCache_Save(const char *tag, int index, const void *input, size_t inputsize, const void *data, size_t datasize)
+{
+	char filename[MAX_QPATH];
+	unsigned char *filedata;
+
+	if (mod_bsp_cache.integer != 1 || !input || !inputsize)
+		return;
+	Mod_BSPCache_FileName(filename, sizeof(filename), tag, index);
+	filedata = (unsigned char *)Mem_Alloc(tempmempool, BSPCACHE_HEADERSIZE + datasize);
+	memcpy(filedata, BSPCACHE_IDENT, 8);
+	StoreLittleLong(filedata + 8, BSPCACHE_VERSION);
+	StoreLittleLong(filedata + 12, (unsigned int)inputsize);
+	Com_BlockFullChecksum((void *)input, (int)inputsize, filedata + 16);
+	memcpy(filedata + BSPCACHE_HEADERSIZE, data, datasize);
+	if (!FS_WriteFile(filename, filedata, (fs_offset_t)(BSPCACHE_HEADERSIZE + datasize)))
+		Con_DPrintf("%s: could not write cache file %s\n", loadmodel->name, filename);
+	Mem_Free(filedata);
+}
+
+static void Mod_BSPCache_BuildTriangleNeighbors(int index, int *neighbors, const int *elements, int numtriangles)
+{
+	size_t size = numtriangles * sizeof(int[3]);
+	size_t cachedsize;
+	int i;
+	int *cached = (int *)Mod_BSPCache_Load("neighbors", index, elements, size, &cachedsize);
+	if (cached)
+	{
+		if (cachedsize == size)
+		{
+			// -1 means no neighbor
+			for (i = 0;i < numtriangles * 3;i++)
+				if (cached[i] < -1 || cached[i] >= numtriangles)
+					break;
+			if (i == numtriangles * 3)
+			{
+				memcpy(neighbors, cached, size);
+				Mem_Free(cached);
+				return;
+			}
+		}
+		Mem_Free(cached);
+	}
+	Mod_BuildTriangleNeighbors(neighbors, elements, numtriangles);
+	Mod_BSPCache_Save("neighbors", index, elements, size, neighbors, size);
+}
+
 static int Mod_Q1BSP_CreateShadowMesh(dp_model_t *mod)
 {
 	int j;
@@ -3833,7 +3942,7 @@ static int Mod_Q1BSP_CreateShadowMesh(dp_model_t *mod)
 		mod->brush.shadowmesh = Mod_ShadowMesh_Finish(mod->mempool, mod->brush.shadowmesh, false, r_enableshadowvolumes.integer != 0, false);
 	}
 	if (mod->brush.shadowmesh && mod->brush.shadowmesh->neighbor3i && mod_bsp_createshadowmesh.integer < 2)
-		Mod_BuildTriangleNeighbors(mod->brush.shadowmesh->neighbor3i, mod->brush.shadowmesh->element3i, mod->brush.shadowmesh->numtriangles);
+		Mod_BSPCache_BuildTriangleNeighbors(0, mod->brush.shadowmesh->neighbor3i, mod->brush.shadowmesh->element3i, mod->brush.shadowmesh->numtriangles);
 	return numshadowmeshtriangles;
 }
 
@@ -3944,6 +4053,7 @@ void Mod_Q1BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->DrawDebug = R_Q1BSP_DrawDebug;
 	mod->DrawPrepass = R_Q1BSP_DrawPrepass;
 	mod->GetLightInfo = R_Q1BSP_GetLightInfo;
+	mod->CompileLightInfo = R_Q1BSP_CompileLightInfo;
 	mod->CompileShadowMap = R_Q1BSP_CompileShadowMap;
 	mod->DrawShadowMap = R_Q1BSP_DrawShadowMap;
 	mod->CompileShadowVolume = R_Q1BSP_CompileShadowVolume;
@@ -4926,6 +5036,7 @@ static void Mod_Q2BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->DrawDebug = R_Q1BSP_DrawDebug;
 	mod->DrawPrepass = R_Q1BSP_DrawPrepass;
 	mod->GetLightInfo = R_Q1BSP_GetLightInfo;
+	mod->CompileLightInfo = R_Q1BSP_CompileLightInfo;
 	mod->CompileShadowMap = R_Q1BSP_CompileShadowMap;
 	mod->DrawShadowMap = R_Q1BSP_DrawShadowMap;
 	mod->CompileShadowVolume = R_Q1BSP_CompileShadowVolume;
@@ -7768,6 +7879,90 @@ void Mod_CollisionBIH_TraceLineAgainstSurfaces(dp_model_t *model, const frameble
 }
 
 
+// header of a cached BIH tree, followed by the nodes
+typedef struct bspcache_bih_s
+{
+	float mins[3];
+	float maxs[3];
+	int rootnode;
+	int numnodes;
+	int nodesize;
+	int unused;
+}
+bspcache_bih_t;
+
+// the traversal code trusts the tree completely, so check every node: split
+// nodes must point at later nodes (this also rules out loops) and unordered
+// nodes at existing leafs
+static qboolean Mod_BSPCache_CheckBIHNodes(const bih_node_t *nodes, int numnodes, int numleafs)
+{
+	int i, j;
+	const bih_node_t *node;
+	for (i = 0, node = nodes;i < numnodes;i++, node++)
+	{
+		switch (node->type)
+		{
+		case BIH_SPLITX:
+		case BIH_SPLITY:
+		case BIH_SPLITZ:
+			if (node->front <= i || node->front >= numnodes || node->back <= i || node->back >= numnodes)
+				return false;
+			break;
+		case BIH_UNORDERED:
+			for (j = 0;j < BIH_MAXUNORDEREDCHILDREN && node->children[j] >= 0;j++)
+				if (node->children[j] >= numleafs)
+					return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+static qboolean Mod_BSPCache_LoadBIH(bih_t *out, const char *tag, int index, int numleafs, bih_leaf_t *leafs)
+{
+	size_t cachesize;
+	bspcache_bih_t *cache = (bspcache_bih_t *)Mod_BSPCache_Load(tag, index, leafs, numleafs * sizeof(bih_leaf_t), &cachesize);
+	if (!cache)
+		return false;
+	if (cachesize < sizeof(*cache) || cache->nodesize != (int)sizeof(bih_node_t) || cache->numnodes < 1 || cache->numnodes > numleafs + 1 || cachesize != sizeof(*cache) + cache->numnodes * sizeof(bih_node_t) || cache->rootnode < 0 || cache->rootnode >= cache->numnodes
+	 || !Mod_BSPCache_CheckBIHNodes((const bih_node_t *)(cache + 1), cache->numnodes, numleafs))
+	{
+		Con_DPrintf("%s: invalid BIH tree in cache, rebuilding it\n", loadmodel->name);
+		Mem_Free(cache);
+		return false;
+	}
+	memset(out, 0, sizeof(*out));
+	out->numleafs = numleafs;
+	out->leafs = leafs;
+	out->numnodes = out->maxnodes = cache->numnodes;
+	out->nodes = (bih_node_t *)Mem_Alloc(loadmodel->mempool, cache->numnodes * sizeof(bih_node_t));
+	memcpy(out->nodes, cache + 1, cache->numnodes * sizeof(bih_node_t));
+	out->rootnode = cache->rootnode;
+	VectorCopy(cache->mins, out->mins);
+	VectorCopy(cache->maxs, out->maxs);
+	Mem_Free(cache);
+	return true;
+}
+
+static void Mod_BSPCache_SaveBIH(const bih_t *bih, const char *tag, int index)
+{
+	size_t size = sizeof(bspcache_bih_t) + bih->numnodes * sizeof(bih_node_t);
+	bspcache_bih_t *cache;
+	if (mod_bsp_cache.integer != 1 || bih->error != BIHERROR_OK || bih->numnodes < 1)
+		return;
+	cache = (bspcache_bih_t *)Mem_Alloc(tempmempool, size);
+	VectorCopy(bih->mins, cache->mins);
+	VectorCopy(bih->maxs, cache->maxs);
+	cache->rootnode = bih->rootnode;
+	cache->numnodes = bih->numnodes;
+	cache->nodesize = (int)sizeof(bih_node_t);
+	memcpy(cache + 1, bih->nodes, bih->numnodes * sizeof(bih_node_t));
+	Mod_BSPCache_Save(tag, index, bih->leafs, bih->numleafs * sizeof(bih_leaf_t), cache, size);
+	Mem_Free(cache);
+}
+
 bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t *out)
 {
 	int j;
@@ -7784,6 +7979,8 @@ bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t
 	const int *renderelement3i;
 	const float *rendervertex3f;
 	bih_leaf_t *bihleafs;
+	// only maps are cached, alias models build their trees quickly
+	qboolean usecache = model->type == mod_brushq1 || model->type == mod_brushq2 || model->type == mod_brushq3;
 	bih_node_t *bihnodes;
 	int *temp_leafsort;
 	int *temp_leafsortscratch;
@@ -7888,6 +8085,11 @@ bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t
 		}
 	}
 
+	// the leafs fully describe the tree, so a cached tree built from
+	// identical leafs can be used as is
+	if (usecache && Mod_BSPCache_LoadBIH(out, userendersurfaces ? "bihrender" : "bihcollision", model->brush.submodel, bihnumleafs, bihleafs))
+		return out;
+
 	// allocate buffers for the produced and temporary data
 	bihmaxnodes = bihnumleafs + 1;
 	bihnodes = (bih_node_t *)Mem_Alloc(loadmodel->mempool, sizeof(bih_node_t) * bihmaxnodes);
@@ -7907,6 +8109,9 @@ bih_t *Mod_MakeCollisionBIH(dp_model_t *model, qboolean userendersurfaces, bih_t
 		out->nodes = (bih_node_t *)Mem_Realloc(loadmodel->mempool, out->nodes, out->numnodes * sizeof(bih_node_t));
 	}
 
+	if (usecache)
+		Mod_BSPCache_SaveBIH(out, userendersurfaces ? "bihrender" : "bihcollision", model->brush.submodel);
+
 	return out;
 }
 
@@ -8041,6 +8246,7 @@ static void Mod_Q3BSP_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	mod->DrawDebug = R_Q1BSP_DrawDebug;
 	mod->DrawPrepass = R_Q1BSP_DrawPrepass;
 	mod->GetLightInfo = R_Q1BSP_GetLightInfo;
+	mod->CompileLightInfo = R_Q1BSP_CompileLightInfo;
 	mod->CompileShadowMap = R_Q1BSP_CompileShadowMap;
 	mod->DrawShadowMap = R_Q1BSP_DrawShadowMap;
 	mod->CompileShadowVolume = R_Q1BSP_CompileShadowVolume;
@@ -8385,6 +8591,7 @@ void Mod_OBJ_Load(dp_model_t *mod, void *buffer, void *bufferend)
 	loadmodel->DrawDebug = R_Q1BSP_DrawDebug;
 	loadmodel->DrawPrepass = R_Q1BSP_DrawPrepass;
 	loadmodel->GetLightInfo = R_Q1BSP_GetLightInfo;
+	loadmodel->CompileLightInfo = R_Q1BSP_CompileLightInfo;
 	loadmodel->CompileShadowMap = R_Q1BSP_CompileShadowMap;
 	loadmodel->DrawShadowMap = R_Q1BSP_DrawShadowMap;
 	loadmodel->CompileShadowVolume = R_Q1BSP_CompileShadowVolume;
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "image.h"
 #include "r_shadow.h"
 #include "polygon.h"
+#include "thread.h"
 
 cvar_t r_enableshadowvolumes = {CVAR_SAVE, "r_enableshadowvolumes", "1", "Enables use of Stencil Shadow Volume shadowing methods, saves some memory if turned off"};
 cvar_t r_mipskins = {CVAR_SAVE, "r_mipskins", "0", "mipmaps model skins so they render faster in the distance and do not display noise artifacts, can cause discoloration of skins if they contain undesirable border colors"};
@@ -39,12 +40,46 @@ cvar_t mod_generatelightmaps_gridsamples = {CVAR_SAVE, "mod_generatelightmaps_gr
 cvar_t mod_generatelightmaps_lightmapradius = {CVAR_SAVE, "mod_generatelightmaps_lightmapradius", "16", "sampling area around each lightmap pixel"};
 cvar_t mod_generatelightmaps_vertexradius = {CVAR_SAVE, "mod_generatelightmaps_vertexradius", "16", "sampling area around each vertex"};
 cvar_t mod_generatelightmaps_gridradius = {CVAR_SAVE, "mod_generatelightmaps_gridradius", "64", "sampling area around each lightgrid cell center"};
+cvar_t mod_generatelightmaps_threads = {CVAR_SAVE, "mod_generatelightmaps_threads", "1", "number of threads baking lightmap pixels (including the main thread)"};
+cvar_t mod_generatelightmaps_shadowtraces = {CVAR_SAVE, "mod_generatelightmaps_shadowtraces", "0", "trace shadow rays through the world BIH rather than testing points against a shadow volume bsp per light (lights whose bsp runs out of nodes always trace)"};
+cvar_t mod_generatelightmaps_progressive = {CVAR_SAVE, "mod_generatelightmaps_progressive", "0", "take one shadow test per lightmap pixel first and only spend the full mod_generatelightmaps_lightmapsamples on pixels along shadow edges"};
+cvar_t mod_generatelightmaps_cache = {CVAR_SAVE, "mod_generatelightmaps_cache", "1", "remember baked lightmap pixels per surface so running mod_generatelightmaps again on the same map only rebakes surfaces whose lights changed"};
 
 dp_model_t *loadmodel;
 
 static mempool_t *mod_mempool;
 static memexpandablearray_t models;
 
+// models by name for Mod_FindName, the entries are kept outside of dp_model_t
+// because brush submodels are made by copying the whole struct
+#define MODEL_HASH_SIZE 1024
+typedef struct model_hash_entry_s
+{
+	dp_model_t *model;
+	struct model_hash_entry_s *next;
+}
+model_hash_entry_t;
+static model_hash_entry_t *model_hash[MODEL_HASH_SIZE];
+
+static unsigned int Mod_HashName(const char *name)
+{
+	return CRC_Block((const unsigned char *)name, strlen(name)) & (MODEL_HASH_SIZE - 1);
+}
+
+static void Mod_UnlinkHash(dp_model_t *mod)
+{
+	model_hash_entry_t **link, *entry;
+	for (link = &model_hash[Mod_HashName(mod->name)];(entry = *link);link = &entry->next)
+	{
+		if (entry->model == mod)
+		{
+			*link = entry->next;
+			Mem_Free(entry);
+			return;
+		}
+	}
+}
+
 static mempool_t* q3shaders_mem;
 typedef struct q3shader_hash_entry_s
 {
@@ -181,6 +216,10 @@ void Mod_Init (void)
 	Cvar_RegisterVariable(&mod_generatelightmaps_lightmapradius);
 	Cvar_RegisterVariable(&mod_generatelightmaps_vertexradius);
 	Cvar_RegisterVariable(&mod_generatelightmaps_gridradius);
+	Cvar_RegisterVariable(&mod_generatelightmaps_threads);
+	Cvar_RegisterVariable(&mod_generatelightmaps_shadowtraces);
+	Cvar_RegisterVariable(&mod_generatelightmaps_progressive);
+	Cvar_RegisterVariable(&mod_generatelightmaps_cache);
 
 	Cmd_AddCommand ("modellist", Mod_Print, "prints a list of loaded models");
 	Cmd_AddCommand ("modelprecache", Mod_Precache, "load a model");
@@ -559,6 +598,7 @@ void Mod_PurgeUnused(void)
 		if ((mod = (dp_model_t*) Mem_ExpandableArray_RecordAtIndex(&models, i)) && mod->name[0] && !mod->used)
 		{
 			Mod_UnloadModel(mod);
+			Mod_UnlinkHash(mod);
 			Mem_ExpandableArray_FreeRecord(&models, mod);
 		}
 	}
@@ -572,8 +612,8 @@ Mod_FindName
 */
 dp_model_t *Mod_FindName(const char *name, const char *parentname)
 {
-	int i;
-	int nummodels;
+	unsigned int hashindex;
+	model_hash_entry_t *entry;
 	dp_model_t *mod;
 
 	if (!parentname)
@@ -582,15 +622,15 @@ dp_model_t *Mod_FindName(const char *name, const char *parentname)
 	// if we're not dedicatd, the renderer calls will crash without video
 	Host_StartVideo();
 
-	nummodels = (int)Mem_ExpandableArray_IndexRange(&models);
-
 	if (!name[0])
 		Host_Error ("Mod_ForName: empty name");
 
 	// search the currently loaded models
-	for (i = 0;i < nummodels;i++)
+	hashindex = Mod_HashName(name);
+	for (entry = model_hash[hashindex];entry;entry = entry->next)
 	{
-		if ((mod = (dp_model_t*) Mem_ExpandableArray_RecordAtIndex(&models, i)) && mod->name[0] && !strcmp(mod->name, name) && ((!mod->brush.parentmodel && !parentname[0]) || (mod->brush.parentmodel && parentname[0] && !strcmp(mod->brush.parentmodel->name, parentname))))
+		mod = entry->model;
+		if (!strcmp(mod->name, name) && ((!mod->brush.parentmodel && !parentname[0]) || (mod->brush.parentmodel && parentname[0] && !strcmp(mod->brush.parentmodel->name, parentname))))
 		{
 			mod->used = true;
 			return mod;
@@ -600,6 +640,12 @@ dp_model_t *Mod_FindName(const char *name, const char *parentname)
 	// no match found, create a new one
 	mod = (dp_model_t *) Mem_ExpandableArray_AllocRecord(&models);
 	strlcpy(mod->name, name, sizeof(mod->name));
+	entry = (model_hash_entry_t *)Mem_Alloc(mod_mempool, sizeof(model_hash_entry_t));
+	entry->model = mod;
+	// hash the stored name, which Mod_UnlinkHash uses (may be truncated)
+	hashindex = Mod_HashName(mod->name);
+	entry->next = model_hash[hashindex];
+	model_hash[hashindex] = entry;
 	if (parentname[0])
 		mod->brush.parentmodel = Mod_FindName(parentname, NULL);
 	else
@@ -4106,6 +4152,19 @@ static qboolean Mod_GenerateLightmaps_SamplePoint_SVBSP(const svbsp_t *svbsp, co
 	return num == -1; // true if empty, false if solid (shadowed)
 }
 
+// returns true if pos can see the light, this is called from the bake threads
+static qboolean Mod_GenerateLightmaps_SamplePoint_Visible(const lightmaplight_t *lightinfo, const float *pos)
+{
+	trace_t trace;
+	if (lightinfo->svbsp.nodes && !mod_generatelightmaps_shadowtraces.integer)
+		return Mod_GenerateLightmaps_SamplePoint_SVBSP(&lightinfo->svbsp, pos);
+	if (cl.worldmodel->render_bih.nodes)
+		Mod_CollisionBIH_TraceLineAgainstSurfaces(cl.worldmodel, NULL, NULL, &trace, pos, lightinfo->origin, SUPERCONTENTS_VISBLOCKERMASK);
+	else
+		cl.worldmodel->TraceLine(cl.worldmodel, NULL, NULL, &trace, pos, lightinfo->origin, SUPERCONTENTS_VISBLOCKERMASK);
+	return trace.fraction >= 1;
+}
+
 static void Mod_GenerateLightmaps_SamplePoint(const float *pos, const float *normal, float *sample, int numoffsets, const float *offsets)
 {
 	int i;
@@ -4140,7 +4199,7 @@ static void Mod_GenerateLightmaps_SamplePoint(const float *pos, const float *nor
 		{
 			hits = 0;
 			tests = 1;
-			if (Mod_GenerateLightmaps_SamplePoint_SVBSP(&lightinfo->svbsp, pos))
+			if (Mod_GenerateLightmaps_SamplePoint_Visible(lightinfo, pos))
 				hits++;
 			for (offsetindex = 1;offsetindex < numoffsets;offsetindex++)
 			{
@@ -4153,7 +4212,7 @@ static void Mod_GenerateLightmaps_SamplePoint(const float *pos, const float *nor
 						VectorLerp(pos, trace.fraction, offsetpos, offsetpos);
 				}
 				tests++;
-				if (Mod_GenerateLightmaps_SamplePoint_SVBSP(&lightinfo->svbsp, offsetpos))
+				if (Mod_GenerateLightmaps_SamplePoint_Visible(lightinfo, offsetpos))
 					hits++;
 			}
 			if (!hits)
@@ -4178,13 +4237,13 @@ static void Mod_GenerateLightmaps_SamplePoint(const float *pos, const float *nor
 	}
 }
 
-static void Mod_GenerateLightmaps_LightmapSample(const float *pos, const float *normal, unsigned char *lm_bgr, unsigned char *lm_dir)
+static void Mod_GenerateLightmaps_LightmapSample(const float *pos, const float *normal, int numoffsets, unsigned char *lm_bgr, unsigned char *lm_dir)
 {
 	float sample[5*3];
 	float color[3];
 	float dir[3];
 	float f;
-	Mod_GenerateLightmaps_SamplePoint(pos, normal, sample, mod_generatelightmaps_numoffsets[0], mod_generatelightmaps_offsets[0][0]);
+	Mod_GenerateLightmaps_SamplePoint(pos, normal, sample, numoffsets, mod_generatelightmaps_offsets[0][0]);
 	//VectorSet(dir, sample[3] + sample[4] + sample[5], sample[6] + sample[7] + sample[8], sample[9] + sample[10] + sample[11]);
 	VectorCopy(sample + 12, dir);
 	VectorNormalize(dir);
@@ -4439,21 +4498,108 @@ static void Mod_GenerateLightmaps_DestroyTriangleInformation(dp_model_t *model)
 
 float lmaxis[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
 
-static void Mod_GenerateLightmaps_CreateLightmaps(dp_model_t *model)
+// state shared by the lightmap bake threads, surfaces are handed out one at a
+// time and each one only writes its own blocks of the lightmap textures
+typedef struct mod_generatelightmaps_bake_s
 {
-	msurface_t *surface;
-	int surfaceindex;
-	int lightmapindex;
-	int lightmapnumber;
+	dp_model_t *model;
+	int texturesize;
+	unsigned char *lightmappixels;
+	unsigned char *deluxemappixels;
+	const unsigned char *surfacedirty;
+	void *mutex;
+	int nextsurface;
+}
+mod_generatelightmaps_bake_t;
+
+static mod_generatelightmaps_bake_t mod_generatelightmaps_bake;
+
+// baked pixels of the last mod_generatelightmaps run, reused for surfaces
+// that have the same key (triangle layout, sampling settings and the lights
+// touching them) when the command is run again on the same map
+typedef struct mod_generatelightmaps_cache_s
+{
+	char modelname[MAX_QPATH];
+	unsigned int modelcrc;
+	int texturesize;
+	int numlightmaps;
+	int numsurfaces;
+	unsigned char *surfacekeys;
+	unsigned char *lightmappixels;
+	unsigned char *deluxemappixels;
+}
+mod_generatelightmaps_cache_t;
+
+static mod_generatelightmaps_cache_t mod_generatelightmaps_cache_state;
+
+static void Mod_GenerateLightmaps_FreeCache(void)
+{
+	mod_generatelightmaps_cache_t *c = &mod_generatelightmaps_cache_state;
+	if (c->surfacekeys)
+		Mem_Free(c->surfacekeys);
+	if (c->lightmappixels)
+		Mem_Free(c->lightmappixels);
+	if (c->deluxemappixels)
+		Mem_Free(c->deluxemappixels);
+	memset(c, 0, sizeof(*c));
+}
+
+static void Mod_GenerateLightmaps_SurfaceKey(dp_model_t *model, int surfaceindex, int lm_texturesize, unsigned char *key)
+{
+	const msurface_t *surface = model->data_surfaces + surfaceindex;
+	const lightmaptriangle_t *triangle;
+	const lightmaplight_t *lightinfo;
+	float lightmins[3];
+	float lightmaxs[3];
+	float *data;
+	float *d;
 	int i;
-	int j;
-	int k;
+	d = data = (float *)Mem_Alloc(tempmempool, (8 + surface->num_triangles * 18 + mod_generatelightmaps_numlights * 7) * sizeof(float));
+	*d++ = lm_texturesize;
+	*d++ = surface->num_triangles;
+	*d++ = mod_generatelightmaps_numoffsets[0];
+	*d++ = mod_generatelightmaps_lightmapradius.value;
+	*d++ = mod_generatelightmaps_progressive.integer;
+	*d++ = mod_generatelightmaps_shadowtraces.integer;
+	*d++ = r_shadow_lightattenuationdividebias.value;
+	*d++ = r_shadow_lightattenuationlinearscale.value;
+	for (i = 0, triangle = mod_generatelightmaps_lightmaptriangles + surface->num_firsttriangle;i < surface->num_triangles;i++, triangle++)
+	{
+		*d++ = triangle->lightmapindex;
+		*d++ = triangle->lmoffset[0];
+		*d++ = triangle->lmoffset[1];
+		*d++ = triangle->lmsize[0];
+		*d++ = triangle->lmsize[1];
+		*d++ = triangle->lmbase[0];
+		*d++ = triangle->lmbase[1];
+		*d++ = triangle->lmscale[0];
+		*d++ = triangle->lmscale[1];
+		memcpy(d, triangle->vertex, sizeof(triangle->vertex));d += 9;
+	}
+	// only lights that can reach the surface matter
+	for (i = 0, lightinfo = mod_generatelightmaps_lightinfo;i < mod_generatelightmaps_numlights;i++, lightinfo++)
+	{
+		VectorSet(lightmins, lightinfo->origin[0] - lightinfo->radius, lightinfo->origin[1] - lightinfo->radius, lightinfo->origin[2] - lightinfo->radius);
+		VectorSet(lightmaxs, lightinfo->origin[0] + lightinfo->radius, lightinfo->origin[1] + lightinfo->radius, lightinfo->origin[2] + lightinfo->radius);
+		if (!BoxesOverlap(surface->mins, surface->maxs, lightmins, lightmaxs))
+			continue;
+		VectorCopy(lightinfo->origin, d);d += 3;
+		*d++ = lightinfo->radius;
+		VectorCopy(lightinfo->color, d);d += 3;
+	}
+	Com_BlockFullChecksum(data, (int)((d - data) * sizeof(float)), key);
+	Mem_Free(data);
+}
+
+static void Mod_GenerateLightmaps_BakeTriangle(const lightmaptriangle_t *triangle, int lm_texturesize, unsigned char *lightmappixels, unsigned char *deluxemappixels)
+{
 	int x;
 	int y;
+	int pass;
 	int axis;
 	int axis1;
 	int axis2;
-	int retry;
+	int numoffsets;
 	int pixeloffset;
 	float trianglenormal[3];
 	float samplecenter[3];
@@ -4463,6 +4609,172 @@ static void Mod_GenerateLightmaps_CreateLightmaps(dp_model_t *model)
 	float slopex;
 	float slopey;
 	float slopebase;
+	unsigned char *edgepixels = NULL;
+	const unsigned char *p;
+	qboolean progressive = mod_generatelightmaps_progressive.integer && mod_generatelightmaps_numoffsets[0] > 1;
+
+	TriangleNormal(triangle->vertex[0], triangle->vertex[1], triangle->vertex[2], trianglenormal);
+	VectorNormalize(trianglenormal);
+	VectorCopy(trianglenormal, samplenormal); // FIXME: this is supposed to be interpolated per pixel from vertices
+	axis = triangle->axis;
+	axis1 = axis == 0 ? 1 : 0;
+	axis2 = axis == 2 ? 1 : 2;
+	lmiscale[0] = 1.0f / triangle->lmscale[0];
+	lmiscale[1] = 1.0f / triangle->lmscale[1];
+	if (trianglenormal[axis] < 0)
+		VectorNegate(trianglenormal, trianglenormal);
+	CrossProduct(lmaxis[axis2], trianglenormal, temp);slopex = temp[axis] / temp[axis1];
+	CrossProduct(lmaxis[axis1], trianglenormal, temp);slopey = temp[axis] / temp[axis2];
+	slopebase = triangle->vertex[0][axis] - triangle->vertex[0][axis1]*slopex - triangle->vertex[0][axis2]*slopey;
+
+	// the progressive first pass takes a single shadow test per pixel, then
+	// the pixels that differ from a neighbor are sampled again properly
+	for (pass = progressive ? 0 : 1;pass < 2;pass++)
+	{
+		numoffsets = pass ? mod_generatelightmaps_numoffsets[0] : 1;
+		for (y = 0;y < triangle->lmsize[1];y++)
+		{
+			pixeloffset = ((triangle->lightmapindex * lm_texturesize + y + triangle->lmoffset[1]) * lm_texturesize + triangle->lmoffset[0]) * 4;
+			for (x = 0;x < triangle->lmsize[0];x++, pixeloffset += 4)
+			{
+				if (edgepixels && !edgepixels[y * triangle->lmsize[0] + x])
+					continue;
+				samplecenter[axis1] = (x+0.5f)*lmiscale[0] + triangle->lmbase[0];
+				samplecenter[axis2] = (y+0.5f)*lmiscale[1] + triangle->lmbase[1];
+				samplecenter[axis] = samplecenter[axis1]*slopex + samplecenter[axis2]*slopey + slopebase;
+				VectorMA(samplecenter, 0.125f, samplenormal, samplecenter);
+				Mod_GenerateLightmaps_LightmapSample(samplecenter, samplenormal, numoffsets, lightmappixels + pixeloffset, deluxemappixels + pixeloffset);
+			}
+		}
+		if (pass)
+			break;
+		// mark both pixels of every neighboring pair that differs
+		edgepixels = (unsigned char *)Mem_Alloc(tempmempool, triangle->lmsize[0] * triangle->lmsize[1]);
+		for (y = 0;y < triangle->lmsize[1];y++)
+		{
+			pixeloffset = ((triangle->lightmapindex * lm_texturesize + y + triangle->lmoffset[1]) * lm_texturesize + triangle->lmoffset[0]) * 4;
+			for (x = 0;x < triangle->lmsize[0];x++, pixeloffset += 4)
+			{
+				p = lightmappixels + pixeloffset;
+				if (x + 1 < triangle->lmsize[0] && (abs(p[0] - p[4]) > 2 || abs(p[1] - p[5]) > 2 || abs(p[2] - p[6]) > 2))
+					edgepixels[y * triangle->lmsize[0] + x] = edgepixels[y * triangle->lmsize[0] + x + 1] = 1;
+				if (y + 1 < triangle->lmsize[1] && (abs(p[0] - p[lm_texturesize*4+0]) > 2 || abs(p[1] - p[lm_texturesize*4+1]) > 2 || abs(p[2] - p[lm_texturesize*4+2]) > 2))
+					edgepixels[y * triangle->lmsize[0] + x] = edgepixels[(y + 1) * triangle->lmsize[0] + x] = 1;
+			}
+		}
+	}
+	if (edgepixels)
+		Mem_Free(edgepixels);
+}
+
+static int Mod_GenerateLightmaps_BakeThread(void *data)
+{
+	mod_generatelightmaps_bake_t *b = &mod_generatelightmaps_bake;
+	const msurface_t *surface;
+	int surfaceindex;
+	int i;
+	for (;;)
+	{
+		if (b->mutex)
+			Thread_LockMutex(b->mutex);
+		surfaceindex = b->nextsurface++;
+		if (b->mutex)
+			Thread_UnlockMutex(b->mutex);
+		if (surfaceindex >= b->model->num_surfaces)
+			break;
+		if (b->surfacedirty && !b->surfacedirty[surfaceindex])
+			continue;
+		surface = b->model->data_surfaces + surfaceindex;
+		for (i = 0;i < surface->num_triangles;i++)
+			Mod_GenerateLightmaps_BakeTriangle(&mod_generatelightmaps_lightmaptriangles[surface->num_firsttriangle+i], b->texturesize, b->lightmappixels, b->deluxemappixels);
+	}
+	return 0;
+}
+
+// fills in the lightmap pixels of every surface, reusing the cached pixels of
+// surfaces that did not change since the last run
+static void Mod_GenerateLightmaps_BakeLightmaps(dp_model_t *model, int lm_texturesize, unsigned char *lightmappixels, unsigned char *deluxemappixels)
+{
+	mod_generatelightmaps_bake_t *b = &mod_generatelightmaps_bake;
+	mod_generatelightmaps_cache_t *c = &mod_generatelightmaps_cache_state;
+	size_t numpixelbytes = (size_t)model->brushq3.num_mergedlightmaps * lm_texturesize * lm_texturesize * 4;
+	unsigned char *surfacekeys = NULL;
+	unsigned char *surfacedirty = NULL;
+	void *threads[64];
+	int numthreads;
+	int numdirty;
+	int surfaceindex;
+	int i;
+
+	numdirty = model->num_surfaces;
+	if (mod_generatelightmaps_cache.integer)
+	{
+		surfacekeys = (unsigned char *)Mem_Alloc(mod_mempool, model->num_surfaces * 16);
+		for (surfaceindex = 0;surfaceindex < model->num_surfaces;surfaceindex++)
+			Mod_GenerateLightmaps_SurfaceKey(model, surfaceindex, lm_texturesize, surfacekeys + surfaceindex * 16);
+		if (c->lightmappixels && !strcmp(c->modelname, model->name) && c->modelcrc == model->crc && c->texturesize == lm_texturesize && c->numlightmaps == model->brushq3.num_mergedlightmaps && c->numsurfaces == model->num_surfaces)
+		{
+			surfacedirty = (unsigned char *)Mem_Alloc(tempmempool, model->num_surfaces);
+			for (surfaceindex = 0, numdirty = 0;surfaceindex < model->num_surfaces;surfaceindex++)
+			{
+				surfacedirty[surfaceindex] = memcmp(surfacekeys + surfaceindex * 16, c->surfacekeys + surfaceindex * 16, 16) != 0;
+				numdirty += surfacedirty[surfaceindex];
+			}
+			memcpy(lightmappixels, c->lightmappixels, numpixelbytes);
+			memcpy(deluxemappixels, c->deluxemappixels, numpixelbytes);
+		}
+	}
+
+	memset(b, 0, sizeof(*b));
+	b->model = model;
+	b->texturesize = lm_texturesize;
+	b->lightmappixels = lightmappixels;
+	b->deluxemappixels = deluxemappixels;
+	b->surfacedirty = surfacedirty;
+	numthreads = Thread_HasThreads() ? bound(1, mod_generatelightmaps_threads.integer, (int)(sizeof(threads)/sizeof(threads[0]))) : 1;
+	if (numthreads > 1)
+		b->mutex = Thread_CreateMutex();
+	for (i = 1;i < numthreads;i++)
+		threads[i] = Thread_CreateThread(Mod_GenerateLightmaps_BakeThread, NULL);
+	Mod_GenerateLightmaps_BakeThread(NULL);
+	for (i = 1;i < numthreads;i++)
+		Thread_WaitThread(threads[i], 0);
+	if (b->mutex)
+		Thread_DestroyMutex(b->mutex);
+	memset(b, 0, sizeof(*b));
+	Con_Printf("baked lightmaps for %i of %i surfaces using %i threads\n", numdirty, model->num_surfaces, numthreads);
+
+	Mod_GenerateLightmaps_FreeCache();
+	if (surfacekeys)
+	{
+		strlcpy(c->modelname, model->name, sizeof(c->modelname));
+		c->modelcrc = model->crc;
+		c->texturesize = lm_texturesize;
+		c->numlightmaps = model->brushq3.num_mergedlightmaps;
+		c->numsurfaces = model->num_surfaces;
+		c->surfacekeys = surfacekeys;
+		c->lightmappixels = (unsigned char *)Mem_Alloc(mod_mempool, numpixelbytes);
+		c->deluxemappixels = (unsigned char *)Mem_Alloc(mod_mempool, numpixelbytes);
+		memcpy(c->lightmappixels, lightmappixels, numpixelbytes);
+		memcpy(c->deluxemappixels, deluxemappixels, numpixelbytes);
+	}
+	if (surfacedirty)
+		Mem_Free(surfacedirty);
+}
+
+static void Mod_GenerateLightmaps_CreateLightmaps(dp_model_t *model)
+{
+	msurface_t *surface;
+	int surfaceindex;
+	int lightmapindex;
+	int lightmapnumber;
+	int i;
+	int j;
+	int k;
+	int axis;
+	int axis1;
+	int axis2;
+	int retry;
 	float lmscalepixels;
 	float lmmins;
 	float lmmaxs;
@@ -4565,19 +4877,9 @@ static void Mod_GenerateLightmaps_CreateLightmaps(dp_model_t *model)
 		for (i = 0;i < surface->num_triangles;i++)
 		{
 			triangle = &mod_generatelightmaps_lightmaptriangles[surface->num_firsttriangle+i];
-			TriangleNormal(triangle->vertex[0], triangle->vertex[1], triangle->vertex[2], trianglenormal);
-			VectorNormalize(trianglenormal);
-			VectorCopy(trianglenormal, samplenormal); // FIXME: this is supposed to be interpolated per pixel from vertices
 			axis = triangle->axis;
 			axis1 = axis == 0 ? 1 : 0;
 			axis2 = axis == 2 ? 1 : 2;
-			lmiscale[0] = 1.0f / triangle->lmscale[0];
-			lmiscale[1] = 1.0f / triangle->lmscale[1];
-			if (trianglenormal[axis] < 0)
-				VectorNegate(trianglenormal, trianglenormal);
-			CrossProduct(lmaxis[axis2], trianglenormal, temp);slopex = temp[axis] / temp[axis1];
-			CrossProduct(lmaxis[axis1], trianglenormal, temp);slopey = temp[axis] / temp[axis2];
-			slopebase = triangle->vertex[0][axis] - triangle->vertex[0][axis1]*slopex - triangle->vertex[0][axis2]*slopey;
 			for (j = 0;j < 3;j++)
 			{
 				float *t2f = model->surfmesh.data_texcoordlightmap2f + e[i*3+j]*2;
@@ -4641,21 +4943,12 @@ static void Mod_GenerateLightmaps_CreateLightmaps(dp_model_t *model)
 			Matrix4x4_FromVectors(&backmatrix, forward, left, up, origin);
 #endif
 #define LM_DIST_EPSILON (1.0f / 32.0f)
-			for (y = 0;y < triangle->lmsize[1];y++)
-			{
-				pixeloffset = ((triangle->lightmapindex * lm_texturesize + y + triangle->lmoffset[1]) * lm_texturesize + triangle->lmoffset[0]) * 4;
-				for (x = 0;x < triangle->lmsize[0];x++, pixeloffset += 4)
-				{
-					samplecenter[axis1] = (x+0.5f)*lmiscale[0] + triangle->lmbase[0];
-					samplecenter[axis2] = (y+0.5f)*lmiscale[1] + triangle->lmbase[1];
-					samplecenter[axis] = samplecenter[axis1]*slopex + samplecenter[axis2]*slopey + slopebase;
-					VectorMA(samplecenter, 0.125f, samplenormal, samplecenter);
-					Mod_GenerateLightmaps_LightmapSample(samplecenter, samplenormal, lightmappixels + pixeloffset, deluxemappixels + pixeloffset);
-				}
-			}
 		}
 	}
 
+	// now sample the lighting for all the pixels
+	Mod_GenerateLightmaps_BakeLightmaps(model, lm_texturesize, lightmappixels, deluxemappixels);
+
 	for (lightmapindex = 0;lightmapindex < model->brushq3.num_mergedlightmaps;lightmapindex++)
 	{
 		model->brushq3.data_lightmaps[lightmapindex] = R_LoadTexture2D(model->texturepool, va(vabuf, sizeof(vabuf), "lightmap%i", lightmapindex), lm_texturesize, lm_texturesize, lightmappixels + lightmapindex * lm_texturesize * lm_texturesize * 4, TEXTYPE_BGRA, TEXF_FORCELINEAR, -1, NULL);
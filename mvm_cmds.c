@@ -30,6 +30,7 @@ const char *vm_m_extensions =
 "DP_QC_DIGEST "
 "DP_QC_DIGEST_SHA256 "
 "DP_QC_FINDCHAIN_TOFIELD "
+"DP_QC_HASHTABLES "
 "DP_QC_I18N "
 "DP_QC_LOG "
 "DP_QC_RENDER_SCENE "
@@ -38,6 +39,7 @@ const char *vm_m_extensions =
 "DP_QC_STRINGBUFFERS "
 "DP_QC_STRINGBUFFERS_CVARLIST "
 "DP_QC_STRINGBUFFERS_EXT_WIP "
+"DP_QC_STRINGBUFFERS_HASHED "
 "DP_QC_STRINGCOLORFUNCTIONS "
 "DP_QC_STRING_CASE_FUNCTIONS "
 "DP_QC_STRREPLACE "
@@ -788,6 +790,7 @@ static void VM_M_copyentity (prvm_prog_t *prog)
 	in = PRVM_G_EDICT(OFS_PARM0);
 	out = PRVM_G_EDICT(OFS_PARM1);
 	memcpy(out->fields.fp, in->fields.fp, prog->entityfields * sizeof(prvm_vec_t));
+	PRVM_FindIndex_Touch(prog, PRVM_NUM_FOR_EDICT(out));
 }
 
 //#66 vector() getmousepos (EXT_CSQC)
@@ -1607,6 +1610,23 @@ NULL,							// #640
 VM_M_crypto_getmyidstatus,				// #641 float(float i) crypto_getmyidstatus
 VM_coverage,						// #642
 VM_M_crypto_getidstatus,				// #643 float(string addr) crypto_getidstatus
+VM_hashtable_create,					// #644 float() hashtable_create (DP_QC_HASHTABLES)
+VM_hashtable_delete,					// #645 void(float table) hashtable_delete (DP_QC_HASHTABLES)
+VM_hashtable_clear,					// #646 void(float table) hashtable_clear (DP_QC_HASHTABLES)
+VM_hashtable_count,					// #647 float(float table) hashtable_count (DP_QC_HASHTABLES)
+VM_hashtable_gettype,					// #648 float(float table, string key) hashtable_gettype (DP_QC_HASHTABLES)
+VM_hashtable_remove,					// #649 float(float table, string key) hashtable_remove (DP_QC_HASHTABLES)
+VM_hashtable_getkey,					// #650 string(float table, float index) hashtable_getkey (DP_QC_HASHTABLES)
+VM_hashtable_setstring,					// #651 void(float table, string key, string value) hashtable_setstring (DP_QC_HASHTABLES)
+VM_hashtable_setfloat,					// #652 void(float table, string key, float value) hashtable_setfloat (DP_QC_HASHTABLES)
+VM_hashtable_setvector,					// #653 void(float table, string key, vector value) hashtable_setvector (DP_QC_HASHTABLES)
+VM_hashtable_setentity,					// #654 void(float table, string key, entity value) hashtable_setentity (DP_QC_HASHTABLES)
+VM_hashtable_getstring,					// #655 string(float table, string key) hashtable_getstring (DP_QC_HASHTABLES)
+VM_hashtable_getfloat,					// #656 float(float table, string key) hashtable_getfloat (DP_QC_HASHTABLES)
+VM_hashtable_getvector,					// #657 vector(float table, string key) hashtable_getvector (DP_QC_HASHTABLES)
+VM_hashtable_getentity,					// #658 entity(float table, string key) hashtable_getentity (DP_QC_HASHTABLES)
+VM_hashtable_writefile,					// #659 float(float filehandle, float table) hashtable_writefile (DP_QC_HASHTABLES)
+VM_hashtable_loadfile,					// #660 float(string filename, float table) hashtable_loadfile (DP_QC_HASHTABLES)
 NULL
 };
 
@@ -14,7 +14,7 @@ static float portaltemppoints2[256][3];
 static int portal_markid = 0;
 static float boxpoints[4*3];
 
-static int Portal_PortalThroughPortalPlanes(tinyplane_t *clipplanes, int clipnumplanes, float *targpoints, int targnumpoints, float *out, int maxpoints)
+static int Portal_PortalThroughPortalPlanes(tinyplane_t *clipplanes, int clipnumplanes, float *targpoints, int targnumpoints, float *out, int maxpoints, float (*temppoints)[256][3])
 {
 	int numpoints = targnumpoints, i, w;
 	if (numpoints < 1)
@@ -22,16 +22,16 @@ static int Portal_PortalThroughPortalPlanes(tinyplane_t *clipplanes, int clipnum
 	if (maxpoints > 256)
 		maxpoints = 256;
 	w = 0;
-	memcpy(&portaltemppoints[w][0][0], targpoints, numpoints * 3 * sizeof(float));
+	memcpy(&temppoints[w][0][0], targpoints, numpoints * 3 * sizeof(float));
 	for (i = 0;i < clipnumplanes && numpoints > 0;i++)
 	{
-		PolygonF_Divide(numpoints, &portaltemppoints[w][0][0], clipplanes[i].normal[0], clipplanes[i].normal[1], clipplanes[i].normal[2], clipplanes[i].dist, 1.0f/32.0f, 256, &portaltemppoints[1-w][0][0], &numpoints, 0, NULL, NULL, NULL);
+		PolygonF_Divide(numpoints, &temppoints[w][0][0], clipplanes[i].normal[0], clipplanes[i].normal[1], clipplanes[i].normal[2], clipplanes[i].dist, 1.0f/32.0f, 256, &temppoints[1-w][0][0], &numpoints, 0, NULL, NULL, NULL);
 		w = 1-w;
 		numpoints = min(numpoints, 256);
 	}
 	numpoints = min(numpoints, maxpoints);
 	if (numpoints > 0)
-		memcpy(out, &portaltemppoints[w][0][0], numpoints * 3 * sizeof(float));
+		memcpy(out, &temppoints[w][0][0], numpoints * 3 * sizeof(float));
 	return numpoints;
 }
 
@@ -51,7 +51,7 @@ static int Portal_RecursiveFlowSearch (mleaf_t *leaf, vec3_t eye, int firstclipp
 		// only flow through portals facing away from the viewer
 		if (PlaneDiff(eye, (&p->plane)) < 0)
 		{
-			newpoints = Portal_PortalThroughPortalPlanes(&portalplanes[firstclipplane], numclipplanes, (float *) p->points, p->numpoints, &portaltemppoints2[0][0], 256);
+			newpoints = Portal_PortalThroughPortalPlanes(&portalplanes[firstclipplane], numclipplanes, (float *) p->points, p->numpoints, &portaltemppoints2[0][0], 256, portaltemppoints);
 			if (newpoints < 3)
 				continue;
 			else if (firstclipplane + numclipplanes + newpoints > MAXRECURSIVEPORTALPLANES)
@@ -283,6 +283,12 @@ typedef struct portalrecursioninfo_s
 	vec3_t eye;
 	float *updateleafsmins;
 	float *updateleafsmaxs;
+	// work space of this call (not shared with Portal_CheckPolygon), so
+	// several lights can be compiled on different threads at once
+	tinyplane_t portalplanes[MAXRECURSIVEPORTALPLANES];
+	float temppoints[2][256][3];
+	float temppoints2[256][3];
+	qboolean ranoutofportalplanes;
 }
 portalrecursioninfo_t;
 
@@ -340,7 +346,7 @@ static void Portal_RecursiveFlow (portalrecursioninfo_t *info, mleaf_t *leaf, in
 					VectorCopy(vertex3f + elements[2] * 3, v + 6);
 					if (PointInfrontOfTriangle(info->eye, v + 0, v + 3, v + 6)
 					 && (insidebox || TriangleBBoxOverlapsBox(v, v + 3, v + 6, info->boxmins, info->boxmaxs))
-					 && (!info->exact || Portal_PortalThroughPortalPlanes(&portalplanes[firstclipplane], numclipplanes, v, 3, &portaltemppoints2[0][0], 256) > 0))
+					 && (!info->exact || Portal_PortalThroughPortalPlanes(&info->portalplanes[firstclipplane], numclipplanes, v, 3, &info->temppoints2[0][0], 256, info->temppoints) > 0))
 					{
 						addedtris = true;
 						if (info->shadowtrispvs)
@@ -365,24 +371,24 @@ static void Portal_RecursiveFlow (portalrecursioninfo_t *info, mleaf_t *leaf, in
 		dist = PlaneDiff(info->eye, (&p->plane));
 		if (dist < 0 && BoxesOverlap(p->past->mins, p->past->maxs, info->boxmins, info->boxmaxs))
 		{
-			newpoints = Portal_PortalThroughPortalPlanes(&portalplanes[firstclipplane], numclipplanes, (float *) p->points, p->numpoints, &portaltemppoints2[0][0], 256);
+			newpoints = Portal_PortalThroughPortalPlanes(&info->portalplanes[firstclipplane], numclipplanes, (float *) p->points, p->numpoints, &info->temppoints2[0][0], 256, info->temppoints);
 			if (newpoints < 3)
 				continue;
 			else if (firstclipplane + numclipplanes + newpoints > MAXRECURSIVEPORTALPLANES)
-				ranoutofportalplanes = true;
+				info->ranoutofportalplanes = true;
 			else
 			{
 				// find the center by averaging
 				VectorClear(center);
 				for (i = 0;i < newpoints;i++)
-					VectorAdd(center, portaltemppoints2[i], center);
+					VectorAdd(center, info->temppoints2[i], center);
 				// ixtable is a 1.0f / N table
 				VectorScale(center, ixtable[newpoints], center);
 				// calculate the planes, and make sure the polygon can see its own center
-				newplanes = &portalplanes[firstclipplane + numclipplanes];
+				newplanes = &info->portalplanes[firstclipplane + numclipplanes];
 				for (prev = newpoints - 1, i = 0;i < newpoints;prev = i, i++)
 				{
-					TriangleNormal(portaltemppoints2[prev], portaltemppoints2[i], info->eye, newplanes[i].normal);
+					TriangleNormal(info->temppoints2[prev], info->temppoints2[i], info->eye, newplanes[i].normal);
 					VectorNormalize(newplanes[i].normal);
 					newplanes[i].dist = DotProduct(info->eye, newplanes[i].normal);
 					if (DotProduct(newplanes[i].normal, center) <= newplanes[i].dist)
@@ -423,6 +429,7 @@ static void Portal_RecursiveFindLeafForFlow(portalrecursioninfo_t *info, mnode_t
 void Portal_Visibility(dp_model_t *model, const vec3_t eye, int *leaflist, unsigned char *leafpvs, int *numleafspointer, int *surfacelist, unsigned char *surfacepvs, int *numsurfacespointer, const mplane_t *frustumplanes, int numfrustumplanes, int exact, const float *boxmins, const float *boxmaxs, float *updateleafsmins, float *updateleafsmaxs, unsigned char *shadowtrispvs, unsigned char *lighttrispvs, unsigned char *visitingleafpvs)
 {
 	int i;
+	// this is rather large for the stack (about 25KB) but keeps it reentrant
 	portalrecursioninfo_t info;
 
 	// if there is no model, it can not block visibility
@@ -441,12 +448,11 @@ void Portal_Visibility(dp_model_t *model, const vec3_t eye, int *leaflist, unsig
 	// put frustum planes (if any) into tinyplane format at start of buffer
 	for (i = 0;i < numfrustumplanes;i++)
 	{
-		VectorCopy(frustumplanes[i].normal, portalplanes[i].normal);
-		portalplanes[i].dist = frustumplanes[i].dist;
+		VectorCopy(frustumplanes[i].normal, info.portalplanes[i].normal);
+		info.portalplanes[i].dist = frustumplanes[i].dist;
 	}
 
-	ranoutofportalplanes = false;
-	ranoutofportals = false;
+	info.ranoutofportalplanes = false;
 
 	VectorCopy(boxmins, info.boxmins);
 	VectorCopy(boxmaxs, info.boxmaxs);
@@ -468,10 +474,8 @@ void Portal_Visibility(dp_model_t *model, const vec3_t eye, int *leaflist, unsig
 
 	Portal_RecursiveFindLeafForFlow(&info, model->brush.data_nodes);
 
-	if (ranoutofportalplanes)
+	if (info.ranoutofportalplanes)
 		Con_Printf("Portal_RecursiveFlow: ran out of %d plane stack when recursing through portals\n", MAXRECURSIVEPORTALPLANES);
-	if (ranoutofportals)
-		Con_Printf("Portal_RecursiveFlow: ran out of %d portal stack when recursing through portals\n", MAXRECURSIVEPORTALS);
 	if (numsurfacespointer)
 		*numsurfacespointer = info.numsurfaces;
 	if (numleafspointer)
@@ -44,6 +44,7 @@ typedef struct prvm_stack_s
 	double			tprofile_acc;
 	double			profile_acc;
 	double			builtinsprofile_acc;
+	int				tempstrings_mark; // tempstrings cursize when the function was entered
 } prvm_stack_t;
 
 
@@ -520,8 +521,21 @@ prvm_prog_funcoffsets_t;
 
 // stringbuffer flags
 #define STRINGBUFFER_SAVED     1   // saved in savegames
-#define STRINGBUFFER_QCFLAGS   1   // allowed to be set by QC
+#define STRINGBUFFER_HASHED    2   // exact bufstr_find uses a hash index
+#define STRINGBUFFER_QCFLAGS   3   // allowed to be set by QC
 #define STRINGBUFFER_TEMP      128 // internal use ONLY 
+
+// strings of a buffer are packed into blocks, a freed string stays in its
+// block until the buffer is compacted
+typedef struct prvm_stringbuffer_block_s
+{
+	struct prvm_stringbuffer_block_s *next;
+	size_t size;
+	size_t used;
+	char data[1];
+}
+prvm_stringbuffer_block_t;
+
 typedef struct prvm_stringbuffer_s
 {
 	int max_strings;
@@ -529,9 +543,142 @@ typedef struct prvm_stringbuffer_s
 	char **strings;
 	const char *origin;
 	unsigned char flags;
+
+	prvm_stringbuffer_block_t *blocks; // newest first
+	size_t usedbytes; // bytes of all blocks in use, including freed strings
+	size_t freedbytes; // bytes of freed strings
+
+	// STRINGBUFFER_HASHED: chains of string indices with the same hash
+	// (-1 terminates), both arrays are rebuilt when max_strings grows
+	int hashmask;
+	int *hashheads;
+	int *hashnext;
 }
 prvm_stringbuffer_t;
 
+// DP_QC_HASHTABLES, entries are kept in one array (so removing an entry
+// moves the last one into its place) and chained by index from the buckets
+typedef struct prvm_hashtable_entry_s
+{
+	char *key;
+	unsigned int hash;
+	int next; // next entry in the same bucket, -1 terminates
+	etype_t type; // ev_string, ev_float, ev_vector or ev_entity
+	prvm_vec_t value[3]; // ev_float and ev_vector
+	int edict; // ev_entity, as an entity number
+	char *string; // ev_string
+}
+prvm_hashtable_entry_t;
+
+typedef struct prvm_hashtable_s
+{
+	const char *origin;
+	int numentries;
+	int maxentries;
+	prvm_hashtable_entry_t *entries;
+	int mask; // number of buckets - 1
+	int *heads;
+}
+prvm_hashtable_t;
+
+// name lookup table for fielddefs, globaldefs or functions, built by
+// PRVM_Prog_Load, chains hold indices into the def array (-1 terminates)
+typedef struct prvm_namehash_s
+{
+	int mask; // number of buckets - 1
+	int *heads;
+	int *next;
+}
+prvm_namehash_t;
+
+// tempstrings live in an arena of segments that is never moved, a string is
+// addressed by a virtual offset whose upper bits select the segment (a string
+// larger than a segment gets several consecutive segments of one allocation)
+#define PRVM_TEMPSTRINGS_SEGMENTBITS 18
+#define PRVM_TEMPSTRINGS_SEGMENTSIZE (1 << PRVM_TEMPSTRINGS_SEGMENTBITS)
+#define PRVM_TEMPSTRINGS_MAXSEGMENTS ((1 << 28) >> PRVM_TEMPSTRINGS_SEGMENTBITS)
+#define PRVM_TEMPSTRINGS_MARKER 0xFF
+#define PRVM_TEMPSTRINGS_POISON 0xFE
+typedef struct prvm_tempstrings_s
+{
+	int cursize; // virtual offset of the next tempstring
+	int maxsize; // virtual size of all segments
+	// tempstrings below this have been stored outside of the function that
+	// created them, so leaving a function never reclaims them
+	int keep;
+	int numsegments;
+	unsigned char *segments[PRVM_TEMPSTRINGS_MAXSEGMENTS];
+	int segmentend[PRVM_TEMPSTRINGS_MAXSEGMENTS]; // virtual end of the allocation the segment belongs to
+
+	// with developer on (latched whenever the buffer is empty) every string
+	// is preceded by PRVM_TEMPSTRINGS_MARKER, reclaimed space is filled with
+	// PRVM_TEMPSTRINGS_POISON and each reclaim shifts where the next strings
+	// start, so an offset that outlived a reclaim points at something that
+	// is not a string start and PRVM_GetString complains
+	qboolean checkreuse;
+	int skew;
+
+	// statistics for prvm_tempstrings
+	int builtin; // builtin currently executing, 0 for QC or engine
+	double *builtinbytes; // numbuiltins entries
+	double *builtinstrings;
+	double reclaimedbytes;
+	int peaksize;
+}
+prvm_tempstrings_t;
+
+// sampling profiler, every so many statements the QC call stack is recorded
+// and identical stacks are merged, prvm_sampleprofile_write saves them in
+// the folded format read by flame graph tools
+#define PRVM_SAMPLEPROFILE_HASHSIZE 4096
+#define PRVM_SAMPLEPROFILE_MAXSTACKS 65536
+typedef struct prvm_samplestack_s
+{
+	unsigned int hash;
+	int firstframe; // index into frames, root function first
+	int numframes;
+	int count;
+	int next; // index+1 of the next stack in the same hash bucket
+}
+prvm_samplestack_t;
+
+typedef struct prvm_sampleprofile_s
+{
+	// statements left until the next sample, 0 while sampling is off
+	int countdown;
+	// statements a builtin call is counted as
+	int builtincost;
+	int hash[PRVM_SAMPLEPROFILE_HASHSIZE];
+	prvm_samplestack_t *stacks;
+	int numstacks;
+	int maxstacks;
+	int *frames; // function numbers
+	int numframes;
+	int maxframes;
+	double samples;
+	double dropped; // samples of new stacks after the table filled up
+}
+prvm_sampleprofile_t;
+
+// optional lookup index over one string or float entity field, used by the
+// find* builtins instead of scanning every edict (see prvm_findindex)
+// each bucket is a chain of edict numbers in ascending order, 0 terminates
+#define PRVM_FINDINDEX_MAX 16
+#define PRVM_FINDINDEX_BUCKETS 1024
+typedef struct prvm_findindex_s
+{
+	int fieldofs;
+	etype_t type; // ev_string or ev_float (entity fields are indexed as ev_float)
+	int heads[PRVM_FINDINDEX_BUCKETS];
+	int tails[PRVM_FINDINDEX_BUCKETS];
+	// per edict, limit_edicts entries each
+	int *next;
+	int *prev;
+	int *bucket; // bucket + 1 the edict is linked into, 0 if not linked
+	unsigned int *nonzero; // ev_float only, bit set when the value is not 0 (for findflags)
+}
+prvm_findindex_t;
+
 // [INIT] variables flagged with this token can be initialized by 'you'
 // NOTE: external code has to create and free the mempools but everything else is done by prvm !
 typedef struct prvm_prog_s
@@ -568,6 +715,11 @@ typedef struct prvm_prog_s
 	int					numstrings;
 	int					numglobals;
 
+	// hashed names for PRVM_ED_FindField/FindGlobal/FindFunction
+	prvm_namehash_t		fielddefs_hash;
+	prvm_namehash_t		globaldefs_hash;
+	prvm_namehash_t		functions_hash;
+
 	int					*statement_linenums; // NULL if not available
 	int					*statement_columnnums; // NULL if not available
 
@@ -586,15 +738,32 @@ typedef struct prvm_prog_s
 
 	int					maxknownstrings;
 	int					numknownstrings;
-	// this is updated whenever a string is removed or added
-	// (simple optimization of the free string search)
-	int					firstfreeknownstring;
+	// head of the chain of unused slots below numknownstrings, linked
+	// through knownstrings_next (all links are index + 1, 0 ends a chain)
+	int					freeknownstrings;
 	const char			**knownstrings;
 	unsigned char		*knownstrings_freeable;
 	const char          **knownstrings_origin;
+	// pointer -> slot lookup, maxknownstrings buckets (always a power of 2)
+	int					*knownstrings_hash;
+	// next slot in the same hash bucket, or next free slot if unused
+	int					*knownstrings_next;
 	const char			***stringshash;
 
 	memexpandablearray_t	stringbuffersarray;
+	memexpandablearray_t	hashtablesarray;
+
+	// lookup indexes for the find* builtins, set up from prvm_findindex
+	int					numfindindexes;
+	prvm_findindex_t	*findindexes;
+	// per field offset, nonzero if stores to it have to refresh an index
+	unsigned char		*findindex_fieldmap;
+	// edicts whose indexed fields may have changed since they were indexed
+	// (marked by OP_STOREP, cleared as each lookup relinks them)
+	unsigned char		*findindex_dirty;
+	int					*findindex_dirtylist;
+	int					findindex_numdirty;
+	qboolean			findindex_built;
 
 	// all memory allocations related to this vm_prog (code, edicts, strings)
 	mempool_t			*progs_mempool; // [INIT]
@@ -638,7 +807,9 @@ typedef struct prvm_prog_s
 	skeleton_t			*skeletons[MAX_EDICTS];
 
 	// buffer for storing all tempstrings created during one invocation of ExecuteProgram
-	sizebuf_t			tempstringsbuf;
+	prvm_tempstrings_t	tempstringsbuf;
+
+	prvm_sampleprofile_t	sampleprofile;
 
 	// LordHavoc: moved this here to clean up things that relied on prvm_prog_list too much
 	// FIXME: make VM_CL_R_Polygon functions use Debug_Polygon functions?
@@ -795,6 +966,9 @@ void PRVM_Profile (prvm_prog_t *prog, int maxfunctions, double mintime, int sort
 void PRVM_Profile_f (void);
 void PRVM_ChildProfile_f (void);
 void PRVM_CallProfile_f (void);
+void PRVM_SampleProfile_Sample(prvm_prog_t *prog, mfunction_t *leaf);
+void PRVM_SampleProfile_Write_f (void);
+void PRVM_SampleProfile_Reset_f (void);
 void PRVM_PrintFunction_f (void);
 
 void PRVM_PrintState(prvm_prog_t *prog, int stack_index);
@@ -819,6 +993,13 @@ prvm_edict_t *PRVM_ED_Alloc(prvm_prog_t *prog);
 void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed);
 void PRVM_ED_ClearEdict(prvm_prog_t *prog, prvm_edict_t *e);
 
+void PRVM_FindIndex_Touch(prvm_prog_t *prog, int num);
+void PRVM_FindIndex_Flush(prvm_prog_t *prog);
+prvm_findindex_t *PRVM_FindIndex_ForField(prvm_prog_t *prog, int fieldofs, etype_t type);
+int PRVM_FindIndex_NextString(prvm_prog_t *prog, prvm_findindex_t *index, int start, const char *s);
+int PRVM_FindIndex_NextFloat(prvm_prog_t *prog, prvm_findindex_t *index, int start, prvm_vec_t f);
+int PRVM_FindIndex_NextFlags(prvm_prog_t *prog, prvm_findindex_t *index, int start, prvm_int_t flags);
+
 void PRVM_PrintFunctionStatements(prvm_prog_t *prog, const char *name);
 void PRVM_ED_Print(prvm_prog_t *prog, prvm_edict_t *ed, const char *wildcard_fieldname);
 void PRVM_ED_Write(prvm_prog_t *prog, qfile_t *f, prvm_edict_t *ed);
@@ -872,6 +1053,9 @@ const char *PRVM_GetString(prvm_prog_t *prog, int num);
 int PRVM_SetEngineString(prvm_prog_t *prog, const char *s);
 const char *PRVM_ChangeEngineString(prvm_prog_t *prog, int i, const char *s);
 int PRVM_SetTempString(prvm_prog_t *prog, const char *s);
+void PRVM_TempStrings_Keep(prvm_prog_t *prog);
+void PRVM_TempStrings_Escape(prvm_prog_t *prog, int globalofs);
+void PRVM_TempStrings_Reclaim(prvm_prog_t *prog, int mark);
 int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer);
 void PRVM_FreeString(prvm_prog_t *prog, int num);
 
@@ -1019,6 +1019,7 @@ void VM_find(prvm_prog_t *prog)
 	int		f;
 	const char	*s, *t;
 	prvm_edict_t	*ed;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNT(3,VM_find);
 
@@ -1026,6 +1027,12 @@ void VM_find(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM1);
 	s = PRVM_G_STRING(OFS_PARM2);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_string)))
+	{
+		VM_RETURN_EDICT(PRVM_EDICT_NUM(PRVM_FindIndex_NextString(prog, index, e, s)));
+		return;
+	}
+
 	// LordHavoc: apparently BloodMage does a find(world, weaponmodel, "") and
 	// expects it to find all the monsters, so we must be careful to support
 	// searching for ""
@@ -1064,6 +1071,7 @@ void VM_findfloat(prvm_prog_t *prog)
 	int		f;
 	float	s;
 	prvm_edict_t	*ed;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNT(3,VM_findfloat);
 
@@ -1071,6 +1079,12 @@ void VM_findfloat(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM1);
 	s = PRVM_G_FLOAT(OFS_PARM2);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_float)))
+	{
+		VM_RETURN_EDICT(PRVM_EDICT_NUM(PRVM_FindIndex_NextFloat(prog, index, e, s)));
+		return;
+	}
+
 	for (e++ ; e < prog->num_edicts ; e++)
 	{
 		prog->xfunction->builtinsprofile++;
@@ -1103,6 +1117,7 @@ void VM_findchain(prvm_prog_t *prog)
 	const char	*s, *t;
 	prvm_edict_t	*ent, *chain;
 	int chainfield;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNTRANGE(2,3,VM_findchain);
 
@@ -1118,6 +1133,18 @@ void VM_findchain(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM0);
 	s = PRVM_G_STRING(OFS_PARM1);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_string)))
+	{
+		for (i = PRVM_FindIndex_NextString(prog, index, 0, s);i;i = PRVM_FindIndex_NextString(prog, index, i, s))
+		{
+			ent = PRVM_EDICT_NUM(i);
+			PRVM_EDICTFIELDEDICT(ent,chainfield) = PRVM_NUM_FOR_EDICT(chain);
+			chain = ent;
+		}
+		VM_RETURN_EDICT(chain);
+		return;
+	}
+
 	// LordHavoc: apparently BloodMage does a find(world, weaponmodel, "") and
 	// expects it to find all the monsters, so we must be careful to support
 	// searching for ""
@@ -1158,6 +1185,7 @@ void VM_findchainfloat(prvm_prog_t *prog)
 	float	s;
 	prvm_edict_t	*ent, *chain;
 	int chainfield;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNTRANGE(2, 3, VM_findchainfloat);
 
@@ -1173,6 +1201,18 @@ void VM_findchainfloat(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM0);
 	s = PRVM_G_FLOAT(OFS_PARM1);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_float)))
+	{
+		for (i = PRVM_FindIndex_NextFloat(prog, index, 0, s);i;i = PRVM_FindIndex_NextFloat(prog, index, i, s))
+		{
+			ent = PRVM_EDICT_NUM(i);
+			PRVM_EDICTFIELDEDICT(ent,chainfield) = PRVM_EDICT_TO_PROG(chain);
+			chain = ent;
+		}
+		VM_RETURN_EDICT(chain);
+		return;
+	}
+
 	ent = PRVM_NEXT_EDICT(prog->edicts);
 	for (i = 1;i < prog->num_edicts;i++, ent = PRVM_NEXT_EDICT(ent))
 	{
@@ -1203,6 +1243,7 @@ void VM_findflags(prvm_prog_t *prog)
 	prvm_int_t	f;
 	prvm_int_t	s;
 	prvm_edict_t	*ed;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNT(3, VM_findflags);
 
@@ -1211,6 +1252,12 @@ void VM_findflags(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM1);
 	s = (prvm_int_t)PRVM_G_FLOAT(OFS_PARM2);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_float)))
+	{
+		VM_RETURN_EDICT(PRVM_EDICT_NUM(PRVM_FindIndex_NextFlags(prog, index, e, s)));
+		return;
+	}
+
 	for (e++ ; e < prog->num_edicts ; e++)
 	{
 		prog->xfunction->builtinsprofile++;
@@ -1244,6 +1291,7 @@ void VM_findchainflags(prvm_prog_t *prog)
 	prvm_int_t		s;
 	prvm_edict_t	*ent, *chain;
 	int chainfield;
+	prvm_findindex_t *index;
 
 	VM_SAFEPARMCOUNTRANGE(2, 3, VM_findchainflags);
 
@@ -1259,6 +1307,18 @@ void VM_findchainflags(prvm_prog_t *prog)
 	f = PRVM_G_INT(OFS_PARM0);
 	s = (prvm_int_t)PRVM_G_FLOAT(OFS_PARM1);
 
+	if ((index = PRVM_FindIndex_ForField(prog, f, ev_float)))
+	{
+		for (i = PRVM_FindIndex_NextFlags(prog, index, 0, s);i;i = PRVM_FindIndex_NextFlags(prog, index, i, s))
+		{
+			ent = PRVM_EDICT_NUM(i);
+			PRVM_EDICTFIELDEDICT(ent,chainfield) = PRVM_EDICT_TO_PROG(chain);
+			chain = ent;
+		}
+		VM_RETURN_EDICT(chain);
+		return;
+	}
+
 	ent = PRVM_NEXT_EDICT(prog->edicts);
 	for (i = 1;i < prog->num_edicts;i++, ent = PRVM_NEXT_EDICT(ent))
 	{
@@ -2638,6 +2698,8 @@ void VM_tokenize (prvm_prog_t *prog)
 		++num_tokens;
 	}
 
+	// argv() may be called after the calling function returned
+	PRVM_TempStrings_Keep(prog);
 	PRVM_G_FLOAT(OFS_RETURN) = num_tokens;
 }
 
@@ -2669,6 +2731,8 @@ void VM_tokenize_console (prvm_prog_t *prog)
 		++num_tokens;
 	}
 
+	// argv() may be called after the calling function returned
+	PRVM_TempStrings_Keep(prog);
 	PRVM_G_FLOAT(OFS_RETURN) = num_tokens;
 }
 
@@ -2747,6 +2811,8 @@ void VM_tokenizebyseparator (prvm_prog_t *prog)
 			break;
 	}
 
+	// argv() may be called after the calling function returned
+	PRVM_TempStrings_Keep(prog);
 	PRVM_G_FLOAT(OFS_RETURN) = num_tokens;
 }
 
@@ -4610,6 +4676,130 @@ void VM_altstr_ins(prvm_prog_t *prog)
 
 static size_t stringbuffers_sortlength;
 
+#define STRINGBUFFER_BLOCKSIZE 16384
+
+static void BufStr_HashLink(prvm_stringbuffer_t *stringbuffer, int strindex)
+{
+	const char *s = stringbuffer->strings[strindex];
+	int bucket = CRC_Block((const unsigned char *)s, strlen(s)) & stringbuffer->hashmask;
+	stringbuffer->hashnext[strindex] = stringbuffer->hashheads[bucket];
+	stringbuffer->hashheads[bucket] = strindex;
+}
+
+static void BufStr_HashUnlink(prvm_stringbuffer_t *stringbuffer, int strindex)
+{
+	const char *s = stringbuffer->strings[strindex];
+	int *link = &stringbuffer->hashheads[CRC_Block((const unsigned char *)s, strlen(s)) & stringbuffer->hashmask];
+	while (*link != strindex)
+		link = &stringbuffer->hashnext[*link];
+	*link = stringbuffer->hashnext[strindex];
+}
+
+// the hash index either covers every string of the buffer or does not exist
+static void BufStr_HashRebuild(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
+{
+	int i, numbuckets;
+
+	if (stringbuffer->hashheads)
+		Mem_Free(stringbuffer->hashheads);
+	if (stringbuffer->hashnext)
+		Mem_Free(stringbuffer->hashnext);
+	stringbuffer->hashheads = NULL;
+	stringbuffer->hashnext = NULL;
+	stringbuffer->hashmask = 0;
+	if (!(stringbuffer->flags & STRINGBUFFER_HASHED) || !stringbuffer->max_strings)
+		return;
+
+	for (numbuckets = 64;numbuckets < stringbuffer->max_strings && numbuckets < 65536;numbuckets *= 2)
+		;
+	stringbuffer->hashmask = numbuckets - 1;
+	stringbuffer->hashheads = (int *)Mem_Alloc(prog->progs_mempool, numbuckets * sizeof(int));
+	stringbuffer->hashnext = (int *)Mem_Alloc(prog->progs_mempool, stringbuffer->max_strings * sizeof(int));
+	for (i = 0;i < numbuckets;i++)
+		stringbuffer->hashheads[i] = -1;
+	for (i = 0;i < stringbuffer->num_strings;i++)
+		if (stringbuffer->strings[i])
+			BufStr_HashLink(stringbuffer, i);
+}
+
+static char *BufStr_AllocString(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, const char *str)
+{
+	prvm_stringbuffer_block_t *block = stringbuffer->blocks;
+	size_t len = strlen(str) + 1;
+	char *s;
+
+	if (!block || block->used + len > block->size)
+	{
+		size_t size = max(len, (size_t)STRINGBUFFER_BLOCKSIZE);
+		block = (prvm_stringbuffer_block_t *)Mem_Alloc(prog->progs_mempool, sizeof(prvm_stringbuffer_block_t) + size);
+		block->size = size;
+		block->next = stringbuffer->blocks;
+		stringbuffer->blocks = block;
+	}
+	s = block->data + block->used;
+	memcpy(s, str, len);
+	block->used += len;
+	stringbuffer->usedbytes += len;
+	return s;
+}
+
+static void BufStr_FreeString(prvm_stringbuffer_t *stringbuffer, int strindex)
+{
+	if (!stringbuffer->strings[strindex])
+		return;
+	if (stringbuffer->hashheads)
+		BufStr_HashUnlink(stringbuffer, strindex);
+	stringbuffer->freedbytes += strlen(stringbuffer->strings[strindex]) + 1;
+	stringbuffer->strings[strindex] = NULL;
+}
+
+static void BufStr_ClearStrings(prvm_stringbuffer_t *stringbuffer)
+{
+	prvm_stringbuffer_block_t *block, *next;
+
+	for (block = stringbuffer->blocks;block;block = next)
+	{
+		next = block->next;
+		Mem_Free(block);
+	}
+	if (stringbuffer->strings)
+		Mem_Free(stringbuffer->strings);
+	if (stringbuffer->hashheads)
+		Mem_Free(stringbuffer->hashheads);
+	if (stringbuffer->hashnext)
+		Mem_Free(stringbuffer->hashnext);
+	stringbuffer->blocks = NULL;
+	stringbuffer->strings = NULL;
+	stringbuffer->hashheads = NULL;
+	stringbuffer->hashnext = NULL;
+	stringbuffer->hashmask = 0;
+	stringbuffer->usedbytes = 0;
+	stringbuffer->freedbytes = 0;
+	stringbuffer->max_strings = 0;
+	stringbuffer->num_strings = 0;
+}
+
+// copies the live strings into new blocks, the hash index holds string
+// indices so it stays valid
+static void BufStr_Compact(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
+{
+	prvm_stringbuffer_block_t *block, *next;
+	int i;
+
+	block = stringbuffer->blocks;
+	stringbuffer->blocks = NULL;
+	stringbuffer->usedbytes = 0;
+	stringbuffer->freedbytes = 0;
+	for (i = 0;i < stringbuffer->num_strings;i++)
+		if (stringbuffer->strings[i])
+			stringbuffer->strings[i] = BufStr_AllocString(prog, stringbuffer, stringbuffer->strings[i]);
+	for (;block;block = next)
+	{
+		next = block->next;
+		Mem_Free(block);
+	}
+}
+
 static void BufStr_Expand(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, int strindex)
 {
 	if (stringbuffer->max_strings <= strindex)
@@ -4623,6 +4813,8 @@ static void BufStr_Expand(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer,
 			memcpy(stringbuffer->strings, oldstrings, stringbuffer->num_strings * sizeof(stringbuffer->strings[0]));
 		if (oldstrings)
 			Mem_Free(oldstrings);
+		if (stringbuffer->flags & STRINGBUFFER_HASHED)
+			BufStr_HashRebuild(prog, stringbuffer);
 	}
 }
 
@@ -4632,16 +4824,58 @@ static void BufStr_Shrink(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
 	while (stringbuffer->num_strings > 0 && stringbuffer->strings[stringbuffer->num_strings - 1] == NULL)
 		stringbuffer->num_strings--;
 
-	// if empty, free the string pointer array
+	// if empty, free the string pointer array and the string blocks
 	if (stringbuffer->num_strings == 0)
+		BufStr_ClearStrings(stringbuffer);
+	// if most of the blocks are freed strings, pack the rest
+	else if (stringbuffer->freedbytes > STRINGBUFFER_BLOCKSIZE && stringbuffer->freedbytes > stringbuffer->usedbytes / 2)
+		BufStr_Compact(prog, stringbuffer);
+}
+
+// stores a copy of str (or nothing for NULL) at strindex, growing the buffer as needed
+static void BufStr_StoreString(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, int strindex, const char *str)
+{
+	BufStr_Expand(prog, stringbuffer, strindex);
+	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
+	BufStr_FreeString(stringbuffer, strindex);
+	if (str)
 	{
-		stringbuffer->max_strings = 0;
-		if (stringbuffer->strings)
-			Mem_Free(stringbuffer->strings);
-		stringbuffer->strings = NULL;
+		stringbuffer->strings[strindex] = BufStr_AllocString(prog, stringbuffer, str);
+		if (stringbuffer->hashheads)
+			BufStr_HashLink(stringbuffer, strindex);
 	}
 }
 
+// bottom-up merge sort, unlike qsort it keeps equal strings in their order
+static void BufStr_StableSort(char **strings, int numstrings, int (*compare)(const void *, const void *))
+{
+	char **temp, **in, **out, **swap;
+	int width, lo, mid, hi, i, j, k;
+
+	temp = (char **)Mem_Alloc(tempmempool, numstrings * sizeof(*strings));
+	in = strings;
+	out = temp;
+	for (width = 1;width < numstrings;width *= 2)
+	{
+		for (lo = 0;lo < numstrings;lo += width * 2)
+		{
+			mid = min(lo + width, numstrings);
+			hi = min(lo + width * 2, numstrings);
+			for (i = lo, j = mid, k = lo;k < hi;k++)
+			{
+				if (i < mid && (j >= hi || compare(&in[j], &in[i]) >= 0))
+					out[k] = in[i++];
+				else
+					out[k] = in[j++];
+			}
+		}
+		swap = in;in = out;out = swap;
+	}
+	if (in != strings)
+		memcpy(strings, in, numstrings * sizeof(*strings));
+	Mem_Free(temp);
+}
+
 static int BufStr_SortStringsUP (const void *in1, const void *in2)
 {
 	const char *a, *b;
@@ -4699,40 +4933,19 @@ prvm_stringbuffer_t *BufStr_FindCreateReplace (prvm_prog_t *prog, int bufindex,
 
 void BufStr_Set(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer, int strindex, const char *str)
 {
-	size_t  alloclen;
-
 	if (!stringbuffer || strindex < 0)
 		return;
 
-	BufStr_Expand(prog, stringbuffer, strindex);
-	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-	if (stringbuffer->strings[strindex])
-		Mem_Free(stringbuffer->strings[strindex]);
-	stringbuffer->strings[strindex] = NULL;
-
-	if (str)
-	{
-		// not the NULL string!
-		alloclen = strlen(str) + 1;
-		stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-		memcpy(stringbuffer->strings[strindex], str, alloclen);
-	}
-
+	BufStr_StoreString(prog, stringbuffer, strindex, str);
 	BufStr_Shrink(prog, stringbuffer);
 }
 
 void BufStr_Del(prvm_prog_t *prog, prvm_stringbuffer_t *stringbuffer)
 {
-	int i;
-	
 	if (!stringbuffer)
 		return;
 
-	for (i = 0;i < stringbuffer->num_strings;i++)
-		if (stringbuffer->strings[i])
-			Mem_Free(stringbuffer->strings[i]);
-	if (stringbuffer->strings)
-		Mem_Free(stringbuffer->strings);
+	BufStr_ClearStrings(stringbuffer);
 	if(stringbuffer->origin)
 		PRVM_Free((char *)stringbuffer->origin);
 	Mem_ExpandableArray_FreeRecord(&prog->stringbuffersarray, stringbuffer);
@@ -4852,32 +5065,20 @@ void VM_buf_copy (prvm_prog_t *prog)
 		VM_Warning(prog, "VM_buf_copy: source == destination (%i) in %s\n", i, prog->name);
 		return;
 	}
-	dststringbuffer = (prvm_stringbuffer_t *)Mem_ExpandableArray_RecordAtIndex(&prog->stringbuffersarray, (int)PRVM_G_FLOAT(OFS_PARM0));
+	dststringbuffer = (prvm_stringbuffer_t *)Mem_ExpandableArray_RecordAtIndex(&prog->stringbuffersarray, (int)PRVM_G_FLOAT(OFS_PARM1));
 	if(!dststringbuffer)
 	{
 		VM_Warning(prog, "VM_buf_copy: invalid destination buffer %i used in %s\n", (int)PRVM_G_FLOAT(OFS_PARM1), prog->name);
 		return;
 	}
 
-	for (i = 0;i < dststringbuffer->num_strings;i++)
-		if (dststringbuffer->strings[i])
-			Mem_Free(dststringbuffer->strings[i]);
-	if (dststringbuffer->strings)
-		Mem_Free(dststringbuffer->strings);
-	*dststringbuffer = *srcstringbuffer;
-	if (dststringbuffer->max_strings)
-		dststringbuffer->strings = (char **)Mem_Alloc(prog->progs_mempool, sizeof(dststringbuffer->strings[0]) * dststringbuffer->max_strings);
-
-	for (i = 0;i < dststringbuffer->num_strings;i++)
-	{
+	// the destination keeps its own flags, origin and string blocks
+	BufStr_ClearStrings(dststringbuffer);
+	if (srcstringbuffer->num_strings > 0)
+		BufStr_Expand(prog, dststringbuffer, srcstringbuffer->num_strings - 1);
+	for (i = 0;i < srcstringbuffer->num_strings;i++)
 		if (srcstringbuffer->strings[i])
-		{
-			size_t stringlen;
-			stringlen = strlen(srcstringbuffer->strings[i]) + 1;
-			dststringbuffer->strings[i] = (char *)Mem_Alloc(prog->progs_mempool, stringlen);
-			memcpy(dststringbuffer->strings[i], srcstringbuffer->strings[i], stringlen);
-		}
-	}
+			BufStr_StoreString(prog, dststringbuffer, i, srcstringbuffer->strings[i]);
 }
 
 /*
@@ -4909,10 +5110,13 @@ void VM_buf_sort (prvm_prog_t *prog)
 		stringbuffers_sortlength = 0x7FFFFFFF;
 
 	if(!PRVM_G_FLOAT(OFS_PARM2))
-		qsort(stringbuffer->strings, stringbuffer->num_strings, sizeof(char*), BufStr_SortStringsUP);
+		BufStr_StableSort(stringbuffer->strings, stringbuffer->num_strings, BufStr_SortStringsUP);
 	else
-		qsort(stringbuffer->strings, stringbuffer->num_strings, sizeof(char*), BufStr_SortStringsDOWN);
+		BufStr_StableSort(stringbuffer->strings, stringbuffer->num_strings, BufStr_SortStringsDOWN);
 
+	// the strings moved to other indices
+	if (stringbuffer->hashheads)
+		BufStr_HashRebuild(prog, stringbuffer);
 	BufStr_Shrink(prog, stringbuffer);
 }
 
@@ -5032,7 +5236,6 @@ void VM_bufstr_add (prvm_prog_t *prog)
 	int				order, strindex;
 	prvm_stringbuffer_t *stringbuffer;
 	const char		*string;
-	size_t			alloclen;
 
 	VM_SAFEPARMCOUNT(3, VM_bufstr_add);
 
@@ -5057,12 +5260,7 @@ void VM_bufstr_add (prvm_prog_t *prog)
 			if (stringbuffer->strings[strindex] == NULL)
 				break;
 
-	BufStr_Expand(prog, stringbuffer, strindex);
-
-	stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-	alloclen = strlen(string) + 1;
-	stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-	memcpy(stringbuffer->strings[strindex], string, alloclen);
+	BufStr_StoreString(prog, stringbuffer, strindex, string);
 
 	PRVM_G_FLOAT(OFS_RETURN) = strindex;
 }
@@ -5094,11 +5292,7 @@ void VM_bufstr_free (prvm_prog_t *prog)
 	}
 
 	if (i < stringbuffer->num_strings)
-	{
-		if(stringbuffer->strings[i])
-			Mem_Free(stringbuffer->strings[i]);
-		stringbuffer->strings[i] = NULL;
-	}
+		BufStr_FreeString(stringbuffer, i);
 
 	BufStr_Shrink(prog, stringbuffer);
 }
@@ -5112,7 +5306,6 @@ float buf_loadfile(string filename, float bufhandle) = #535;
 */
 void VM_buf_loadfile(prvm_prog_t *prog)
 {
-	size_t alloclen;
 	prvm_stringbuffer_t *stringbuffer;
 	char string[VM_STRINGTEMP_LENGTH];
 	int strindex, c, end;
@@ -5169,11 +5362,7 @@ void VM_buf_loadfile(prvm_prog_t *prog)
 		// add and continue
 		if (c >= 0 || end)
 		{
-			BufStr_Expand(prog, stringbuffer, strindex);
-			stringbuffer->num_strings = max(stringbuffer->num_strings, strindex + 1);
-			alloclen = strlen(string) + 1;
-			stringbuffer->strings[strindex] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-			memcpy(stringbuffer->strings[strindex], string, alloclen);
+			BufStr_StoreString(prog, stringbuffer, strindex, string);
 			strindex = stringbuffer->num_strings;
 		}
 		else
@@ -5394,6 +5583,17 @@ void VM_bufstr_find(prvm_prog_t *prog)
 	// find
 	i = (prog->argc > 3) ? (int)PRVM_G_FLOAT(OFS_PARM3) : 0;
 	step = (prog->argc > 4) ? (int)PRVM_G_FLOAT(OFS_PARM4) : 1;
+	if (stringbuffer->hashheads && matchrule == MATCH_WHOLE && step > 0)
+	{
+		// only the strings equal to match are in its chain, pick the first
+		// one the linear search below would have reached
+		int j, found = -1;
+		for (j = stringbuffer->hashheads[CRC_Block((const unsigned char *)match, matchlen) & stringbuffer->hashmask];j >= 0;j = stringbuffer->hashnext[j])
+			if (j >= i && (j - i) % step == 0 && (found < 0 || j < found) && !strcmp(stringbuffer->strings[j], match))
+				found = j;
+		PRVM_G_FLOAT(OFS_RETURN) = found;
+		return;
+	}
 	while(i < stringbuffer->num_strings)
 	{
 		if (stringbuffer->strings[i] && match_rule(stringbuffer->strings[i], VM_STRINGTEMP_LENGTH, match, matchlen, matchrule))
@@ -5456,7 +5656,6 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 	cvar_t *cvar;
 	const char *partial, *antipartial;
 	size_t len, antilen;
-	size_t alloclen;
 	qboolean ispattern, antiispattern;
 	int n;
 	prvm_stringbuffer_t	*stringbuffer;
@@ -5484,12 +5683,7 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 	else
 		antilen = strlen(antipartial);
 	
-	for (n = 0;n < stringbuffer->num_strings;n++)
-		if (stringbuffer->strings[n])
-			Mem_Free(stringbuffer->strings[n]);
-	if (stringbuffer->strings)
-		Mem_Free(stringbuffer->strings);
-	stringbuffer->strings = NULL;
+	BufStr_ClearStrings(stringbuffer);
 
 	ispattern = partial && (strchr(partial, '*') || strchr(partial, '?'));
 	antiispattern = antipartial && (strchr(antipartial, '*') || strchr(antipartial, '?'));
@@ -5506,9 +5700,8 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 		++n;
 	}
 
-	stringbuffer->max_strings = stringbuffer->num_strings = n;
-	if (stringbuffer->max_strings)
-		stringbuffer->strings = (char **)Mem_Alloc(prog->progs_mempool, sizeof(stringbuffer->strings[0]) * stringbuffer->max_strings);
+	if (n)
+		BufStr_Expand(prog, stringbuffer, n - 1);
 	
 	n = 0;
 	for(cvar = cvar_vars; cvar; cvar = cvar->next)
@@ -5519,15 +5712,582 @@ void VM_buf_cvarlist(prvm_prog_t *prog)
 		if(antilen && (antiispattern ? matchpattern_with_separator(cvar->name, antipartial, false, "", false) : !strncmp(antipartial, cvar->name, antilen)))
 			continue;
 
-		alloclen = strlen(cvar->name) + 1;
-		stringbuffer->strings[n] = (char *)Mem_Alloc(prog->progs_mempool, alloclen);
-		memcpy(stringbuffer->strings[n], cvar->name, alloclen);
+		BufStr_StoreString(prog, stringbuffer, n, cvar->name);
 
 		++n;
 	}
 }
 
 
+////////////////////////////////////////
+// Hashtable functions
+////////////////////////////////////////
+//DP_QC_HASHTABLES
+
+static prvm_hashtable_t *HashTable_FromParm(prvm_prog_t *prog, int parm, const char *funcname)
+{
+	prvm_hashtable_t *table = (prvm_hashtable_t *)Mem_ExpandableArray_RecordAtIndex(&prog->hashtablesarray, (int)PRVM_G_FLOAT(parm));
+	if (!table)
+		VM_Warning(prog, "%s: invalid hashtable %i used in %s\n", funcname, (int)PRVM_G_FLOAT(parm), prog->name);
+	return table;
+}
+
+static int HashTable_Find(const prvm_hashtable_t *table, const char *key, unsigned int hash)
+{
+	int i;
+	if (!table->heads)
+		return -1;
+	for (i = table->heads[hash & table->mask];i >= 0;i = table->entries[i].next)
+		if (table->entries[i].hash == hash && !strcmp(table->entries[i].key, key))
+			return i;
+	return -1;
+}
+
+static const prvm_hashtable_entry_t *HashTable_Lookup(const prvm_hashtable_t *table, const char *key)
+{
+	int i = HashTable_Find(table, key, CRC_Block((const unsigned char *)key, strlen(key)));
+	return i >= 0 ? &table->entries[i] : NULL;
+}
+
+static void HashTable_Link(prvm_hashtable_t *table, int i)
+{
+	int bucket = table->entries[i].hash & table->mask;
+	table->entries[i].next = table->heads[bucket];
+	table->heads[bucket] = i;
+}
+
+static void HashTable_Unlink(prvm_hashtable_t *table, int i)
+{
+	int *link = &table->heads[table->entries[i].hash & table->mask];
+	while (*link != i)
+		link = &table->entries[*link].next;
+	*link = table->entries[i].next;
+}
+
+static void HashTable_Rehash(prvm_prog_t *prog, prvm_hashtable_t *table, int numbuckets)
+{
+	int i;
+	if (table->heads)
+		Mem_Free(table->heads);
+	table->mask = numbuckets - 1;
+	table->heads = (int *)Mem_Alloc(prog->progs_mempool, numbuckets * sizeof(int));
+	for (i = 0;i < numbuckets;i++)
+		table->heads[i] = -1;
+	for (i = 0;i < table->numentries;i++)
+		HashTable_Link(table, i);
+}
+
+// returns the entry for key, creating it if needed, with its old value cleared
+static prvm_hashtable_entry_t *HashTable_Set(prvm_prog_t *prog, prvm_hashtable_t *table, const char *key, etype_t type)
+{
+	prvm_hashtable_entry_t *entry;
+	unsigned int hash;
+	size_t keylength;
+	int i;
+
+	hash = CRC_Block((const unsigned char *)key, strlen(key));
+	i = HashTable_Find(table, key, hash);
+	if (i < 0)
+	{
+		if (table->numentries >= table->maxentries)
+		{
+			table->maxentries = max(16, table->maxentries * 2);
+			table->entries = (prvm_hashtable_entry_t *)Mem_Realloc(prog->progs_mempool, table->entries, table->maxentries * sizeof(prvm_hashtable_entry_t));
+		}
+		// keep about one entry per bucket, CRC_Block has 16 bits
+		if (!table->heads || (table->numentries > table->mask && table->mask < 65535))
+			HashTable_Rehash(prog, table, table->heads ? (table->mask + 1) * 2 : 16);
+		i = table->numentries++;
+		entry = &table->entries[i];
+		memset(entry, 0, sizeof(*entry));
+		keylength = strlen(key) + 1;
+		entry->key = (char *)Mem_Alloc(prog->progs_mempool, keylength);
+		memcpy(entry->key, key, keylength);
+		entry->hash = hash;
+		HashTable_Link(table, i);
+	}
+	entry = &table->entries[i];
+	if (entry->string)
+		Mem_Free(entry->string);
+	entry->string = NULL;
+	VectorClear(entry->value);
+	entry->edict = 0;
+	entry->type = type;
+	return entry;
+}
+
+static void HashTable_SetString(prvm_prog_t *prog, prvm_hashtable_t *table, const char *key, const char *value)
+{
+	prvm_hashtable_entry_t *entry = HashTable_Set(prog, table, key, ev_string);
+	size_t length = strlen(value) + 1;
+	entry->string = (char *)Mem_Alloc(prog->progs_mempool, length);
+	memcpy(entry->string, value, length);
+}
+
+static void HashTable_Remove(prvm_hashtable_t *table, int i)
+{
+	int last;
+
+	HashTable_Unlink(table, i);
+	Mem_Free(table->entries[i].key);
+	if (table->entries[i].string)
+		Mem_Free(table->entries[i].string);
+	last = --table->numentries;
+	if (i != last)
+	{
+		HashTable_Unlink(table, last);
+		table->entries[i] = table->entries[last];
+		HashTable_Link(table, i);
+	}
+}
+
+static void HashTable_Clear(prvm_hashtable_t *table)
+{
+	int i;
+	for (i = 0;i < table->numentries;i++)
+	{
+		Mem_Free(table->entries[i].key);
+		if (table->entries[i].string)
+			Mem_Free(table->entries[i].string);
+	}
+	if (table->entries)
+		Mem_Free(table->entries);
+	if (table->heads)
+		Mem_Free(table->heads);
+	table->entries = NULL;
+	table->heads = NULL;
+	table->numentries = table->maxentries = 0;
+	table->mask = 0;
+}
+
+/*
+========================
+VM_hashtable_create
+creates a new hashtable and returns its handle
+float hashtable_create(void) = #644;
+========================
+*/
+void VM_hashtable_create (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	int i;
+
+	VM_SAFEPARMCOUNT(0, VM_hashtable_create);
+
+	table = (prvm_hashtable_t *) Mem_ExpandableArray_AllocRecord(&prog->hashtablesarray);
+	for (i = 0;table != Mem_ExpandableArray_RecordAtIndex(&prog->hashtablesarray, i);i++);
+	table->origin = PRVM_AllocationOrigin(prog);
+	PRVM_G_FLOAT(OFS_RETURN) = i;
+}
+
+/*
+========================
+VM_hashtable_delete
+deletes a hashtable and everything in it
+void hashtable_delete(float table) = #645;
+========================
+*/
+void VM_hashtable_delete (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(1, VM_hashtable_delete);
+
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_delete")))
+		return;
+	HashTable_Clear(table);
+	if (table->origin)
+		PRVM_Free((char *)table->origin);
+	Mem_ExpandableArray_FreeRecord(&prog->hashtablesarray, table);
+}
+
+/*
+========================
+VM_hashtable_clear
+removes all entries from a hashtable
+void hashtable_clear(float table) = #646;
+========================
+*/
+void VM_hashtable_clear (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(1, VM_hashtable_clear);
+
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_clear")))
+		HashTable_Clear(table);
+}
+
+/*
+========================
+VM_hashtable_count
+returns the number of entries, -1 for an invalid table
+float hashtable_count(float table) = #647;
+========================
+*/
+void VM_hashtable_count (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(1, VM_hashtable_count);
+
+	PRVM_G_FLOAT(OFS_RETURN) = -1;
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_count")))
+		PRVM_G_FLOAT(OFS_RETURN) = table->numentries;
+}
+
+/*
+========================
+VM_hashtable_gettype
+returns the type of the value stored for key (TYPE_STRING, TYPE_FLOAT,
+TYPE_VECTOR, TYPE_ENTITY), 0 if there is none
+float hashtable_gettype(float table, string key) = #648;
+========================
+*/
+void VM_hashtable_gettype (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const prvm_hashtable_entry_t *entry;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_gettype);
+
+	PRVM_G_FLOAT(OFS_RETURN) = 0;
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_gettype")) && (entry = HashTable_Lookup(table, PRVM_G_STRING(OFS_PARM1))))
+		PRVM_G_FLOAT(OFS_RETURN) = entry->type;
+}
+
+/*
+========================
+VM_hashtable_remove
+removes the entry for key, returns 1 if there was one
+float hashtable_remove(float table, string key) = #649;
+========================
+*/
+void VM_hashtable_remove (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const char *key;
+	int i;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_remove);
+
+	PRVM_G_FLOAT(OFS_RETURN) = 0;
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_remove")))
+		return;
+	key = PRVM_G_STRING(OFS_PARM1);
+	i = HashTable_Find(table, key, CRC_Block((const unsigned char *)key, strlen(key)));
+	if (i >= 0)
+	{
+		HashTable_Remove(table, i);
+		PRVM_G_FLOAT(OFS_RETURN) = 1;
+	}
+}
+
+/*
+========================
+VM_hashtable_getkey
+returns the key of entry index (0 to hashtable_count - 1) for iterating over
+a hashtable, removing an entry moves the last entry to its index
+string hashtable_getkey(float table, float index) = #650;
+========================
+*/
+void VM_hashtable_getkey (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	int i;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_getkey);
+
+	PRVM_G_INT(OFS_RETURN) = OFS_NULL;
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_getkey")))
+		return;
+	i = (int)PRVM_G_FLOAT(OFS_PARM1);
+	if (i >= 0 && i < table->numentries)
+		PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, table->entries[i].key);
+}
+
+/*
+========================
+VM_hashtable_set*
+store a value for key, replacing the old value (of any type)
+void hashtable_setstring(float table, string key, string value) = #651;
+void hashtable_setfloat(float table, string key, float value) = #652;
+void hashtable_setvector(float table, string key, vector value) = #653;
+void hashtable_setentity(float table, string key, entity value) = #654;
+========================
+*/
+void VM_hashtable_setstring (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(3, VM_hashtable_setstring);
+
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_setstring")))
+		HashTable_SetString(prog, table, PRVM_G_STRING(OFS_PARM1), PRVM_G_STRING(OFS_PARM2));
+}
+
+void VM_hashtable_setfloat (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(3, VM_hashtable_setfloat);
+
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_setfloat")))
+		HashTable_Set(prog, table, PRVM_G_STRING(OFS_PARM1), ev_float)->value[0] = PRVM_G_FLOAT(OFS_PARM2);
+}
+
+void VM_hashtable_setvector (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(3, VM_hashtable_setvector);
+
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_setvector")))
+		VectorCopy(PRVM_G_VECTOR(OFS_PARM2), HashTable_Set(prog, table, PRVM_G_STRING(OFS_PARM1), ev_vector)->value);
+}
+
+void VM_hashtable_setentity (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	VM_SAFEPARMCOUNT(3, VM_hashtable_setentity);
+
+	if ((table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_setentity")))
+		HashTable_Set(prog, table, PRVM_G_STRING(OFS_PARM1), ev_entity)->edict = PRVM_G_EDICTNUM(OFS_PARM2);
+}
+
+/*
+========================
+VM_hashtable_get*
+return the value stored for key, or "", 0, '0 0 0' or world if there is none
+or it has another type; getstring converts any value to a string and
+getfloat converts strings
+string hashtable_getstring(float table, string key) = #655;
+float hashtable_getfloat(float table, string key) = #656;
+vector hashtable_getvector(float table, string key) = #657;
+entity hashtable_getentity(float table, string key) = #658;
+========================
+*/
+void VM_hashtable_getstring (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const prvm_hashtable_entry_t *entry;
+	char s[128];
+	VM_SAFEPARMCOUNT(2, VM_hashtable_getstring);
+
+	PRVM_G_INT(OFS_RETURN) = OFS_NULL;
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_getstring")) || !(entry = HashTable_Lookup(table, PRVM_G_STRING(OFS_PARM1))))
+		return;
+	switch (entry->type)
+	{
+	case ev_string:
+		PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, entry->string);
+		return;
+	case ev_float:
+		if ((prvm_vec_t)((prvm_int_t)entry->value[0]) == entry->value[0])
+			dpsnprintf(s, sizeof(s), "%.0f", entry->value[0]);
+		else
+			dpsnprintf(s, sizeof(s), "%f", entry->value[0]);
+		break;
+	case ev_vector:
+		dpsnprintf(s, sizeof(s), "%.9g %.9g %.9g", entry->value[0], entry->value[1], entry->value[2]);
+		break;
+	default:
+		dpsnprintf(s, sizeof(s), "%i", entry->edict);
+		break;
+	}
+	PRVM_G_INT(OFS_RETURN) = PRVM_SetTempString(prog, s);
+}
+
+void VM_hashtable_getfloat (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const prvm_hashtable_entry_t *entry;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_getfloat);
+
+	PRVM_G_FLOAT(OFS_RETURN) = 0;
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_getfloat")) || !(entry = HashTable_Lookup(table, PRVM_G_STRING(OFS_PARM1))))
+		return;
+	if (entry->type == ev_float)
+		PRVM_G_FLOAT(OFS_RETURN) = entry->value[0];
+	else if (entry->type == ev_string)
+		PRVM_G_FLOAT(OFS_RETURN) = atof(entry->string);
+}
+
+void VM_hashtable_getvector (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const prvm_hashtable_entry_t *entry;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_getvector);
+
+	VectorClear(PRVM_G_VECTOR(OFS_RETURN));
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_getvector")) || !(entry = HashTable_Lookup(table, PRVM_G_STRING(OFS_PARM1))))
+		return;
+	if (entry->type == ev_vector)
+		VectorCopy(entry->value, PRVM_G_VECTOR(OFS_RETURN));
+}
+
+void VM_hashtable_getentity (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	const prvm_hashtable_entry_t *entry;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_getentity);
+
+	VM_RETURN_EDICT(prog->edicts);
+	if (!(table = HashTable_FromParm(prog, OFS_PARM0, "VM_hashtable_getentity")) || !(entry = HashTable_Lookup(table, PRVM_G_STRING(OFS_PARM1))))
+		return;
+	// the entity may have been removed since, but a number past the
+	// current edicts would not even be valid
+	if (entry->type == ev_entity && entry->edict > 0 && entry->edict < prog->num_edicts)
+		VM_RETURN_EDICT(PRVM_EDICT_NUM(entry->edict));
+}
+
+// writes a quoted string that COM_ParseToken_Simple with parsebackslash reads back
+static void HashTable_WriteString(qfile_t *file, const char *s)
+{
+	char buf[VM_STRINGTEMP_LENGTH];
+	size_t l;
+
+	buf[0] = '\"';
+	for (l = 1;l < sizeof(buf) - 3 && *s;s++)
+	{
+		if (*s == '\n')
+		{
+			buf[l++] = '\\';
+			buf[l++] = 'n';
+		}
+		else if (*s == '\r')
+			continue;
+		else if (*s == '\"' || *s == '\\')
+		{
+			buf[l++] = '\\';
+			buf[l++] = *s;
+		}
+		else
+			buf[l++] = *s;
+	}
+	buf[l++] = '\"';
+	FS_Write(file, buf, l);
+}
+
+/*
+========================
+VM_hashtable_writefile
+writes all entries of a hashtable to a file opened with fopen, one
+"key" type value line each, returns 1 if succesful
+entities are written as entity numbers, which are only meaningful while the
+same entities exist (e.g. in a savegame)
+float hashtable_writefile(float filehandle, float table) = #659;
+========================
+*/
+void VM_hashtable_writefile (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	prvm_hashtable_entry_t *entry;
+	qfile_t *file;
+	int filenum, i;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_writefile);
+
+	PRVM_G_FLOAT(OFS_RETURN) = 0;
+	filenum = (int)PRVM_G_FLOAT(OFS_PARM0);
+	if (filenum < 0 || filenum >= PRVM_MAX_OPENFILES)
+	{
+		VM_Warning(prog, "VM_hashtable_writefile: invalid file handle %i used in %s\n", filenum, prog->name);
+		return;
+	}
+	if (prog->openfiles[filenum] == NULL)
+	{
+		VM_Warning(prog, "VM_hashtable_writefile: no such file handle %i (or file has been closed) in %s\n", filenum, prog->name);
+		return;
+	}
+	file = prog->openfiles[filenum];
+	if (!(table = HashTable_FromParm(prog, OFS_PARM1, "VM_hashtable_writefile")))
+		return;
+
+	for (i = 0, entry = table->entries;i < table->numentries;i++, entry++)
+	{
+		HashTable_WriteString(file, entry->key);
+		FS_Printf(file, " %i ", (int)entry->type);
+		switch (entry->type)
+		{
+		case ev_string:
+			HashTable_WriteString(file, entry->string);
+			break;
+		case ev_float:
+			FS_Printf(file, "%.9g", entry->value[0]);
+			break;
+		case ev_vector:
+			FS_Printf(file, "\"%.9g %.9g %.9g\"", entry->value[0], entry->value[1], entry->value[2]);
+			break;
+		default:
+			FS_Printf(file, "%i", entry->edict);
+			break;
+		}
+		FS_Write(file, "\n", 1);
+	}
+	PRVM_G_FLOAT(OFS_RETURN) = 1;
+}
+
+/*
+========================
+VM_hashtable_loadfile
+adds the entries of a file written by hashtable_writefile to a hashtable,
+replacing entries with the same key, returns 1 if succesful
+float hashtable_loadfile(string filename, float table) = #660;
+========================
+*/
+void VM_hashtable_loadfile (prvm_prog_t *prog)
+{
+	prvm_hashtable_t *table;
+	prvm_hashtable_entry_t *entry;
+	const char *filename, *data;
+	char *text;
+	char key[VM_STRINGTEMP_LENGTH];
+	char vabuf[1024];
+	double v[3];
+	int type;
+	VM_SAFEPARMCOUNT(2, VM_hashtable_loadfile);
+
+	PRVM_G_FLOAT(OFS_RETURN) = 0;
+	if (!(table = HashTable_FromParm(prog, OFS_PARM1, "VM_hashtable_loadfile")))
+		return;
+	filename = PRVM_G_STRING(OFS_PARM0);
+	text = (char *)FS_LoadFile(va(vabuf, sizeof(vabuf), "data/%s", filename), tempmempool, false, NULL);
+	if (text == NULL)
+		text = (char *)FS_LoadFile(filename, tempmempool, false, NULL);
+	if (text == NULL)
+	{
+		if (developer_extra.integer)
+			VM_Warning(prog, "VM_hashtable_loadfile: failed to open file %s in %s\n", filename, prog->name);
+		return;
+	}
+
+	data = text;
+	for (;;)
+	{
+		if (!COM_ParseToken_Simple(&data, false, true, false))
+			break;
+		strlcpy(key, com_token, sizeof(key));
+		if (!COM_ParseToken_Simple(&data, false, true, false))
+			break;
+		type = atoi(com_token);
+		if (!COM_ParseToken_Simple(&data, false, true, false))
+			break;
+		switch (type)
+		{
+		case ev_string:
+			HashTable_SetString(prog, table, key, com_token);
+			break;
+		case ev_float:
+			HashTable_Set(prog, table, key, ev_float)->value[0] = atof(com_token);
+			break;
+		case ev_vector:
+			entry = HashTable_Set(prog, table, key, ev_vector);
+			if (sscanf(com_token, "%lf %lf %lf", &v[0], &v[1], &v[2]) == 3)
+				VectorCopy(v, entry->value);
+			break;
+		case ev_entity:
+			HashTable_Set(prog, table, key, ev_entity)->edict = atoi(com_token);
+			break;
+		default:
+			VM_Warning(prog, "VM_hashtable_loadfile: unknown type %i for key %s in %s\n", type, key, filename);
+			break;
+		}
+	}
+	Mem_Free(text);
+	PRVM_G_FLOAT(OFS_RETURN) = 1;
+}
+
 
 
 //=============
@@ -6030,6 +6790,7 @@ void VM_SetTraceGlobals(prvm_prog_t *prog, const trace_t *trace)
 	PRVM_gameglobalfloat(trace_dphitcontents) = trace->hitsupercontents;
 	PRVM_gameglobalfloat(trace_dphitq3surfaceflags) = trace->hitq3surfaceflags;
 	PRVM_gameglobalstring(trace_dphittexturename) = trace->hittexture ? PRVM_SetTempString(prog, trace->hittexture->name) : 0;
+	PRVM_TempStrings_Keep(prog);
 }
 
 void VM_ClearTraceGlobals(prvm_prog_t *prog)
@@ -459,6 +459,25 @@ void VM_argv_start_index (prvm_prog_t *prog);
 void VM_argv_end_index (prvm_prog_t *prog);
 
 void VM_buf_cvarlist(prvm_prog_t *prog);
+
+void VM_hashtable_create (prvm_prog_t *prog);
+void VM_hashtable_delete (prvm_prog_t *prog);
+void VM_hashtable_clear (prvm_prog_t *prog);
+void VM_hashtable_count (prvm_prog_t *prog);
+void VM_hashtable_gettype (prvm_prog_t *prog);
+void VM_hashtable_remove (prvm_prog_t *prog);
+void VM_hashtable_getkey (prvm_prog_t *prog);
+void VM_hashtable_setstring (prvm_prog_t *prog);
+void VM_hashtable_setfloat (prvm_prog_t *prog);
+void VM_hashtable_setvector (prvm_prog_t *prog);
+void VM_hashtable_setentity (prvm_prog_t *prog);
+void VM_hashtable_getstring (prvm_prog_t *prog);
+void VM_hashtable_getfloat (prvm_prog_t *prog);
+void VM_hashtable_getvector (prvm_prog_t *prog);
+void VM_hashtable_getentity (prvm_prog_t *prog);
+void VM_hashtable_writefile (prvm_prog_t *prog);
+void VM_hashtable_loadfile (prvm_prog_t *prog);
+
 void VM_cvar_description(prvm_prog_t *prog);
 
 void VM_CL_getextresponse (prvm_prog_t *prog);
@@ -43,6 +43,13 @@ cvar_t prvm_leaktest_ignore_classnames = {0, "prvm_leaktest_ignore_classnames",
 cvar_t prvm_errordump = {0, "prvm_errordump", "0", "write a savegame on crash to crash-server.dmp"};
 cvar_t prvm_breakpointdump = {0, "prvm_breakpointdump", "0", "write a savegame on breakpoint to breakpoint-server.dmp"};
 cvar_t prvm_reuseedicts_startuptime = {0, "prvm_reuseedicts_startuptime", "2", "allows immediate re-use of freed entity slots during start of new level (value in seconds)"};
+cvar_t prvm_reorderfields = {0, "prvm_reorderfields", "0", "when progs are loaded, move the entity fields the engine uses in front of the fields only the mod uses so fewer cache lines are touched per entity; breaks progs that compute field offsets arithmetically"};
+cvar_t prvm_progscache = {0, "prvm_progscache", "1", "keep the decoded form of the last progs each VM loaded, in memory and in cache/ of the gamedir, so loading the same file again (restart, changelevel, reconnect, next startup) skips decoding and checking it, 2 = only keep it in memory"};
+cvar_t prvm_sampleprofile = {0, "prvm_sampleprofile", "0", "record the QC call stack about every this many statements (0 = off), cheap enough to leave on while a server is running; write the result with prvm_sampleprofile_write"};
+cvar_t prvm_sampleprofile_builtincost = {0, "prvm_sampleprofile_builtincost", "20", "number of statements a builtin call counts as for prvm_sampleprofile, the sample is then attributed to the builtin"};
+cvar_t prvm_tempstrings_scoped = {0, "prvm_tempstrings_scoped", "1", "reclaim the tempstrings a QC function created when it returns, unless they were returned or stored outside its locals"};
+cvar_t prvm_findindex = {0, "prvm_findindex", "", "space separated list of string, float or entity fields (e.g. classname targetname target) to keep a lookup index for, so that find, findfloat, findflags and the findchain variants on them don't have to scan every entity; takes effect when progs are loaded; fields the engine writes to itself (model, netname, flags...) must not be listed"};
+cvar_t prvm_findindex_verify = {0, "prvm_findindex_verify", "0", "checks every indexed find result against a full scan and prints a warning on mismatch"};
 cvar_t prvm_reuseedicts_neverinsameframe = {0, "prvm_reuseedicts_neverinsameframe", "1", "never allows re-use of freed entity slots during same frame"};
 
 static double prvm_reuseedicts_always_allow = 0;
@@ -199,6 +206,7 @@ freed and sets the allocation origin.
 void PRVM_ED_ClearEdict(prvm_prog_t *prog, prvm_edict_t *e)
 {
 	memset(e->fields.fp, 0, prog->entityfields * sizeof(prvm_vec_t));
+	PRVM_FindIndex_Touch(prog, PRVM_NUM_FOR_EDICT(e));
 	e->priv.required->free = false;
 	e->priv.required->freetime = realtime;
 	if(e->priv.required->allocation_origin)
@@ -302,6 +310,7 @@ void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed)
 		return;
 
 	prog->free_edict(prog, ed);
+	PRVM_FindIndex_Touch(prog, PRVM_NUM_FOR_EDICT(ed));
 
 	ed->priv.required->free = true;
 	ed->priv.required->freetime = realtime;
@@ -312,6 +321,337 @@ void PRVM_ED_Free(prvm_prog_t *prog, prvm_edict_t *ed)
 	}
 }
 
+/*
+===============
+prvm_findindex
+
+Optional lookup indexes over string and float entity fields for the find*
+builtins.  Every QC store to an entity field goes through OP_STOREP, which
+marks the edict dirty if the field is indexed, as do edict clears, copies,
+frees and entity parsing; dirty edicts are relinked before the next lookup.
+Candidates are still compared against the real field value, so a stale
+entry can only cost time, but fields the engine writes to directly (model,
+netname, flags...) are not tracked and should not be indexed.
+===============
+*/
+#define PRVM_FINDINDEX_MATCH_STRING 0
+#define PRVM_FINDINDEX_MATCH_FLOAT 1
+#define PRVM_FINDINDEX_MATCH_FLAGS 2
+
+static int PRVM_FindIndex_HashString(const char *s)
+{
+	return CRC_Block((const unsigned char *)s, strlen(s)) & (PRVM_FINDINDEX_BUCKETS - 1);
+}
+
+static int PRVM_FindIndex_HashFloat(prvm_vec_t f)
+{
+	union {prvm_vec_t f;unsigned char b[sizeof(prvm_vec_t)];} u;
+	// -0 compares equal to 0 so it has to land in the same bucket
+	u.f = f == 0 ? 0 : f;
+	return CRC_Block(u.b, sizeof(u.b)) & (PRVM_FINDINDEX_BUCKETS - 1);
+}
+
+static void PRVM_FindIndex_Unlink(prvm_findindex_t *index, int num)
+{
+	int b = index->bucket[num] - 1;
+	if (b < 0)
+		return;
+	if (index->prev[num])
+		index->next[index->prev[num]] = index->next[num];
+	else
+		index->heads[b] = index->next[num];
+	if (index->next[num])
+		index->prev[index->next[num]] = index->prev[num];
+	else
+		index->tails[b] = index->prev[num];
+	index->next[num] = 0;
+	index->prev[num] = 0;
+	index->bucket[num] = 0;
+}
+
+static void PRVM_FindIndex_Link(prvm_findindex_t *index, int num, int b)
+{
+	int after;
+	// chains are kept in edict order so find() can continue from its start
+	// entity, new edicts usually go at the end so search backwards
+	for (after = index->tails[b];after > num;after = index->prev[after])
+		;
+	index->prev[num] = after;
+	index->next[num] = after ? index->next[after] : index->heads[b];
+	if (after)
+		index->next[after] = num;
+	else
+		index->heads[b] = num;
+	if (index->next[num])
+		index->prev[index->next[num]] = num;
+	else
+		index->tails[b] = num;
+	index->bucket[num] = b + 1;
+}
+
+static void PRVM_FindIndex_Update(prvm_prog_t *prog, int num)
+{
+	int i, b;
+	const char *s;
+	prvm_vec_t f;
+	prvm_findindex_t *index;
+	prvm_edict_t *ed = PRVM_EDICT_NUM(num);
+
+	for (i = 0, index = prog->findindexes;i < prog->numfindindexes;i++, index++)
+	{
+		if (index->type == ev_string)
+		{
+			s = PRVM_E_STRING(ed, index->fieldofs);
+			b = PRVM_FindIndex_HashString(s ? s : "");
+		}
+		else
+		{
+			f = PRVM_E_FLOAT(ed, index->fieldofs);
+			b = PRVM_FindIndex_HashFloat(f);
+			if (f)
+				index->nonzero[num >> 5] |= 1u << (num & 31);
+			else
+				index->nonzero[num >> 5] &= ~(1u << (num & 31));
+		}
+		if (index->bucket[num] == b + 1)
+			continue;
+		PRVM_FindIndex_Unlink(index, num);
+		PRVM_FindIndex_Link(index, num, b);
+	}
+}
+
+// brings the indexes up to date before a lookup, stores are marked as they
+// happen so every edict is clean afterwards
+static void PRVM_FindIndex_Refresh(prvm_prog_t *prog)
+{
+	int i, num;
+	if (!prog->findindex_built)
+	{
+		for (i = 1;i < prog->num_edicts;i++)
+			PRVM_FindIndex_Update(prog, i);
+		prog->findindex_built = true;
+	}
+	for (i = 0;i < prog->findindex_numdirty;i++)
+	{
+		num = prog->findindex_dirtylist[i];
+		PRVM_FindIndex_Update(prog, num);
+		prog->findindex_dirty[num] = 0;
+	}
+	prog->findindex_numdirty = 0;
+}
+
+void PRVM_FindIndex_Touch(prvm_prog_t *prog, int num)
+{
+	if (!prog->findindex_dirty || prog->findindex_dirty[num])
+		return;
+	prog->findindex_dirty[num] = 1;
+	prog->findindex_dirtylist[prog->findindex_numdirty++] = num;
+}
+
+// called when the outermost ExecuteProgram returns
+void PRVM_FindIndex_Flush(prvm_prog_t *prog)
+{
+	int i;
+	if (prog->findindex_built)
+	{
+		PRVM_FindIndex_Refresh(prog);
+		return;
+	}
+	// nothing is indexed yet, the first lookup builds everything
+	for (i = 0;i < prog->findindex_numdirty;i++)
+		prog->findindex_dirty[prog->findindex_dirtylist[i]] = 0;
+	prog->findindex_numdirty = 0;
+}
+
+static void PRVM_FindIndex_Init(prvm_prog_t *prog)
+{
+	const char *p;
+	ddef_t *d;
+	etype_t type;
+	prvm_findindex_t *index;
+
+	prog->numfindindexes = 0;
+	prog->findindexes = NULL;
+	prog->findindex_fieldmap = NULL;
+	prog->findindex_dirty = NULL;
+	prog->findindex_dirtylist = NULL;
+	prog->findindex_numdirty = 0;
+	prog->findindex_built = false;
+
+	for (p = prvm_findindex.string;COM_ParseToken_Console(&p);)
+	{
+		// a field that doesn't exist in this prog is simply not indexed
+		if (!(d = PRVM_ED_FindField(prog, com_token)))
+			continue;
+		switch (d->type & ~DEF_SAVEGLOBAL)
+		{
+		case ev_string:
+			type = ev_string;
+			break;
+		case ev_float:
+		case ev_entity:
+			type = ev_float;
+			break;
+		default:
+			Con_Printf("%s: prvm_findindex: field %s is not a string, float or entity field\n", prog->name, com_token);
+			continue;
+		}
+		if (prog->numfindindexes >= PRVM_FINDINDEX_MAX)
+		{
+			Con_Printf("%s: prvm_findindex: too many fields, ignoring %s\n", prog->name, com_token);
+			break;
+		}
+		if (!prog->findindexes)
+		{
+			prog->findindexes = (prvm_findindex_t *)PRVM_Alloc(PRVM_FINDINDEX_MAX * sizeof(prvm_findindex_t));
+			prog->findindex_fieldmap = (unsigned char *)PRVM_Alloc(prog->entityfields);
+			prog->findindex_dirty = (unsigned char *)PRVM_Alloc(prog->limit_edicts);
+			prog->findindex_dirtylist = (int *)PRVM_Alloc(prog->limit_edicts * sizeof(int));
+		}
+		index = prog->findindexes + prog->numfindindexes++;
+		index->fieldofs = d->ofs;
+		index->type = type;
+		index->next = (int *)PRVM_Alloc(prog->limit_edicts * sizeof(int));
+		index->prev = (int *)PRVM_Alloc(prog->limit_edicts * sizeof(int));
+		index->bucket = (int *)PRVM_Alloc(prog->limit_edicts * sizeof(int));
+		if (type == ev_float)
+			index->nonzero = (unsigned int *)PRVM_Alloc(((prog->limit_edicts + 31) >> 5) * sizeof(unsigned int));
+		// a vector store starting up to 2 fields earlier may cover this one
+		prog->findindex_fieldmap[d->ofs] = 1;
+		if (d->ofs >= 1)
+			prog->findindex_fieldmap[d->ofs - 1] = 1;
+		if (d->ofs >= 2)
+			prog->findindex_fieldmap[d->ofs - 2] = 1;
+	}
+}
+
+prvm_findindex_t *PRVM_FindIndex_ForField(prvm_prog_t *prog, int fieldofs, etype_t type)
+{
+	int i;
+	prvm_findindex_t *index;
+	if (!prog->numfindindexes || fieldofs < 0 || fieldofs >= prog->entityfields || !prog->findindex_fieldmap[fieldofs])
+		return NULL;
+	for (i = 0, index = prog->findindexes;i < prog->numfindindexes;i++, index++)
+	{
+		if (index->fieldofs == fieldofs && index->type == type)
+		{
+			PRVM_FindIndex_Refresh(prog);
+			return index;
+		}
+	}
+	return NULL;
+}
+
+static qboolean PRVM_FindIndex_Match(prvm_prog_t *prog, prvm_findindex_t *index, int num, int match, const char *s, prvm_vec_t f, prvm_int_t flags)
+{
+	const char *t;
+	prvm_edict_t *ed = PRVM_EDICT_NUM(num);
+	if (ed->priv.required->free)
+		return false;
+	switch (match)
+	{
+	case PRVM_FINDINDEX_MATCH_STRING:
+		t = PRVM_E_STRING(ed, index->fieldofs);
+		return !strcmp(t ? t : "", s);
+	case PRVM_FINDINDEX_MATCH_FLOAT:
+		return PRVM_E_FLOAT(ed, index->fieldofs) == f;
+	default:
+		return PRVM_E_FLOAT(ed, index->fieldofs) && ((prvm_int_t)PRVM_E_FLOAT(ed, index->fieldofs) & flags);
+	}
+}
+
+// with prvm_findindex_verify the result is checked against a full scan
+static int PRVM_FindIndex_Verify(prvm_prog_t *prog, prvm_findindex_t *index, int start, int result, int match, const char *s, prvm_vec_t f, prvm_int_t flags)
+{
+	int e;
+	for (e = start + 1;e < prog->num_edicts;e++)
+		if (PRVM_FindIndex_Match(prog, index, e, match, s, f, flags))
+			break;
+	if (e >= prog->num_edicts)
+		e = 0;
+	if (e != result)
+	{
+		Con_Printf("%s: prvm_findindex: lookup on field %s after entity %i returned %i instead of %i\n", prog->name, PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, index->fieldofs)->s_name), start, result, e);
+		return e;
+	}
+	return result;
+}
+
+// returns the first edict after start in the same chain as value hash b
+static int PRVM_FindIndex_First(prvm_prog_t *prog, prvm_findindex_t *index, int start, int b)
+{
+	int e;
+	// continuing from the previous result is by far the most common case
+	if (start > 0 && start < prog->limit_edicts && index->bucket[start] == b + 1)
+		return index->next[start];
+	for (e = index->heads[b];e && e <= start;e = index->next[e])
+		;
+	return e;
+}
+
+int PRVM_FindIndex_NextString(prvm_prog_t *prog, prvm_findindex_t *index, int start, const char *s)
+{
+	int e;
+	for (e = PRVM_FindIndex_First(prog, index, start, PRVM_FindIndex_HashString(s));e && e < prog->num_edicts;e = index->next[e])
+	{
+		prog->xfunction->builtinsprofile++;
+		if (PRVM_FindIndex_Match(prog, index, e, PRVM_FINDINDEX_MATCH_STRING, s, 0, 0))
+			break;
+	}
+	if (e >= prog->num_edicts)
+		e = 0;
+	if (prvm_findindex_verify.integer)
+		e = PRVM_FindIndex_Verify(prog, index, start, e, PRVM_FINDINDEX_MATCH_STRING, s, 0, 0);
+	return e;
+}
+
+int PRVM_FindIndex_NextFloat(prvm_prog_t *prog, prvm_findindex_t *index, int start, prvm_vec_t f)
+{
+	int e;
+	for (e = PRVM_FindIndex_First(prog, index, start, PRVM_FindIndex_HashFloat(f));e && e < prog->num_edicts;e = index->next[e])
+	{
+		prog->xfunction->builtinsprofile++;
+		if (PRVM_FindIndex_Match(prog, index, e, PRVM_FINDINDEX_MATCH_FLOAT, NULL, f, 0))
+			break;
+	}
+	if (e >= prog->num_edicts)
+		e = 0;
+	if (prvm_findindex_verify.integer)
+		e = PRVM_FindIndex_Verify(prog, index, start, e, PRVM_FINDINDEX_MATCH_FLOAT, NULL, f, 0);
+	return e;
+}
+
+int PRVM_FindIndex_NextFlags(prvm_prog_t *prog, prvm_findindex_t *index, int start, prvm_int_t flags)
+{
+	int e;
+	unsigned int bits;
+	// flags can't be hashed, but edicts with a 0 value are skipped 32 at a time
+	for (e = start + 1;e < prog->num_edicts;e++)
+	{
+		bits = index->nonzero[e >> 5] >> (e & 31);
+		if (!bits)
+		{
+			e |= 31;
+			continue;
+		}
+		while (!(bits & 1))
+		{
+			bits >>= 1;
+			e++;
+		}
+		if (e >= prog->num_edicts)
+			break;
+		prog->xfunction->builtinsprofile++;
+		if (PRVM_FindIndex_Match(prog, index, e, PRVM_FINDINDEX_MATCH_FLAGS, NULL, 0, flags))
+			break;
+	}
+	if (e >= prog->num_edicts)
+		e = 0;
+	if (prvm_findindex_verify.integer)
+		e = PRVM_FindIndex_Verify(prog, index, start, e, PRVM_FINDINDEX_MATCH_FLAGS, NULL, 0, flags);
+	return e;
+}
+
 //===========================================================================
 
 /*
@@ -352,6 +692,41 @@ ddef_t *PRVM_ED_FieldAtOfs (prvm_prog_t *prog, int ofs)
 	return NULL;
 }
 
+/*
+============
+PRVM_ED_BuildNameHash
+
+Indexes numdefs names, names points at the s_name of the first def and
+stride is the size of the def struct.  Chains are built from the end so a lookup
+finds the first def with a name, the same one a linear search would.
+============
+*/
+static void PRVM_ED_BuildNameHash (prvm_prog_t *prog, prvm_namehash_t *hash, const int *names, int numdefs, size_t stride)
+{
+	int i, numbuckets, bucket;
+	const char *name;
+
+	for (numbuckets = 64;numbuckets < numdefs * 2 && numbuckets < 65536;numbuckets *= 2)
+		;
+	hash->mask = numbuckets - 1;
+	hash->heads = (int *)Mem_Alloc(prog->progs_mempool, numbuckets * sizeof(int));
+	hash->next = (int *)Mem_Alloc(prog->progs_mempool, max(numdefs, 1) * sizeof(int));
+	for (i = 0;i < numbuckets;i++)
+		hash->heads[i] = -1;
+	for (i = numdefs - 1;i >= 0;i--)
+	{
+		name = PRVM_GetString(prog, *(const int *)((const unsigned char *)names + i * stride));
+		bucket = CRC_Block((const unsigned char *)name, strlen(name)) & hash->mask;
+		hash->next[i] = hash->heads[bucket];
+		hash->heads[bucket] = i;
+	}
+}
+
+static int PRVM_ED_NameHashHead (const prvm_namehash_t *hash, const char *name)
+{
+	return hash->heads[CRC_Block((const unsigned char *)name, strlen(name)) & hash->mask];
+}
+
 /*
 ============
 PRVM_ED_FindField
@@ -362,6 +737,18 @@ ddef_t *PRVM_ED_FindField (prvm_prog_t *prog, const char *name)
 	ddef_t *def;
 	int i;
 
+	if (prog->fielddefs_hash.heads)
+	{
+		for (i = PRVM_ED_NameHashHead(&prog->fielddefs_hash, name);i >= 0;i = prog->fielddefs_hash.next[i])
+		{
+			def = &prog->fielddefs[i];
+			if (!strcmp(PRVM_GetString(prog, def->s_name), name))
+				return def;
+		}
+		return NULL;
+	}
+
+	// still loading
 	for (i = 0;i < prog->numfielddefs;i++)
 	{
 		def = &prog->fielddefs[i];
@@ -381,6 +768,18 @@ ddef_t *PRVM_ED_FindGlobal (prvm_prog_t *prog, const char *name)
 	ddef_t *def;
 	int i;
 
+	if (prog->globaldefs_hash.heads)
+	{
+		for (i = PRVM_ED_NameHashHead(&prog->globaldefs_hash, name);i >= 0;i = prog->globaldefs_hash.next[i])
+		{
+			def = &prog->globaldefs[i];
+			if (!strcmp(PRVM_GetString(prog, def->s_name), name))
+				return def;
+		}
+		return NULL;
+	}
+
+	// still loading
 	for (i = 0;i < prog->numglobaldefs;i++)
 	{
 		def = &prog->globaldefs[i];
@@ -401,6 +800,18 @@ mfunction_t *PRVM_ED_FindFunction (prvm_prog_t *prog, const char *name)
 	mfunction_t		*func;
 	int				i;
 
+	if (prog->functions_hash.heads)
+	{
+		for (i = PRVM_ED_NameHashHead(&prog->functions_hash, name);i >= 0;i = prog->functions_hash.next[i])
+		{
+			func = &prog->functions[i];
+			if (!strcmp(PRVM_GetString(prog, func->s_name), name))
+				return func;
+		}
+		return NULL;
+	}
+
+	// still loading
 	for (i = 0;i < prog->numfunctions;i++)
 	{
 		func = &prog->functions[i];
@@ -955,7 +1366,10 @@ qboolean PRVM_ED_ParseEpair(prvm_prog_t *prog, prvm_edict_t *ent, ddef_t *key, c
 	mfunction_t *func;
 
 	if (ent)
+	{
 		val = (prvm_eval_t *)(ent->fields.fp + key->ofs);
+		PRVM_FindIndex_Touch(prog, PRVM_NUM_FOR_EDICT(ent));
+	}
 	else
 		val = (prvm_eval_t *)(prog->globals.fp + key->ofs);
 	switch (key->type & ~DEF_SAVEGLOBAL)
@@ -1559,6 +1973,145 @@ static void PRVM_FindOffsets(prvm_prog_t *prog)
 #undef PRVM_DECLARE_function
 }
 
+/*
+===============
+PRVM_ED_ReorderFields
+
+With prvm_reorderfields the entity fields the engine knows about (the ones
+in prvm_offsets.h) are moved in front of the fields only the mod uses, so
+physics and networking touch a few cache lines per edict instead of the
+whole field block.  The layout stays one flat block per edict, only the
+offsets change: fielddefs and every ev_field global are remapped.  Vectors
+and field arrays (slots without a def of their own) move as one group.
+Field 0 stays in place so zero field globals (unset variables) stay valid,
+and progs whose statements address fields through globals without an
+ev_field def (stripped field constants) are left alone.
+===============
+*/
+static void PRVM_ED_ReorderFields(prvm_prog_t *prog)
+{
+	int i, j, ofs, numhot, numgroups, newofs, numundefined;
+	int *remap, *groupstart;
+	unsigned char *hot, *fieldglobal;
+	const int *engineoffsets;
+	ddef_t *d;
+	mstatement_t *st;
+
+	if (!prog->entityfields)
+		return;
+
+	hot = (unsigned char *)Mem_Alloc(tempmempool, prog->entityfields + prog->numglobals);
+	fieldglobal = hot + prog->entityfields;
+
+	// every global a statement takes a field from has to be one we remap
+	for (i = 0;i < prog->numglobaldefs;i++)
+	{
+		d = &prog->globaldefs[i];
+		if ((d->type & ~DEF_SAVEGLOBAL) == ev_field && d->ofs >= 0 && d->ofs < prog->numglobals)
+			fieldglobal[d->ofs] = true;
+	}
+	numundefined = 0;
+	for (i = 0, st = prog->statements;i < prog->progs_numstatements;i++, st++)
+	{
+		switch (st->op)
+		{
+		case OP_ADDRESS:
+		case OP_LOAD_F:
+		case OP_LOAD_FLD:
+		case OP_LOAD_ENT:
+		case OP_LOAD_S:
+		case OP_LOAD_FNC:
+		case OP_LOAD_V:
+			if (st->operand[1] >= 0 && !fieldglobal[st->operand[1]])
+			{
+				// count each global only once
+				fieldglobal[st->operand[1]] = true;
+				numundefined++;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	if (numundefined)
+	{
+		Con_Printf("%s: prvm_reorderfields: %i field globals have no def (stripped progs?), not reordering fields\n", prog->name, numundefined);
+		Mem_Free(hot);
+		return;
+	}
+
+	// find out which fields the engine uses by looking them up once
+	PRVM_FindOffsets(prog);
+
+	remap = (int *)Mem_Alloc(tempmempool, prog->entityfields * 2 * sizeof(int));
+	groupstart = remap + prog->entityfields;
+
+	// split the slots into groups, each def starts a new group unless it is
+	// the _x/_y/_z part of a vector that is already covered
+	for (i = 0;i < prog->entityfields;i++)
+		groupstart[i] = -1;
+	for (i = 0;i < prog->numfielddefs;i++)
+	{
+		d = &prog->fielddefs[i];
+		if (d->ofs >= 0 && d->ofs < prog->entityfields)
+			groupstart[d->ofs] = d->ofs;
+	}
+	for (i = 0;i < prog->numfielddefs;i++)
+	{
+		d = &prog->fielddefs[i];
+		if ((d->type & ~DEF_SAVEGLOBAL) == ev_vector && d->ofs >= 0 && d->ofs + 2 < prog->entityfields)
+			groupstart[d->ofs + 1] = groupstart[d->ofs + 2] = -2;
+	}
+	groupstart[0] = 0;
+	for (i = 1;i < prog->entityfields;i++)
+		if (groupstart[i] < 0)
+			groupstart[i] = groupstart[i - 1];
+	numgroups = 0;
+	for (i = 0;i < prog->entityfields;i++)
+		if (groupstart[i] == i)
+			numgroups++;
+
+	// a group is hot if the engine has an offset pointing into it, the first
+	// group counts as hot so field 0 keeps its offset
+	engineoffsets = (const int *)&prog->fieldoffsets;
+	for (i = 0;i < (int)(sizeof(prog->fieldoffsets) / sizeof(int));i++)
+		if (engineoffsets[i] >= 0 && engineoffsets[i] < prog->entityfields)
+			hot[groupstart[engineoffsets[i]]] = true;
+	hot[0] = true;
+
+	// hot groups first, then the rest, both in their original order
+	newofs = 0;
+	for (j = 1;j >= 0;j--)
+		for (i = 0;i < prog->entityfields;i++)
+			if (hot[groupstart[i]] == j)
+				remap[i] = newofs++;
+	numhot = 0;
+	for (i = 0;i < prog->entityfields;i++)
+		if (hot[groupstart[i]])
+			numhot++;
+
+	for (i = 0;i < prog->numfielddefs;i++)
+	{
+		d = &prog->fielddefs[i];
+		if (d->ofs >= 0 && d->ofs < prog->entityfields)
+			d->ofs = remap[d->ofs];
+	}
+	// several defs may share a global so go by global, not by def
+	for (i = 0;i < prog->numglobals;i++)
+	{
+		if (!fieldglobal[i])
+			continue;
+		ofs = prog->globals.ip[i];
+		if (ofs > 0 && ofs < prog->entityfields)
+			prog->globals.ip[i] = remap[ofs];
+	}
+
+	Con_DPrintf("%s: moved %i engine field slots in front of %i mod field slots (%i field groups)\n", prog->name, numhot, prog->entityfields - numhot, numgroups);
+
+	Mem_Free(remap);
+	Mem_Free(hot);
+}
+
 // not used
 /*
 typedef struct dpfield_s
@@ -1854,37 +2407,391 @@ void PRVM_Prog_Reset(prvm_prog_t *prog)
 
 /*
 ===============
-PRVM_LoadLNO
+PRVM_ProgsCache
+
+The decoded form of the last progs each VM loaded, keyed on an md4 digest of
+the file, so that loading the same file again (restart, changelevel,
+reconnecting to a server with the same csprogs) skips decoding and checking
+it.  Everything lives in one blob; the parts that are never written after
+loading (statements, line numbers, name hashes) are used in place, the rest is
+copied.
+
+The blob is also stored in cache/<vm>progs_<digest>.dat so the first load of a
+known file after startup can use it too.  It is written in the layout of this
+build, so the file records the struct sizes and byte order it was written
+with.  Cache files are only read from the real gamedir (never from packs, which
+may have been downloaded), and everything they contain is range checked
+before use.
 ===============
 */
-static void PRVM_LoadLNO( prvm_prog_t *prog, const char *progname ) {
-	fs_offset_t filesize;
-	unsigned char *lno;
-	unsigned int *header;
-	char filename[512];
+#define PROGSCACHE_IDENT "DPPROGC"
+#define PROGSCACHE_VERSION 1
 
-	FS_StripExtension( progname, filename, sizeof( filename ) );
-	strlcat( filename, ".lno", sizeof( filename ) );
+typedef struct prvm_progscacheinfo_s
+{
+	// the key, a cached blob is only used if all of these match
+	unsigned char digest[16];
+	int filesize;
+	int numrequiredfields;
+	int numrequiredglobals;
+	int requiredcrc;
+	int numstatements;
+	int numfunctions;
+	int numglobaldefs;
+	int numfielddefs;
+	int numglobals;
+
+	int numexplicitcoveragestatements;
+	int haslinenums;
+	int hascolumnnums;
+	int fielddefsmask;
+	int globaldefsmask;
+	int functionsmask;
+}
+prvm_progscacheinfo_t;
 
-	lno = FS_LoadFile( filename, tempmempool, false, &filesize );
-	if( !lno ) {
-		return;
-	}
+typedef struct prvm_progscachefile_s
+{
+	char ident[8];
+	int version;
+	int layout[5];
+	prvm_progscacheinfo_t info;
+}
+prvm_progscachefile_t;
 
-/*
-<Spike>    SafeWrite (h, &lnotype, sizeof(int));
-<Spike>    SafeWrite (h, &version, sizeof(int));
-<Spike>    SafeWrite (h, &numglobaldefs, sizeof(int));
-<Spike>    SafeWrite (h, &numpr_globals, sizeof(int));
-<Spike>    SafeWrite (h, &numfielddefs, sizeof(int));
-<Spike>    SafeWrite (h, &numstatements, sizeof(int));
-<Spike>    SafeWrite (h, statement_linenums, numstatements*sizeof(int));
-*/
-	if ((unsigned int)filesize < (6 + prog->progs_numstatements) * sizeof(int))
-	{
-		Mem_Free(lno);
-		return;
-	}
+typedef struct prvm_progscache_s
+{
+	prvm_progscacheinfo_t info;
+
+	unsigned char *blob;
+	size_t blobsize;
+	mstatement_t *statements;
+	int *statement_linenums;
+	int *statement_columnnums;
+	mfunction_t *functions;
+	ddef_t *globaldefs;
+	ddef_t *fielddefs;
+	prvm_vec_t *globals;
+	prvm_namehash_t fielddefs_hash;
+	prvm_namehash_t globaldefs_hash;
+	prvm_namehash_t functions_hash;
+}
+prvm_progscache_t;
+
+static mempool_t *prvm_progscache_mempool;
+static prvm_progscache_t prvm_progscache_list[PRVM_PROG_MAX];
+
+// folds the names of the engine defs appended to the progs into the key,
+// their name hash entries are part of the blob
+static int PRVM_ProgsCache_RequiredCRC(int numrequiredfields, const prvm_required_field_t *required_field, int numrequiredglobals, const prvm_required_field_t *required_global)
+{
+	unsigned int crc = 0;
+	int i;
+	for (i = 0;i < numrequiredfields;i++)
+		crc = crc * 31 + CRC_Block((const unsigned char *)required_field[i].name, strlen(required_field[i].name)) + required_field[i].type;
+	for (i = 0;i < numrequiredglobals;i++)
+		crc = crc * 31 + CRC_Block((const unsigned char *)required_global[i].name, strlen(required_global[i].name)) + required_global[i].type;
+	return (int)crc;
+}
+
+static void PRVM_ProgsCache_MakeKey(prvm_prog_t *prog, prvm_progscacheinfo_t *key, const void *data, fs_offset_t filesize, int numrequiredfields, const prvm_required_field_t *required_field, int numrequiredglobals, const prvm_required_field_t *required_global)
+{
+	memset(key, 0, sizeof(*key));
+	Com_BlockFullChecksum((void *)data, (int)filesize, key->digest);
+	key->filesize = (int)filesize;
+	key->numrequiredfields = numrequiredfields;
+	key->numrequiredglobals = numrequiredglobals;
+	key->requiredcrc = PRVM_ProgsCache_RequiredCRC(numrequiredfields, required_field, numrequiredglobals, required_global);
+	key->numstatements = prog->progs_numstatements;
+	key->numfunctions = prog->progs_numfunctions;
+	key->numglobaldefs = prog->progs_numglobaldefs;
+	key->numfielddefs = prog->progs_numfielddefs;
+	key->numglobals = prog->progs_numglobals;
+}
+
+static qboolean PRVM_ProgsCache_KeyMatches(const prvm_progscacheinfo_t *info, const prvm_progscacheinfo_t *key)
+{
+	return !memcmp(info->digest, key->digest, sizeof(key->digest))
+		&& info->filesize == key->filesize
+		&& info->numrequiredfields == key->numrequiredfields
+		&& info->numrequiredglobals == key->numrequiredglobals
+		&& info->requiredcrc == key->requiredcrc
+		&& info->numstatements == key->numstatements
+		&& info->numfunctions == key->numfunctions
+		&& info->numglobaldefs == key->numglobaldefs
+		&& info->numfielddefs == key->numfielddefs
+		&& info->numglobals == key->numglobals;
+}
+
+static void PRVM_ProgsCache_FileName(prvm_prog_t *prog, char *filename, size_t filenamesize, const unsigned char *digest)
+{
+	char hex[33];
+	int i;
+	for (i = 0;i < 16;i++)
+		dpsnprintf(hex + i * 2, 3, "%02x", digest[i]);
+	dpsnprintf(filename, filenamesize, "cache/%sprogs_%s.dat", prog->name, hex);
+}
+
+static void PRVM_ProgsCache_FileLayout(int *layout)
+{
+	layout[0] = 0x01020304; // byte order
+	layout[1] = (int)sizeof(mstatement_t);
+	layout[2] = (int)sizeof(mfunction_t);
+	layout[3] = (int)sizeof(ddef_t);
+	layout[4] = (int)sizeof(prvm_vec_t);
+}
+
+static void *PRVM_ProgsCache_Section(prvm_progscache_t *cache, size_t *offset, size_t size)
+{
+	void *p = cache->blob ? cache->blob + *offset : NULL;
+	*offset += size;
+	return p;
+}
+
+static void PRVM_ProgsCache_HashSections(prvm_progscache_t *cache, size_t *offset, prvm_namehash_t *hash, int mask, int numdefs)
+{
+	hash->mask = mask;
+	hash->heads = (int *)PRVM_ProgsCache_Section(cache, offset, (mask + 1) * sizeof(int));
+	hash->next = (int *)PRVM_ProgsCache_Section(cache, offset, max(numdefs, 1) * sizeof(int));
+}
+
+// points the section pointers into cache->blob (when there is one) and
+// returns the size of the blob cache->info describes
+static size_t PRVM_ProgsCache_Layout(prvm_progscache_t *cache)
+{
+	const prvm_progscacheinfo_t *info = &cache->info;
+	size_t offset = 0;
+
+	// functions (which hold doubles) go first, then the globals, then the
+	// parts that only need 4 byte alignment
+	cache->functions = (mfunction_t *)PRVM_ProgsCache_Section(cache, &offset, info->numfunctions * sizeof(mfunction_t));
+	cache->globals = (prvm_vec_t *)PRVM_ProgsCache_Section(cache, &offset, info->numglobals * sizeof(prvm_vec_t));
+	cache->statements = (mstatement_t *)PRVM_ProgsCache_Section(cache, &offset, info->numstatements * sizeof(mstatement_t));
+	cache->globaldefs = (ddef_t *)PRVM_ProgsCache_Section(cache, &offset, info->numglobaldefs * sizeof(ddef_t));
+	cache->fielddefs = (ddef_t *)PRVM_ProgsCache_Section(cache, &offset, info->numfielddefs * sizeof(ddef_t));
+	cache->statement_linenums = info->haslinenums ? (int *)PRVM_ProgsCache_Section(cache, &offset, info->numstatements * sizeof(int)) : NULL;
+	cache->statement_columnnums = info->hascolumnnums ? (int *)PRVM_ProgsCache_Section(cache, &offset, info->numstatements * sizeof(int)) : NULL;
+	PRVM_ProgsCache_HashSections(cache, &offset, &cache->fielddefs_hash, info->fielddefsmask, info->numfielddefs + info->numrequiredfields);
+	PRVM_ProgsCache_HashSections(cache, &offset, &cache->globaldefs_hash, info->globaldefsmask, info->numglobaldefs + info->numrequiredglobals);
+	PRVM_ProgsCache_HashSections(cache, &offset, &cache->functions_hash, info->functionsmask, info->numfunctions);
+	return offset;
+}
+
+static void PRVM_ProgsCache_Clear(prvm_progscache_t *cache)
+{
+	if (cache->blob)
+		Mem_Free(cache->blob);
+	memset(cache, 0, sizeof(*cache));
+}
+
+// chains must run towards higher indices so a damaged file can not make a
+// lookup loop forever
+static qboolean PRVM_ProgsCache_CheckNameHash(const prvm_namehash_t *hash, int numdefs)
+{
+	int i, numbuckets;
+	for (numbuckets = 64;numbuckets < numdefs * 2 && numbuckets < 65536;numbuckets *= 2)
+		;
+	if (hash->mask != numbuckets - 1)
+		return false;
+	for (i = 0;i < numbuckets;i++)
+		if (hash->heads[i] < -1 || hash->heads[i] >= numdefs)
+			return false;
+	for (i = 0;i < numdefs;i++)
+		if (hash->next[i] != -1 && (hash->next[i] <= i || hash->next[i] >= numdefs))
+			return false;
+	return true;
+}
+
+// the same checks decoding the progs does
+static qboolean PRVM_ProgsCache_Check(const prvm_progscache_t *cache)
+{
+	const prvm_progscacheinfo_t *info = &cache->info;
+	const mstatement_t *st;
+	int i, j;
+
+	for (i = 0, st = cache->statements;i < info->numstatements;i++, st++)
+	{
+		if ((unsigned int)st->op > OP_BITOR)
+			return false;
+		for (j = 0;j < 3;j++)
+			if (st->operand[j] < -1 || st->operand[j] >= info->numglobals)
+				return false;
+		if (st->jumpabsolute < -1 || st->jumpabsolute >= info->numstatements)
+			return false;
+	}
+	for (i = 0;i < info->numfunctions;i++)
+		if (cache->functions[i].first_statement >= info->numstatements)
+			return false;
+	for (i = 0;i < info->numfielddefs;i++)
+		if (cache->fielddefs[i].type & DEF_SAVEGLOBAL)
+			return false;
+	return PRVM_ProgsCache_CheckNameHash(&cache->fielddefs_hash, info->numfielddefs + info->numrequiredfields)
+		&& PRVM_ProgsCache_CheckNameHash(&cache->globaldefs_hash, info->numglobaldefs + info->numrequiredglobals)
+		&& PRVM_ProgsCache_CheckNameHash(&cache->functions_hash, info->numfunctions);
+}
+
+static qboolean PRVM_ProgsCache_Load(prvm_prog_t *prog, prvm_progscache_t *cache, const prvm_progscacheinfo_t *key)
+{
+	char filename[MAX_QPATH];
+	char vabuf[MAX_OSPATH];
+	int layout[5];
+	unsigned char *filedata;
+	fs_offset_t filesize;
+	prvm_progscachefile_t header;
+
+	PRVM_ProgsCache_FileName(prog, filename, sizeof(filename), key->digest);
+	// the same path FS_WriteFile stores to
+	filedata = FS_SysLoadFile(va(vabuf, sizeof(vabuf), "%s/%s", fs_gamedir, filename), tempmempool, true, &filesize);
+	if (!filedata)
+		return false;
+	PRVM_ProgsCache_FileLayout(layout);
+	if (filesize >= (fs_offset_t)sizeof(header))
+	{
+		memcpy(&header, filedata, sizeof(header));
+		if (!memcmp(header.ident, PROGSCACHE_IDENT, 8)
+		 && header.version == PROGSCACHE_VERSION
+		 && !memcmp(header.layout, layout, sizeof(layout))
+		 && PRVM_ProgsCache_KeyMatches(&header.info, key))
+		{
+			cache->info = header.info;
+			cache->info.haslinenums = cache->info.haslinenums != 0;
+			cache->info.hascolumnnums = cache->info.hascolumnnums != 0;
+			// the masks are checked against the def counts after loading,
+			// this only keeps the size computation sane
+			if (cache->info.fielddefsmask >= 0 && cache->info.fielddefsmask < 65536
+			 && cache->info.globaldefsmask >= 0 && cache->info.globaldefsmask < 65536
+			 && cache->info.functionsmask >= 0 && cache->info.functionsmask < 65536)
+			{
+				cache->blobsize = PRVM_ProgsCache_Layout(cache);
+				if (filesize == (fs_offset_t)(sizeof(header) + cache->blobsize))
+				{
+					cache->blob = (unsigned char *)Mem_Alloc(prvm_progscache_mempool, max(cache->blobsize, (size_t)1));
+					memcpy(cache->blob, filedata + sizeof(header), cache->blobsize);
+					PRVM_ProgsCache_Layout(cache);
+					if (PRVM_ProgsCache_Check(cache))
+					{
+						Mem_Free(filedata);
+						return true;
+					}
+				}
+			}
+		}
+	}
+	Con_DPrintf("%s: stale or invalid cache file %s\n", prog->name, filename);
+	PRVM_ProgsCache_Clear(cache);
+	Mem_Free(filedata);
+	return false;
+}
+
+static void PRVM_ProgsCache_Save(prvm_prog_t *prog, const prvm_progscache_t *cache)
+{
+	char filename[MAX_QPATH];
+	prvm_progscachefile_t header;
+	const void *data[2];
+	fs_offset_t len[2];
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.ident, PROGSCACHE_IDENT, 8);
+	header.version = PROGSCACHE_VERSION;
+	PRVM_ProgsCache_FileLayout(header.layout);
+	header.info = cache->info;
+	data[0] = &header;
+	len[0] = sizeof(header);
+	data[1] = cache->blob;
+	len[1] = (fs_offset_t)cache->blobsize;
+	PRVM_ProgsCache_FileName(prog, filename, sizeof(filename), cache->info.digest);
+	if (!FS_WriteFileInBlocks(filename, data, len, 2))
+		Con_DPrintf("%s: could not write cache file %s\n", prog->name, filename);
+}
+
+static prvm_progscache_t *PRVM_ProgsCache_Find(prvm_prog_t *prog, const prvm_progscacheinfo_t *key)
+{
+	prvm_progscache_t *cache = &prvm_progscache_list[prog - prvm_prog_list];
+	if (!prvm_progscache.integer)
+		return NULL;
+	if (cache->blob && PRVM_ProgsCache_KeyMatches(&cache->info, key))
+		return cache;
+	PRVM_ProgsCache_Clear(cache);
+	if (prvm_progscache.integer == 1 && PRVM_ProgsCache_Load(prog, cache, key))
+		return cache;
+	return NULL;
+}
+
+static void PRVM_ProgsCache_CopyNameHash(prvm_namehash_t *out, const prvm_namehash_t *in, int numdefs)
+{
+	memcpy(out->heads, in->heads, (in->mask + 1) * sizeof(int));
+	memcpy(out->next, in->next, max(numdefs, 1) * sizeof(int));
+}
+
+static void PRVM_ProgsCache_Store(prvm_prog_t *prog, const prvm_progscacheinfo_t *key)
+{
+	prvm_progscache_t *cache = &prvm_progscache_list[prog - prvm_prog_list];
+
+	PRVM_ProgsCache_Clear(cache);
+	if (!prvm_progscache.integer)
+		return;
+
+	cache->info = *key;
+	cache->info.numexplicitcoveragestatements = prog->numexplicitcoveragestatements;
+	cache->info.haslinenums = prog->statement_linenums != NULL;
+	cache->info.hascolumnnums = prog->statement_columnnums != NULL;
+	cache->info.fielddefsmask = prog->fielddefs_hash.mask;
+	cache->info.globaldefsmask = prog->globaldefs_hash.mask;
+	cache->info.functionsmask = prog->functions_hash.mask;
+	cache->blobsize = PRVM_ProgsCache_Layout(cache);
+	cache->blob = (unsigned char *)Mem_Alloc(prvm_progscache_mempool, max(cache->blobsize, (size_t)1));
+	PRVM_ProgsCache_Layout(cache);
+
+	memcpy(cache->functions, prog->functions, key->numfunctions * sizeof(mfunction_t));
+	memcpy(cache->globals, prog->globals.fp, key->numglobals * sizeof(prvm_vec_t));
+	memcpy(cache->statements, prog->statements, key->numstatements * sizeof(mstatement_t));
+	memcpy(cache->globaldefs, prog->globaldefs, key->numglobaldefs * sizeof(ddef_t));
+	memcpy(cache->fielddefs, prog->fielddefs, key->numfielddefs * sizeof(ddef_t));
+	if (cache->statement_linenums)
+		memcpy(cache->statement_linenums, prog->statement_linenums, key->numstatements * sizeof(int));
+	if (cache->statement_columnnums)
+		memcpy(cache->statement_columnnums, prog->statement_columnnums, key->numstatements * sizeof(int));
+	PRVM_ProgsCache_CopyNameHash(&cache->fielddefs_hash, &prog->fielddefs_hash, prog->numfielddefs);
+	PRVM_ProgsCache_CopyNameHash(&cache->globaldefs_hash, &prog->globaldefs_hash, prog->numglobaldefs);
+	PRVM_ProgsCache_CopyNameHash(&cache->functions_hash, &prog->functions_hash, prog->numfunctions);
+
+	if (prvm_progscache.integer == 1)
+		PRVM_ProgsCache_Save(prog, cache);
+}
+
+/*
+===============
+PRVM_LoadLNO
+===============
+*/
+static void PRVM_LoadLNO( prvm_prog_t *prog, const char *progname ) {
+	fs_offset_t filesize;
+	unsigned char *lno;
+	unsigned int *header;
+	char filename[512];
+
+	FS_StripExtension( progname, filename, sizeof( filename ) );
+	strlcat( filename, ".lno", sizeof( filename ) );
+
+	lno = FS_LoadFile( filename, tempmempool, false, &filesize );
+	if( !lno ) {
+		return;
+	}
+
+/*
+<Spike>    SafeWrite (h, &lnotype, sizeof(int));
+<Spike>    SafeWrite (h, &version, sizeof(int));
+<Spike>    SafeWrite (h, &numglobaldefs, sizeof(int));
+<Spike>    SafeWrite (h, &numpr_globals, sizeof(int));
+<Spike>    SafeWrite (h, &numfielddefs, sizeof(int));
+<Spike>    SafeWrite (h, &numstatements, sizeof(int));
+<Spike>    SafeWrite (h, statement_linenums, numstatements*sizeof(int));
+*/
+	if ((unsigned int)filesize < (6 + prog->progs_numstatements) * sizeof(int))
+	{
+		Mem_Free(lno);
+		return;
+	}
 
 	header = (unsigned int *) lno;
 	if( header[ 0 ] == *(unsigned int *) "LNOF" &&
@@ -1939,6 +2846,8 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 	char vabuf[1024];
 	char vabuf2[1024];
 	cvar_t *cvar;
+	prvm_progscache_t *cache;
+	prvm_progscacheinfo_t cachekey;
 
 	if (prog->loaded)
 		prog->error_cmd("PRVM_LoadProgs: there is already a %s program loaded!", prog->name );
@@ -1995,6 +2904,15 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 	prog->numglobals = prog->progs_numglobals;
 	prog->entityfields = prog->progs_entityfields;
 
+	// if this exact file was loaded before the decoding and checking below
+	// can be skipped
+	cache = NULL;
+	if (prvm_progscache.integer)
+	{
+		PRVM_ProgsCache_MakeKey(prog, &cachekey, dprograms, filesize, numrequiredfields, required_field, numrequiredglobals, required_global);
+		cache = PRVM_ProgsCache_Find(prog, &cachekey);
+	}
+
 	if (LittleLong(dprograms->ofs_strings) + prog->progs_numstrings > (int)filesize)
 		prog->error_cmd("%s: %s strings go past end of file", prog->name, filename);
 	prog->strings = (char *)Mem_Alloc(prog->progs_mempool, prog->progs_numstrings);
@@ -2003,10 +2921,14 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 
 	prog->numknownstrings = 0;
 	prog->maxknownstrings = 0;
+	prog->freeknownstrings = 0;
 	prog->knownstrings = NULL;
 	prog->knownstrings_freeable = NULL;
+	prog->knownstrings_hash = NULL;
+	prog->knownstrings_next = NULL;
 
 	Mem_ExpandableArray_NewArray(&prog->stringbuffersarray, prog->progs_mempool, sizeof(prvm_stringbuffer_t), 64);
+	Mem_ExpandableArray_NewArray(&prog->hashtablesarray, prog->progs_mempool, sizeof(prvm_hashtable_t), 16);
 
 	// we need to expand the globaldefs and fielddefs to include engine defs
 	prog->globaldefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numglobaldefs + numrequiredglobals) * sizeof(ddef_t));
@@ -2015,35 +2937,49 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 		// when trying to return the last or second-last global
 		// (RETURN always returns a vector, there is no RETURN_F instruction)
 	prog->fielddefs = (ddef_t *)Mem_Alloc(prog->progs_mempool, (prog->progs_numfielddefs + numrequiredfields) * sizeof(ddef_t));
-	// we need to convert the statements to our memory format
-	prog->statements = (mstatement_t *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(mstatement_t));
+	// we need to convert the statements to our memory format, a cached copy
+	// is never written to so it can be used in place
+	if (cache)
+		prog->statements = cache->statements;
+	else
+		prog->statements = (mstatement_t *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(mstatement_t));
 	// allocate space for profiling statement usage
 	prog->statement_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
 	prog->explicit_profile = (double *)Mem_Alloc(prog->progs_mempool, prog->progs_numstatements * sizeof(*prog->statement_profile));
 	// functions need to be converted to the memory format
 	prog->functions = (mfunction_t *)Mem_Alloc(prog->progs_mempool, sizeof(mfunction_t) * prog->progs_numfunctions);
 
-	for (i = 0;i < prog->progs_numfunctions;i++)
+	if (cache)
+		memcpy(prog->functions, cache->functions, prog->progs_numfunctions * sizeof(mfunction_t));
+	else
 	{
-		prog->functions[i].first_statement = LittleLong(infunctions[i].first_statement);
-		prog->functions[i].parm_start = LittleLong(infunctions[i].parm_start);
-		prog->functions[i].s_name = LittleLong(infunctions[i].s_name);
-		prog->functions[i].s_file = LittleLong(infunctions[i].s_file);
-		prog->functions[i].numparms = LittleLong(infunctions[i].numparms);
-		prog->functions[i].locals = LittleLong(infunctions[i].locals);
-		memcpy(prog->functions[i].parm_size, infunctions[i].parm_size, sizeof(infunctions[i].parm_size));
-		if(prog->functions[i].first_statement >= prog->numstatements)
-			prog->error_cmd("PRVM_LoadProgs: out of bounds function statement (function %d) in %s", i, prog->name);
-		// TODO bounds check parm_start, s_name, s_file, numparms, locals, parm_size
+		for (i = 0;i < prog->progs_numfunctions;i++)
+		{
+			prog->functions[i].first_statement = LittleLong(infunctions[i].first_statement);
+			prog->functions[i].parm_start = LittleLong(infunctions[i].parm_start);
+			prog->functions[i].s_name = LittleLong(infunctions[i].s_name);
+			prog->functions[i].s_file = LittleLong(infunctions[i].s_file);
+			prog->functions[i].numparms = LittleLong(infunctions[i].numparms);
+			prog->functions[i].locals = LittleLong(infunctions[i].locals);
+			memcpy(prog->functions[i].parm_size, infunctions[i].parm_size, sizeof(infunctions[i].parm_size));
+			if(prog->functions[i].first_statement >= prog->numstatements)
+				prog->error_cmd("PRVM_LoadProgs: out of bounds function statement (function %d) in %s", i, prog->name);
+			// TODO bounds check parm_start, s_name, s_file, numparms, locals, parm_size
+		}
 	}
 
 	// copy the globaldefs to the new globaldefs list
-	for (i=0 ; i<prog->numglobaldefs ; i++)
+	if (cache)
+		memcpy(prog->globaldefs, cache->globaldefs, prog->progs_numglobaldefs * sizeof(ddef_t));
+	else
 	{
-		prog->globaldefs[i].type = LittleShort(inglobaldefs[i].type);
-		prog->globaldefs[i].ofs = LittleShort(inglobaldefs[i].ofs);
-		prog->globaldefs[i].s_name = LittleLong(inglobaldefs[i].s_name);
-		// TODO bounds check ofs, s_name
+		for (i=0 ; i<prog->numglobaldefs ; i++)
+		{
+			prog->globaldefs[i].type = LittleShort(inglobaldefs[i].type);
+			prog->globaldefs[i].ofs = LittleShort(inglobaldefs[i].ofs);
+			prog->globaldefs[i].s_name = LittleLong(inglobaldefs[i].s_name);
+			// TODO bounds check ofs, s_name
+		}
 	}
 
 	// append the required globals
@@ -2060,14 +2996,19 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 	}
 
 	// copy the progs fields to the new fields list
-	for (i = 0;i < prog->numfielddefs;i++)
+	if (cache)
+		memcpy(prog->fielddefs, cache->fielddefs, prog->progs_numfielddefs * sizeof(ddef_t));
+	else
 	{
-		prog->fielddefs[i].type = LittleShort(infielddefs[i].type);
-		if (prog->fielddefs[i].type & DEF_SAVEGLOBAL)
-			prog->error_cmd("PRVM_LoadProgs: prog->fielddefs[i].type & DEF_SAVEGLOBAL in %s", prog->name);
-		prog->fielddefs[i].ofs = LittleShort(infielddefs[i].ofs);
-		prog->fielddefs[i].s_name = LittleLong(infielddefs[i].s_name);
-		// TODO bounds check ofs, s_name
+		for (i = 0;i < prog->numfielddefs;i++)
+		{
+			prog->fielddefs[i].type = LittleShort(infielddefs[i].type);
+			if (prog->fielddefs[i].type & DEF_SAVEGLOBAL)
+				prog->error_cmd("PRVM_LoadProgs: prog->fielddefs[i].type & DEF_SAVEGLOBAL in %s", prog->name);
+			prog->fielddefs[i].ofs = LittleShort(infielddefs[i].ofs);
+			prog->fielddefs[i].s_name = LittleLong(infielddefs[i].s_name);
+			// TODO bounds check ofs, s_name
+		}
 	}
 
 	// append the required fields
@@ -2083,172 +3024,194 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 		prog->numfielddefs++;
 	}
 
+	// all names are known now, index them for the PRVM_ED_Find* lookups
+	if (cache)
+	{
+		prog->fielddefs_hash = cache->fielddefs_hash;
+		prog->globaldefs_hash = cache->globaldefs_hash;
+		prog->functions_hash = cache->functions_hash;
+	}
+	else
+	{
+		PRVM_ED_BuildNameHash(prog, &prog->fielddefs_hash, &prog->fielddefs[0].s_name, prog->numfielddefs, sizeof(ddef_t));
+		PRVM_ED_BuildNameHash(prog, &prog->globaldefs_hash, &prog->globaldefs[0].s_name, prog->numglobaldefs, sizeof(ddef_t));
+		PRVM_ED_BuildNameHash(prog, &prog->functions_hash, &prog->functions[0].s_name, prog->numfunctions, sizeof(mfunction_t));
+	}
+
 	// LordHavoc: TODO: reorder globals to match engine struct
 	// LordHavoc: TODO: reorder fields to match engine struct
 #define remapglobal(index) (index)
 #define remapfield(index) (index)
 
-	// copy globals
-	// FIXME: LordHavoc: this uses a crude way to identify integer constants, rather than checking for matching globaldefs and checking their type
-	for (i = 0;i < prog->progs_numglobals;i++)
+	if (cache)
+	{
+		memcpy(prog->globals.fp, cache->globals, prog->progs_numglobals * sizeof(prvm_vec_t));
+		prog->numexplicitcoveragestatements = cache->info.numexplicitcoveragestatements;
+	}
+	else
 	{
-		u.i = LittleLong(inglobals[i]);
-		// most globals are 0, we only need to deal with the ones that are not
-		if (u.i)
+		// copy globals
+		// FIXME: LordHavoc: this uses a crude way to identify integer constants, rather than checking for matching globaldefs and checking their type
+		for (i = 0;i < prog->progs_numglobals;i++)
 		{
-			d = u.i & 0xFF800000;
-			if ((d == 0xFF800000) || (d == 0))
+			u.i = LittleLong(inglobals[i]);
+			// most globals are 0, we only need to deal with the ones that are not
+			if (u.i)
 			{
-				// Looks like an integer (expand to int64)
-				prog->globals.ip[remapglobal(i)] = u.i;
-			}
-			else
-			{
-				// Looks like a float (expand to double)
-				prog->globals.fp[remapglobal(i)] = u.f;
+				d = u.i & 0xFF800000;
+				if ((d == 0xFF800000) || (d == 0))
+				{
+					// Looks like an integer (expand to int64)
+					prog->globals.ip[remapglobal(i)] = u.i;
+				}
+				else
+				{
+					// Looks like a float (expand to double)
+					prog->globals.fp[remapglobal(i)] = u.f;
+				}
 			}
 		}
-	}
 
-	// LordHavoc: TODO: support 32bit progs statement formats
-	// copy, remap globals in statements, bounds check
-	for (i = 0;i < prog->progs_numstatements;i++)
-	{
-		op = (opcode_t)LittleShort(instatements[i].op);
-		a = (unsigned short)LittleShort(instatements[i].a);
-		b = (unsigned short)LittleShort(instatements[i].b);
-		c = (unsigned short)LittleShort(instatements[i].c);
-		switch (op)
+		// LordHavoc: TODO: support 32bit progs statement formats
+		// copy, remap globals in statements, bounds check
+		for (i = 0;i < prog->progs_numstatements;i++)
 		{
-		case OP_IF:
-		case OP_IFNOT:
-			b = (short)b;
-			if (a >= prog->progs_numglobals || b + i < 0 || b + i >= prog->progs_numstatements)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds IF/IFNOT (statement %d) in %s", i, prog->name);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = remapglobal(a);
-			prog->statements[i].operand[1] = -1;
-			prog->statements[i].operand[2] = -1;
-			prog->statements[i].jumpabsolute = i + b;
-			break;
-		case OP_GOTO:
-			a = (short)a;
-			if (a + i < 0 || a + i >= prog->progs_numstatements)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds GOTO (statement %d) in %s", i, prog->name);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = -1;
-			prog->statements[i].operand[1] = -1;
-			prog->statements[i].operand[2] = -1;
-			prog->statements[i].jumpabsolute = i + a;
-			break;
-		default:
-			Con_DPrintf("PRVM_LoadProgs: unknown opcode %d at statement %d in %s\n", (int)op, i, prog->name);
-			break;
-		// global global global
-		case OP_ADD_F:
-		case OP_ADD_V:
-		case OP_SUB_F:
-		case OP_SUB_V:
-		case OP_MUL_F:
-		case OP_MUL_V:
-		case OP_MUL_FV:
-		case OP_MUL_VF:
-		case OP_DIV_F:
-		case OP_BITAND:
-		case OP_BITOR:
-		case OP_GE:
-		case OP_LE:
-		case OP_GT:
-		case OP_LT:
-		case OP_AND:
-		case OP_OR:
-		case OP_EQ_F:
-		case OP_EQ_V:
-		case OP_EQ_S:
-		case OP_EQ_E:
-		case OP_EQ_FNC:
-		case OP_NE_F:
-		case OP_NE_V:
-		case OP_NE_S:
-		case OP_NE_E:
-		case OP_NE_FNC:
-		case OP_ADDRESS:
-		case OP_LOAD_F:
-		case OP_LOAD_FLD:
-		case OP_LOAD_ENT:
-		case OP_LOAD_S:
-		case OP_LOAD_FNC:
-		case OP_LOAD_V:
-			if (a >= prog->progs_numglobals || b >= prog->progs_numglobals || c >= prog->progs_numglobals)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d)", i);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = remapglobal(a);
-			prog->statements[i].operand[1] = remapglobal(b);
-			prog->statements[i].operand[2] = remapglobal(c);
-			prog->statements[i].jumpabsolute = -1;
-			break;
-		// global none global
-		case OP_NOT_F:
-		case OP_NOT_V:
-		case OP_NOT_S:
-		case OP_NOT_FNC:
-		case OP_NOT_ENT:
-			if (a >= prog->progs_numglobals || c >= prog->progs_numglobals)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = remapglobal(a);
-			prog->statements[i].operand[1] = -1;
-			prog->statements[i].operand[2] = remapglobal(c);
-			prog->statements[i].jumpabsolute = -1;
-			break;
-		// 2 globals
-		case OP_STOREP_F:
-		case OP_STOREP_ENT:
-		case OP_STOREP_FLD:
-		case OP_STOREP_S:
-		case OP_STOREP_FNC:
-		case OP_STORE_F:
-		case OP_STORE_ENT:
-		case OP_STORE_FLD:
-		case OP_STORE_S:
-		case OP_STORE_FNC:
-		case OP_STATE:
-		case OP_STOREP_V:
-		case OP_STORE_V:
-			if (a >= prog->progs_numglobals || b >= prog->progs_numglobals)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = remapglobal(a);
-			prog->statements[i].operand[1] = remapglobal(b);
-			prog->statements[i].operand[2] = -1;
-			prog->statements[i].jumpabsolute = -1;
-			break;
-		// 1 global
-		case OP_CALL0:
-			if ( a < prog->progs_numglobals)
-				if ( prog->globals.ip[remapglobal(a)] >= 0 )
-					if ( prog->globals.ip[remapglobal(a)] < prog->progs_numfunctions )
-						if ( prog->functions[prog->globals.ip[remapglobal(a)]].first_statement == -642 )
-							++prog->numexplicitcoveragestatements;
-		case OP_CALL1:
-		case OP_CALL2:
-		case OP_CALL3:
-		case OP_CALL4:
-		case OP_CALL5:
-		case OP_CALL6:
-		case OP_CALL7:
-		case OP_CALL8:
-		case OP_DONE:
-		case OP_RETURN:
-			if ( a >= prog->progs_numglobals)
-				prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
-			prog->statements[i].op = op;
-			prog->statements[i].operand[0] = remapglobal(a);
-			prog->statements[i].operand[1] = -1;
-			prog->statements[i].operand[2] = -1;
-			prog->statements[i].jumpabsolute = -1;
-			break;
-		}
+			op = (opcode_t)LittleShort(instatements[i].op);
+			a = (unsigned short)LittleShort(instatements[i].a);
+			b = (unsigned short)LittleShort(instatements[i].b);
+			c = (unsigned short)LittleShort(instatements[i].c);
+			switch (op)
+			{
+			case OP_IF:
+			case OP_IFNOT:
+				b = (short)b;
+				if (a >= prog->progs_numglobals || b + i < 0 || b + i >= prog->progs_numstatements)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds IF/IFNOT (statement %d) in %s", i, prog->name);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = remapglobal(a);
+				prog->statements[i].operand[1] = -1;
+				prog->statements[i].operand[2] = -1;
+				prog->statements[i].jumpabsolute = i + b;
+				break;
+			case OP_GOTO:
+				a = (short)a;
+				if (a + i < 0 || a + i >= prog->progs_numstatements)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds GOTO (statement %d) in %s", i, prog->name);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = -1;
+				prog->statements[i].operand[1] = -1;
+				prog->statements[i].operand[2] = -1;
+				prog->statements[i].jumpabsolute = i + a;
+				break;
+			default:
+				Con_DPrintf("PRVM_LoadProgs: unknown opcode %d at statement %d in %s\n", (int)op, i, prog->name);
+				break;
+			// global global global
+			case OP_ADD_F:
+			case OP_ADD_V:
+			case OP_SUB_F:
+			case OP_SUB_V:
+			case OP_MUL_F:
+			case OP_MUL_V:
+			case OP_MUL_FV:
+			case OP_MUL_VF:
+			case OP_DIV_F:
+			case OP_BITAND:
+			case OP_BITOR:
+			case OP_GE:
+			case OP_LE:
+			case OP_GT:
+			case OP_LT:
+			case OP_AND:
+			case OP_OR:
+			case OP_EQ_F:
+			case OP_EQ_V:
+			case OP_EQ_S:
+			case OP_EQ_E:
+			case OP_EQ_FNC:
+			case OP_NE_F:
+			case OP_NE_V:
+			case OP_NE_S:
+			case OP_NE_E:
+			case OP_NE_FNC:
+			case OP_ADDRESS:
+			case OP_LOAD_F:
+			case OP_LOAD_FLD:
+			case OP_LOAD_ENT:
+			case OP_LOAD_S:
+			case OP_LOAD_FNC:
+			case OP_LOAD_V:
+				if (a >= prog->progs_numglobals || b >= prog->progs_numglobals || c >= prog->progs_numglobals)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d)", i);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = remapglobal(a);
+				prog->statements[i].operand[1] = remapglobal(b);
+				prog->statements[i].operand[2] = remapglobal(c);
+				prog->statements[i].jumpabsolute = -1;
+				break;
+			// global none global
+			case OP_NOT_F:
+			case OP_NOT_V:
+			case OP_NOT_S:
+			case OP_NOT_FNC:
+			case OP_NOT_ENT:
+				if (a >= prog->progs_numglobals || c >= prog->progs_numglobals)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = remapglobal(a);
+				prog->statements[i].operand[1] = -1;
+				prog->statements[i].operand[2] = remapglobal(c);
+				prog->statements[i].jumpabsolute = -1;
+				break;
+			// 2 globals
+			case OP_STOREP_F:
+			case OP_STOREP_ENT:
+			case OP_STOREP_FLD:
+			case OP_STOREP_S:
+			case OP_STOREP_FNC:
+			case OP_STORE_F:
+			case OP_STORE_ENT:
+			case OP_STORE_FLD:
+			case OP_STORE_S:
+			case OP_STORE_FNC:
+			case OP_STATE:
+			case OP_STOREP_V:
+			case OP_STORE_V:
+				if (a >= prog->progs_numglobals || b >= prog->progs_numglobals)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = remapglobal(a);
+				prog->statements[i].operand[1] = remapglobal(b);
+				prog->statements[i].operand[2] = -1;
+				prog->statements[i].jumpabsolute = -1;
+				break;
+			// 1 global
+			case OP_CALL0:
+				if ( a < prog->progs_numglobals)
+					if ( prog->globals.ip[remapglobal(a)] >= 0 )
+						if ( prog->globals.ip[remapglobal(a)] < prog->progs_numfunctions )
+							if ( prog->functions[prog->globals.ip[remapglobal(a)]].first_statement == -642 )
+								++prog->numexplicitcoveragestatements;
+			case OP_CALL1:
+			case OP_CALL2:
+			case OP_CALL3:
+			case OP_CALL4:
+			case OP_CALL5:
+			case OP_CALL6:
+			case OP_CALL7:
+			case OP_CALL8:
+			case OP_DONE:
+			case OP_RETURN:
+				if ( a >= prog->progs_numglobals)
+					prog->error_cmd("PRVM_LoadProgs: out of bounds global index (statement %d) in %s", i, prog->name);
+				prog->statements[i].op = op;
+				prog->statements[i].operand[0] = remapglobal(a);
+				prog->statements[i].operand[1] = -1;
+				prog->statements[i].operand[2] = -1;
+				prog->statements[i].jumpabsolute = -1;
+				break;
+			}
+	}
 	}
 	if(prog->numstatements < 1)
 	{
@@ -2275,7 +3238,17 @@ void PRVM_Prog_Load(prvm_prog_t *prog, const char * filename, unsigned char * da
 		if(PRVM_ED_FindFunction(prog, required_func[i]) == 0)
 			prog->error_cmd("%s: %s not found in %s",prog->name, required_func[i], filename);
 
-	PRVM_LoadLNO(prog, filename);
+	if (cache)
+	{
+		prog->statement_linenums = cache->statement_linenums;
+		prog->statement_columnnums = cache->statement_columnnums;
+	}
+	else
+	{
+		PRVM_LoadLNO(prog, filename);
+		if (prvm_progscache.integer)
+			PRVM_ProgsCache_Store(prog, &cachekey);
+	}
 
 	PRVM_Init_Exec(prog);
 
@@ -2447,6 +3420,9 @@ fail:
 		;
 	}
 
+	if (prvm_reorderfields.integer)
+		PRVM_ED_ReorderFields(prog);
+
 	prog->loaded = TRUE;
 
 	PRVM_UpdateBreakpoints(prog);
@@ -2462,12 +3438,82 @@ fail:
 	// init mempools
 	PRVM_MEM_Alloc(prog);
 
+	PRVM_FindIndex_Init(prog);
+
 	// Inittime is at least the time when this function finished. However,
 	// later events may bump it.
 	prog->inittime = realtime;
 }
 
 
+static const char *PRVM_BuiltinName(prvm_prog_t *prog, int builtinnumber)
+{
+	int i;
+	for (i = 0;i < prog->numfunctions;i++)
+		if (prog->functions[i].first_statement == -builtinnumber)
+			return PRVM_GetString(prog, prog->functions[i].s_name);
+	return "(unnamed)";
+}
+
+static void PRVM_TempStrings_f (void)
+{
+	prvm_prog_t *prog;
+	prvm_tempstrings_t *ts;
+	int i, best, howmany;
+	double max, total;
+	unsigned char *printed;
+
+	if (Cmd_Argc() < 2 || Cmd_Argc() > 3)
+	{
+		Con_Print("prvm_tempstrings <program name> [howmany|reset]\n");
+		return;
+	}
+
+	if (!(prog = PRVM_FriendlyProgFromString(Cmd_Argv(1))))
+		return;
+	ts = &prog->tempstringsbuf;
+
+	if (Cmd_Argc() == 3 && !strcmp(Cmd_Argv(2), "reset"))
+	{
+		if (ts->builtinbytes)
+		{
+			memset(ts->builtinbytes, 0, prog->numbuiltins * sizeof(double));
+			memset(ts->builtinstrings, 0, prog->numbuiltins * sizeof(double));
+		}
+		ts->reclaimedbytes = 0;
+		ts->peaksize = ts->cursize;
+		return;
+	}
+	howmany = Cmd_Argc() == 3 ? atoi(Cmd_Argv(2)) : 20;
+
+	Con_Printf("%s tempstrings: %i segments (%iKB), %iKB in use, peak %iKB, %.0fKB reclaimed on function return\n", prog->name, ts->numsegments, ts->maxsize / 1024, ts->cursize / 1024, ts->peaksize / 1024, ts->reclaimedbytes / 1024);
+	if (!ts->builtinbytes)
+		return;
+	total = 0;
+	for (i = 0;i < prog->numbuiltins;i++)
+		total += ts->builtinbytes[i];
+	Con_Printf("[     Bytes] [   Strings] [share] builtin\n");
+	printed = (unsigned char *)Mem_Alloc(tempmempool, prog->numbuiltins);
+	while (howmany-- > 0)
+	{
+		max = 0;
+		best = -1;
+		for (i = 0;i < prog->numbuiltins;i++)
+		{
+			if (!printed[i] && max < ts->builtinbytes[i])
+			{
+				max = ts->builtinbytes[i];
+				best = i;
+			}
+		}
+		if (best < 0)
+			break;
+		printed[best] = true;
+		Con_Printf("%12.0f %12.0f %6.2f%% %s\n", ts->builtinbytes[best], ts->builtinstrings[best], total > 0 ? ts->builtinbytes[best] * 100.0 / total : 0, best ? PRVM_BuiltinName(prog, best) : "(engine)");
+	}
+	Mem_Free(printed);
+}
+
 static void PRVM_Fields_f (void)
 {
 	prvm_prog_t *prog;
@@ -2901,6 +3947,9 @@ void PRVM_Init (void)
 	Cmd_AddCommand ("prvm_profile", PRVM_Profile_f, "prints execution statistics about the most used QuakeC functions in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_childprofile", PRVM_ChildProfile_f, "prints execution statistics about the most used QuakeC functions in the selected VM (server, client, menu), sorted by time taken in function with child calls");
 	Cmd_AddCommand ("prvm_callprofile", PRVM_CallProfile_f, "prints execution statistics about the most time consuming QuakeC calls from the engine in the selected VM (server, client, menu)");
+	Cmd_AddCommand ("prvm_sampleprofile_write", PRVM_SampleProfile_Write_f, "writes the QC call stacks collected by prvm_sampleprofile in the selected VM (server, client, menu) to a file in folded format for flame graph tools (default qcprofile_<program name>.folded)");
+	Cmd_AddCommand ("prvm_sampleprofile_reset", PRVM_SampleProfile_Reset_f, "discards the QC call stacks collected by prvm_sampleprofile in the selected VM (server, client, menu)");
+	Cmd_AddCommand ("prvm_tempstrings", PRVM_TempStrings_f, "prints tempstring memory use and how many tempstring bytes each builtin created in the selected VM (server, client, menu); with reset as second argument the counters are cleared");
 	Cmd_AddCommand ("prvm_fields", PRVM_Fields_f, "prints usage statistics on properties (how many entities have non-zero values) in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_globals", PRVM_Globals_f, "prints all global variables in the selected VM (server, client, menu)");
 	Cmd_AddCommand ("prvm_global", PRVM_Global_f, "prints value of a specified global variable in the selected VM (server, client, menu)");
@@ -2930,6 +3979,15 @@ void PRVM_Init (void)
 	Cvar_RegisterVariable (&prvm_breakpointdump);
 	Cvar_RegisterVariable (&prvm_reuseedicts_startuptime);
 	Cvar_RegisterVariable (&prvm_reuseedicts_neverinsameframe);
+	Cvar_RegisterVariable (&prvm_reorderfields);
+	Cvar_RegisterVariable (&prvm_tempstrings_scoped);
+	Cvar_RegisterVariable (&prvm_sampleprofile);
+	Cvar_RegisterVariable (&prvm_sampleprofile_builtincost);
+	Cvar_RegisterVariable (&prvm_findindex);
+	Cvar_RegisterVariable (&prvm_findindex_verify);
+	Cvar_RegisterVariable (&prvm_progscache);
+
+	prvm_progscache_mempool = Mem_AllocPool("PRVM progs cache", 0, NULL);
 
 	// COMMANDLINEOPTION: PRVM: -norunaway disables the runaway loop check (it might be impossible to exit DarkPlaces if used!)
 	prvm_runawaycheck = !COM_CheckParm("-norunaway");
@@ -2975,7 +4033,16 @@ const char *PRVM_GetString(prvm_prog_t *prog, int num)
 		// tempstring returned by engine to QC (becomes invalid after returning to engine)
 		num -= prog->stringssize;
 		if (num < prog->tempstringsbuf.cursize)
-			return (char *)prog->tempstringsbuf.data + num;
+		{
+			const unsigned char *s = prog->tempstringsbuf.segments[num >> PRVM_TEMPSTRINGS_SEGMENTBITS] + (num & (PRVM_TEMPSTRINGS_SEGMENTSIZE - 1));
+			int m = num - 1;
+			if (prog->tempstringsbuf.checkreuse && (m < 0 || prog->tempstringsbuf.segments[m >> PRVM_TEMPSTRINGS_SEGMENTBITS][m & (PRVM_TEMPSTRINGS_SEGMENTSIZE - 1)] != PRVM_TEMPSTRINGS_MARKER))
+			{
+				VM_Warning(prog, "PRVM_GetString: temp-string offset %i is no longer valid, it was reclaimed when the function that created it returned\n", num);
+				return "";
+			}
+			return (const char *)s;
+		}
 		else
 		{
 			VM_Warning(prog, "PRVM_GetString: Invalid temp-string offset (%i >= %i prog->tempstringsbuf.cursize)\n", num, prog->tempstringsbuf.cursize);
@@ -3009,6 +4076,109 @@ const char *PRVM_GetString(prvm_prog_t *prog, int num)
 	}
 }
 
+// known strings are found by address through a chained hash table, unused
+// slots are kept on a free list so registering a string never has to scan
+static int PRVM_KnownStrings_Hash(prvm_prog_t *prog, const char *s)
+{
+	unsigned long long p = (unsigned long long)(size_t)s;
+	// allocations are aligned so the low bits carry no information
+	p = (p >> 4) ^ (p >> 20) ^ (p >> 36);
+	return (int)((unsigned int)p * 2654435761u >> 8) & (prog->maxknownstrings - 1);
+}
+
+static void PRVM_KnownStrings_Link(prvm_prog_t *prog, int i)
+{
+	int h = PRVM_KnownStrings_Hash(prog, prog->knownstrings[i]);
+	prog->knownstrings_next[i] = prog->knownstrings_hash[h];
+	prog->knownstrings_hash[h] = i + 1;
+}
+
+static void PRVM_KnownStrings_Unlink(prvm_prog_t *prog, int i)
+{
+	int *link = &prog->knownstrings_hash[PRVM_KnownStrings_Hash(prog, prog->knownstrings[i])];
+	while (*link && *link != i + 1)
+		link = &prog->knownstrings_next[*link - 1];
+	if (*link)
+		*link = prog->knownstrings_next[i];
+	prog->knownstrings_next[i] = 0;
+}
+
+static int PRVM_KnownStrings_Find(prvm_prog_t *prog, const char *s)
+{
+	int i;
+	if (!prog->maxknownstrings)
+		return -1;
+	for (i = prog->knownstrings_hash[PRVM_KnownStrings_Hash(prog, s)];i;i = prog->knownstrings_next[i - 1])
+		if (prog->knownstrings[i - 1] == s)
+			return i - 1;
+	return -1;
+}
+
+static void PRVM_KnownStrings_Grow(prvm_prog_t *prog)
+{
+	int i;
+	const char **oldstrings = prog->knownstrings;
+	const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
+	const char **oldstrings_origin = prog->knownstrings_origin;
+	// double the size so that long sessions don't spend their time copying
+	prog->maxknownstrings = max(128, prog->maxknownstrings * 2);
+	prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
+	prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
+	if(prog->leaktest_active)
+		prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
+	if (prog->numknownstrings)
+	{
+		memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
+		memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
+		if(prog->leaktest_active && oldstrings_origin)
+			memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
+	}
+	if (oldstrings)
+		Mem_Free((char **)oldstrings);
+	if (oldstrings_freeable)
+		Mem_Free((unsigned char *)oldstrings_freeable);
+	if (oldstrings_origin && oldstrings_origin != prog->knownstrings_origin)
+		Mem_Free((char **)oldstrings_origin);
+	// the bucket count follows the capacity, so rehash everything
+	if (prog->knownstrings_hash)
+		Mem_Free(prog->knownstrings_hash);
+	if (prog->knownstrings_next)
+		Mem_Free(prog->knownstrings_next);
+	prog->knownstrings_hash = (int *)PRVM_Alloc(prog->maxknownstrings * sizeof(int));
+	prog->knownstrings_next = (int *)PRVM_Alloc(prog->maxknownstrings * sizeof(int));
+	prog->freeknownstrings = 0;
+	for (i = prog->numknownstrings - 1;i >= 0;i--)
+	{
+		if (prog->knownstrings[i])
+			PRVM_KnownStrings_Link(prog, i);
+		else
+		{
+			prog->knownstrings_next[i] = prog->freeknownstrings;
+			prog->freeknownstrings = i + 1;
+		}
+	}
+}
+
+// returns an unused slot for s, the caller fills in the other arrays
+static int PRVM_KnownStrings_New(prvm_prog_t *prog, const char *s)
+{
+	int i;
+	if (prog->freeknownstrings)
+	{
+		i = prog->freeknownstrings - 1;
+		prog->freeknownstrings = prog->knownstrings_next[i];
+	}
+	else
+	{
+		if (prog->numknownstrings >= prog->maxknownstrings)
+			PRVM_KnownStrings_Grow(prog);
+		i = prog->numknownstrings++;
+	}
+	prog->knownstrings[i] = s;
+	PRVM_KnownStrings_Link(prog, i);
+	return i;
+}
+
 const char *PRVM_ChangeEngineString(prvm_prog_t *prog, int i, const char *s)
 {
 	const char *old;
@@ -3016,55 +4186,40 @@ const char *PRVM_ChangeEngineString(prvm_prog_t *prog, int i, const char *s)
 	if(i < 0 || i >= prog->numknownstrings)
 		prog->error_cmd("PRVM_ChangeEngineString: s is not an engine string");
 	old = prog->knownstrings[i];
+	// a NULL slot is on the free list and can't be reused from here
+	if (!old)
+		prog->error_cmd("PRVM_ChangeEngineString: s is not an engine string");
+	PRVM_KnownStrings_Unlink(prog, i);
 	prog->knownstrings[i] = s;
+	if (s)
+		PRVM_KnownStrings_Link(prog, i);
 	return old;
 }
 
 int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 {
 	int i;
+	const char *segment;
 	if (!s)
 		return 0;
 	if (s >= prog->strings && s <= prog->strings + prog->stringssize)
 		prog->error_cmd("PRVM_SetEngineString: s in prog->strings area");
 	// if it's in the tempstrings area, use a reserved range
 	// (otherwise we'd get millions of useless string offsets cluttering the database)
-	if (s >= (char *)prog->tempstringsbuf.data && s < (char *)prog->tempstringsbuf.data + prog->tempstringsbuf.maxsize)
-		return prog->stringssize + (s - (char *)prog->tempstringsbuf.data);
+	for (i = prog->tempstringsbuf.numsegments - 1;i >= 0;i--)
+	{
+		segment = (const char *)prog->tempstringsbuf.segments[i];
+		if (s >= segment && s < segment + PRVM_TEMPSTRINGS_SEGMENTSIZE)
+			return prog->stringssize + (i << PRVM_TEMPSTRINGS_SEGMENTBITS) + (int)(s - segment);
+	}
 	// see if it's a known string address
-	for (i = 0;i < prog->numknownstrings;i++)
-		if (prog->knownstrings[i] == s)
-			return PRVM_KNOWNSTRINGBASE + i;
+	i = PRVM_KnownStrings_Find(prog, s);
+	if (i >= 0)
+		return PRVM_KNOWNSTRINGBASE + i;
 	// new unknown engine string
 	if (developer_insane.integer)
 		Con_DPrintf("new engine string %p = \"%s\"\n", s, s);
-	for (i = prog->firstfreeknownstring;i < prog->numknownstrings;i++)
-		if (!prog->knownstrings[i])
-			break;
-	if (i >= prog->numknownstrings)
-	{
-		if (i >= prog->maxknownstrings)
-		{
-			const char **oldstrings = prog->knownstrings;
-			const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
-			const char **oldstrings_origin = prog->knownstrings_origin;
-			prog->maxknownstrings += 128;
-			prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
-			if(prog->leaktest_active)
-				prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			if (prog->numknownstrings)
-			{
-				memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
-				memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
-				if(prog->leaktest_active)
-					memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
-			}
-		}
-		prog->numknownstrings++;
-	}
-	prog->firstfreeknownstring = i + 1;
-	prog->knownstrings[i] = s;
+	i = PRVM_KnownStrings_New(prog, s);
 	prog->knownstrings_freeable[i] = false;
 	if(prog->leaktest_active)
 		prog->knownstrings_origin[i] = NULL;
@@ -3078,41 +4233,142 @@ int PRVM_SetEngineString(prvm_prog_t *prog, const char *s)
 // (technically each PRVM_ExecuteProgram call saves the cursize value and
 //  restores it on return, so multiple recursive calls can share the same
 //  buffer)
-// the buffer size is automatically grown as needed
+// the buffer size is automatically grown as needed, by adding segments so
+// that existing tempstrings never move
+//
+// in addition each QC function call records cursize when it is entered, and
+// when it returns the tempstrings it created are reclaimed unless one of them
+// may still be referenced: it is returned, or it was stored anywhere other
+// than the function's own locals or the parameters of a call it makes (the
+// stores raise tempstringsbuf.keep, see PRVM_TempStrings_Escape)
+
+static char *PRVM_TempStrings_Alloc(prvm_prog_t *prog, int size, int *offset)
+{
+	prvm_tempstrings_t *ts = &prog->tempstringsbuf;
+	int i, o, numsegments, prefix;
+	unsigned char *data;
+
+	// strings above cursize are gone, so they can't be kept either
+	if (ts->keep > ts->cursize)
+		ts->keep = ts->cursize;
+	if (!ts->cursize)
+		ts->checkreuse = developer.integer > 0;
+	prefix = ts->checkreuse ? ts->skew + 1 : 0;
+	size += prefix;
+	// find room in the allocation cursize is in, or a later one
+	o = ts->cursize;
+	while (o < ts->maxsize && o + size > ts->segmentend[o >> PRVM_TEMPSTRINGS_SEGMENTBITS])
+		o = ts->segmentend[o >> PRVM_TEMPSTRINGS_SEGMENTBITS];
+	if (o >= ts->maxsize)
+	{
+		o = ts->maxsize;
+		numsegments = (size + PRVM_TEMPSTRINGS_SEGMENTSIZE - 1) >> PRVM_TEMPSTRINGS_SEGMENTBITS;
+		if (ts->numsegments + numsegments > PRVM_TEMPSTRINGS_MAXSEGMENTS)
+			prog->error_cmd("PRVM_SetTempString: ran out of tempstring memory!  (refusing to grow tempstring buffer over 256MB, cursize %i, size %i)\n", ts->cursize, size);
+		data = (unsigned char *)Mem_Alloc(prog->progs_mempool, numsegments << PRVM_TEMPSTRINGS_SEGMENTBITS);
+		for (i = 0;i < numsegments;i++)
+		{
+			ts->segments[ts->numsegments + i] = data + (i << PRVM_TEMPSTRINGS_SEGMENTBITS);
+			ts->segmentend[ts->numsegments + i] = o + (numsegments << PRVM_TEMPSTRINGS_SEGMENTBITS);
+		}
+		ts->numsegments += numsegments;
+		ts->maxsize += numsegments << PRVM_TEMPSTRINGS_SEGMENTBITS;
+		Con_DPrintf("PRVM_SetTempString: enlarging tempstrings buffer (%iKB -> %iKB)\n", o/1024, ts->maxsize/1024);
+	}
+	ts->cursize = o + size;
+	ts->peaksize = max(ts->peaksize, ts->cursize);
+
+	if (!ts->builtinbytes && prog->numbuiltins)
+	{
+		ts->builtinbytes = (double *)PRVM_Alloc(prog->numbuiltins * sizeof(double));
+		ts->builtinstrings = (double *)PRVM_Alloc(prog->numbuiltins * sizeof(double));
+	}
+	if (ts->builtin < prog->numbuiltins)
+	{
+		ts->builtinbytes[ts->builtin] += size - prefix;
+		ts->builtinstrings[ts->builtin]++;
+	}
+
+	data = ts->segments[o >> PRVM_TEMPSTRINGS_SEGMENTBITS] + (o & (PRVM_TEMPSTRINGS_SEGMENTSIZE - 1));
+	if (prefix)
+	{
+		memset(data, PRVM_TEMPSTRINGS_POISON, prefix - 1);
+		data[prefix - 1] = PRVM_TEMPSTRINGS_MARKER;
+	}
+	*offset = o + prefix;
+	return (char *)data + prefix;
+}
 
 int PRVM_SetTempString(prvm_prog_t *prog, const char *s)
 {
-	int size;
+	int size, offset;
 	char *t;
 	if (!s)
 		return 0;
 	size = (int)strlen(s) + 1;
 	if (developer_insane.integer)
 		Con_DPrintf("PRVM_SetTempString: cursize %i, size %i\n", prog->tempstringsbuf.cursize, size);
-	if (prog->tempstringsbuf.maxsize < prog->tempstringsbuf.cursize + size)
-	{
-		sizebuf_t old = prog->tempstringsbuf;
-		if (prog->tempstringsbuf.cursize + size >= 1<<28)
-			prog->error_cmd("PRVM_SetTempString: ran out of tempstring memory!  (refusing to grow tempstring buffer over 256MB, cursize %i, size %i)\n", prog->tempstringsbuf.cursize, size);
-		prog->tempstringsbuf.maxsize = max(prog->tempstringsbuf.maxsize, 65536);
-		while (prog->tempstringsbuf.maxsize < prog->tempstringsbuf.cursize + size)
-			prog->tempstringsbuf.maxsize *= 2;
-		if (prog->tempstringsbuf.maxsize != old.maxsize || prog->tempstringsbuf.data == NULL)
-		{
-			Con_DPrintf("PRVM_SetTempString: enlarging tempstrings buffer (%iKB -> %iKB)\n", old.maxsize/1024, prog->tempstringsbuf.maxsize/1024);
-			prog->tempstringsbuf.data = (unsigned char *) Mem_Alloc(prog->progs_mempool, prog->tempstringsbuf.maxsize);
-			if (old.data)
-			{
-				if (old.cursize)
-					memcpy(prog->tempstringsbuf.data, old.data, old.cursize);
-				Mem_Free(old.data);
-			}
-		}
-	}
-	t = (char *)prog->tempstringsbuf.data + prog->tempstringsbuf.cursize;
+	t = PRVM_TempStrings_Alloc(prog, size, &offset);
 	memcpy(t, s, size);
-	prog->tempstringsbuf.cursize += size;
-	return PRVM_SetEngineString(prog, t);
+	return prog->stringssize + offset;
+}
+
+// all current tempstrings may be referenced from outside the function that
+// is executing, used by builtins that store tempstrings in globals
+void PRVM_TempStrings_Keep(prvm_prog_t *prog)
+{
+	prog->tempstringsbuf.keep = prog->tempstringsbuf.cursize;
+}
+
+// called by the interpreter when a tempstring created since the last keep
+// is stored to global globalofs, or through a pointer if globalofs is -1
+void PRVM_TempStrings_Escape(prvm_prog_t *prog, int globalofs)
+{
+	mfunction_t *f = prog->xfunction;
+	if (globalofs >= 0)
+	{
+		// call parameters are copied to the callee's locals
+		if (globalofs < RESERVED_OFS)
+			return;
+		if (f && globalofs >= f->parm_start && globalofs < f->parm_start + f->locals)
+			return;
+	}
+	prog->tempstringsbuf.keep = prog->tempstringsbuf.cursize;
+}
+
+// fills reclaimed tempstring space (except the final terminator, so a
+// dangling pointer reads a visible garbage string rather than running on)
+// and moves the next strings to different offsets
+static void PRVM_TempStrings_Poison(prvm_prog_t *prog, int start, int end)
+{
+	prvm_tempstrings_t *ts = &prog->tempstringsbuf;
+	int o, n;
+	for (o = start;o < end - 1;o += n)
+	{
+		n = min(end - 1, ts->segmentend[o >> PRVM_TEMPSTRINGS_SEGMENTBITS]) - o;
+		n = min(n, PRVM_TEMPSTRINGS_SEGMENTSIZE - (o & (PRVM_TEMPSTRINGS_SEGMENTSIZE - 1)));
+		memset(ts->segments[o >> PRVM_TEMPSTRINGS_SEGMENTBITS] + (o & (PRVM_TEMPSTRINGS_SEGMENTSIZE - 1)), PRVM_TEMPSTRINGS_POISON, n);
+	}
+	ts->skew = (ts->skew + 1) & 7;
+}
+
+// called when a function returns, mark is cursize when it was entered
+void PRVM_TempStrings_Reclaim(prvm_prog_t *prog, int mark)
+{
+	prvm_tempstrings_t *ts = &prog->tempstringsbuf;
+	int ret;
+	mark = max(mark, ts->keep);
+	if (ts->cursize <= mark)
+		return;
+	// a returned tempstring lives on in the caller (this may also be an
+	// unrelated value that happens to look like one, which just keeps them)
+	ret = PRVM_G_INT(OFS_RETURN) - prog->stringssize;
+	if (ret >= mark && ret < ts->cursize)
+		return;
+	ts->reclaimedbytes += ts->cursize - mark;
+	if (ts->checkreuse)
+		PRVM_TempStrings_Poison(prog, mark, ts->cursize);
+	ts->cursize = mark;
 }
 
 int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer)
@@ -3124,39 +4380,7 @@ int PRVM_AllocString(prvm_prog_t *prog, size_t bufferlength, char **pointer)
 			*pointer = NULL;
 		return 0;
 	}
-	for (i = prog->firstfreeknownstring;i < prog->numknownstrings;i++)
-		if (!prog->knownstrings[i])
-			break;
-	if (i >= prog->numknownstrings)
-	{
-		if (i >= prog->maxknownstrings)
-		{
-			const char **oldstrings = prog->knownstrings;
-			const unsigned char *oldstrings_freeable = prog->knownstrings_freeable;
-			const char **oldstrings_origin = prog->knownstrings_origin;
-			prog->maxknownstrings += 128;
-			prog->knownstrings = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			prog->knownstrings_freeable = (unsigned char *)PRVM_Alloc(prog->maxknownstrings * sizeof(unsigned char));
-			if(prog->leaktest_active)
-				prog->knownstrings_origin = (const char **)PRVM_Alloc(prog->maxknownstrings * sizeof(char *));
-			if (prog->numknownstrings)
-			{
-				memcpy((char **)prog->knownstrings, oldstrings, prog->numknownstrings * sizeof(char *));
-				memcpy((char **)prog->knownstrings_freeable, oldstrings_freeable, prog->numknownstrings * sizeof(unsigned char));
-				if(prog->leaktest_active)
-					memcpy((char **)prog->knownstrings_origin, oldstrings_origin, prog->numknownstrings * sizeof(char *));
-			}
-			if (oldstrings)
-				Mem_Free((char **)oldstrings);
-			if (oldstrings_freeable)
-				Mem_Free((unsigned char *)oldstrings_freeable);
-			if (oldstrings_origin)
-				Mem_Free((char **)oldstrings_origin);
-		}
-		prog->numknownstrings++;
-	}
-	prog->firstfreeknownstring = i + 1;
-	prog->knownstrings[i] = (char *)PRVM_Alloc(bufferlength);
+	i = PRVM_KnownStrings_New(prog, (char *)PRVM_Alloc(bufferlength));
 	prog->knownstrings_freeable[i] = true;
 	if(prog->leaktest_active)
 		prog->knownstrings_origin[i] = PRVM_AllocationOrigin(prog);
@@ -3178,13 +4402,17 @@ void PRVM_FreeString(prvm_prog_t *prog, int num)
 			prog->error_cmd("PRVM_FreeString: attempt to free a non-existent or already freed string");
 		if (!prog->knownstrings_freeable[num])
 			prog->error_cmd("PRVM_FreeString: attempt to free a string owned by the engine");
+		PRVM_KnownStrings_Unlink(prog, num);
 		PRVM_Free((char *)prog->knownstrings[num]);
 		if(prog->leaktest_active)
 			if(prog->knownstrings_origin[num])
 				PRVM_Free((char *)prog->knownstrings_origin[num]);
 		prog->knownstrings[num] = NULL;
 		prog->knownstrings_freeable[num] = false;
-		prog->firstfreeknownstring = min(prog->firstfreeknownstring, num);
+		if(prog->leaktest_active)
+			prog->knownstrings_origin[num] = NULL;
+		prog->knownstrings_next[num] = prog->freeknownstrings;
+		prog->freeknownstrings = num + 1;
 	}
 	else
 		prog->error_cmd("PRVM_FreeString: invalid string offset %i", num);
@@ -3417,6 +4645,17 @@ void PRVM_LeakTest(prvm_prog_t *prog)
 		}
 	}
 
+	for (i = 0; i < (int)Mem_ExpandableArray_IndexRange(&prog->hashtablesarray); ++i)
+	{
+		prvm_hashtable_t *table = (prvm_hashtable_t*) Mem_ExpandableArray_RecordAtIndex(&prog->hashtablesarray, i);
+		if(table)
+		if(table->origin)
+		{
+			Con_Printf("Open hashtable handle found!\n  Allocated at: %s\n", table->origin);
+			leaked = true;
+		}
+	}
+
 	for(i = 0; i < PRVM_MAX_OPENFILES; ++i)
 	{
 		if(prog->openfiles[i])
@@ -122,6 +122,9 @@ PRVM_PrintStatement
 extern cvar_t prvm_coverage;
 extern cvar_t prvm_statementprofiling;
 extern cvar_t prvm_timeprofiling;
+extern cvar_t prvm_tempstrings_scoped;
+extern cvar_t prvm_sampleprofile;
+extern cvar_t prvm_sampleprofile_builtincost;
 static void PRVM_PrintStatement(prvm_prog_t *prog, mstatement_t *s)
 {
 	size_t i;
@@ -506,6 +509,165 @@ void PRVM_ChildProfile_f (void)
 	PRVM_Profile(prog, howmany, 0, 1);
 }
 
+/*
+============
+PRVM_SampleProfile_Sample
+
+Records the current QC call stack, called from the interpreter when
+prog->sampleprofile.countdown runs out; leaf is the builtin being called or NULL
+============
+*/
+void PRVM_SampleProfile_Sample(prvm_prog_t *prog, mfunction_t *leaf)
+{
+	prvm_sampleprofile_t *sp = &prog->sampleprofile;
+	prvm_samplestack_t *stack;
+	int frames[PRVM_MAX_STACK_DEPTH + 2];
+	int i, numframes;
+	unsigned int hash;
+
+	if (prvm_sampleprofile.integer <= 0)
+	{
+		sp->countdown = 0;
+		return;
+	}
+	// jitter the interval so that samples do not lock step with loops
+	sp->countdown = prvm_sampleprofile.integer / 2 + 1 + rand() % prvm_sampleprofile.integer;
+	sp->builtincost = max(0, prvm_sampleprofile_builtincost.integer);
+
+	// same walk as PRVM_StackTrace, but root first
+	numframes = 0;
+	for (i = 1;i < prog->depth;i++)
+		if (prog->stack[i].f)
+			frames[numframes++] = (int)(prog->stack[i].f - prog->functions);
+	if (prog->xfunction)
+		frames[numframes++] = (int)(prog->xfunction - prog->functions);
+	if (leaf)
+		frames[numframes++] = (int)(leaf - prog->functions);
+	if (!numframes)
+		return;
+	sp->samples++;
+
+	hash = CRC_Block((const unsigned char *)frames, numframes * sizeof(int));
+	for (i = sp->hash[hash & (PRVM_SAMPLEPROFILE_HASHSIZE - 1)];i;i = stack->next)
+	{
+		stack = sp->stacks + i - 1;
+		if (stack->hash == hash && stack->numframes == numframes && !memcmp(sp->frames + stack->firstframe, frames, numframes * sizeof(int)))
+		{
+			stack->count++;
+			return;
+		}
+	}
+
+	// a new stack
+	if (sp->numstacks >= PRVM_SAMPLEPROFILE_MAXSTACKS)
+	{
+		sp->dropped++;
+		return;
+	}
+	if (sp->numstacks >= sp->maxstacks)
+	{
+		sp->maxstacks = max(256, sp->maxstacks * 2);
+		sp->stacks = (prvm_samplestack_t *)Mem_Realloc(prog->progs_mempool, sp->stacks, sp->maxstacks * sizeof(prvm_samplestack_t));
+	}
+	if (sp->numframes + numframes > sp->maxframes)
+	{
+		sp->maxframes = max(sp->numframes + numframes, max(4096, sp->maxframes * 2));
+		sp->frames = (int *)Mem_Realloc(prog->progs_mempool, sp->frames, sp->maxframes * sizeof(int));
+	}
+	stack = sp->stacks + sp->numstacks++;
+	stack->hash = hash;
+	stack->firstframe = sp->numframes;
+	stack->numframes = numframes;
+	stack->count = 1;
+	stack->next = sp->hash[hash & (PRVM_SAMPLEPROFILE_HASHSIZE - 1)];
+	sp->hash[hash & (PRVM_SAMPLEPROFILE_HASHSIZE - 1)] = sp->numstacks;
+	memcpy(sp->frames + sp->numframes, frames, numframes * sizeof(int));
+	sp->numframes += numframes;
+}
+
+/*
+============
+PRVM_SampleProfile_Write_f
+
+Writes the stacks collected by prvm_sampleprofile as one "func;func;func count"
+line each, the input format of flamegraph.pl and similar tools
+============
+*/
+void PRVM_SampleProfile_Write_f (void)
+{
+	prvm_prog_t *prog;
+	prvm_sampleprofile_t *sp;
+	prvm_samplestack_t *stack;
+	qfile_t *f;
+	char filename[MAX_QPATH];
+	int i, j;
+
+	if (Cmd_Argc() != 2 && Cmd_Argc() != 3)
+	{
+		Con_Print("prvm_sampleprofile_write <program name> [filename]\n");
+		return;
+	}
+
+	if (!(prog = PRVM_FriendlyProgFromString(Cmd_Argv(1))))
+		return;
+
+	sp = &prog->sampleprofile;
+	if (!sp->numstacks)
+	{
+		Con_Printf("%s: no samples collected, set prvm_sampleprofile to the number of statements between samples\n", prog->name);
+		return;
+	}
+
+	if (Cmd_Argc() == 3)
+		strlcpy(filename, Cmd_Argv(2), sizeof(filename));
+	else
+		dpsnprintf(filename, sizeof(filename), "qcprofile_%s.folded", prog->name);
+	f = FS_OpenRealFile(filename, "w", false);
+	if (!f)
+	{
+		Con_Printf("prvm_sampleprofile_write: couldn't open %s for writing\n", filename);
+		return;
+	}
+	for (i = 0, stack = sp->stacks;i < sp->numstacks;i++, stack++)
+	{
+		for (j = 0;j < stack->numframes;j++)
+			FS_Printf(f, "%s%s", j ? ";" : "", PRVM_GetString(prog, prog->functions[sp->frames[stack->firstframe + j]].s_name));
+		FS_Printf(f, " %i\n", stack->count);
+	}
+	FS_Close(f);
+	Con_Printf("%s: wrote %i stacks from %.0f samples to %s", prog->name, sp->numstacks, sp->samples, filename);
+	if (sp->dropped)
+		Con_Printf(" (%.0f samples of new stacks dropped, the table is full)", sp->dropped);
+	Con_Print("\n");
+}
+
+void PRVM_SampleProfile_Reset_f (void)
+{
+	prvm_prog_t *prog;
+	prvm_sampleprofile_t *sp;
+
+	if (Cmd_Argc() != 2)
+	{
+		Con_Print("prvm_sampleprofile_reset <program name>\n");
+		return;
+	}
+
+	if (!(prog = PRVM_FriendlyProgFromString(Cmd_Argv(1))))
+		return;
+
+	sp = &prog->sampleprofile;
+	if (sp->stacks)
+		Mem_Free(sp->stacks);
+	if (sp->frames)
+		Mem_Free(sp->frames);
+	sp->stacks = NULL;
+	sp->frames = NULL;
+	sp->numstacks = sp->maxstacks = 0;
+	sp->numframes = sp->maxframes = 0;
+	sp->samples = sp->dropped = 0;
+	memset(sp->hash, 0, sizeof(sp->hash));
+}
+
 void PRVM_PrintState(prvm_prog_t *prog, int stack_index)
 {
 	int i;
@@ -558,6 +720,8 @@ void PRVM_Crash(prvm_prog_t *prog)
 
 	// delete all tempstrings (FIXME: is this safe in VM->engine->VM recursion?)
 	prog->tempstringsbuf.cursize = 0;
+	prog->tempstringsbuf.keep = 0;
+	prog->tempstringsbuf.builtin = 0;
 
 	// reset the prog pointer
 	prog = NULL;
@@ -590,6 +754,7 @@ static int PRVM_EnterFunction (prvm_prog_t *prog, mfunction_t *f)
 	prog->stack[prog->depth].profile_acc = -f->profile;
 	prog->stack[prog->depth].tprofile_acc = -f->tprofile + -f->tbprofile;
 	prog->stack[prog->depth].builtinsprofile_acc = -f->builtinsprofile;
+	prog->stack[prog->depth].tempstrings_mark = prog->tempstringsbuf.cursize;
 	prog->depth++;
 	if (prog->depth >=PRVM_MAX_STACK_DEPTH)
 		prog->error_cmd("stack overflow");
@@ -645,6 +810,8 @@ static int PRVM_LeaveFunction (prvm_prog_t *prog)
 
 // up stack
 	prog->depth--;
+	if (prvm_tempstrings_scoped.integer)
+		PRVM_TempStrings_Reclaim(prog, prog->stack[prog->depth].tempstrings_mark);
 	f = prog->xfunction;
 	--f->recursion;
 	prog->xfunction = prog->stack[prog->depth].f;
@@ -787,6 +954,13 @@ void MVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessag
 	starttm = calltime;
 	// instead of counting instructions, we count jumps
 	jumpcount = 0;
+	// start sampling once prvm_sampleprofile is set, PRVM_SampleProfile_Sample
+	// takes care of the interval after that
+	if (prog->sampleprofile.countdown <= 0 && prvm_sampleprofile.integer > 0)
+	{
+		prog->sampleprofile.countdown = prvm_sampleprofile.integer;
+		prog->sampleprofile.builtincost = max(0, prvm_sampleprofile_builtincost.integer);
+	}
 	// add one to the callcount of this function because otherwise engine-called functions aren't counted
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
@@ -828,6 +1002,10 @@ cleanup:
 	// delete tempstrings created by this function
 	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
+	// back in the engine, so no field stores can be pending any more
+	if (!exitdepth && prog->findindex_numdirty)
+		PRVM_FindIndex_Flush(prog);
+
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	func->totaltime += tm;
 
@@ -894,6 +1072,13 @@ void CLVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	starttm = calltime;
 	// instead of counting instructions, we count jumps
 	jumpcount = 0;
+	// start sampling once prvm_sampleprofile is set, PRVM_SampleProfile_Sample
+	// takes care of the interval after that
+	if (prog->sampleprofile.countdown <= 0 && prvm_sampleprofile.integer > 0)
+	{
+		prog->sampleprofile.countdown = prvm_sampleprofile.integer;
+		prog->sampleprofile.builtincost = max(0, prvm_sampleprofile_builtincost.integer);
+	}
 	// add one to the callcount of this function because otherwise engine-called functions aren't counted
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
@@ -935,6 +1120,10 @@ cleanup:
 	// delete tempstrings created by this function
 	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
+	// back in the engine, so no field stores can be pending any more
+	if (!exitdepth && prog->findindex_numdirty)
+		PRVM_FindIndex_Flush(prog);
+
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	func->totaltime += tm;
 
@@ -1005,6 +1194,13 @@ void PRVM_ExecuteProgram (prvm_prog_t *prog, func_t fnum, const char *errormessa
 	starttm = calltime;
 	// instead of counting instructions, we count jumps
 	jumpcount = 0;
+	// start sampling once prvm_sampleprofile is set, PRVM_SampleProfile_Sample
+	// takes care of the interval after that
+	if (prog->sampleprofile.countdown <= 0 && prvm_sampleprofile.integer > 0)
+	{
+		prog->sampleprofile.countdown = prvm_sampleprofile.integer;
+		prog->sampleprofile.builtincost = max(0, prvm_sampleprofile_builtincost.integer);
+	}
 	// add one to the callcount of this function because otherwise engine-called functions aren't counted
 	if (prog->xfunction->callcount++ == 0 && (prvm_coverage.integer & 1))
 		PRVM_FunctionCoverageEvent(prog, prog->xfunction);
@@ -1046,6 +1242,10 @@ cleanup:
 	// delete tempstrings created by this function
 	prog->tempstringsbuf.cursize = restorevm_tempstringsbuf_cursize;
 
+	// back in the engine, so no field stores can be pending any more
+	if (!exitdepth && prog->findindex_numdirty)
+		PRVM_FindIndex_Flush(prog);
+
 	tm = Sys_DirtyTime() - calltime;if (tm < 0 || tm >= 1800) tm = 0;
 	func->totaltime += tm;
 
@@ -1,6 +1,8 @@
 // NEED to reset startst after calling this! startst may or may not be clobbered!
 #define ADVANCE_PROFILE_BEFORE_JUMP() \
 	prog->xfunction->profile += (st - startst); \
+	if (prog->sampleprofile.countdown > 0 && (prog->sampleprofile.countdown -= (int)(st - startst)) <= 0) \
+		PRVM_SampleProfile_Sample(prog, NULL); \
 	if (prvm_statementprofiling.integer || (prvm_coverage.integer & 4)) { \
 		/* All statements from startst+1 to st have been hit. */ \
 		while (++startst <= st) { \
@@ -284,6 +286,9 @@
 			HANDLE_OPCODE(OP_STORE_S):
 			HANDLE_OPCODE(OP_STORE_FNC):		// pointers
 				OPB->_int = OPA->_int;
+				// a tempstring stored outside this function's locals has to outlive it
+				if (OPA->_int - prog->stringssize >= prog->tempstringsbuf.keep && OPA->_int - prog->stringssize < prog->tempstringsbuf.cursize)
+					PRVM_TempStrings_Escape(prog, st->operand[1]);
 				DISPATCH_OPCODE();
 			HANDLE_OPCODE(OP_STORE_V):
 				OPB->ivector[0] = OPA->ivector[0];
@@ -310,8 +315,13 @@
 						VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name);
 					}
 				}
+				// a store to an indexed field is relinked at the next lookup
+				if (prog->findindex_fieldmap && prog->findindex_fieldmap[OPB->_int % cached_entityfields])
+					PRVM_FindIndex_Touch(prog, OPB->_int / cached_entityfields);
 				ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int);
 				ptr->_int = OPA->_int;
+				if (OPA->_int - prog->stringssize >= prog->tempstringsbuf.keep && OPA->_int - prog->stringssize < prog->tempstringsbuf.cursize)
+					PRVM_TempStrings_Escape(prog, -1);
 				DISPATCH_OPCODE();
 			HANDLE_OPCODE(OP_STOREP_V):
 				if ((prvm_uint_t)OPB->_int - cached_entityfields > (prvm_uint_t)cached_entityfieldsarea_entityfields_3)
@@ -328,6 +338,8 @@
 						VM_Warning(prog, "assignment to world.%s (field %i) in %s\n", PRVM_GetString(prog, PRVM_ED_FieldAtOfs(prog, OPB->_int)->s_name), (int)OPB->_int, prog->name);
 					}
 				}
+				if (prog->findindex_fieldmap && prog->findindex_fieldmap[OPB->_int % cached_entityfields])
+					PRVM_FindIndex_Touch(prog, OPB->_int / cached_entityfields);
 				ptr = (prvm_eval_t *)(cached_edictsfields + OPB->_int);
 				ptr->ivector[0] = OPA->ivector[0];
 				ptr->ivector[1] = OPA->ivector[1];
@@ -491,9 +503,15 @@
 					// negative first_statement values are built in functions
 					int builtinnumber = -enterfunc->first_statement;
 					prog->xfunction->builtinsprofile++;
+					if (prog->sampleprofile.countdown > 0 && (prog->sampleprofile.countdown -= prog->sampleprofile.builtincost) <= 0)
+						PRVM_SampleProfile_Sample(prog, enterfunc);
 					if (builtinnumber < prog->numbuiltins && prog->builtins[builtinnumber])
 					{
+						// tempstrings created by the builtin are counted for prvm_tempstrings
+						int oldbuiltin = prog->tempstringsbuf.builtin;
+						prog->tempstringsbuf.builtin = builtinnumber;
 						prog->builtins[builtinnumber](prog);
+						prog->tempstringsbuf.builtin = oldbuiltin;
 #ifdef PRVMTIMEPROFILING 
 						tm = Sys_DirtyTime();
 						enterfunc->tprofile += (tm - starttm >= 0 && tm - starttm < 1800) ? (tm - starttm) : 0;
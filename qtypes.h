@@ -35,6 +35,13 @@ typedef bool qboolean;
 #define RESTRICT
 #endif
 
+// per-thread copy of a global, used by code that may run on loader threads
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 // LordHavoc: upgrade the prvm to double precision for better time values
 // LordHavoc: to be enabled when bugs are worked out...
 //#define PRVM_64
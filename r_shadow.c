@@ -140,6 +140,10 @@ demonstrated by the game Doom3.
 #include "portals.h"
 #include "image.h"
 #include "dpsoftrast.h"
+#include "thread.h"
+#ifdef SSE_PRESENT
+#include <xmmintrin.h>
+#endif
 
 #ifdef SUPPORTD3D
 #include <d3d9.h>
@@ -313,6 +317,8 @@ cvar_t r_shadow_realtime_world_compile = {0, "r_shadow_realtime_world_compile",
 cvar_t r_shadow_realtime_world_compileshadow = {0, "r_shadow_realtime_world_compileshadow", "1", "enables compilation of shadows from world lights for higher performance rendering"};
 cvar_t r_shadow_realtime_world_compilesvbsp = {0, "r_shadow_realtime_world_compilesvbsp", "1", "enables svbsp optimization during compilation (slower than compileportalculling but more exact)"};
 cvar_t r_shadow_realtime_world_compileportalculling = {0, "r_shadow_realtime_world_compileportalculling", "1", "enables portal-based culling optimization during compilation (overrides compilesvbsp)"};
+cvar_t r_shadow_realtime_world_compilethreads = {CVAR_SAVE, "r_shadow_realtime_world_compilethreads", "0", "number of threads used to cull world lights that need compiling (0 = one per cpu core, 1 = compile on the main thread only)"};
+cvar_t r_shadow_realtime_world_compilecache = {CVAR_SAVE, "r_shadow_realtime_world_compilecache", "0", "stores the culling results (leafs, surfaces and triangle masks) of compiled world lights in cache/<mapname>_rtlights.dat so later loads of the same map only have to build the shadow meshes, 2 = only read the cache file"};
 cvar_t r_shadow_scissor = {0, "r_shadow_scissor", "1", "use scissor optimization of light rendering (restricts rendering to the portion of the screen affected by the light)"};
 cvar_t r_shadow_shadowmapping = {CVAR_SAVE, "r_shadow_shadowmapping", "1", "enables use of shadowmapping (depth texture sampling) instead of stencil shadow volumes, requires gl_fbo 1"};
 cvar_t r_shadow_shadowmapping_filterquality = {CVAR_SAVE, "r_shadow_shadowmapping_filterquality", "-1", "shadowmap filter modes: -1 = auto-select, 0 = no filtering, 1 = bilinear, 2 = bilinear 2x2 blur (fast), 3 = 3x3 blur (moderate), 4 = 4x4 blur (slow)"};
@@ -358,6 +364,7 @@ cvar_t r_shadow_bouncegrid_intensity = {CVAR_SAVE, "r_shadow_bouncegrid_intensit
 cvar_t r_shadow_bouncegrid_particlebounceintensity = {CVAR_SAVE, "r_shadow_bouncegrid_particlebounceintensity", "2", "amount of energy carried over after each bounce, this is a multiplier of texture color and the result is clamped to 1 or less, to prevent adding energy on each bounce"};
 cvar_t r_shadow_bouncegrid_particleintensity = {CVAR_SAVE, "r_shadow_bouncegrid_particleintensity", "0.25", "brightness of particles contributing to bouncegrid texture"};
 cvar_t r_shadow_bouncegrid_sortlightpaths = {CVAR_SAVE, "r_shadow_bouncegrid_sortlightpaths", "1", "sort light paths before accumulating them into the bouncegrid texture, this reduces cpu cache misses"};
+cvar_t r_shadow_bouncegrid_threads = {CVAR_SAVE, "r_shadow_bouncegrid_threads", "0", "number of threads (including the main thread) used to trace photons, accumulate light paths into the bouncegrid texture and blur it (0 = one per cpu core, at most 32), splatting and blurring give each thread a slab of the texture along Z"};
 cvar_t r_shadow_bouncegrid_lightpathsize = {CVAR_SAVE, "r_shadow_bouncegrid_lightpathsize", "1", "width of the light path for accumulation of light in the bouncegrid texture"};
 cvar_t r_shadow_bouncegrid_static = {CVAR_SAVE, "r_shadow_bouncegrid_static", "1", "use static radiosity solution (high quality) rather than dynamic (splotchy)"};
 cvar_t r_shadow_bouncegrid_static_directionalshading = {CVAR_SAVE, "r_shadow_bouncegrid_static_directionalshading", "1", "whether to use directionalshading when in static mode"};
@@ -636,10 +643,16 @@ static void r_shadow_start(void)
 }
 
 static void R_Shadow_FreeDeferred(void);
+static void R_Shadow_CompileCache_Flush(void);
+static void R_Shadow_CompileCache_Free(void);
+static void R_Shadow_StopThreads(void);
 static void r_shadow_shutdown(void)
 {
 	CHECKGLERROR
+	R_Shadow_CompileCache_Flush();
 	R_Shadow_UncompileWorldLights();
+	R_Shadow_CompileCache_Free();
+	R_Shadow_StopThreads();
 
 	R_Shadow_FreeShadowMaps();
 
@@ -731,7 +744,11 @@ static void r_shadow_newmap(void)
 	if (r_editlights_sprcubemapnoshadowlight) R_SkinFrame_MarkUsed(r_editlights_sprcubemapnoshadowlight);
 	if (r_editlights_sprselection)            R_SkinFrame_MarkUsed(r_editlights_sprselection);
 	if (strncmp(cl.worldname, r_shadow_mapname, sizeof(r_shadow_mapname)))
+	{
+		// the lights of the previous map are still compiled here
+		R_Shadow_CompileCache_Flush();
 		R_Shadow_EditLights_Reload_f();
+	}
 }
 
 static int r_shadow_nummodelshadows;
@@ -780,6 +797,8 @@ void R_Shadow_Init(void)
 	Cvar_RegisterVariable(&r_shadow_realtime_world_compileshadow);
 	Cvar_RegisterVariable(&r_shadow_realtime_world_compilesvbsp);
 	Cvar_RegisterVariable(&r_shadow_realtime_world_compileportalculling);
+	Cvar_RegisterVariable(&r_shadow_realtime_world_compilethreads);
+	Cvar_RegisterVariable(&r_shadow_realtime_world_compilecache);
 	Cvar_RegisterVariable(&r_shadow_scissor);
 	Cvar_RegisterVariable(&r_shadow_shadowmapping);
 	Cvar_RegisterVariable(&r_shadow_shadowmapping_vsdct);
@@ -826,6 +845,7 @@ void R_Shadow_Init(void)
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_particlebounceintensity);
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_particleintensity);
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_sortlightpaths);
+	Cvar_RegisterVariable(&r_shadow_bouncegrid_threads);
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_static);
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_static_spacing);
 	Cvar_RegisterVariable(&r_shadow_bouncegrid_static_directionalshading);
@@ -2428,7 +2448,25 @@ typedef struct r_shadow_bouncegrid_splatpath_s
 }
 r_shadow_bouncegrid_splatpath_t;
 
-static void R_Shadow_BounceGrid_AddSplatPath(vec3_t originalstart, vec3_t originalend, vec3_t color)
+// what one thread of R_Shadow_BounceGrid_TracePhotons produces and needs for
+// itself, the paths are merged into r_shadow_bouncegrid_state.splatpaths
+typedef struct r_shadow_bouncegrid_photonslab_s
+{
+	r_shadow_bouncegrid_splatpath_t *splatpaths;
+	int numsplatpaths;
+	int maxsplatpaths;
+	// random state of the slab
+	unsigned int seed;
+	// trace cache of the slab, a given photon is always traced by the same
+	// slab (unless the thread count changes) so it keeps hitting its cache
+	collision_cache_t *cache;
+	int stat_traces;
+	int stat_hits;
+	int stat_bounces;
+}
+r_shadow_bouncegrid_photonslab_t;
+
+static void R_Shadow_BounceGrid_AddSplatPath(r_shadow_bouncegrid_photonslab_t *photonslab, vec3_t originalstart, vec3_t originalend, vec3_t color)
 {
 	int bestaxis;
 	int numsplats;
@@ -2475,17 +2513,12 @@ static void R_Shadow_BounceGrid_AddSplatPath(vec3_t originalstart, vec3_t origin
 	end[1] = (end[1] - r_shadow_bouncegrid_state.mins[1]) * r_shadow_bouncegrid_state.ispacing[1];
 	end[2] = (end[2] - r_shadow_bouncegrid_state.mins[2]) * r_shadow_bouncegrid_state.ispacing[2];
 
-	// check if we need to grow the splatpaths array
-	if (r_shadow_bouncegrid_state.maxsplatpaths <= r_shadow_bouncegrid_state.numsplatpaths)
+	// check if we need to grow the splatpaths array (this runs on the tracing
+	// threads, so frame data can't be used here)
+	if (photonslab->maxsplatpaths <= photonslab->numsplatpaths)
 	{
-		// double the limit, this will persist from frame to frame so we don't
-		// make the same mistake each time
-		r_shadow_bouncegrid_splatpath_t *newpaths;
-		r_shadow_bouncegrid_state.maxsplatpaths *= 2;
-		newpaths = (r_shadow_bouncegrid_splatpath_t *)R_FrameData_Alloc(sizeof(r_shadow_bouncegrid_splatpath_t) * r_shadow_bouncegrid_state.maxsplatpaths);
-		if (r_shadow_bouncegrid_state.splatpaths)
-			memcpy(newpaths, r_shadow_bouncegrid_state.splatpaths, r_shadow_bouncegrid_state.numsplatpaths * sizeof(r_shadow_bouncegrid_splatpath_t));
-		r_shadow_bouncegrid_state.splatpaths = newpaths;
+		photonslab->maxsplatpaths = max(photonslab->maxsplatpaths * 2, 1024);
+		photonslab->splatpaths = (r_shadow_bouncegrid_splatpath_t *)Mem_Realloc(tempmempool, photonslab->splatpaths, sizeof(r_shadow_bouncegrid_splatpath_t) * photonslab->maxsplatpaths);
 	}
 
 	// divide a series of splats along the length using the maximum axis
@@ -2505,7 +2538,7 @@ static void R_Shadow_BounceGrid_AddSplatPath(vec3_t originalstart, vec3_t origin
 	VectorSubtract(originalstart, originalend, originaldir);
 	VectorNormalize(originaldir);
 
-	path = r_shadow_bouncegrid_state.splatpaths + r_shadow_bouncegrid_state.numsplatpaths++;
+	path = photonslab->splatpaths + photonslab->numsplatpaths++;
 	VectorCopy(start, path->point);
 	VectorScale(diff, ilen, path->step);
 	VectorCopy(color, path->splatcolor);
@@ -2816,18 +2849,152 @@ static void R_Shadow_BounceGrid_AssignPhotons(r_shadow_bouncegrid_settings_t *se
 	*photonscaling = min(normalphotonscaling, maxphotonscaling);
 }
 
-static int R_Shadow_BounceGrid_SplatPathCompare(const void *pa, const void *pb)
+// sorts the splat paths by their starting Z pixel with a stable counting sort,
+// paths always run upward in Z so this is the order the Z slabs need them in
+static void R_Shadow_BounceGrid_SortSplatPaths(void)
 {
-	r_shadow_bouncegrid_splatpath_t *a = (r_shadow_bouncegrid_splatpath_t *)pa;
-	r_shadow_bouncegrid_splatpath_t *b = (r_shadow_bouncegrid_splatpath_t *)pb;
-	// we only really care about sorting by Z
-	if (a->point[2] < b->point[2])
-		return -1;
-	if (a->point[2] > b->point[2])
-		return 1;
+	int i, bucket, sum, count;
+	int numbuckets = r_shadow_bouncegrid_state.resolution[2];
+	int numsplatpaths = r_shadow_bouncegrid_state.numsplatpaths;
+	r_shadow_bouncegrid_splatpath_t *splatpaths = r_shadow_bouncegrid_state.splatpaths;
+	r_shadow_bouncegrid_splatpath_t *sorted;
+	int *buckets;
+
+	if (numsplatpaths < 2 || numbuckets < 2)
+		return;
+
+	buckets = (int *)R_FrameData_Alloc(numbuckets * sizeof(int));
+	memset(buckets, 0, numbuckets * sizeof(int));
+	for (i = 0;i < numsplatpaths;i++)
+		buckets[bound(0, (int)splatpaths[i].point[2], numbuckets - 1)]++;
+	for (bucket = 0, sum = 0;bucket < numbuckets;bucket++)
+	{
+		count = buckets[bucket];
+		buckets[bucket] = sum;
+		sum += count;
+	}
+	sorted = (r_shadow_bouncegrid_splatpath_t *)R_FrameData_Alloc(numsplatpaths * sizeof(r_shadow_bouncegrid_splatpath_t));
+	for (i = 0;i < numsplatpaths;i++)
+		sorted[buckets[bound(0, (int)splatpaths[i].point[2], numbuckets - 1)]++] = splatpaths[i];
+	// the sorted copy replaces the array, the old one is frame data anyway
+	r_shadow_bouncegrid_state.splatpaths = sorted;
+}
+
+/*
+=============
+worker threads
+
+persistent threads used by the bouncegrid passes and by world light
+compilation, a job is called once per slab (the main thread always does
+slab 0) and the workers are kept waiting on a barrier between jobs
+=============
+*/
+#define MAXSHADOWTHREADS 32
+
+typedef struct r_shadow_workers_s
+{
+	int numthreads; // including the main thread
+	void *threads[MAXSHADOWTHREADS];
+	int threadslab[MAXSHADOWTHREADS];
+	void *startbarrier;
+	void *donebarrier;
+	qboolean quit;
+	void (*job)(int slab, int numslabs);
+}
+r_shadow_workers_t;
+
+static r_shadow_workers_t r_shadow_workers;
+
+static int R_Shadow_WorkerThread(void *data)
+{
+	int slab = *(int *)data;
+	for (;;)
+	{
+		Thread_WaitBarrier(r_shadow_workers.startbarrier);
+		if (r_shadow_workers.quit)
+			break;
+		r_shadow_workers.job(slab, r_shadow_workers.numthreads);
+		Thread_WaitBarrier(r_shadow_workers.donebarrier);
+	}
 	return 0;
 }
 
+static void R_Shadow_StopThreads(void)
+{
+	r_shadow_workers_t *w = &r_shadow_workers;
+	int i;
+	if (w->numthreads > 1)
+	{
+		w->quit = true;
+		Thread_WaitBarrier(w->startbarrier);
+		for (i = 1;i < w->numthreads;i++)
+			Thread_WaitThread(w->threads[i], 0);
+		Thread_DestroyBarrier(w->startbarrier);
+		Thread_DestroyBarrier(w->donebarrier);
+	}
+	memset(w, 0, sizeof(*w));
+}
+
+static void R_Shadow_StartThreads(int numthreads)
+{
+	r_shadow_workers_t *w = &r_shadow_workers;
+	int i;
+	R_Shadow_StopThreads();
+	w->numthreads = numthreads;
+	if (numthreads < 2)
+		return;
+	w->startbarrier = Thread_CreateBarrier(numthreads);
+	w->donebarrier = Thread_CreateBarrier(numthreads);
+	for (i = 1;i < numthreads;i++)
+	{
+		w->threadslab[i] = i;
+		w->threads[i] = Thread_CreateThread(R_Shadow_WorkerThread, &w->threadslab[i]);
+	}
+}
+
+// returns the number of threads to use for a thread count cvar, 0 means one per cpu core
+static int R_Shadow_NumThreads(int value)
+{
+	if (!Thread_HasThreads())
+		return 1;
+	if (value < 1)
+		value = Thread_GetNumCPUs();
+	return bound(1, value, MAXSHADOWTHREADS);
+}
+
+// runs job on numthreads slabs and returns when all of them are done
+static void R_Shadow_RunJob(void (*job)(int slab, int numslabs), int numthreads)
+{
+	r_shadow_workers_t *w = &r_shadow_workers;
+	if (w->numthreads != numthreads)
+		R_Shadow_StartThreads(numthreads);
+	if (w->numthreads < 2)
+	{
+		job(0, 1);
+		return;
+	}
+	w->job = job;
+	Thread_WaitBarrier(w->startbarrier);
+	job(0, w->numthreads);
+	Thread_WaitBarrier(w->donebarrier);
+}
+
+static void R_Shadow_BounceGrid_RunJob(void (*job)(int slab, int numslabs))
+{
+	int numthreads = R_Shadow_NumThreads(r_shadow_bouncegrid_threads.integer);
+	// never use more slabs than there are Z layers
+	numthreads = min(numthreads, max(1, r_shadow_bouncegrid_state.resolution[2] - 2));
+	R_Shadow_RunJob(job, numthreads);
+}
+
+// pixels with Z in [zmin, zmax) belong to this slab
+static void R_Shadow_BounceGrid_SlabRange(int slab, int numslabs, int *zmin, int *zmax)
+{
+	int resolution2 = r_shadow_bouncegrid_state.resolution[2];
+	*zmin = slab * resolution2 / numslabs;
+	*zmax = (slab + 1) * resolution2 / numslabs;
+}
+
 static void R_Shadow_BounceGrid_ClearPixels(void)
 {
 	// clear the highpixels array we'll be accumulating into
@@ -2835,14 +3002,15 @@ static void R_Shadow_BounceGrid_ClearPixels(void)
 	memset(r_shadow_bouncegrid_state.highpixels, 0, r_shadow_bouncegrid_state.numpixels * sizeof(float[4]));
 }
 
-static void R_Shadow_BounceGrid_PerformSplats(void)
+static void R_Shadow_BounceGrid_PerformSplatsInSlab(int slab, int numslabs)
 {
 	int splatsize = r_shadow_bouncegrid_state.settings.lightpathsize;
 	int splatsize1 = splatsize + 1;
-	r_shadow_bouncegrid_splatpath_t *splatpaths = r_shadow_bouncegrid_state.splatpaths;
-	r_shadow_bouncegrid_splatpath_t *splatpath;
+	const r_shadow_bouncegrid_splatpath_t *splatpaths = r_shadow_bouncegrid_state.splatpaths;
+	const r_shadow_bouncegrid_splatpath_t *splatpath;
 	float *highpixels = r_shadow_bouncegrid_state.highpixels;
 	int numsplatpaths = r_shadow_bouncegrid_state.numsplatpaths;
+	qboolean sorted = r_shadow_bouncegrid_sortlightpaths.integer != 0;
 	int splatindex;
 	vec3_t steppos;
 	vec3_t stepdelta;
@@ -2855,6 +3023,7 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 	int tex[3];
 	int pixelsperband = r_shadow_bouncegrid_state.pixelsperband;
 	int pixelbands = r_shadow_bouncegrid_state.pixelbands;
+	int zmin, zmax, zi0, zi1;
 	int numsteps;
 	int step;
 
@@ -2863,10 +3032,7 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 
 	// we use this a lot, so get a local copy
 	VectorCopy(r_shadow_bouncegrid_state.resolution, resolution);
-
-	// sort the splats before we execute them, to reduce cache misses
-	if (r_shadow_bouncegrid_sortlightpaths.integer)
-		qsort(splatpaths, numsplatpaths, sizeof(*splatpaths), R_Shadow_BounceGrid_SplatPathCompare);
+	R_Shadow_BounceGrid_SlabRange(slab, numslabs, &zmin, &zmax);
 
 	// the middle row/column/layer of each splat are full intensity
 	for (step = 1;step < splatsize;step++)
@@ -2875,6 +3041,16 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 	splatpath = splatpaths;
 	for (splatindex = 0;splatindex < numsplatpaths;splatindex++, splatpath++)
 	{
+		// paths only go upward in Z, skip the ones that never reach this slab
+		// and stop once they all start above it
+		if (splatpath->point[2] - splatsize1 >= zmax)
+		{
+			if (sorted)
+				break;
+			continue;
+		}
+		if (splatpath->point[2] + splatpath->step[2] * splatpath->remainingsplats + splatsize1 < zmin)
+			continue;
 		// calculate second order spherical harmonics values (average, slopeX, slopeY, slopeZ)
 		// accumulate average shotcolor
 		VectorCopy(splatpath->splatdir, dir);
@@ -2923,9 +3099,8 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 		VectorCopy(splatpath->point, steppos);
 		VectorCopy(splatpath->step, stepdelta);
 		numsteps = splatpath->remainingsplats;
-		for (step = 0;step < numsteps;step++)
+		for (step = 0;step < numsteps;step++, VectorAdd(steppos, stepdelta, steppos))
 		{
-			r_refdef.stats[r_stat_bouncegrid_splats]++;
 			// figure out the min corner of the pixels we'll need to update
 			texcorner[0] = steppos[0] - (splatsize1 * 0.5f);
 			texcorner[1] = steppos[1] - (splatsize1 * 0.5f);
@@ -2944,6 +3119,14 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 				// it is within bounds...  do the real work now
 				int xi, yi, zi;
 
+				// only the layers inside this slab
+				if (tex[2] >= zmax)
+					break;
+				zi0 = max(0, zmin - tex[2]);
+				zi1 = min(splatsize1, zmax - tex[2]);
+				if (zi0 >= zi1)
+					continue;
+
 				// calculate the antialiased box edges
 				texlerp[splatsize][0] = texcorner[0] - tex[0];
 				texlerp[splatsize][1] = texcorner[1] - tex[1];
@@ -2953,7 +3136,7 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 				texlerp[0][2] = 1.0f - texlerp[splatsize][2];
 
 				// accumulate light onto the pixels
-				for (zi = 0;zi < splatsize1;zi++)
+				for (zi = zi0;zi < zi1;zi++)
 				{
 					for (yi = 0;yi < splatsize1;yi++)
 					{
@@ -2963,6 +3146,11 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 							float w = texlerp[xi][0]*texlerp[yi][1]*texlerp[zi][2] * boxweight;
 							int band = 0;
 							float *p = highpixels + 4 * index + band * pixelsperband * 4;
+#ifdef SSE_PRESENT
+							__m128 w4 = _mm_set1_ps(w);
+							for (;band < pixelbands;band++, p += pixelsperband * 4)
+								_mm_store_ps(p, _mm_add_ps(_mm_load_ps(p), _mm_mul_ps(_mm_loadu_ps(splatcolor + band*4), w4)));
+#else
 							for (;band < pixelbands;band++, p += pixelsperband * 4)
 							{
 								// add to the pixel color
@@ -2971,17 +3159,39 @@ static void R_Shadow_BounceGrid_PerformSplats(void)
 								p[2] += splatcolor[band*4+2] * w;
 								p[3] += splatcolor[band*4+3] * w;
 							}
+#endif
 						}
 					}
 				}
 			}
-			VectorAdd(steppos, stepdelta, steppos);
 		}
 	}
 }
 
-static void R_Shadow_BounceGrid_BlurPixelsInDirection(const float *inpixels, float *outpixels, int off)
+static void R_Shadow_BounceGrid_PerformSplats(void)
 {
+	int splatindex;
+
+	for (splatindex = 0;splatindex < r_shadow_bouncegrid_state.numsplatpaths;splatindex++)
+		r_refdef.stats[r_stat_bouncegrid_splats] += r_shadow_bouncegrid_state.splatpaths[splatindex].remainingsplats;
+
+	// sort the splats before we execute them, to reduce cache misses
+	if (r_shadow_bouncegrid_sortlightpaths.integer)
+		R_Shadow_BounceGrid_SortSplatPaths();
+
+	R_Shadow_BounceGrid_RunJob(R_Shadow_BounceGrid_PerformSplatsInSlab);
+}
+
+// current pass of R_Shadow_BounceGrid_BlurPixels
+static const float *r_shadow_bouncegrid_blurin;
+static float *r_shadow_bouncegrid_blurout;
+static int r_shadow_bouncegrid_bluroff;
+
+static void R_Shadow_BounceGrid_BlurPixelsInSlab(int slab, int numslabs)
+{
+	const float *inpixels = r_shadow_bouncegrid_blurin;
+	float *outpixels = r_shadow_bouncegrid_blurout;
+	int off = r_shadow_bouncegrid_bluroff;
 	const float *inpixel;
 	float *outpixel;
 	int pixelbands = r_shadow_bouncegrid_state.pixelbands;
@@ -2989,10 +3199,17 @@ static void R_Shadow_BounceGrid_BlurPixelsInDirection(const float *inpixels, flo
 	unsigned int index;
 	unsigned int x, y, z;
 	unsigned int resolution[3];
+	int zmin, zmax;
+#ifdef SSE_PRESENT
+	__m128 third = _mm_set1_ps(1.0f / 3.0f);
+#endif
 	VectorCopy(r_shadow_bouncegrid_state.resolution, resolution);
+	R_Shadow_BounceGrid_SlabRange(slab, numslabs, &zmin, &zmax);
+	zmin = max(zmin, 1);
+	zmax = min(zmax, (int)resolution[2]-1);
 	for (pixelband = 0;pixelband < pixelbands;pixelband++)
 	{
-		for (z = 1;z < resolution[2]-1;z++)
+		for (z = zmin;(int)z < zmax;z++)
 		{
 			for (y = 1;y < resolution[1]-1;y++)
 			{
@@ -3002,16 +3219,28 @@ static void R_Shadow_BounceGrid_BlurPixelsInDirection(const float *inpixels, flo
 				outpixel = outpixels + 4*index;
 				for (;x < resolution[0]-1;x++, inpixel += 4, outpixel += 4)
 				{
+#ifdef SSE_PRESENT
+					_mm_store_ps(outpixel, _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_load_ps(inpixel), _mm_load_ps(inpixel + off)), _mm_load_ps(inpixel - off)), third));
+#else
 					outpixel[0] = (inpixel[0] + inpixel[  off] + inpixel[0-off]) * (1.0f / 3.0);
 					outpixel[1] = (inpixel[1] + inpixel[1+off] + inpixel[1-off]) * (1.0f / 3.0);
 					outpixel[2] = (inpixel[2] + inpixel[2+off] + inpixel[2-off]) * (1.0f / 3.0);
 					outpixel[3] = (inpixel[3] + inpixel[3+off] + inpixel[3-off]) * (1.0f / 3.0);
+#endif
 				}
 			}
 		}
 	}
 }
 
+static void R_Shadow_BounceGrid_BlurPixelsInDirection(const float *inpixels, float *outpixels, int off)
+{
+	r_shadow_bouncegrid_blurin = inpixels;
+	r_shadow_bouncegrid_blurout = outpixels;
+	r_shadow_bouncegrid_bluroff = off;
+	R_Shadow_BounceGrid_RunJob(R_Shadow_BounceGrid_BlurPixelsInSlab);
+}
+
 static void R_Shadow_BounceGrid_BlurPixels(void)
 {
 	float *highpixels = r_shadow_bouncegrid_state.highpixels;
@@ -3202,19 +3431,39 @@ static void R_Shadow_BounceGrid_ConvertPixelsAndUpload(void)
 	r_shadow_bouncegrid_state.lastupdatetime = realtime;
 }
 
-static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t settings, unsigned int range, unsigned int range1, unsigned int range2, float photonscaling, int flag)
+// the photon tracing pass of R_Shadow_BounceGrid_TracePhotons
+typedef struct r_shadow_bouncegrid_photonjob_s
 {
+	r_shadow_bouncegrid_settings_t settings;
+	unsigned int range; // number of world lights
+	unsigned int range2; // range+range1
+	float photonscaling;
+	int hitsupercontentsmask;
+	// entities the dynamic mode traces can hit, gathered on the main thread
+	int numtouchedicts;
+	prvm_edict_t *touchedicts[MAX_EDICTS];
+	r_shadow_bouncegrid_photonslab_t slabs[MAXSHADOWTHREADS];
+}
+r_shadow_bouncegrid_photonjob_t;
+
+static r_shadow_bouncegrid_photonjob_t r_shadow_bouncegrid_photonjob;
+
+// the photons of each light are dealt out to the slabs in turn, so every
+// thread gets a share of every light
+static void R_Shadow_BounceGrid_TracePhotonsInSlab(int slab, int numslabs)
+{
+	r_shadow_bouncegrid_photonjob_t *job = &r_shadow_bouncegrid_photonjob;
+	r_shadow_bouncegrid_photonslab_t *photonslab = job->slabs + slab;
+	const r_shadow_bouncegrid_settings_t *settings = &job->settings;
 	dlight_t *light;
 	int bouncecount;
-	int hitsupercontentsmask;
-	int maxbounce;
 	int shootparticles;
 	int shotparticles;
 	trace_t cliptrace;
 	//trace_t cliptrace2;
 	//trace_t cliptrace3;
 	unsigned int lightindex;
-	unsigned int seed = (unsigned int)(realtime * 1000.0f);
+	unsigned int seed = photonslab->seed;
 	vec3_t shotcolor;
 	vec3_t baseshotcolor;
 	vec3_t surfcolor;
@@ -3225,20 +3474,9 @@ static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t sett
 	vec_t s;
 	rtlight_t *rtlight;
 
-	// we'll need somewhere to store these
-	r_shadow_bouncegrid_state.numsplatpaths = 0;
-	r_shadow_bouncegrid_state.splatpaths = (r_shadow_bouncegrid_splatpath_t *)R_FrameData_Alloc(sizeof(r_shadow_bouncegrid_splatpath_t) * r_shadow_bouncegrid_state.maxsplatpaths);
-
-	// figure out what we want to interact with
-	if (settings.hitmodels)
-		hitsupercontentsmask = SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY;// | SUPERCONTENTS_LIQUIDSMASK;
-	else
-		hitsupercontentsmask = SUPERCONTENTS_SOLID;// | SUPERCONTENTS_LIQUIDSMASK;
-	maxbounce = settings.maxbounce;
-
-	for (lightindex = 0;lightindex < range2;lightindex++)
+	for (lightindex = 0;lightindex < job->range2;lightindex++)
 	{
-		if (lightindex < range)
+		if (lightindex < job->range)
 		{
 			light = (dlight_t *) Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
 			if (!light)
@@ -3246,55 +3484,50 @@ static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t sett
 			rtlight = &light->rtlight;
 		}
 		else
-			rtlight = r_refdef.scene.lights[lightindex - range];
+			rtlight = r_refdef.scene.lights[lightindex - job->range];
 		// note that this code used to keep track of residual photons and
 		// distribute them evenly to achieve exactly a desired photon count,
 		// but that caused unwanted flickering in dynamic mode
-		shootparticles = (int)floor(rtlight->photons * photonscaling);
+		shootparticles = (int)floor(rtlight->photons * job->photonscaling);
 		// skip if we won't be shooting any photons
 		if (!shootparticles)
 			continue;
-		radius = rtlight->radius * settings.lightradiusscale;
-		s = settings.particleintensity / shootparticles;
+		radius = rtlight->radius * settings->lightradiusscale;
+		s = settings->particleintensity / shootparticles;
 		VectorScale(rtlight->photoncolor, s, baseshotcolor);
-		r_refdef.stats[r_stat_bouncegrid_lights]++;
-		r_refdef.stats[r_stat_bouncegrid_particles] += shootparticles;
-		for (shotparticles = 0;shotparticles < shootparticles;shotparticles++)
+		for (shotparticles = slab;shotparticles < shootparticles;shotparticles += numslabs)
 		{
-			if (settings.stablerandom > 0)
+			if (settings->stablerandom > 0)
 				seed = lightindex * 11937 + shotparticles;
 			VectorCopy(baseshotcolor, shotcolor);
 			VectorCopy(rtlight->shadoworigin, clipstart);
-			if (settings.stablerandom < 0)
-				VectorRandom(clipend);
-			else
-				VectorCheeseRandom(clipend);
+			VectorCheeseRandom(clipend);
 			VectorMA(clipstart, radius, clipend, clipend);
 			for (bouncecount = 0;;bouncecount++)
 			{
-				r_refdef.stats[r_stat_bouncegrid_traces]++;
-				//r_refdef.scene.worldmodel->TraceLineAgainstSurfaces(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace, clipstart, clipend, hitsupercontentsmask);
-				//r_refdef.scene.worldmodel->TraceLine(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace2, clipstart, clipend, hitsupercontentsmask);
-				if (settings.staticmode)
+				photonslab->stat_traces++;
+				//r_refdef.scene.worldmodel->TraceLineAgainstSurfaces(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace, clipstart, clipend, job->hitsupercontentsmask);
+				//r_refdef.scene.worldmodel->TraceLine(r_refdef.scene.worldmodel, NULL, NULL, &cliptrace2, clipstart, clipend, job->hitsupercontentsmask);
+				if (settings->staticmode)
 				{
 					// static mode fires a LOT of rays but none of them are identical, so they are not cached
-					cliptrace = CL_TraceLine(clipstart, clipend, settings.staticmode ? MOVE_WORLDONLY : (settings.hitmodels ? MOVE_HITMODEL : MOVE_NOMONSTERS), NULL, hitsupercontentsmask, collision_extendmovelength.value, true, false, NULL, true, true);
+					cliptrace = CL_TraceLine(clipstart, clipend, settings->staticmode ? MOVE_WORLDONLY : (settings->hitmodels ? MOVE_HITMODEL : MOVE_NOMONSTERS), NULL, job->hitsupercontentsmask, collision_extendmovelength.value, true, false, NULL, true, true);
 				}
 				else
 				{
 					// dynamic mode fires many rays and most will match the cache from the previous frame
-					cliptrace = CL_Cache_TraceLineSurfaces(clipstart, clipend, settings.staticmode ? MOVE_WORLDONLY : (settings.hitmodels ? MOVE_HITMODEL : MOVE_NOMONSTERS), hitsupercontentsmask);
+					cliptrace = CL_Cache_TraceLineSurfaces(photonslab->cache, clipstart, clipend, settings->staticmode ? MOVE_WORLDONLY : (settings->hitmodels ? MOVE_HITMODEL : MOVE_NOMONSTERS), job->hitsupercontentsmask, job->numtouchedicts, job->touchedicts);
 				}
-				if (bouncecount > 0 || settings.includedirectlighting)
+				if (bouncecount > 0 || settings->includedirectlighting)
 				{
 					vec3_t hitpos;
 					VectorCopy(cliptrace.endpos, hitpos);
-					R_Shadow_BounceGrid_AddSplatPath(clipstart, hitpos, shotcolor);
+					R_Shadow_BounceGrid_AddSplatPath(photonslab, clipstart, hitpos, shotcolor);
 				}
 				if (cliptrace.fraction >= 1.0f)
 					break;
-				r_refdef.stats[r_stat_bouncegrid_hits]++;
-				if (bouncecount >= maxbounce)
+				photonslab->stat_hits++;
+				if (bouncecount >= settings->maxbounce)
 					break;
 				// scale down shot color by bounce intensity and texture color (or 50% if no texture reported)
 				// also clamp the resulting color to never add energy, even if the user requests extreme values
@@ -3302,22 +3535,19 @@ static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t sett
 					VectorCopy(cliptrace.hittexture->currentskinframe->avgcolor, surfcolor);
 				else
 					VectorSet(surfcolor, 0.5f, 0.5f, 0.5f);
-				VectorScale(surfcolor, settings.particlebounceintensity, surfcolor);
+				VectorScale(surfcolor, settings->particlebounceintensity, surfcolor);
 				surfcolor[0] = min(surfcolor[0], 1.0f);
 				surfcolor[1] = min(surfcolor[1], 1.0f);
 				surfcolor[2] = min(surfcolor[2], 1.0f);
 				VectorMultiply(shotcolor, surfcolor, shotcolor);
 				if (VectorLength2(baseshotcolor) == 0.0f)
 					break;
-				r_refdef.stats[r_stat_bouncegrid_bounces]++;
-				if (settings.bounceanglediffuse)
+				photonslab->stat_bounces++;
+				if (settings->bounceanglediffuse)
 				{
 					// random direction, primarily along plane normal
 					s = VectorDistance(cliptrace.endpos, clipend);
-					if (settings.stablerandom < 0)
-						VectorRandom(clipend);
-					else
-						VectorCheeseRandom(clipend);
+					VectorCheeseRandom(clipend);
 					VectorMA(cliptrace.plane.normal, 0.95f, clipend, clipend);
 					VectorNormalize(clipend);
 					VectorScale(clipend, s, clipend);
@@ -3334,6 +3564,118 @@ static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t sett
 			}
 		}
 	}
+	photonslab->seed = seed;
+}
+
+/*
+=============
+R_Shadow_BounceGrid_TracePhotons
+
+the photons are traced on the bouncegrid worker threads, each one has its own
+random state, trace cache and list of light paths, which are merged here in
+slab order afterwards
+=============
+*/
+static void R_Shadow_BounceGrid_TracePhotons(r_shadow_bouncegrid_settings_t settings, unsigned int range, unsigned int range1, unsigned int range2, float photonscaling, int flag)
+{
+	r_shadow_bouncegrid_photonjob_t *job = &r_shadow_bouncegrid_photonjob;
+	r_shadow_bouncegrid_photonslab_t *photonslab;
+	dlight_t *light;
+	rtlight_t *rtlight;
+	unsigned int lightindex;
+	unsigned int seed;
+	int i, shootparticles, numsplatpaths;
+	vec_t radius;
+	vec3_t lightmins, lightmaxs;
+
+	job->settings = settings;
+	job->range = range;
+	job->range2 = range2;
+	job->photonscaling = photonscaling;
+
+	// figure out what we want to interact with
+	if (settings.hitmodels)
+		job->hitsupercontentsmask = SUPERCONTENTS_SOLID | SUPERCONTENTS_BODY;// | SUPERCONTENTS_LIQUIDSMASK;
+	else
+		job->hitsupercontentsmask = SUPERCONTENTS_SOLID;// | SUPERCONTENTS_LIQUIDSMASK;
+
+	// count the lights and find the box the photons can reach, a photon path
+	// is never longer than the radius of its light
+	VectorSet(lightmins, 1e30f, 1e30f, 1e30f);
+	VectorSet(lightmaxs, -1e30f, -1e30f, -1e30f);
+	for (lightindex = 0;lightindex < range2;lightindex++)
+	{
+		if (lightindex < range)
+		{
+			light = (dlight_t *) Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
+			if (!light)
+				continue;
+			rtlight = &light->rtlight;
+		}
+		else
+			rtlight = r_refdef.scene.lights[lightindex - range];
+		shootparticles = (int)floor(rtlight->photons * photonscaling);
+		if (!shootparticles)
+			continue;
+		r_refdef.stats[r_stat_bouncegrid_lights]++;
+		r_refdef.stats[r_stat_bouncegrid_particles] += shootparticles;
+		radius = rtlight->radius * settings.lightradiusscale;
+		lightmins[0] = min(lightmins[0], rtlight->shadoworigin[0] - radius);
+		lightmins[1] = min(lightmins[1], rtlight->shadoworigin[1] - radius);
+		lightmins[2] = min(lightmins[2], rtlight->shadoworigin[2] - radius);
+		lightmaxs[0] = max(lightmaxs[0], rtlight->shadoworigin[0] + radius);
+		lightmaxs[1] = max(lightmaxs[1], rtlight->shadoworigin[1] + radius);
+		lightmaxs[2] = max(lightmaxs[2], rtlight->shadoworigin[2] + radius);
+	}
+
+	// World_EntitiesInBox is not thread safe, so the dynamic mode traces get
+	// one list of the entities near any light
+	job->numtouchedicts = 0;
+	if (!settings.staticmode && lightmins[0] <= lightmaxs[0])
+		job->numtouchedicts = CL_Cache_EntitiesInBox(lightmins, lightmaxs, MAX_EDICTS, job->touchedicts);
+
+	// stable random seeds every photon itself, otherwise each slab continues
+	// its own sequence (rand() is shared by all threads, so it is only used
+	// here to seed them when unstable random is requested)
+	seed = settings.stablerandom < 0 ? (unsigned int)rand() : (unsigned int)(realtime * 1000.0f);
+	for (i = 0;i < MAXSHADOWTHREADS;i++)
+	{
+		photonslab = job->slabs + i;
+		photonslab->numsplatpaths = 0;
+		photonslab->maxsplatpaths = 0;
+		photonslab->splatpaths = NULL;
+		photonslab->seed = seed + i * 7919u;
+		photonslab->cache = Collision_Cache_Get(i);
+		photonslab->stat_traces = 0;
+		photonslab->stat_hits = 0;
+		photonslab->stat_bounces = 0;
+	}
+
+	R_Shadow_BounceGrid_RunJob(R_Shadow_BounceGrid_TracePhotonsInSlab);
+
+	// merge the light paths of the slabs
+	numsplatpaths = 0;
+	for (i = 0;i < MAXSHADOWTHREADS;i++)
+		numsplatpaths += job->slabs[i].numsplatpaths;
+	// this will persist from frame to frame so the slabs start out big enough
+	r_shadow_bouncegrid_state.maxsplatpaths = max(r_shadow_bouncegrid_state.maxsplatpaths, numsplatpaths);
+	r_shadow_bouncegrid_state.numsplatpaths = 0;
+	r_shadow_bouncegrid_state.splatpaths = (r_shadow_bouncegrid_splatpath_t *)R_FrameData_Alloc(sizeof(r_shadow_bouncegrid_splatpath_t) * max(numsplatpaths, 1));
+	for (i = 0;i < MAXSHADOWTHREADS;i++)
+	{
+		photonslab = job->slabs + i;
+		if (photonslab->numsplatpaths)
+			memcpy(r_shadow_bouncegrid_state.splatpaths + r_shadow_bouncegrid_state.numsplatpaths, photonslab->splatpaths, photonslab->numsplatpaths * sizeof(r_shadow_bouncegrid_splatpath_t));
+		r_shadow_bouncegrid_state.numsplatpaths += photonslab->numsplatpaths;
+		if (photonslab->splatpaths)
+			Mem_Free(photonslab->splatpaths);
+		photonslab->splatpaths = NULL;
+		r_refdef.stats[r_stat_bouncegrid_traces] += photonslab->stat_traces;
+		r_refdef.stats[r_stat_bouncegrid_hits] += photonslab->stat_hits;
+		r_refdef.stats[r_stat_bouncegrid_bounces] += photonslab->stat_bounces;
+		if (photonslab->stat_traces && !settings.staticmode)
+			Collision_Cache_FlushStats(photonslab->cache);
+	}
 }
 
 void R_Shadow_UpdateBounceGridTexture(void)
@@ -3915,17 +4257,369 @@ void R_RTLight_Update(rtlight_t *rtlight, int isstatic, matrix4x4_t *matrix, vec
 
 // compiles rtlight geometry
 // (undone by R_FreeCompiledRTLight, which R_UpdateLight calls)
-void R_RTLight_Compile(rtlight_t *rtlight)
+/*
+=============
+compiled light cache
+
+the culling results of R_RTLight_Compile only depend on the light and the
+world model, so they can be stored in a per-map file and reused on the next
+load, records are keyed on an md4 digest of everything the culling reads
+=============
+*/
+#define R_SHADOW_COMPILECACHE_IDENT "DPRTLC1"
+#define R_SHADOW_COMPILECACHE_VERSION 1
+#define R_SHADOW_COMPILECACHE_HASHSIZE 1024
+
+typedef struct r_shadow_compilecacherecord_s
 {
-	int i;
-	int numsurfaces, numleafs, numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes;
-	int lighttris, shadowtris, shadowzpasstris, shadowzfailtris;
-	entity_render_t *ent = r_refdef.scene.worldentity;
-	dp_model_t *model = r_refdef.scene.worldmodel;
+	unsigned char key[16];
+	int datasize; // bytes following this header, a multiple of 4
+	float cullmins[3];
+	float cullmaxs[3];
+	int numsurfaces;
+	int numleafs;
+	int numleafpvsbytes;
+	int numshadowtrispvsbytes;
+	int numlighttrispvsbytes;
+}
+r_shadow_compilecacherecord_t;
+
+typedef struct r_shadow_compilecache_s
+{
+	char mapname[MAX_QPATH];
+	unsigned int mapcrc;
+	qboolean loaded;
+	qboolean dirty;
+	// all records back to back, exactly as stored in the file after its header
 	unsigned char *data;
-	shadowmesh_t *mesh;
+	size_t size;
+	size_t maxsize;
+	int numrecords;
+	int maxrecords;
+	size_t *recordoffsets;
+	int *recordnext;
+	int hash[R_SHADOW_COMPILECACHE_HASHSIZE];
+}
+r_shadow_compilecache_t;
 
-	// compile the light
+static r_shadow_compilecache_t r_shadow_compilecache;
+
+static const r_shadow_compilecacherecord_t *R_Shadow_CompileCache_Record(int index)
+{
+	return (const r_shadow_compilecacherecord_t *)(r_shadow_compilecache.data + r_shadow_compilecache.recordoffsets[index]);
+}
+
+static void R_Shadow_CompileCache_FileName(char *filename, size_t filenamesize)
+{
+	char basename[MAX_QPATH];
+	FS_StripExtension(r_shadow_compilecache.mapname, basename, sizeof(basename));
+	dpsnprintf(filename, filenamesize, "cache/%s_rtlights.dat", basename);
+}
+
+static void R_Shadow_CompileCache_Free(void)
+{
+	size_t lightindex;
+	dlight_t *light;
+	size_t range = Mem_ExpandableArray_IndexRange(&r_shadow_worldlightsarray); // checked
+	// the record numbers of compiled lights refer to this cache
+	for (lightindex = 0;lightindex < range;lightindex++)
+	{
+		light = (dlight_t *) Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
+		if (light)
+			light->rtlight.static_compilecacherecord = 0;
+	}
+	if (r_shadow_compilecache.data)
+		Mem_Free(r_shadow_compilecache.data);
+	if (r_shadow_compilecache.recordoffsets)
+		Mem_Free(r_shadow_compilecache.recordoffsets);
+	if (r_shadow_compilecache.recordnext)
+		Mem_Free(r_shadow_compilecache.recordnext);
+	memset(&r_shadow_compilecache, 0, sizeof(r_shadow_compilecache));
+}
+
+static void R_Shadow_CompileCache_AddRecord(const r_shadow_compilecacherecord_t *record, const unsigned char *data)
+{
+	r_shadow_compilecache_t *c = &r_shadow_compilecache;
+	size_t recordsize = sizeof(*record) + record->datasize;
+	int h;
+	if (c->size + recordsize > c->maxsize)
+	{
+		c->maxsize = max(c->maxsize * 2, c->size + recordsize + 65536);
+		c->data = (unsigned char *)(c->data ? Mem_Realloc(r_main_mempool, c->data, c->maxsize) : Mem_Alloc(r_main_mempool, c->maxsize));
+	}
+	if (c->numrecords >= c->maxrecords)
+	{
+		c->maxrecords = max(c->maxrecords * 2, 256);
+		c->recordoffsets = (size_t *)(c->recordoffsets ? Mem_Realloc(r_main_mempool, c->recordoffsets, c->maxrecords * sizeof(size_t)) : Mem_Alloc(r_main_mempool, c->maxrecords * sizeof(size_t)));
+		c->recordnext = (int *)(c->recordnext ? Mem_Realloc(r_main_mempool, c->recordnext, c->maxrecords * sizeof(int)) : Mem_Alloc(r_main_mempool, c->maxrecords * sizeof(int)));
+	}
+	memcpy(c->data + c->size, record, sizeof(*record));
+	if (data != c->data + c->size + sizeof(*record))
+		memcpy(c->data + c->size + sizeof(*record), data, record->datasize);
+	h = BuffLittleLong(record->key) & (R_SHADOW_COMPILECACHE_HASHSIZE - 1);
+	c->recordoffsets[c->numrecords] = c->size;
+	c->recordnext[c->numrecords] = c->hash[h];
+	c->hash[h] = c->numrecords;
+	c->numrecords++;
+	c->size += recordsize;
+}
+
+static void R_Shadow_CompileCache_Load(dp_model_t *model)
+{
+	r_shadow_compilecache_t *c = &r_shadow_compilecache;
+	char filename[MAX_QPATH];
+	unsigned char *filedata;
+	fs_offset_t filesize, offset;
+	r_shadow_compilecacherecord_t record;
+	int i;
+
+	// switching maps without r_shadow_newmap (the cache was enabled later)
+	R_Shadow_CompileCache_Flush();
+	R_Shadow_CompileCache_Free();
+	strlcpy(c->mapname, model->name, sizeof(c->mapname));
+	c->mapcrc = model->crc;
+	c->loaded = true;
+	for (i = 0;i < R_SHADOW_COMPILECACHE_HASHSIZE;i++)
+		c->hash[i] = -1;
+
+	R_Shadow_CompileCache_FileName(filename, sizeof(filename));
+	filedata = FS_LoadFile(filename, tempmempool, true, &filesize);
+	if (!filedata)
+		return;
+	if (filesize < 16 || memcmp(filedata, R_SHADOW_COMPILECACHE_IDENT, 8) || BuffLittleLong(filedata + 8) != R_SHADOW_COMPILECACHE_VERSION || BuffLittleLong(filedata + 12) != (int)sizeof(record))
+	{
+		Con_DPrintf("R_Shadow_CompileCache_Load: ignoring invalid cache file %s\n", filename);
+		Mem_Free(filedata);
+		return;
+	}
+	for (offset = 16;offset + (fs_offset_t)sizeof(record) <= filesize;offset += sizeof(record) + record.datasize)
+	{
+		memcpy(&record, filedata + offset, sizeof(record));
+		if (record.datasize < 0 || offset + (fs_offset_t)sizeof(record) + record.datasize > filesize)
+			break;
+		R_Shadow_CompileCache_AddRecord(&record, filedata + offset + sizeof(record));
+	}
+	Mem_Free(filedata);
+	Con_DPrintf("R_Shadow_CompileCache_Load: %i compiled lights in %s\n", c->numrecords, filename);
+}
+
+/*
+=============
+R_Shadow_CompileCache_Flush
+
+rewrites the cache file with the records used by the currently compiled world
+lights, records of lights that were moved or deleted (or not compiled at all
+this time) are dropped, this is only called when leaving the map so the file
+is never written during play
+=============
+*/
+static void R_Shadow_CompileCache_Flush(void)
+{
+	r_shadow_compilecache_t *c = &r_shadow_compilecache;
+	char filename[MAX_QPATH];
+	unsigned char header[16];
+	unsigned char *used;
+	const void **data;
+	fs_offset_t *len;
+	size_t lightindex;
+	dlight_t *light;
+	size_t range;
+	int i, numused;
+
+	if (!c->loaded || !c->numrecords || r_shadow_realtime_world_compilecache.integer != 1)
+		return;
+	used = (unsigned char *)Mem_Alloc(tempmempool, c->numrecords);
+	numused = 0;
+	range = Mem_ExpandableArray_IndexRange(&r_shadow_worldlightsarray); // checked
+	for (lightindex = 0;lightindex < range;lightindex++)
+	{
+		light = (dlight_t *) Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
+		if (!light || !light->rtlight.compiled)
+			continue;
+		i = light->rtlight.static_compilecacherecord - 1;
+		if (i >= 0 && i < c->numrecords && !used[i])
+		{
+			used[i] = true;
+			numused++;
+		}
+	}
+	// nothing new and nothing stale, or no lights compiled to tell them
+	// apart (rtworld off), keep the file as it is
+	if ((!c->dirty && numused == c->numrecords) || !numused)
+	{
+		Mem_Free(used);
+		return;
+	}
+	c->dirty = false;
+	memcpy(header, R_SHADOW_COMPILECACHE_IDENT, 8);
+	StoreLittleLong(header + 8, R_SHADOW_COMPILECACHE_VERSION);
+	StoreLittleLong(header + 12, sizeof(r_shadow_compilecacherecord_t));
+	data = (const void **)Mem_Alloc(tempmempool, (numused + 1) * sizeof(*data));
+	len = (fs_offset_t *)Mem_Alloc(tempmempool, (numused + 1) * sizeof(*len));
+	data[0] = header;
+	len[0] = sizeof(header);
+	numused = 1;
+	for (i = 0;i < c->numrecords;i++)
+	{
+		if (!used[i])
+			continue;
+		data[numused] = R_Shadow_CompileCache_Record(i);
+		len[numused] = sizeof(r_shadow_compilecacherecord_t) + R_Shadow_CompileCache_Record(i)->datasize;
+		numused++;
+	}
+	R_Shadow_CompileCache_FileName(filename, sizeof(filename));
+	if (FS_WriteFileInBlocks(filename, data, len, numused))
+		Con_DPrintf("R_Shadow_CompileCache_Flush: %i compiled lights written to %s (%i dropped)\n", numused - 1, filename, c->numrecords - (numused - 1));
+	else
+		Con_DPrintf("R_Shadow_CompileCache_Flush: could not write %s\n", filename);
+	Mem_Free(len);
+	Mem_Free(data);
+	Mem_Free(used);
+}
+
+static void R_Shadow_CompileCache_Key(const rtlight_t *rtlight, dp_model_t *model, unsigned char *key)
+{
+	struct
+	{
+		float origin[3];
+		float radius;
+		int frontsidecasting;
+		int portalculling;
+		int svbsp;
+		int sortsurfaces;
+		unsigned int mapcrc;
+		int numsurfaces;
+		int numtriangles;
+		int numleafs;
+	}
+	k;
+	memset(&k, 0, sizeof(k));
+	VectorCopy(rtlight->shadoworigin, k.origin);
+	k.radius = rtlight->radius;
+	k.frontsidecasting = r_shadow_frontsidecasting.integer;
+	k.portalculling = r_shadow_realtime_world_compileportalculling.integer;
+	k.svbsp = r_shadow_realtime_world_compilesvbsp.integer;
+	k.sortsurfaces = r_shadow_sortsurfaces.integer;
+	k.mapcrc = model->crc;
+	k.numsurfaces = model->num_surfaces;
+	k.numtriangles = model->surfmesh.num_triangles;
+	k.numleafs = model->brush.num_leafs;
+	Com_BlockFullChecksum(&k, sizeof(k), key);
+}
+
+// returns the index of the record with this key, or -1
+static int R_Shadow_CompileCache_Find(const unsigned char *key)
+{
+	r_shadow_compilecache_t *c = &r_shadow_compilecache;
+	int i;
+	for (i = c->hash[BuffLittleLong(key) & (R_SHADOW_COMPILECACHE_HASHSIZE - 1)];i >= 0;i = c->recordnext[i])
+		if (!memcmp(R_Shadow_CompileCache_Record(i)->key, key, 16))
+			return i;
+	return -1;
+}
+
+// allocates the grouped static_* arrays of a compiled light
+static void R_RTLight_AllocStaticData(rtlight_t *rtlight, int numsurfaces, int numleafs, int numleafpvsbytes, int numshadowtrispvsbytes, int numlighttrispvsbytes)
+{
+	unsigned char *data = (unsigned char *)Mem_Alloc(r_main_mempool, sizeof(int) * numsurfaces + sizeof(int) * numleafs + numleafpvsbytes + numshadowtrispvsbytes + numlighttrispvsbytes);
+	rtlight->static_numsurfaces = numsurfaces;
+	rtlight->static_surfacelist = (int *)data;data += sizeof(int) * numsurfaces;
+	rtlight->static_numleafs = numleafs;
+	rtlight->static_leaflist = (int *)data;data += sizeof(int) * numleafs;
+	rtlight->static_numleafpvsbytes = numleafpvsbytes;
+	rtlight->static_leafpvs = (unsigned char *)data;data += numleafpvsbytes;
+	rtlight->static_numshadowtrispvsbytes = numshadowtrispvsbytes;
+	rtlight->static_shadowtrispvs = (unsigned char *)data;data += numshadowtrispvsbytes;
+	rtlight->static_numlighttrispvsbytes = numlighttrispvsbytes;
+	rtlight->static_lighttrispvs = (unsigned char *)data;data += numlighttrispvsbytes;
+}
+
+static qboolean R_RTLight_LoadCompiled(rtlight_t *rtlight, const r_shadow_compilecacherecord_t *record, int numleafpvsbytes, int numshadowtrispvsbytes, int numlighttrispvsbytes)
+{
+	int size;
+	if (record->numleafpvsbytes != numleafpvsbytes || record->numshadowtrispvsbytes != numshadowtrispvsbytes || record->numlighttrispvsbytes != numlighttrispvsbytes)
+		return false;
+	size = sizeof(int) * (record->numsurfaces + record->numleafs) + numleafpvsbytes + numshadowtrispvsbytes + numlighttrispvsbytes;
+	if (record->datasize < size)
+		return false;
+	R_RTLight_AllocStaticData(rtlight, record->numsurfaces, record->numleafs, numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes);
+	memcpy(rtlight->static_surfacelist, record + 1, size);
+	VectorCopy(record->cullmins, rtlight->cullmins);
+	VectorCopy(record->cullmaxs, rtlight->cullmaxs);
+	return true;
+}
+
+static void R_RTLight_StoreCompiled(rtlight_t *rtlight, const unsigned char *key)
+{
+	r_shadow_compilecacherecord_t record;
+	int size = sizeof(int) * (rtlight->static_numsurfaces + rtlight->static_numleafs) + rtlight->static_numleafpvsbytes + rtlight->static_numshadowtrispvsbytes + rtlight->static_numlighttrispvsbytes;
+	unsigned char *data = (unsigned char *)Mem_Alloc(tempmempool, (size + 3) & ~3);
+	memset(&record, 0, sizeof(record));
+	memcpy(record.key, key, 16);
+	record.datasize = (size + 3) & ~3;
+	VectorCopy(rtlight->cullmins, record.cullmins);
+	VectorCopy(rtlight->cullmaxs, record.cullmaxs);
+	record.numsurfaces = rtlight->static_numsurfaces;
+	record.numleafs = rtlight->static_numleafs;
+	record.numleafpvsbytes = rtlight->static_numleafpvsbytes;
+	record.numshadowtrispvsbytes = rtlight->static_numshadowtrispvsbytes;
+	record.numlighttrispvsbytes = rtlight->static_numlighttrispvsbytes;
+	// the static arrays are one allocation starting at static_surfacelist
+	memcpy(data, rtlight->static_surfacelist, size);
+	R_Shadow_CompileCache_AddRecord(&record, data);
+	r_shadow_compilecache.dirty = true;
+	rtlight->static_compilecacherecord = r_shadow_compilecache.numrecords;
+	Mem_Free(data);
+}
+
+static void R_RTLight_StaticDataSizes(dp_model_t *model, int *numleafpvsbytes, int *numshadowtrispvsbytes, int *numlighttrispvsbytes)
+{
+	*numleafpvsbytes = (model->brush.num_leafs + 7) >> 3;
+	*numshadowtrispvsbytes = ((model->brush.shadowmesh ? model->brush.shadowmesh->numtriangles : model->surfmesh.num_triangles) + 7) >> 3;
+	*numlighttrispvsbytes = (model->surfmesh.num_triangles + 7) >> 3;
+}
+
+// looks up the culling results of the light in the compile cache, the key is
+// filled in for R_RTLight_StoreCompiled either way
+static qboolean R_RTLight_LoadFromCache(rtlight_t *rtlight, dp_model_t *model, unsigned char *key)
+{
+	int index, numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes;
+	if (!r_shadow_realtime_world_compilecache.integer)
+		return false;
+	if (!r_shadow_compilecache.loaded || strcmp(r_shadow_compilecache.mapname, model->name) || r_shadow_compilecache.mapcrc != model->crc)
+		R_Shadow_CompileCache_Load(model);
+	R_Shadow_CompileCache_Key(rtlight, model, key);
+	index = R_Shadow_CompileCache_Find(key);
+	if (index < 0)
+		return false;
+	R_RTLight_StaticDataSizes(model, &numleafpvsbytes, &numshadowtrispvsbytes, &numlighttrispvsbytes);
+	if (!R_RTLight_LoadCompiled(rtlight, R_Shadow_CompileCache_Record(index), numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes))
+		return false;
+	rtlight->static_compilecacherecord = index + 1;
+	return true;
+}
+
+// copies culling results into the static_* arrays of the light
+static void R_RTLight_SetStaticData(rtlight_t *rtlight, dp_model_t *model, int numsurfaces, const int *surfacelist, int numleafs, const int *leaflist, const unsigned char *leafpvs, const unsigned char *shadowtrispvs, const unsigned char *lighttrispvs)
+{
+	int numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes;
+	R_RTLight_StaticDataSizes(model, &numleafpvsbytes, &numshadowtrispvsbytes, &numlighttrispvsbytes);
+	R_RTLight_AllocStaticData(rtlight, numsurfaces, numleafs, numleafpvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes);
+	if (rtlight->static_numsurfaces)
+		memcpy(rtlight->static_surfacelist, surfacelist, rtlight->static_numsurfaces * sizeof(*rtlight->static_surfacelist));
+	if (rtlight->static_numleafs)
+		memcpy(rtlight->static_leaflist, leaflist, rtlight->static_numleafs * sizeof(*rtlight->static_leaflist));
+	if (rtlight->static_numleafpvsbytes)
+		memcpy(rtlight->static_leafpvs, leafpvs, rtlight->static_numleafpvsbytes);
+	if (rtlight->static_numshadowtrispvsbytes)
+		memcpy(rtlight->static_shadowtrispvs, shadowtrispvs, rtlight->static_numshadowtrispvsbytes);
+	if (rtlight->static_numlighttrispvsbytes)
+		memcpy(rtlight->static_lighttrispvs, lighttrispvs, rtlight->static_numlighttrispvsbytes);
+}
+
+// resets the compiled state of the light before its culling is done
+static void R_RTLight_BeginCompile(rtlight_t *rtlight)
+{
 	rtlight->compiled = true;
 	rtlight->shadowmode = rtlight->shadow ? (int)r_shadow_shadowmode : -1;
 	rtlight->static_numleafs = 0;
@@ -3934,6 +4628,7 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 	rtlight->static_leafpvs = NULL;
 	rtlight->static_numsurfaces = 0;
 	rtlight->static_surfacelist = NULL;
+	rtlight->static_compilecacherecord = 0;
 	rtlight->static_shadowmap_receivers = 0x3F;
 	rtlight->static_shadowmap_casters = 0x3F;
 	rtlight->cullmins[0] = rtlight->shadoworigin[0] - rtlight->radius;
@@ -3942,48 +4637,31 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 	rtlight->cullmaxs[0] = rtlight->shadoworigin[0] + rtlight->radius;
 	rtlight->cullmaxs[1] = rtlight->shadoworigin[1] + rtlight->radius;
 	rtlight->cullmaxs[2] = rtlight->shadoworigin[2] + rtlight->radius;
+}
+
+// builds the shadow meshes of a light whose culling is done
+static void R_RTLight_FinishCompile(rtlight_t *rtlight)
+{
+	int i;
+	int lighttris, shadowtris, shadowzpasstris, shadowzfailtris;
+	entity_render_t *ent = r_refdef.scene.worldentity;
+	dp_model_t *model = r_refdef.scene.worldmodel;
+	shadowmesh_t *mesh;
 
 	if (model && model->GetLightInfo)
 	{
 		// this variable must be set for the CompileShadowVolume/CompileShadowMap code
 		r_shadow_compilingrtlight = rtlight;
 		R_FrameData_SetMark();
-		model->GetLightInfo(ent, rtlight->shadoworigin, rtlight->radius, rtlight->cullmins, rtlight->cullmaxs, r_shadow_buffer_leaflist, r_shadow_buffer_leafpvs, &numleafs, r_shadow_buffer_surfacelist, r_shadow_buffer_surfacepvs, &numsurfaces, r_shadow_buffer_shadowtrispvs, r_shadow_buffer_lighttrispvs, r_shadow_buffer_visitingleafpvs, 0, NULL);
-		R_FrameData_ReturnToMark();
-		numleafpvsbytes = (model->brush.num_leafs + 7) >> 3;
-		numshadowtrispvsbytes = ((model->brush.shadowmesh ? model->brush.shadowmesh->numtriangles : model->surfmesh.num_triangles) + 7) >> 3;
-		numlighttrispvsbytes = (model->surfmesh.num_triangles + 7) >> 3;
-		data = (unsigned char *)Mem_Alloc(r_main_mempool, sizeof(int) * numsurfaces + sizeof(int) * numleafs + numleafpvsbytes + numshadowtrispvsbytes + numlighttrispvsbytes);
-		rtlight->static_numsurfaces = numsurfaces;
-		rtlight->static_surfacelist = (int *)data;data += sizeof(int) * numsurfaces;
-		rtlight->static_numleafs = numleafs;
-		rtlight->static_leaflist = (int *)data;data += sizeof(int) * numleafs;
-		rtlight->static_numleafpvsbytes = numleafpvsbytes;
-		rtlight->static_leafpvs = (unsigned char *)data;data += numleafpvsbytes;
-		rtlight->static_numshadowtrispvsbytes = numshadowtrispvsbytes;
-		rtlight->static_shadowtrispvs = (unsigned char *)data;data += numshadowtrispvsbytes;
-		rtlight->static_numlighttrispvsbytes = numlighttrispvsbytes;
-		rtlight->static_lighttrispvs = (unsigned char *)data;data += numlighttrispvsbytes;
-		if (rtlight->static_numsurfaces)
-			memcpy(rtlight->static_surfacelist, r_shadow_buffer_surfacelist, rtlight->static_numsurfaces * sizeof(*rtlight->static_surfacelist));
-		if (rtlight->static_numleafs)
-			memcpy(rtlight->static_leaflist, r_shadow_buffer_leaflist, rtlight->static_numleafs * sizeof(*rtlight->static_leaflist));
-		if (rtlight->static_numleafpvsbytes)
-			memcpy(rtlight->static_leafpvs, r_shadow_buffer_leafpvs, rtlight->static_numleafpvsbytes);
-		if (rtlight->static_numshadowtrispvsbytes)
-			memcpy(rtlight->static_shadowtrispvs, r_shadow_buffer_shadowtrispvs, rtlight->static_numshadowtrispvsbytes);
-		if (rtlight->static_numlighttrispvsbytes)
-			memcpy(rtlight->static_lighttrispvs, r_shadow_buffer_lighttrispvs, rtlight->static_numlighttrispvsbytes);
-		R_FrameData_SetMark();
 		switch (rtlight->shadowmode)
 		{
 		case R_SHADOW_SHADOWMODE_SHADOWMAP2D:
 			if (model->CompileShadowMap && rtlight->shadow)
-				model->CompileShadowMap(ent, rtlight->shadoworigin, NULL, rtlight->radius, numsurfaces, r_shadow_buffer_surfacelist);
+				model->CompileShadowMap(ent, rtlight->shadoworigin, NULL, rtlight->radius, rtlight->static_numsurfaces, rtlight->static_surfacelist);
 			break;
 		default:
 			if (model->CompileShadowVolume && rtlight->shadow)
-				model->CompileShadowVolume(ent, rtlight->shadoworigin, NULL, rtlight->radius, numsurfaces, r_shadow_buffer_surfacelist);
+				model->CompileShadowVolume(ent, rtlight->shadoworigin, NULL, rtlight->radius, rtlight->static_numsurfaces, rtlight->static_surfacelist);
 			break;
 		}
 		R_FrameData_ReturnToMark();
@@ -4022,6 +4700,30 @@ void R_RTLight_Compile(rtlight_t *rtlight)
 		Con_DPrintf("static light built: %f %f %f : %f %f %f box, %i light triangles, %i shadow triangles, %i zpass/%i zfail compiled shadow volume triangles\n", rtlight->cullmins[0], rtlight->cullmins[1], rtlight->cullmins[2], rtlight->cullmaxs[0], rtlight->cullmaxs[1], rtlight->cullmaxs[2], lighttris, shadowtris, shadowzpasstris, shadowzfailtris);
 }
 
+void R_RTLight_Compile(rtlight_t *rtlight)
+{
+	int numsurfaces, numleafs;
+	entity_render_t *ent = r_refdef.scene.worldentity;
+	dp_model_t *model = r_refdef.scene.worldmodel;
+	unsigned char cachekey[16];
+
+	// compile the light
+	R_RTLight_BeginCompile(rtlight);
+	if (model && model->GetLightInfo && !R_RTLight_LoadFromCache(rtlight, model, cachekey))
+	{
+		// GetLightInfo skips frustum culling while this is set
+		r_shadow_compilingrtlight = rtlight;
+		R_FrameData_SetMark();
+		model->GetLightInfo(ent, rtlight->shadoworigin, rtlight->radius, rtlight->cullmins, rtlight->cullmaxs, r_shadow_buffer_leaflist, r_shadow_buffer_leafpvs, &numleafs, r_shadow_buffer_surfacelist, r_shadow_buffer_surfacepvs, &numsurfaces, r_shadow_buffer_shadowtrispvs, r_shadow_buffer_lighttrispvs, r_shadow_buffer_visitingleafpvs, 0, NULL);
+		R_FrameData_ReturnToMark();
+		r_shadow_compilingrtlight = NULL;
+		R_RTLight_SetStaticData(rtlight, model, numsurfaces, r_shadow_buffer_surfacelist, numleafs, r_shadow_buffer_leaflist, r_shadow_buffer_leafpvs, r_shadow_buffer_shadowtrispvs, r_shadow_buffer_lighttrispvs);
+		if (r_shadow_realtime_world_compilecache.integer)
+			R_RTLight_StoreCompiled(rtlight, cachekey);
+	}
+	R_RTLight_FinishCompile(rtlight);
+}
+
 void R_RTLight_Uncompile(rtlight_t *rtlight)
 {
 	if (rtlight->compiled)
@@ -4048,6 +4750,7 @@ void R_RTLight_Uncompile(rtlight_t *rtlight)
 		rtlight->static_shadowtrispvs = NULL;
 		rtlight->static_numlighttrispvsbytes = 0;
 		rtlight->static_lighttrispvs = NULL;
+		rtlight->static_compilecacherecord = 0;
 		rtlight->compiled = false;
 	}
 }
@@ -4400,6 +5103,167 @@ static void R_Shadow_DrawEntityLight(entity_render_t *ent)
 	rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
 }
 
+// true if R_Shadow_PrepareLight would (re)compile this light
+static qboolean R_Shadow_LightNeedsCompile(const rtlight_t *rtlight)
+{
+	// lights that don't light anything are never compiled (see nolight below)
+	if (VectorLength2(rtlight->color) * (rtlight->ambientscale + rtlight->diffusescale + rtlight->specularscale) < (1.0f / 1048576.0f))
+		return false;
+	return rtlight->isstatic && (!rtlight->compiled || (rtlight->shadow && rtlight->shadowmode != (int)r_shadow_shadowmode)) && r_shadow_realtime_world_compile.integer;
+}
+
+typedef struct r_shadow_compilejob_s
+{
+	rtlight_t *rtlight;
+	// culling was loaded from the compile cache, only the meshes are built
+	qboolean cached;
+	unsigned char cachekey[16];
+}
+r_shadow_compilejob_t;
+
+typedef struct r_shadow_compilestate_s
+{
+	dp_model_t *model;
+	// currentmaterialflags of each world texture, R_GetCurrentTexture is not
+	// thread safe so it is only called on the main thread
+	int *materialflags;
+	int numjobs;
+	int nextjob;
+	r_shadow_compilejob_t *jobs;
+	void *mutex;
+}
+r_shadow_compilestate_t;
+
+static r_shadow_compilestate_t r_shadow_compilestate;
+
+// culls lights until there are no jobs left, every thread has its own output
+// buffers and svbsp
+static void R_Shadow_CompileWorldLights_Job(int slab, int numslabs)
+{
+	r_shadow_compilestate_t *s = &r_shadow_compilestate;
+	dp_model_t *model = s->model;
+	r_shadow_compilejob_t *job;
+	rtlight_t *rtlight;
+	svbsp_t svbsp;
+	int jobindex, numleafs, numsurfaces;
+	int numleafpvsbytes, numsurfacepvsbytes, numshadowtrispvsbytes, numlighttrispvsbytes;
+	int *leaflist, *surfacelist;
+	unsigned char *data, *leafpvs, *visitingleafpvs, *surfacepvs, *shadowtrispvs, *lighttrispvs;
+
+	R_RTLight_StaticDataSizes(model, &numleafpvsbytes, &numshadowtrispvsbytes, &numlighttrispvsbytes);
+	numsurfacepvsbytes = (model->num_surfaces + 7) >> 3;
+	data = (unsigned char *)Mem_Alloc(tempmempool, sizeof(int) * (model->brush.num_leafs + model->num_surfaces) + numleafpvsbytes * 2 + numsurfacepvsbytes + numshadowtrispvsbytes + numlighttrispvsbytes);
+	leaflist = (int *)data;data += sizeof(int) * model->brush.num_leafs;
+	surfacelist = (int *)data;data += sizeof(int) * model->num_surfaces;
+	leafpvs = data;data += numleafpvsbytes;
+	visitingleafpvs = data;data += numleafpvsbytes;
+	surfacepvs = data;data += numsurfacepvsbytes;
+	shadowtrispvs = data;data += numshadowtrispvsbytes;
+	lighttrispvs = data;data += numlighttrispvsbytes;
+	memset(&svbsp, 0, sizeof(svbsp));
+
+	for (;;)
+	{
+		Thread_LockMutex(s->mutex);
+		jobindex = s->nextjob++;
+		Thread_UnlockMutex(s->mutex);
+		if (jobindex >= s->numjobs)
+			break;
+		job = s->jobs + jobindex;
+		if (job->cached)
+			continue;
+		rtlight = job->rtlight;
+		model->CompileLightInfo(model, &svbsp, s->materialflags, rtlight->shadoworigin, rtlight->radius, rtlight->cullmins, rtlight->cullmaxs, leaflist, leafpvs, &numleafs, surfacelist, surfacepvs, &numsurfaces, shadowtrispvs, lighttrispvs, visitingleafpvs);
+		R_RTLight_SetStaticData(rtlight, model, numsurfaces, surfacelist, numleafs, leaflist, leafpvs, shadowtrispvs, lighttrispvs);
+	}
+
+	if (svbsp.nodes)
+		Mem_Free(svbsp.nodes);
+	Mem_Free(leaflist);
+}
+
+/*
+=============
+R_Shadow_CompileWorldLights
+
+compiles all the world lights R_Shadow_PrepareLight would compile this frame
+at once, the culling (portal flow or svbsp, the slow part) of lights that are
+not in the compile cache is spread over r_shadow_realtime_world_compilethreads
+threads and the shadow meshes are then built on the main thread in light
+order, with one thread the lights are left to R_Shadow_PrepareLight
+=============
+*/
+static void R_Shadow_CompileWorldLights(int flag)
+{
+	r_shadow_compilestate_t *s = &r_shadow_compilestate;
+	dp_model_t *model = r_refdef.scene.worldmodel;
+	size_t lightindex;
+	dlight_t *light;
+	size_t range;
+	int i, numthreads, numculled;
+
+	numthreads = R_Shadow_NumThreads(r_shadow_realtime_world_compilethreads.integer);
+	if (numthreads < 2 || !model || !model->GetLightInfo || !model->CompileLightInfo)
+		return;
+
+	range = Mem_ExpandableArray_IndexRange(&r_shadow_worldlightsarray); // checked
+	s->numjobs = 0;
+	for (lightindex = 0;lightindex < range;lightindex++)
+	{
+		light = (dlight_t *)Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
+		if (light && (light->flags & flag) && R_Shadow_LightNeedsCompile(&light->rtlight))
+			s->numjobs++;
+	}
+	// a single light (usually one being edited) is not worth the threads
+	if (s->numjobs < 2)
+		return;
+
+	s->jobs = (r_shadow_compilejob_t *)Mem_Alloc(tempmempool, s->numjobs * sizeof(*s->jobs));
+	s->numjobs = 0;
+	numculled = 0;
+	for (lightindex = 0;lightindex < range;lightindex++)
+	{
+		light = (dlight_t *)Mem_ExpandableArray_RecordAtIndex(&r_shadow_worldlightsarray, lightindex);
+		if (!light || !(light->flags & flag) || !R_Shadow_LightNeedsCompile(&light->rtlight))
+			continue;
+		if (light->rtlight.compiled)
+			R_RTLight_Uncompile(&light->rtlight);
+		R_RTLight_BeginCompile(&light->rtlight);
+		s->jobs[s->numjobs].rtlight = &light->rtlight;
+		s->jobs[s->numjobs].cached = R_RTLight_LoadFromCache(&light->rtlight, model, s->jobs[s->numjobs].cachekey);
+		if (!s->jobs[s->numjobs].cached)
+			numculled++;
+		s->numjobs++;
+	}
+
+	if (numculled)
+	{
+		s->model = model;
+		s->materialflags = (int *)Mem_Alloc(tempmempool, max(model->num_textures, 1) * sizeof(int));
+		RSurf_ActiveWorldEntity();
+		for (i = 0;i < model->num_textures;i++)
+			s->materialflags[i] = R_GetCurrentTexture(model->data_textures + i)->currentmaterialflags;
+		rsurface.entity = NULL; // used only by R_GetCurrentTexture and RSurf_ActiveWorldEntity/RSurf_ActiveModelEntity
+		s->nextjob = 0;
+		s->mutex = Thread_CreateMutex();
+		R_Shadow_RunJob(R_Shadow_CompileWorldLights_Job, numthreads);
+		Thread_DestroyMutex(s->mutex);
+		Mem_Free(s->materialflags);
+	}
+
+	// the rest touches the cache and the shared shadow mark buffers
+	for (i = 0;i < s->numjobs;i++)
+	{
+		if (!s->jobs[i].cached && r_shadow_realtime_world_compilecache.integer)
+			R_RTLight_StoreCompiled(s->jobs[i].rtlight, s->jobs[i].cachekey);
+		R_RTLight_FinishCompile(s->jobs[i].rtlight);
+	}
+	if (developer_extra.integer)
+		Con_DPrintf("R_Shadow_CompileWorldLights: compiled %i lights (%i from the cache) on %i threads\n", s->numjobs, s->numjobs - numculled, numthreads);
+	Mem_Free(s->jobs);
+	memset(s, 0, sizeof(*s));
+}
+
 static void R_Shadow_PrepareLight(rtlight_t *rtlight)
 {
 	int i;
@@ -4445,7 +5309,7 @@ static void R_Shadow_PrepareLight(rtlight_t *rtlight)
 	// all at once at the start of a level, not when it stalls gameplay.
 	// (especially important to benchmarks)
 	// compile light
-	if (rtlight->isstatic && !nolight && (!rtlight->compiled || (rtlight->shadow && rtlight->shadowmode != (int)r_shadow_shadowmode)) && r_shadow_realtime_world_compile.integer)
+	if (R_Shadow_LightNeedsCompile(rtlight))
 	{
 		if (rtlight->compiled)
 			R_RTLight_Uncompile(rtlight);
@@ -5185,6 +6049,7 @@ void R_Shadow_PrepareLights(int fbo, rtexture_t *depthtexture, rtexture_t *color
 
 	r_shadow_scenenumlights = 0;
 	flag = r_refdef.scene.rtworld ? LIGHTFLAG_REALTIMEMODE : LIGHTFLAG_NORMALMODE;
+	R_Shadow_CompileWorldLights(flag);
 	range = Mem_ExpandableArray_IndexRange(&r_shadow_worldlightsarray); // checked
 	for (lightindex = 0; lightindex < range; lightindex++)
 	{
@@ -201,6 +201,10 @@ rtexture_t *R_LoadTextureDDSFile(rtexturepool_t *rtexturepool, const char *basen
 // saves a texture to a DDS file
 int R_SaveTextureDDSFile(rtexture_t *rt, const char *filename, qboolean skipuncompressed, qboolean hasalpha, float *avgcolor);
 
+// registers r_texture_dds_build, also called on dedicated servers which do
+// not run R_Textures_Init
+void R_Textures_InitCommands(void);
+
 // free a texture
 void R_FreeTexture(rtexture_t *rt);
 
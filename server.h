@@ -74,6 +74,9 @@ typedef struct server_floodaddress_s
 }
 server_floodaddress_t;
 
+/// number of hash buckets for the precache name lookups, power of 2
+#define SV_PRECACHEHASHSIZE 1024
+
 typedef struct server_s
 {
 	/// false if only a net client
@@ -120,6 +123,12 @@ typedef struct server_s
 	// LordHavoc: precaches are now MAX_QPATH rather than a pointer
 	// updated by SV_SoundIndex
 	char sound_precache[MAX_SOUNDS][MAX_QPATH];
+	/// name lookup for model_precache and sound_precache, see
+	/// SV_PrecacheHash_Link (chains end at 0, which is never a named slot)
+	unsigned short model_precachehash[SV_PRECACHEHASHSIZE];
+	unsigned short model_precachenext[MAX_MODELS];
+	unsigned short sound_precachehash[SV_PRECACHEHASHSIZE];
+	unsigned short sound_precachenext[MAX_SOUNDS];
 	char lightstyles[MAX_LIGHTSTYLES][64];
 	/// some actions are only valid during load
 	server_state_t state;
@@ -143,6 +152,8 @@ typedef struct server_s
 
 	qboolean particleeffectnamesloaded;
 	char particleeffectname[MAX_PARTICLEEFFECTNAME][MAX_QPATH];
+	unsigned short particleeffectnamehash[SV_PRECACHEHASHSIZE];
+	unsigned short particleeffectnamenext[MAX_PARTICLEEFFECTNAME];
 
 	int writeentitiestoclient_stats_culled_pvs;
 	int writeentitiestoclient_stats_culled_trace;
@@ -532,6 +543,9 @@ void SV_ReadClientMessage(void);
 // 2 = precache
 int SV_ModelIndex(const char *s, int precachemode);
 int SV_SoundIndex(const char *s, int precachemode);
+// adds names[index] to a precache name lookup, for code that fills the
+// precache lists directly (hash must have been cleared along with them)
+void SV_PrecacheHash_Link(unsigned short *hash, unsigned short *next, char (*names)[MAX_QPATH], int index);
 
 int SV_ParticleEffectIndex(const char *name);
 
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "snd_ogg.h"
 #include "csprogs.h"
 #include "cl_collision.h"
+#include "thread.h"
 #ifdef CONFIG_CD
 #include "cdaudio.h"
 #endif
@@ -127,6 +128,56 @@ static const speakerlayout_t snd_speakerlayouts[] =
 channel_t channels[MAX_CHANNELS];
 unsigned int total_channels;
 
+/*
+The mixer (the mixing thread, the audio thread of a threaded sound output, or
+the main thread itself) mixes its own copy of the channels, which no other
+thread touches.  The main thread starts, stops and spatializes channels[] and
+publishes them to the mixer as a snapshot every frame; the mixer hands back how
+far each channel got and which ones reached their end.  Both directions go
+through a triple buffer: the writer fills its buffer and swaps it with the
+latest one in a single atomic exchange, and the reader swaps its buffer with
+the latest one if that is new, so neither side ever waits for the other.
+*/
+channel_t mixchannels[MAX_CHANNELS];
+unsigned int total_mixchannels;
+
+// index of the latest buffer in a thread_atomic_t, with this bit set until the reader takes it
+#define SND_MIXBUFFER_FRESH 4
+
+typedef struct snd_mixsnapshot_s
+{
+	unsigned int numchannels;
+	channel_t channels[MAX_CHANNELS];
+}
+snd_mixsnapshot_t;
+
+typedef struct snd_mixposition_s
+{
+	// NULL once the mixer got to the end of the sound
+	sfx_t *sfx;
+	unsigned int serial;
+	double position;
+}
+snd_mixposition_t;
+
+typedef struct snd_mixpositions_s
+{
+	unsigned int numchannels;
+	snd_mixposition_t channels[MAX_CHANNELS];
+}
+snd_mixpositions_t;
+
+static snd_mixsnapshot_t s_mixsnapshots[3];
+static thread_atomic_t s_mixsnapshot_latest;
+static int s_mixsnapshot_write = 1; // main thread
+static int s_mixsnapshot_read = 2; // mixer
+static snd_mixpositions_t s_mixpositions[3];
+static thread_atomic_t s_mixpositions_latest;
+static int s_mixpositions_write = 1; // mixer
+static int s_mixpositions_read = 2; // main thread
+// last serial given to a channel (0 is never used)
+static unsigned int s_channelserial = 0;
+
 snd_ringbuffer_t *snd_renderbuffer = NULL;
 static unsigned int soundtime = 0;
 static unsigned int oldpaintedtime = 0;
@@ -135,6 +186,30 @@ static double snd_starttime = 0.0;
 qboolean snd_threaded = false;
 qboolean snd_usethreadedmixing = false;
 
+// mixing thread for sound backends that have no audio thread of their own,
+// it owns painting the render buffer whenever snd_usethreadedmixing is set,
+// the mutex only keeps it out while the main thread changes the mixing mode,
+// the render buffer, or frees sounds
+static void *s_mixthread = NULL;
+static void *s_mixthread_mutex = NULL;
+static volatile qboolean s_mixthread_quit = false;
+// S_PaintRenderBuffer may run on the mixing thread, which must not print, so
+// it leaves its messages here for S_PaintAndSubmit (SND_PAINTMESSAGE_* bits)
+#define SND_PAINTMESSAGE_EXTRASOUNDTIME 1
+#define SND_PAINTMESSAGE_SOUNDTIMEBACKWARDS 2
+#define SND_PAINTMESSAGE_LOCKFAILED 4
+static thread_atomic_t s_paintmessages;
+static unsigned int s_paintmessage_extrasoundtime;
+static unsigned int s_paintmessage_newsoundtime;
+static unsigned int s_paintmessage_soundtime;
+static unsigned int oldsoundtime = 0;
+static void S_StartMixThread (void);
+static void S_StopMixThread (void);
+static qboolean S_LockRenderBuffer (void);
+static void S_UnlockRenderBuffer (void);
+static unsigned int S_NewChannelSerial (void);
+static void S_DropMixerSfx (sfx_t *sfx);
+
 vec3_t listener_origin;
 matrix4x4_t listener_basematrix;
 static unsigned char *listener_pvs = NULL;
@@ -144,6 +219,9 @@ mempool_t *snd_mempool;
 
 // Linked list of known sfx
 static sfx_t *known_sfx = NULL;
+// known sfx by name (chained through sfx_t::hashnext), power of 2
+#define SFX_HASHSIZE 1024
+static sfx_t *known_sfx_hash[SFX_HASHSIZE];
 
 static qboolean sound_spatialized = false;
 
@@ -183,11 +261,17 @@ cvar_t snd_spatialization_occlusion = {CVAR_SAVE, "snd_spatialization_occlusion"
 cvar_t _snd_mixahead = {CVAR_SAVE, "_snd_mixahead", "0.15", "how much sound to mix ahead of time"};
 cvar_t snd_streaming = { CVAR_SAVE, "snd_streaming", "1", "enables keeping compressed ogg sound files compressed, decompressing them only as needed, otherwise they will be decompressed completely at load (may use a lot of memory); when set to 2, streaming is performed even if this would waste memory"};
 cvar_t snd_streaming_length = { CVAR_SAVE, "snd_streaming_length", "1", "decompress sounds completely if they are less than this play time when snd_streaming is 1"};
+cvar_t snd_streaming_thread = { CVAR_SAVE, "snd_streaming_thread", "1", "decompress streamed sounds ahead of the mixer in a separate thread, music and local sounds first (takes effect on snd_restart)"};
+cvar_t snd_streaming_readahead = { CVAR_SAVE, "snd_streaming_readahead", "0.5", "how much (in seconds) of each playing streamed sound the decode thread keeps decompressed ahead of the mixer (new decoders use the new value)"};
 cvar_t snd_swapstereo = {CVAR_SAVE, "snd_swapstereo", "0", "swaps left/right speakers for old ISA soundblaster cards"};
 extern cvar_t v_flipped;
 cvar_t snd_channellayout = {0, "snd_channellayout", "0", "channel layout. Can be 0 (auto - snd_restart needed), 1 (standard layout), or 2 (ALSA layout)"};
 cvar_t snd_mutewhenidle = {CVAR_SAVE, "snd_mutewhenidle", "1", "whether to disable sound output when game window is inactive"};
 cvar_t snd_maxchannelvolume = {CVAR_SAVE, "snd_maxchannelvolume", "10", "maximum volume of a single sound"};
+cvar_t snd_maxvoices = {CVAR_SAVE, "snd_maxvoices", "64", "maximum number of sounds mixed at once; only the most audible ones are mixed (by volume, distance attenuation and channel volume cvars, the player's own sounds count more), the others become virtual voices that keep playing silently until they are audible enough again; 0 mixes all sounds"};
+cvar_t snd_mixthread = {CVAR_SAVE, "snd_mixthread", "1", "mix sound in a separate thread when the sound output has no audio thread of its own, so level loads and slow frames don't starve the output buffer (takes effect on snd_restart)"};
+cvar_t snd_mixthread_interval = {CVAR_SAVE, "snd_mixthread_interval", "0.005", "how often (in seconds) the mixing thread tops up the output buffer, _snd_mixahead can be lowered accordingly"};
+cvar_t snd_mixsse = {CVAR_SAVE, "snd_mixsse", "1", "use the SSE2 mixer and 16bit conversion (in builds that have SSE2, see snd_mixbenchmark)"};
 cvar_t snd_softclip = {CVAR_SAVE, "snd_softclip", "0", "Use soft-clipping. Soft-clipping can make the sound more smooth if very high volume levels are used. Enable this option if the dynamic range of the loudspeakers is very low. WARNING: This feature creates distortion and should be considered a last resort."};
 //cvar_t snd_softclip = {CVAR_SAVE, "snd_softclip", "0", "Use soft-clipping (when set to 2, use it even if output is floating point). Soft-clipping can make the sound more smooth if very high volume levels are used. Enable this option if the dynamic range of the loudspeakers is very low. WARNING: This feature creates distortion and should be considered a last resort."};
 cvar_t snd_entchannel0volume = {CVAR_SAVE, "snd_entchannel0volume", "1", "volume multiplier of the auto-allocate entity channel of regular entities (DEPRECATED)"};
@@ -762,13 +846,31 @@ void S_Startup (void)
 	snd_renderbuffer->startframe = soundtime;
 	snd_renderbuffer->endframe = soundtime;
 	recording_sound = false;
+
+	// the decode thread must not start under a running mixer
+	if (S_LockRenderBuffer())
+	{
+		OGG_StartDecodeThread();
+		S_UnlockRenderBuffer();
+	}
+	S_StartMixThread();
 }
 
 void S_Shutdown(void)
 {
+	qboolean locked;
+
 	if (snd_renderbuffer == NULL)
 		return;
 
+	S_StopMixThread();
+
+	// streamed sounds are decoded by the mixer itself from here on
+	locked = S_LockRenderBuffer();
+	OGG_StopDecodeThread();
+	if (locked)
+		S_UnlockRenderBuffer();
+
 	oldpaintedtime = snd_renderbuffer->endframe;
 
 	if (simsound)
@@ -867,7 +969,11 @@ void S_Init(void)
 	Cvar_RegisterVariable(&snd_channels);
 	Cvar_RegisterVariable(&snd_mutewhenidle);
 	Cvar_RegisterVariable(&snd_maxchannelvolume);
+	Cvar_RegisterVariable(&snd_maxvoices);
 	Cvar_RegisterVariable(&snd_softclip);
+	Cvar_RegisterVariable(&snd_mixsse);
+	Cvar_RegisterVariable(&snd_mixthread);
+	Cvar_RegisterVariable(&snd_mixthread_interval);
 
 	Cvar_RegisterVariable(&snd_startloopingsounds);
 	Cvar_RegisterVariable(&snd_startnonloopingsounds);
@@ -898,12 +1004,15 @@ void S_Init(void)
 	Cmd_AddCommand("soundinfo", S_SoundInfo_f, "print sound system information (such as channels and speed)");
 	Cmd_AddCommand("snd_restart", S_Restart_f, "restart sound system");
 	Cmd_AddCommand("snd_unloadallsounds", S_UnloadAllSounds_f, "unload all sound files");
+	Cmd_AddCommand("snd_mixbenchmark", S_MixBenchmark_f, "measure how many channels per millisecond the mixer paints, with and without SSE2 (arguments: channels, speakers)");
 
 	Cvar_RegisterVariable(&nosound);
 	Cvar_RegisterVariable(&snd_precache);
 	Cvar_RegisterVariable(&snd_initialized);
 	Cvar_RegisterVariable(&snd_streaming);
 	Cvar_RegisterVariable(&snd_streaming_length);
+	Cvar_RegisterVariable(&snd_streaming_thread);
+	Cvar_RegisterVariable(&snd_streaming_readahead);
 	Cvar_RegisterVariable(&ambient_level);
 	Cvar_RegisterVariable(&ambient_fade);
 	Cvar_RegisterVariable(&snd_noextraupdate);
@@ -916,6 +1025,7 @@ void S_Init(void)
 	Cvar_SetValueQuick(&snd_initialized, true);
 
 	known_sfx = NULL;
+	memset(known_sfx_hash, 0, sizeof(known_sfx_hash));
 
 	total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
 	memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
@@ -984,6 +1094,7 @@ sfx_t changevolume_sfx = {""};
 sfx_t *S_FindName (const char *name)
 {
 	sfx_t *sfx;
+	unsigned int hashindex;
 
 	if (!snd_initialized.integer)
 		return NULL;
@@ -998,8 +1109,8 @@ sfx_t *S_FindName (const char *name)
 	}
 
 	// Look for this sound in the list of known sfx
-	// TODO: hash table search?
-	for (sfx = known_sfx; sfx != NULL; sfx = sfx->next)
+	hashindex = CRC_Block((const unsigned char *)name, strlen(name)) & (SFX_HASHSIZE - 1);
+	for (sfx = known_sfx_hash[hashindex]; sfx != NULL; sfx = sfx->hashnext)
 		if(!strcmp (sfx->name, name))
 			return sfx;
 
@@ -1019,6 +1130,8 @@ sfx_t *S_FindName (const char *name)
 	sfx->memsize = sizeof(*sfx);
 	sfx->next = known_sfx;
 	known_sfx = sfx;
+	sfx->hashnext = known_sfx_hash[hashindex];
+	known_sfx_hash[hashindex] = sfx;
 
 	return sfx;
 }
@@ -1032,6 +1145,7 @@ S_FreeSfx
 void S_FreeSfx (sfx_t *sfx, qboolean force)
 {
 	unsigned int i;
+	sfx_t **hashlink;
 
 	// Do not free a precached sound during purge
 	if (!force && (sfx->flags & (SFXFLAG_LEVELSOUND | SFXFLAG_MENUSOUND)))
@@ -1059,6 +1173,12 @@ void S_FreeSfx (sfx_t *sfx, qboolean force)
 			return;
 		}
 	}
+	for (hashlink = &known_sfx_hash[CRC_Block((const unsigned char *)sfx->name, strlen(sfx->name)) & (SFX_HASHSIZE - 1)]; *hashlink != NULL; hashlink = &(*hashlink)->hashnext)
+		if (*hashlink == sfx)
+		{
+			*hashlink = sfx->hashnext;
+			break;
+		}
 
 	// Stop all channels using this sfx
 	for (i = 0; i < total_channels; i++)
@@ -1069,6 +1189,7 @@ void S_FreeSfx (sfx_t *sfx, qboolean force)
 			S_StopChannel (i, true, false);
 		}
 	}
+	S_DropMixerSfx (sfx);
 
 	// Free it
 	if (sfx->fetcher != NULL && sfx->fetcher->freesfx != NULL)
@@ -1096,6 +1217,8 @@ void S_ClearUsed (void)
 			ambient_sfxs[i] = S_PrecacheSound (ambient_names[i], false, false);
 		if (ambient_sfxs[i] != NULL)
 		{
+			if (channels[i].sfx != ambient_sfxs[i])
+				channels[i].serial = S_NewChannelSerial();
 			channels[i].sfx = ambient_sfxs[i];
 			channels[i].sfx->flags |= SFXFLAG_MENUSOUND;
 			channels[i].flags |= CHANNELFLAG_FORCELOOP;
@@ -1196,6 +1319,205 @@ qboolean S_IsSoundPrecached (const sfx_t *sfx)
 	return (sfx != NULL && sfx->fetcher != NULL) || (sfx == &changevolume_sfx);
 }
 
+/*
+==================
+S_LockRenderBuffer
+
+Locks out the mixing thread and the sound backend, so the mixer's channels
+(and their sfx) can be stopped or freed and the render buffer changed
+==================
+*/
+static qboolean S_LockRenderBuffer (void)
+{
+	if (s_mixthread_mutex)
+		Thread_LockMutex(s_mixthread_mutex);
+	if (simsound || SndSys_LockRenderBuffer())
+		return true;
+	if (s_mixthread_mutex)
+		Thread_UnlockMutex(s_mixthread_mutex);
+	return false;
+}
+
+static void S_UnlockRenderBuffer (void)
+{
+	if (!simsound)
+		SndSys_UnlockRenderBuffer();
+	if (s_mixthread_mutex)
+		Thread_UnlockMutex(s_mixthread_mutex);
+}
+
+static unsigned int S_NewChannelSerial (void)
+{
+	if (++s_channelserial == 0)
+		s_channelserial = 1;
+	return s_channelserial;
+}
+
+/*
+==================
+S_PublishChannels
+
+Hands the current state of the channels to the mixer (main thread)
+==================
+*/
+static void S_PublishChannels (void)
+{
+	snd_mixsnapshot_t *snapshot = &s_mixsnapshots[s_mixsnapshot_write];
+
+	snapshot->numchannels = total_channels;
+	memcpy(snapshot->channels, channels, total_channels * sizeof(channel_t));
+	s_mixsnapshot_write = Thread_AtomicExchange(&s_mixsnapshot_latest, s_mixsnapshot_write | SND_MIXBUFFER_FRESH) & ~SND_MIXBUFFER_FRESH;
+}
+
+/*
+==================
+S_MixStopChannel
+
+Stops a channel of the mixer (mixer only)
+==================
+*/
+void S_MixStopChannel (channel_t *ch)
+{
+	sfx_t *sfx = ch->sfx;
+
+	if (sfx != NULL && sfx->fetcher != NULL && sfx->fetcher->stopchannel != NULL)
+		sfx->fetcher->stopchannel(ch);
+	ch->fetcher_data = NULL;
+	ch->sfx = NULL;
+}
+
+/*
+==================
+S_MixReceiveChannels
+
+Takes the latest snapshot of the channels if there is a new one: channels
+started since the last one start over from their start position, stopped ones
+stop, and the others keep their position and take the new volumes (mixer only)
+==================
+*/
+void S_MixReceiveChannels (void)
+{
+	unsigned int i;
+	const snd_mixsnapshot_t *snapshot;
+	const channel_t *in;
+	channel_t *ch;
+
+	if (!(Thread_AtomicGet(&s_mixsnapshot_latest) & SND_MIXBUFFER_FRESH))
+		return;
+	s_mixsnapshot_read = Thread_AtomicExchange(&s_mixsnapshot_latest, s_mixsnapshot_read) & ~SND_MIXBUFFER_FRESH;
+	snapshot = &s_mixsnapshots[s_mixsnapshot_read];
+
+	for (i = 0, in = snapshot->channels, ch = mixchannels;i < snapshot->numchannels;i++, in++, ch++)
+	{
+		if (in->sfx == NULL)
+		{
+			if (ch->sfx != NULL)
+				S_MixStopChannel(ch);
+			ch->serial = in->serial;
+		}
+		else if (in->serial != ch->serial || (ch->sfx != NULL && ch->sfx != in->sfx))
+		{
+			if (ch->sfx != NULL)
+				S_MixStopChannel(ch);
+			*ch = *in;
+			ch->fetcher_data = NULL;
+		}
+		else if (ch->sfx != NULL)
+		{
+			ch->flags = in->flags;
+			ch->mixspeed = in->mixspeed;
+			memcpy(ch->volume, in->volume, sizeof(ch->volume));
+			ch->isvirtual = in->isvirtual;
+			ch->prologic_invert = in->prologic_invert;
+		}
+		// else the mixer got to the end of the sound before the main thread noticed
+	}
+	// static channels that were cleared
+	for (;i < total_mixchannels;i++, ch++)
+		if (ch->sfx != NULL)
+			S_MixStopChannel(ch);
+	total_mixchannels = snapshot->numchannels;
+}
+
+/*
+==================
+S_MixPublishPositions
+
+Hands the positions of the channels back to the main thread (mixer only)
+==================
+*/
+void S_MixPublishPositions (void)
+{
+	unsigned int i;
+	snd_mixpositions_t *positions = &s_mixpositions[s_mixpositions_write];
+	snd_mixposition_t *out;
+	const channel_t *ch;
+
+	positions->numchannels = total_mixchannels;
+	for (i = 0, ch = mixchannels, out = positions->channels;i < total_mixchannels;i++, ch++, out++)
+	{
+		out->sfx = ch->sfx;
+		out->serial = ch->serial;
+		out->position = ch->position;
+	}
+	s_mixpositions_write = Thread_AtomicExchange(&s_mixpositions_latest, s_mixpositions_write | SND_MIXBUFFER_FRESH) & ~SND_MIXBUFFER_FRESH;
+}
+
+/*
+==================
+S_ReceivePositions
+
+Takes the latest positions from the mixer if there are new ones, and frees the
+channels whose sound it got to the end of (main thread)
+==================
+*/
+static void S_ReceivePositions (void)
+{
+	unsigned int i, numchannels;
+	const snd_mixpositions_t *positions;
+	const snd_mixposition_t *in;
+	channel_t *ch;
+
+	if (!(Thread_AtomicGet(&s_mixpositions_latest) & SND_MIXBUFFER_FRESH))
+		return;
+	s_mixpositions_read = Thread_AtomicExchange(&s_mixpositions_latest, s_mixpositions_read) & ~SND_MIXBUFFER_FRESH;
+	positions = &s_mixpositions[s_mixpositions_read];
+
+	numchannels = min(positions->numchannels, total_channels);
+	for (i = 0, in = positions->channels, ch = channels;i < numchannels;i++, in++, ch++)
+	{
+		// sounds started since then are not known to the mixer yet
+		if (ch->sfx == NULL || ch->serial != in->serial)
+			continue;
+		ch->position = in->position;
+		if (in->sfx == NULL)
+			ch->sfx = NULL;
+	}
+}
+
+/*
+==================
+S_DropMixerSfx
+
+Stops the mixer's channels playing a sound that is about to be freed, the only
+change to the channels that can not wait for the next snapshot (main thread)
+==================
+*/
+static void S_DropMixerSfx (sfx_t *sfx)
+{
+	unsigned int i;
+	qboolean locked;
+
+	locked = snd_renderbuffer != NULL && S_LockRenderBuffer();
+	// the latest snapshot may still have it
+	S_MixReceiveChannels();
+	for (i = 0;i < total_mixchannels;i++)
+		if (mixchannels[i].sfx == sfx)
+			S_MixStopChannel(&mixchannels[i]);
+	if (locked)
+		S_UnlockRenderBuffer();
+}
+
 /*
 ==================
 S_BlockSound
@@ -1218,6 +1540,103 @@ void S_UnblockSound (void)
 }
 
 
+typedef struct channelpriority_s
+{
+	float priority;
+	int index;
+}
+channelpriority_t;
+
+static channelpriority_t snd_channelpriorities[MAX_CHANNELS];
+
+// priority of the least audible mixed channel when there were more audible
+// channels than snd_maxvoices, new sounds below it start as virtual voices
+static float snd_virtualthreshold = 0;
+
+/*
+=================
+S_ChannelPriority
+
+How much a channel is worth mixing, from its spatialized volumes
+=================
+*/
+static float S_ChannelPriority(const channel_t *ch)
+{
+	int i;
+	float priority = 0;
+
+	for (i = 0;i < SND_LISTENERS;i++)
+		priority = max(priority, ch->volume[i]);
+	// the player's own sounds matter more than others at the same volume
+	if (ch->entnum > 0 && (ch->entnum == cl.viewentity || ch->entnum == CL_VM_GetViewEntity()))
+		priority *= 4;
+	return priority;
+}
+
+static int S_ChannelPriority_Compare(const void *ap, const void *bp)
+{
+	const channelpriority_t *a = (const channelpriority_t *)ap;
+	const channelpriority_t *b = (const channelpriority_t *)bp;
+	if (a->priority != b->priority)
+		return a->priority > b->priority ? -1 : 1;
+	return a->index - b->index;
+}
+
+/*
+=================
+S_VirtualizeChannels
+
+Keeps the snd_maxvoices most audible channels mixing and turns the others
+into virtual voices, returns how many audible channels became virtual
+=================
+*/
+static int S_VirtualizeChannels(void)
+{
+	unsigned int i;
+	int numcandidates, maxvoices;
+	float priority;
+	channel_t *ch;
+
+	maxvoices = snd_maxvoices.integer;
+	numcandidates = 0;
+	snd_virtualthreshold = 0;
+	for (i = NUM_AMBIENTS, ch = channels + NUM_AMBIENTS;i < total_channels;i++, ch++)
+	{
+		if (!ch->sfx)
+			continue;
+		// music and menu sounds are always mixed
+		if (maxvoices <= 0 || (ch->flags & (CHANNELFLAG_FULLVOLUME | CHANNELFLAG_LOCALSOUND)))
+		{
+			ch->isvirtual = false;
+			continue;
+		}
+		priority = S_ChannelPriority(ch);
+		if (priority <= 0)
+		{
+			// silent anyway
+			ch->isvirtual = true;
+			continue;
+		}
+		// keep channels near the cut from flipping between mixed and virtual
+		if (!ch->isvirtual)
+			priority *= 1.25f;
+		snd_channelpriorities[numcandidates].priority = priority;
+		snd_channelpriorities[numcandidates].index = i;
+		numcandidates++;
+	}
+	if (numcandidates <= maxvoices)
+	{
+		for (i = 0;i < (unsigned int)numcandidates;i++)
+			channels[snd_channelpriorities[i].index].isvirtual = false;
+		return 0;
+	}
+	qsort(snd_channelpriorities, numcandidates, sizeof(snd_channelpriorities[0]), S_ChannelPriority_Compare);
+	for (i = 0;i < (unsigned int)numcandidates;i++)
+		channels[snd_channelpriorities[i].index].isvirtual = i >= (unsigned int)maxvoices;
+	snd_virtualthreshold = snd_channelpriorities[maxvoices - 1].priority;
+	return numcandidates - maxvoices;
+}
+
 /*
 =================
 SND_PickChannel
@@ -1230,12 +1649,14 @@ static channel_t *SND_PickChannel(int entnum, int entchannel)
 	int ch_idx;
 	int first_to_die;
 	int first_life_left, life_left;
+	float first_priority, priority;
 	channel_t* ch;
 	sfx_t *sfx; // use this instead of ch->sfx->, because that is volatile.
 
 // Check for replacement sound, or find the best one to replace
 	first_to_die = -1;
 	first_life_left = 0x7fffffff;
+	first_priority = 1e30f;
 
 	// entity channels try to replace the existing sound on the channel
 	// channels <= 0 are autochannels
@@ -1274,8 +1695,11 @@ static channel_t *SND_PickChannel(int entnum, int entchannel)
 			continue;
 		life_left = (int)((double)sfx->total_length - ch->position);
 
-		if (life_left < first_life_left)
+		// replace the least audible sound, or the one closest to its end
+		priority = S_ChannelPriority(ch);
+		if (priority < first_priority || (priority == first_priority && life_left < first_life_left))
 		{
+			first_priority = priority;
 			first_life_left = life_left;
 			first_to_die = ch_idx;
 		}
@@ -1648,9 +2072,10 @@ static void S_PlaySfxOnChannel (sfx_t *sfx, channel_t *target_chan, unsigned int
 		Con_Printf("S_PlaySfxOnChannel(%s): channel %i already in use??  Clearing.\n", sfx->name, channelindex);
 		S_StopChannel (channelindex, true, false);
 	}
-	// We MUST set sfx LAST because otherwise we could crash a threaded mixer
-	// (otherwise we'd have to call SndSys_LockRenderBuffer here)
+	// the mixer keeps playing its copy of the channel until the next snapshot
+	// shows it the new serial
 	memset (target_chan, 0, sizeof (*target_chan));
+	target_chan->serial = S_NewChannelSerial();
 	VectorCopy (origin, target_chan->origin);
 	target_chan->flags = flags;
 	target_chan->position = startpos; // start of the sound
@@ -1672,8 +2097,11 @@ static void S_PlaySfxOnChannel (sfx_t *sfx, channel_t *target_chan, unsigned int
 	S_SetChannelSpeed(target_chan - channels, fspeed);
 	SND_Spatialize_WithSfx (target_chan, isstatic, sfx);
 
+	// while there are more audible sounds than snd_maxvoices, sounds below
+	// the least audible mixed one start as virtual voices
+	target_chan->isvirtual = snd_virtualthreshold > 0 && !(flags & (CHANNELFLAG_FULLVOLUME | CHANNELFLAG_LOCALSOUND)) && S_ChannelPriority(target_chan) < snd_virtualthreshold;
+
 	// finally, set the sfx pointer, so the channel becomes valid for playback
-	// and will be noticed by the mixer
 	target_chan->sfx = sfx;
 }
 
@@ -1763,26 +2191,17 @@ void S_StopChannel (unsigned int channel_ind, qboolean lockmutex, qboolean frees
 	if (channel_ind >= total_channels)
 		return;
 
-	// we have to lock an audio mutex to prevent crashes if an audio mixer
-	// thread is currently mixing this channel
-	// the SndSys_LockRenderBuffer function uses such a mutex in
-	// threaded sound backends
-	if (lockmutex && !simsound)
-		SndSys_LockRenderBuffer();
-	
+	// the mixer stops its own copy of the channel when it gets the next
+	// snapshot, so nothing needs to be locked here (lockmutex is unused,
+	// S_FreeSfx takes care of a mixer still playing the freed sound)
 	ch = &channels[channel_ind];
 	sfx = ch->sfx;
 	if (sfx != NULL)
 	{
-		if (sfx->fetcher != NULL && sfx->fetcher->stopchannel != NULL)
-			sfx->fetcher->stopchannel(ch);
-		ch->fetcher_data = NULL;
 		ch->sfx = NULL;
 		if (freesfx)
 			S_FreeSfx(sfx, true);
 	}
-	if (lockmutex && !simsound)
-		SndSys_UnlockRenderBuffer();
 }
 
 
@@ -1832,32 +2251,33 @@ void S_StopAllSounds(qboolean stopcdaudio)
 		CDAudio_Stop();
 #endif
 
-	if (simsound || SndSys_LockRenderBuffer ())
+	for (i = 0; i < total_channels; i++)
+	{
+		if (CDAudio_IsFakeTrack(i))
+			continue;
+		memset(&channels[i], 0, sizeof(channel_t));
+	}
+	if (total_channels < MAX_CHANNELS)
+		memset(channels + total_channels, 0, (MAX_CHANNELS - total_channels) * sizeof(channel_t));
+
+	//total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
+	//memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
+
+	// the mixer must not paint the old channels again into the muted buffer
+	S_PublishChannels();
+	if (S_LockRenderBuffer ())
 	{
 		int clear;
 		size_t memsize;
 
-		for (i = 0; i < total_channels; i++)
-		{
-			if (CDAudio_IsFakeTrack(i))
-				continue;
-			if (channels[i].sfx)
-				S_StopChannel (i, false, false);
-			memset(&channels[i], 0, sizeof(channel_t));
-		}
-		if (total_channels < MAX_CHANNELS)
-			memset(channels + total_channels * sizeof(channel_t), 0, (MAX_CHANNELS - total_channels) * sizeof(channel_t));
-
-		//total_channels = MAX_DYNAMIC_CHANNELS + NUM_AMBIENTS;	// no statics
-		//memset(channels, 0, MAX_CHANNELS * sizeof(channel_t));
+		S_MixReceiveChannels();
 
 		// Mute the contents of the submittion buffer
 		clear = (snd_renderbuffer->format.width == 1) ? 0x80 : 0;
 		memsize = snd_renderbuffer->maxframes * snd_renderbuffer->format.width * snd_renderbuffer->format.channels;
 		memset(snd_renderbuffer->ring, clear, memsize);
 
-		if (!simsound)
-			SndSys_UnlockRenderBuffer ();
+		S_UnlockRenderBuffer ();
 	}
 }
 
@@ -1967,8 +2387,9 @@ static void S_UpdateAmbientSounds (void)
 	for (ambient_channel = 0 ; ambient_channel< NUM_AMBIENTS ; ambient_channel++)
 	{
 		chan = &channels[ambient_channel];
-		sfx = chan->sfx; // fetch the volatile variable
-		if (sfx == NULL || sfx->fetcher == NULL)
+		sfx = chan->sfx;
+		// the mixer does not load sounds itself
+		if (sfx == NULL || !S_LoadSound(sfx, true))
 			continue;
 
 		i = ambientlevels[ambient_channel];
@@ -2005,66 +2426,23 @@ static void S_UpdateAmbientSounds (void)
 	}
 }
 
-static void S_PaintAndSubmit (void)
-{
-	unsigned int newsoundtime, paintedtime, endtime, maxtime, usedframes;
-	int usesoundtimehack;
-	static int soundtimehack = -1;
-	static int oldsoundtime = 0;
-
-	if (snd_renderbuffer == NULL || nosound.integer)
-		return;
-
-	// Update sound time
-	snd_usethreadedmixing = false;
-	usesoundtimehack = true;
-	if (cls.timedemo) // SUPER NASTY HACK to mix non-realtime sound for more reliable benchmarking
-	{
-		usesoundtimehack = 1;
-		newsoundtime = (unsigned int)((double)cl.mtime[0] * (double)snd_renderbuffer->format.speed);
-	}
-	else if (cls.capturevideo.soundrate && !cls.capturevideo.realtime) // SUPER NASTY HACK to record non-realtime sound
-	{
-		usesoundtimehack = 2;
-		newsoundtime = (unsigned int)((double)cls.capturevideo.frame * (double)snd_renderbuffer->format.speed / (double)cls.capturevideo.framerate);
-	}
-	else if (simsound)
-	{
-		usesoundtimehack = 3;
-		newsoundtime = (unsigned int)((realtime - snd_starttime) * (double)snd_renderbuffer->format.speed);
-	}
-	else
-	{
-		snd_usethreadedmixing = snd_threaded && !cls.capturevideo.soundrate;
-		usesoundtimehack = 0;
-		newsoundtime = SndSys_GetSoundTime();
-	}
-	// if the soundtimehack state changes we need to reset the soundtime
-	if (soundtimehack != usesoundtimehack)
-	{
-		snd_renderbuffer->startframe = snd_renderbuffer->endframe = soundtime = newsoundtime;
-
-		// Mute the contents of the submission buffer
-		if (simsound || SndSys_LockRenderBuffer ())
-		{
-			int clear;
-			size_t memsize;
-
-			clear = (snd_renderbuffer->format.width == 1) ? 0x80 : 0;
-			memsize = snd_renderbuffer->maxframes * snd_renderbuffer->format.width * snd_renderbuffer->format.channels;
-			memset(snd_renderbuffer->ring, clear, memsize);
-
-			if (!simsound)
-				SndSys_UnlockRenderBuffer ();
-		}
-	}
-	soundtimehack = usesoundtimehack;
+/*
+===================
+S_PaintRenderBuffer
 
-	if (!soundtimehack && snd_blocked > 0)
-		return;
+Mixes ahead of newsoundtime and submits the result, called with the mixing
+thread mutex held (by that thread itself when it is running), so it leaves
+its messages for S_PaintAndSubmit to print
+===================
+*/
+static void S_PaintMessage (int message)
+{
+	Thread_AtomicExchange(&s_paintmessages, Thread_AtomicGet(&s_paintmessages) | message);
+}
 
-	if (snd_usethreadedmixing)
-		return; // the audio thread will mix its own data
+static void S_PaintRenderBuffer (unsigned int newsoundtime, int soundtimehack)
+{
+	unsigned int paintedtime, endtime, maxtime, usedframes;
 
 	newsoundtime += extrasoundtime;
 	if (newsoundtime < soundtime)
@@ -2083,12 +2461,15 @@ static void S_PaintAndSubmit (void)
 
 			extrasoundtime += additionaltime;
 			newsoundtime += additionaltime;
-			Con_DPrintf("S_PaintAndSubmit: new extra sound time = %u\n",
-						extrasoundtime);
+			s_paintmessage_extrasoundtime = extrasoundtime;
+			S_PaintMessage(SND_PAINTMESSAGE_EXTRASOUNDTIME);
 		}
 		else if (!soundtimehack)
-			Con_Printf("S_PaintAndSubmit: WARNING: newsoundtime < soundtime (%u < %u)\n",
-					   newsoundtime, soundtime);
+		{
+			s_paintmessage_newsoundtime = newsoundtime;
+			s_paintmessage_soundtime = soundtime;
+			S_PaintMessage(SND_PAINTMESSAGE_SOUNDTIMEBACKWARDS);
+		}
 	}
 	soundtime = newsoundtime;
 	recording_sound = (cls.capturevideo.soundrate != 0);
@@ -2097,7 +2478,7 @@ static void S_PaintAndSubmit (void)
 	if (!simsound && !SndSys_LockRenderBuffer())
 	{
 		// If the lock failed, stop here
-		Con_DPrint(">> S_PaintAndSubmit: SndSys_LockRenderBuffer() failed\n");
+		S_PaintMessage(SND_PAINTMESSAGE_LOCKFAILED);
 		return;
 	}
 
@@ -2147,7 +2528,144 @@ static void S_PaintAndSubmit (void)
 	oldsoundtime = soundtime;
 
 	cls.soundstats.latency_milliseconds = (snd_renderbuffer->endframe - snd_renderbuffer->startframe) * 1000 / snd_renderbuffer->format.speed;
-	R_TimeReport("audiomix");
+}
+
+/*
+===================
+S_MixThread
+
+Keeps the render buffer of an unthreaded sound backend filled
+independently of the frame rate
+===================
+*/
+static int S_MixThread (void *unused)
+{
+	while (!s_mixthread_quit)
+	{
+		Thread_LockMutex(s_mixthread_mutex);
+		// the main thread clears snd_usethreadedmixing while it mixes
+		// non-realtime sound (timedemo, video capture)
+		if (snd_usethreadedmixing && snd_blocked <= 0 && !nosound.integer)
+			S_PaintRenderBuffer(SndSys_GetSoundTime(), 0);
+		Thread_UnlockMutex(s_mixthread_mutex);
+		Sys_Sleep((int)(bound(0.001, snd_mixthread_interval.value, 0.05) * 1000000.0));
+	}
+	return 0;
+}
+
+static void S_StartMixThread (void)
+{
+	if (snd_threaded || simsound || !snd_mixthread.integer || !Thread_HasThreads())
+		return;
+	s_mixthread_quit = false;
+	s_mixthread_mutex = Thread_CreateMutex();
+	s_mixthread = Thread_CreateThread(S_MixThread, NULL);
+	if (!s_mixthread)
+	{
+		Thread_DestroyMutex(s_mixthread_mutex);
+		s_mixthread_mutex = NULL;
+		return;
+	}
+	Con_DPrint("S_Startup: mixing in a separate thread\n");
+}
+
+static void S_StopMixThread (void)
+{
+	if (!s_mixthread)
+		return;
+	s_mixthread_quit = true;
+	Thread_WaitThread(s_mixthread, 0);
+	Thread_DestroyMutex(s_mixthread_mutex);
+	s_mixthread = NULL;
+	s_mixthread_mutex = NULL;
+	snd_usethreadedmixing = false;
+}
+
+static void S_PaintAndSubmit (void)
+{
+	unsigned int newsoundtime;
+	int usesoundtimehack, messages;
+	qboolean usethreadedmixing;
+	static int soundtimehack = -1;
+
+	if (snd_renderbuffer == NULL || nosound.integer)
+		return;
+
+	// hand the channels as they are now to whoever mixes them
+	S_PublishChannels();
+
+	// Update sound time
+	usethreadedmixing = false;
+	usesoundtimehack = true;
+	if (cls.timedemo) // SUPER NASTY HACK to mix non-realtime sound for more reliable benchmarking
+	{
+		usesoundtimehack = 1;
+		newsoundtime = (unsigned int)((double)cl.mtime[0] * (double)snd_renderbuffer->format.speed);
+	}
+	else if (cls.capturevideo.soundrate && !cls.capturevideo.realtime) // SUPER NASTY HACK to record non-realtime sound
+	{
+		usesoundtimehack = 2;
+		newsoundtime = (unsigned int)((double)cls.capturevideo.frame * (double)snd_renderbuffer->format.speed / (double)cls.capturevideo.framerate);
+	}
+	else if (simsound)
+	{
+		usesoundtimehack = 3;
+		newsoundtime = (unsigned int)((realtime - snd_starttime) * (double)snd_renderbuffer->format.speed);
+	}
+	else
+	{
+		usethreadedmixing = (snd_threaded || s_mixthread) && !cls.capturevideo.soundrate;
+		usesoundtimehack = 0;
+		newsoundtime = SndSys_GetSoundTime();
+	}
+
+	// while the mixing thread keeps on mixing there is nothing to lock, it
+	// only has to stay out while we change modes or mix ourselves
+	if (!(s_mixthread && usethreadedmixing && snd_usethreadedmixing && soundtimehack == usesoundtimehack))
+	{
+		if (s_mixthread_mutex)
+			Thread_LockMutex(s_mixthread_mutex);
+
+		snd_usethreadedmixing = usethreadedmixing;
+		// if the soundtimehack state changes we need to reset the soundtime
+		if (soundtimehack != usesoundtimehack)
+		{
+			snd_renderbuffer->startframe = snd_renderbuffer->endframe = soundtime = newsoundtime;
+
+			// Mute the contents of the submission buffer
+			if (simsound || SndSys_LockRenderBuffer ())
+			{
+				int clear;
+				size_t memsize;
+
+				clear = (snd_renderbuffer->format.width == 1) ? 0x80 : 0;
+				memsize = snd_renderbuffer->maxframes * snd_renderbuffer->format.width * snd_renderbuffer->format.channels;
+				memset(snd_renderbuffer->ring, clear, memsize);
+
+				if (!simsound)
+					SndSys_UnlockRenderBuffer ();
+			}
+		}
+		soundtimehack = usesoundtimehack;
+
+		// the audio thread will mix its own data
+		if ((soundtimehack || snd_blocked <= 0) && !snd_usethreadedmixing)
+		{
+			S_PaintRenderBuffer(newsoundtime, soundtimehack);
+			R_TimeReport("audiomix");
+		}
+
+		if (s_mixthread_mutex)
+			Thread_UnlockMutex(s_mixthread_mutex);
+	}
+
+	messages = Thread_AtomicExchange(&s_paintmessages, 0);
+	if (messages & SND_PAINTMESSAGE_EXTRASOUNDTIME)
+		Con_DPrintf("S_PaintRenderBuffer: new extra sound time = %u\n", s_paintmessage_extrasoundtime);
+	if (messages & SND_PAINTMESSAGE_SOUNDTIMEBACKWARDS)
+		Con_Printf("S_PaintRenderBuffer: WARNING: newsoundtime < soundtime (%u < %u)\n", s_paintmessage_newsoundtime, s_paintmessage_soundtime);
+	if (messages & SND_PAINTMESSAGE_LOCKFAILED)
+		Con_DPrint(">> S_PaintRenderBuffer: SndSys_LockRenderBuffer() failed\n");
 }
 
 /*
@@ -2166,6 +2684,9 @@ void S_Update(const matrix4x4_t *listenermatrix)
 	if (snd_renderbuffer == NULL || nosound.integer)
 		return;
 
+	// see how far the mixer got, before anything is started or spatialized
+	S_ReceivePositions();
+
 	{
 		double mindist_trans, maxdist_trans;
 
@@ -2308,13 +2829,17 @@ void S_Update(const matrix4x4_t *listenermatrix)
 		if (k < SND_LISTENERS)
 			cls.soundstats.mixedsounds++;
 	}
+
+	// only mix the most audible sounds
+	cls.soundstats.virtualsounds = S_VirtualizeChannels();
+	cls.soundstats.mixedsounds -= cls.soundstats.virtualsounds;
 	R_TimeReport("audiospatialize");
 
 	sound_spatialized = true;
 
 	// debugging output
 	if (snd_show.integer)
-		Con_Printf("----(%u)----\n", cls.soundstats.mixedsounds);
+		Con_Printf("----(%u, %u virtual)----\n", cls.soundstats.mixedsounds, cls.soundstats.virtualsounds);
 
 	S_PaintAndSubmit();
 }
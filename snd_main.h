@@ -62,6 +62,7 @@ struct sfx_s
 {
 	char				name[MAX_QPATH];
 	sfx_t				*next;
+	sfx_t				*hashnext;		// next sfx in the same S_FindName hash bucket
 	size_t				memsize;		// total memory used (including sfx_t and fetcher data)
 
 	snd_format_t		format;			// format describing the audio data that fetcher->getsamplesfloat will return
@@ -92,15 +93,21 @@ typedef struct channel_s
 	int				prologic_invert;// whether a sound is played on the surround channels in prologic
 	float			basespeed;		// playback rate multiplier for pitch variation
 
-	// these are often updated while mixer is running, glitching should be minimized (mismatched channel volumes from spatialization is okay)
+	// recomputed by S_Update every frame, the mixer gets them with the next snapshot of the channels
 	// spatialized playback speed (speed * doppler ratio)
 	float			mixspeed;
 	// spatialized volume per speaker (mastervol * distanceattenuation * channelvolume cvars)
 	float			volume[SND_LISTENERS];
+	// beyond the snd_maxvoices most audible channels, advances in time but is not mixed
+	qboolean		isvirtual;
 
-	// updated ONLY by mixer
+	// updated ONLY by mixer (the main thread's channels get it back a frame later)
 	// position in sfx, starts at 0, loops or stops at sfx->total_length
 	double			position;
+
+	// changes with every sound started on the channel, tells the mixer when
+	// to restart its copy of the channel (see S_MixReceiveChannels)
+	unsigned int	serial;
 } channel_t;
 
 // Sound fetching functions
@@ -117,6 +124,10 @@ struct snd_fetcher_s
 
 extern unsigned int total_channels;
 extern channel_t channels[MAX_CHANNELS];
+// the mixer's own copy of the channels, only touched by the thread that is
+// mixing, which owns their position and fetcher_data
+extern unsigned int total_mixchannels;
+extern channel_t mixchannels[MAX_CHANNELS];
 
 extern snd_ringbuffer_t *snd_renderbuffer;
 extern qboolean snd_threaded; // enables use of snd_usethreadedmixing, provided that no sound hacks are in effect (like timedemo)
@@ -126,6 +137,8 @@ extern cvar_t _snd_mixahead;
 extern cvar_t snd_swapstereo;
 extern cvar_t snd_streaming;
 extern cvar_t snd_streaming_length;
+extern cvar_t snd_streaming_thread;
+extern cvar_t snd_streaming_readahead;
 
 #define SND_CHANNELLAYOUT_AUTO		0
 #define SND_CHANNELLAYOUT_STANDARD	1
@@ -150,6 +163,13 @@ extern qboolean simsound;
 // ====================================================================
 
 void S_MixToBuffer(void *stream, unsigned int frames);
+void S_MixBenchmark_f(void);
+// called by the mixer before and after mixing, take the channels the main
+// thread published and hand back how far each one got
+void S_MixReceiveChannels(void);
+void S_MixPublishPositions(void);
+// called by the mixer when it gets to the end of a sound
+void S_MixStopChannel(channel_t *ch);
 
 qboolean S_LoadSound (sfx_t *sfx, qboolean complain);
 
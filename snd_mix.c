@@ -20,8 +20,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include "quakedef.h"
 #include "snd_main.h"
+#ifdef SSE2_PRESENT
+#include <emmintrin.h>
+#endif
 
 extern cvar_t snd_softclip;
+extern cvar_t snd_mixsse;
 
 static portable_sampleframe_t paintbuffer[PAINTBUFFER_SIZE];
 static portable_sampleframe_t paintbuffer_unswapped[PAINTBUFFER_SIZE];
@@ -125,15 +129,59 @@ static void S_SoftClipPaintBuffer(portable_sampleframe_t *painted_ptr, int nbfra
 	}
 }
 
-static void S_ConvertPaintBuffer(portable_sampleframe_t *painted_ptr, void *rb_ptr, int nbframes, int width, int nchannels)
+#ifdef SSE2_PRESENT
+// 16bit conversion of 8, 4 or 2 channel output, the saturating pack does the
+// clamping so this is a single pass over the paint buffer
+static void S_ConvertPaintBuffer16_SSE2(const portable_sampleframe_t *painted_ptr, short *snd_out, int nbframes, int nchannels)
+{
+	int i, j, val;
+	__m128 scale = _mm_set1_ps(32768.0f);
+	__m128 a, b;
+	int step = 8 / nchannels;
+
+	for (i = 0;i + step <= nbframes;i += step, painted_ptr += step, snd_out += 8)
+	{
+		if (nchannels == 8)
+		{
+			a = _mm_loadu_ps(painted_ptr[0].sample);
+			b = _mm_loadu_ps(painted_ptr[0].sample + 4);
+		}
+		else if (nchannels == 4)
+		{
+			a = _mm_loadu_ps(painted_ptr[0].sample);
+			b = _mm_loadu_ps(painted_ptr[1].sample);
+		}
+		else
+		{
+			a = _mm_movelh_ps(_mm_loadu_ps(painted_ptr[0].sample), _mm_loadu_ps(painted_ptr[1].sample));
+			b = _mm_movelh_ps(_mm_loadu_ps(painted_ptr[2].sample), _mm_loadu_ps(painted_ptr[3].sample));
+		}
+		_mm_storeu_si128((__m128i *)snd_out, _mm_packs_epi32(_mm_cvttps_epi32(_mm_mul_ps(a, scale)), _mm_cvttps_epi32(_mm_mul_ps(b, scale))));
+	}
+	// leftover frames
+	for (;i < nbframes;i++, painted_ptr++)
+	{
+		for (j = 0;j < nchannels;j++)
+		{
+			val = (int)(painted_ptr->sample[j] * 32768.0f);*snd_out++ = bound(-32768, val, 32767);
+		}
+	}
+}
+#endif
+
+static void S_ConvertPaintBuffer(portable_sampleframe_t *painted_ptr, void *rb_ptr, int nbframes, int width, int nchannels, qboolean usesse2)
 {
 	int i, val;
 
 	// FIXME: add 24bit and 32bit float formats
-	// FIXME: optimize with SSE intrinsics?
 	if (width == 2)  // 16bit
 	{
 		short *snd_out = (short*)rb_ptr;
+#ifdef SSE2_PRESENT
+		if (usesse2 && (nchannels == 8 || nchannels == 4 || nchannels == 2))
+			S_ConvertPaintBuffer16_SSE2(painted_ptr, snd_out, nbframes, nchannels);
+		else
+#endif
 		if (nchannels == 8)  // 7.1 surround
 		{
 			for (i = 0;i < nbframes;i++, painted_ptr++)
@@ -260,6 +308,160 @@ CHANNEL MIXING
 ===============================================================================
 */
 
+// paints count sample frames of a channel into paint, resampling the fetched
+// sfx frames with linear interpolation (indexfrac is the 16.16 fixed point
+// position within the first fetched frame, indexfracstep the step per frame)
+static void S_PaintChannel(portable_sampleframe_t *paint, const float *fetchsampleframe, int count, int indexfrac, int indexfracstep, const float *vol, int sfxchannels, qboolean surround)
+{
+	int i;
+	float lerp[2];
+	float sample[3];
+
+	if (sfxchannels == 2)
+	{
+		// music is stereo
+#if SND_LISTENERS != 8
+#error the following code only supports up to 8 channels, update it
+#endif
+		if (surround)
+		{
+			// surround mixing
+			for (i = 0;i < count;i++, paint++)
+			{
+				lerp[1] = indexfrac * (1.0f / 65536.0f);
+				lerp[0] = 1.0f - lerp[1];
+				sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[2] * lerp[1];
+				sample[1] = fetchsampleframe[1] * lerp[0] + fetchsampleframe[3] * lerp[1];
+				sample[2] = (sample[0] + sample[1]) * 0.5f;
+				paint->sample[0] += sample[0] * vol[0];
+				paint->sample[1] += sample[1] * vol[1];
+				paint->sample[2] += sample[0] * vol[2];
+				paint->sample[3] += sample[1] * vol[3];
+				paint->sample[4] += sample[2] * vol[4];
+				paint->sample[5] += sample[2] * vol[5];
+				paint->sample[6] += sample[0] * vol[6];
+				paint->sample[7] += sample[1] * vol[7];
+				indexfrac += indexfracstep;
+				fetchsampleframe += 2 * (indexfrac >> 16);
+				indexfrac &= 0xFFFF;
+			}
+		}
+		else
+		{
+			// stereo mixing
+			for (i = 0;i < count;i++, paint++)
+			{
+				lerp[1] = indexfrac * (1.0f / 65536.0f);
+				lerp[0] = 1.0f - lerp[1];
+				sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[2] * lerp[1];
+				sample[1] = fetchsampleframe[1] * lerp[0] + fetchsampleframe[3] * lerp[1];
+				paint->sample[0] += sample[0] * vol[0];
+				paint->sample[1] += sample[1] * vol[1];
+				indexfrac += indexfracstep;
+				fetchsampleframe += 2 * (indexfrac >> 16);
+				indexfrac &= 0xFFFF;
+			}
+		}
+	}
+	else if (sfxchannels == 1)
+	{
+		// most sounds are mono
+#if SND_LISTENERS != 8
+#error the following code only supports up to 8 channels, update it
+#endif
+		if (surround)
+		{
+			// surround mixing
+			for (i = 0;i < count;i++, paint++)
+			{
+				lerp[1] = indexfrac * (1.0f / 65536.0f);
+				lerp[0] = 1.0f - lerp[1];
+				sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[1] * lerp[1];
+				paint->sample[0] += sample[0] * vol[0];
+				paint->sample[1] += sample[0] * vol[1];
+				paint->sample[2] += sample[0] * vol[2];
+				paint->sample[3] += sample[0] * vol[3];
+				paint->sample[4] += sample[0] * vol[4];
+				paint->sample[5] += sample[0] * vol[5];
+				paint->sample[6] += sample[0] * vol[6];
+				paint->sample[7] += sample[0] * vol[7];
+				indexfrac += indexfracstep;
+				fetchsampleframe += (indexfrac >> 16);
+				indexfrac &= 0xFFFF;
+			}
+		}
+		else
+		{
+			// stereo mixing
+			for (i = 0;i < count;i++, paint++)
+			{
+				lerp[1] = indexfrac * (1.0f / 65536.0f);
+				lerp[0] = 1.0f - lerp[1];
+				sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[1] * lerp[1];
+				paint->sample[0] += sample[0] * vol[0];
+				paint->sample[1] += sample[0] * vol[1];
+				indexfrac += indexfracstep;
+				fetchsampleframe += (indexfrac >> 16);
+				indexfrac &= 0xFFFF;
+			}
+		}
+	}
+}
+
+#ifdef SSE2_PRESENT
+// same as S_PaintChannel, but for surround output each sample frame is
+// painted with two 4 speaker adds, and an interpolated stereo pair is kept
+// in one register
+static void S_PaintChannel_SSE2(portable_sampleframe_t *paint, const float *fetchsampleframe, int count, int indexfrac, int indexfracstep, const float *vol, int sfxchannels, qboolean surround)
+{
+	int i;
+	__m128 vol0 = _mm_loadu_ps(vol);
+	__m128 vol1 = _mm_loadu_ps(vol + 4);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128 a, b, s, c;
+
+#if SND_LISTENERS != 8
+#error the following code only supports up to 8 channels, update it
+#endif
+	if (!surround)
+	{
+		// only two speakers to add to, the scalar code does that just as well
+		S_PaintChannel(paint, fetchsampleframe, count, indexfrac, indexfracstep, vol, sfxchannels, surround);
+	}
+	else if (sfxchannels == 2)
+	{
+		for (i = 0;i < count;i++, paint++)
+		{
+			// a = l0 r0 l0 r0, b = l1 r1 l1 r1, s = l r l r
+			a = _mm_loadu_ps(fetchsampleframe);
+			b = _mm_movehl_ps(a, a);
+			a = _mm_movelh_ps(a, a);
+			s = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(indexfrac * (1.0f / 65536.0f))));
+			// second half of the frame is center center l r
+			c = _mm_mul_ps(_mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 3, 0, 1))), half);
+			c = _mm_shuffle_ps(c, s, _MM_SHUFFLE(1, 0, 1, 0));
+			_mm_storeu_ps(paint->sample, _mm_add_ps(_mm_loadu_ps(paint->sample), _mm_mul_ps(s, vol0)));
+			_mm_storeu_ps(paint->sample + 4, _mm_add_ps(_mm_loadu_ps(paint->sample + 4), _mm_mul_ps(c, vol1)));
+			indexfrac += indexfracstep;
+			fetchsampleframe += 2 * (indexfrac >> 16);
+			indexfrac &= 0xFFFF;
+		}
+	}
+	else if (sfxchannels == 1)
+	{
+		for (i = 0;i < count;i++, paint++)
+		{
+			s = _mm_set1_ps(fetchsampleframe[0] + (fetchsampleframe[1] - fetchsampleframe[0]) * (indexfrac * (1.0f / 65536.0f)));
+			_mm_storeu_ps(paint->sample, _mm_add_ps(_mm_loadu_ps(paint->sample), _mm_mul_ps(s, vol0)));
+			_mm_storeu_ps(paint->sample + 4, _mm_add_ps(_mm_loadu_ps(paint->sample + 4), _mm_mul_ps(s, vol1)));
+			indexfrac += indexfracstep;
+			fetchsampleframe += (indexfrac >> 16);
+			indexfrac &= 0xFFFF;
+		}
+	}
+}
+#endif
+
 void S_MixToBuffer(void *stream, unsigned int bufferframes)
 {
 	int channelindex;
@@ -284,13 +486,15 @@ void S_MixToBuffer(void *stream, unsigned int bufferframes)
 	float fetchsampleframes[S_FETCHBUFFERSIZE*2];
 	const float *fetchsampleframe;
 	float vol[SND_LISTENERS];
-	float lerp[2];
-	float sample[3];
 	double posd;
 	double speedd;
 	float maxvol;
 	qboolean looping;
 	qboolean silent;
+	qboolean usesse2 = snd_mixsse.integer != 0;
+
+	// pick up the channels started, stopped and spatialized since the last mix
+	S_MixReceiveChannels();
 
 	// mix as many times as needed to fill the requested buffer
 	while (bufferframes)
@@ -303,22 +507,21 @@ void S_MixToBuffer(void *stream, unsigned int bufferframes)
 
 		// paint in the channels.
 		// channels with zero volumes still advance in time but don't paint.
-		ch = channels; // cppcheck complains here but it is wrong, channels is a channel_t[MAX_CHANNELS] and not an int
-		for (channelindex = 0;channelindex < (int)total_channels;channelindex++, ch++)
+		ch = mixchannels; // cppcheck complains here but it is wrong, mixchannels is a channel_t[MAX_CHANNELS] and not an int
+		for (channelindex = 0;channelindex < (int)total_mixchannels;channelindex++, ch++)
 		{
 			sfx = ch->sfx;
 			if (sfx == NULL)
 				continue;
-			if (!S_LoadSound (sfx, true))
+			// sounds are loaded by the main thread
+			if (sfx->fetcher == NULL)
 				continue;
 			if (ch->flags & CHANNELFLAG_PAUSED)
 				continue;
 			if (!sfx->total_length)
 				continue;
 
-			// copy the channel information to the stack for reference, otherwise the
-			// values might change during a mix if the spatializer is updating them
-			// (note: this still may get some old and some new values!)
+			// copy the channel information to the stack for reference
 			posd = ch->position;
 			speedd = ch->mixspeed * sfx->format.speed / snd_renderbuffer->format.speed;
 			for (i = 0;i < SND_LISTENERS;i++)
@@ -350,6 +553,9 @@ void S_MixToBuffer(void *stream, unsigned int bufferframes)
 					// ear-drums blown out anyway.
 					break;
 			}
+			// virtual voices only keep their place in the sound
+			if (ch->isvirtual)
+				silent = true;
 
 			// when doing prologic mixing, some channels invert one side
 			if (ch->prologic_invert == -1)
@@ -424,100 +630,18 @@ void S_MixToBuffer(void *stream, unsigned int bufferframes)
 				indexfracstep = (int)floor(speedd * 65536.0);
 				if (!silent)
 				{
-					if (sfx->format.channels == 2)
-					{
-						// music is stereo
-#if SND_LISTENERS != 8
-#error the following code only supports up to 8 channels, update it
-#endif
-						if (snd_speakerlayout.channels > 2)
-						{
-							// surround mixing
-							for (i = 0;i < count;i++, paint++)
-							{
-								lerp[1] = indexfrac * (1.0f / 65536.0f);
-								lerp[0] = 1.0f - lerp[1];
-								sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[2] * lerp[1];
-								sample[1] = fetchsampleframe[1] * lerp[0] + fetchsampleframe[3] * lerp[1];
-								sample[2] = (sample[0] + sample[1]) * 0.5f;
-								paint->sample[0] += sample[0] * vol[0];
-								paint->sample[1] += sample[1] * vol[1];
-								paint->sample[2] += sample[0] * vol[2];
-								paint->sample[3] += sample[1] * vol[3];
-								paint->sample[4] += sample[2] * vol[4];
-								paint->sample[5] += sample[2] * vol[5];
-								paint->sample[6] += sample[0] * vol[6];
-								paint->sample[7] += sample[1] * vol[7];
-								indexfrac += indexfracstep;
-								fetchsampleframe += 2 * (indexfrac >> 16);
-								indexfrac &= 0xFFFF;
-							}
-						}
-						else
-						{
-							// stereo mixing
-							for (i = 0;i < count;i++, paint++)
-							{
-								lerp[1] = indexfrac * (1.0f / 65536.0f);
-								lerp[0] = 1.0f - lerp[1];
-								sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[2] * lerp[1];
-								sample[1] = fetchsampleframe[1] * lerp[0] + fetchsampleframe[3] * lerp[1];
-								paint->sample[0] += sample[0] * vol[0];
-								paint->sample[1] += sample[1] * vol[1];
-								indexfrac += indexfracstep;
-								fetchsampleframe += 2 * (indexfrac >> 16);
-								indexfrac &= 0xFFFF;
-							}
-						}
-					}
-					else if (sfx->format.channels == 1)
-					{
-						// most sounds are mono
-#if SND_LISTENERS != 8
-#error the following code only supports up to 8 channels, update it
+#ifdef SSE2_PRESENT
+					if (usesse2)
+						S_PaintChannel_SSE2(paint, fetchsampleframe, count, indexfrac, indexfracstep, vol, sfx->format.channels, snd_speakerlayout.channels > 2);
+					else
 #endif
-						if (snd_speakerlayout.channels > 2)
-						{
-							// surround mixing
-							for (i = 0;i < count;i++, paint++)
-							{
-								lerp[1] = indexfrac * (1.0f / 65536.0f);
-								lerp[0] = 1.0f - lerp[1];
-								sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[1] * lerp[1];
-								paint->sample[0] += sample[0] * vol[0];
-								paint->sample[1] += sample[0] * vol[1];
-								paint->sample[2] += sample[0] * vol[2];
-								paint->sample[3] += sample[0] * vol[3];
-								paint->sample[4] += sample[0] * vol[4];
-								paint->sample[5] += sample[0] * vol[5];
-								paint->sample[6] += sample[0] * vol[6];
-								paint->sample[7] += sample[0] * vol[7];
-								indexfrac += indexfracstep;
-								fetchsampleframe += (indexfrac >> 16);
-								indexfrac &= 0xFFFF;
-							}
-						}
-						else
-						{
-							// stereo mixing
-							for (i = 0;i < count;i++, paint++)
-							{
-								lerp[1] = indexfrac * (1.0f / 65536.0f);
-								lerp[0] = 1.0f - lerp[1];
-								sample[0] = fetchsampleframe[0] * lerp[0] + fetchsampleframe[1] * lerp[1];
-								paint->sample[0] += sample[0] * vol[0];
-								paint->sample[1] += sample[0] * vol[1];
-								indexfrac += indexfracstep;
-								fetchsampleframe += (indexfrac >> 16);
-								indexfrac &= 0xFFFF;
-							}
-						}
-					}
+						S_PaintChannel(paint, fetchsampleframe, count, indexfrac, indexfracstep, vol, sfx->format.channels, snd_speakerlayout.channels > 2);
+					paint += count;
 				}
 			}
 			ch->position = posd;
 			if (!looping && istartframe == totallength)
-				S_StopChannel(ch - channels, false, false);
+				S_MixStopChannel(ch);
 		}
 
 		S_SoftClipPaintBuffer(paintbuffer, totalmixframes, snd_renderbuffer->format.width, snd_renderbuffer->format.channels);
@@ -527,10 +651,92 @@ void S_MixToBuffer(void *stream, unsigned int bufferframes)
 			S_CaptureAVISound(paintbuffer, totalmixframes);
 #endif
 
-		S_ConvertPaintBuffer(paintbuffer, outbytes, totalmixframes, snd_renderbuffer->format.width, snd_renderbuffer->format.channels);
+		S_ConvertPaintBuffer(paintbuffer, outbytes, totalmixframes, snd_renderbuffer->format.width, snd_renderbuffer->format.channels, usesse2);
 
 		// advance the output pointer
 		outbytes += totalmixframes * snd_renderbuffer->format.width * snd_renderbuffer->format.channels;
 		bufferframes -= totalmixframes;
 	}
+
+	S_MixPublishPositions();
+}
+
+/*
+===============
+S_MixBenchmark_f
+
+mixes synthetic channels with the scalar and (if compiled in) the SSE2
+mixer and prints how many channels each mixes per millisecond
+===============
+*/
+static double S_MixBenchmark(int numchannels, int speakers, qboolean usesse2, portable_sampleframe_t *paint, short *out, const float *source)
+{
+	int c, mixes;
+	double starttime, elapsed;
+	float vol[SND_LISTENERS];
+	int indexfracstep;
+
+	for (c = 0;c < SND_LISTENERS;c++)
+		vol[c] = 0.5f / (c + 1);
+	starttime = Sys_DirtyTime();
+	for (mixes = 0;;mixes++)
+	{
+		elapsed = Sys_DirtyTime() - starttime;
+		if (elapsed >= 0.25 && mixes >= 4)
+			break;
+		memset(paint, 0, PAINTBUFFER_SIZE * sizeof(*paint));
+		for (c = 0;c < numchannels;c++)
+		{
+			// a mix of mono and stereo sounds at 22050 and 44100hz played at 48000hz
+			indexfracstep = (c & 2) ? 30106 : 60211;
+#ifdef SSE2_PRESENT
+			if (usesse2)
+				S_PaintChannel_SSE2(paint, source, PAINTBUFFER_SIZE, c & 0xFFFF, indexfracstep, vol, (c & 1) + 1, speakers > 2);
+			else
+#endif
+				S_PaintChannel(paint, source, PAINTBUFFER_SIZE, c & 0xFFFF, indexfracstep, vol, (c & 1) + 1, speakers > 2);
+		}
+		S_ConvertPaintBuffer(paint, out, PAINTBUFFER_SIZE, 2, speakers, usesse2);
+	}
+	// channels of one paint buffer each per millisecond
+	return mixes * numchannels / (elapsed * 1000.0);
+}
+
+void S_MixBenchmark_f(void)
+{
+	int i, numchannels, speakers;
+	portable_sampleframe_t *paint;
+	short *out;
+	float *source;
+	double scalar;
+
+	numchannels = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 128;
+	speakers = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : (snd_renderbuffer ? (int)snd_renderbuffer->format.channels : 2);
+	if (numchannels < 1 || (speakers != 1 && speakers != 2 && speakers != 4 && speakers != 6 && speakers != 8))
+	{
+		Con_Printf("usage: snd_mixbenchmark [channels] [speakers]\nspeakers is 1, 2, 4, 6 or 8 (default is the current sound output)\n");
+		return;
+	}
+
+	// the source has to cover PAINTBUFFER_SIZE stereo frames at a step of
+	// just under 1, plus the frame the last one interpolates towards
+	source = (float *)Mem_Alloc(tempmempool, (PAINTBUFFER_SIZE + 2) * 2 * sizeof(float));
+	for (i = 0;i < (PAINTBUFFER_SIZE + 2) * 2;i++)
+		source[i] = lhrandom(-1.0f, 1.0f);
+	paint = (portable_sampleframe_t *)Mem_Alloc(tempmempool, PAINTBUFFER_SIZE * sizeof(*paint));
+	out = (short *)Mem_Alloc(tempmempool, PAINTBUFFER_SIZE * SND_LISTENERS * sizeof(*out));
+
+	Con_Printf("mixing %i channels of %i frames into %i speakers at 16bit\n", numchannels, PAINTBUFFER_SIZE, speakers);
+	scalar = S_MixBenchmark(numchannels, speakers, false, paint, out, source);
+	Con_Printf("scalar: %.1f channels/ms\n", scalar);
+#ifdef SSE2_PRESENT
+	{
+		double sse2 = S_MixBenchmark(numchannels, speakers, true, paint, out, source);
+		Con_Printf("SSE2:   %.1f channels/ms (%.2fx)\n", sse2, sse2 / max(scalar, 0.0001));
+	}
+#endif
+
+	Mem_Free(out);
+	Mem_Free(paint);
+	Mem_Free(source);
 }
@@ -26,6 +26,7 @@
 #include "snd_main.h"
 #include "snd_ogg.h"
 #include "snd_wav.h"
+#include "thread.h"
 
 #ifdef LINK_TO_LIBVORBIS
 #define OV_EXCLUDE_STATIC_CALLBACKS
@@ -395,26 +396,254 @@ static long ovcb_tell (void *ov_decode)
 }
 
 // Per-sfx data structure
-typedef struct
+typedef struct ogg_stream_persfx_s
 {
+	struct ogg_stream_persfx_s *next;	// next streamed sound (list walked by the decode thread)
+	sfx_t			*sfx;
 	unsigned char	*file;
 	size_t			filesize;
+	struct ogg_stream_decoder_s *decoders;	// open decoders on this file
 } ogg_stream_persfx_t;
 
-// Per-channel data structure
-typedef struct
+// Decoder with a read-ahead buffer of decompressed frames, shared by all
+// channels currently playing from the part of the sound it holds
+typedef struct ogg_stream_decoder_s
 {
+	struct ogg_stream_decoder_s *next;	// next decoder on the same sfx
+	sfx_t			*sfx;
 	OggVorbis_File	vf;
 	ov_decode_t		ov_decode;
 	int				bs;
-	int				buffer_firstframe;
-	int				buffer_numframes;
-	unsigned char	buffer[STREAM_BUFFERSIZE*4];
+	snd_ringbuffer_t *ringbuffer;		// startframe/endframe count frames decoded since the last seek
+	unsigned int	position;			// frame of the sound stored at ringbuffer->startframe
+	struct ogg_stream_perchannel_s *channels;	// channels reading from this decoder
+	double			lastused;			// when the last channel stopped reading from this decoder
+	qboolean		eof;				// everything up to sfx->total_length has been decoded
+	qboolean		busy;				// the decode thread is filling the buffer without holding the lock
+} ogg_stream_decoder_t;
+
+// Per-channel data structure
+typedef struct ogg_stream_perchannel_s
+{
+	struct ogg_stream_perchannel_s *next;	// next channel reading from the same decoder
+	ogg_stream_decoder_t *decoder;
+	unsigned int	readframe;			// first frame of the last request, earlier frames may be discarded
+	qboolean		looping;
+	qboolean		priority;			// music, menu and local sounds are decoded ahead first
 } ogg_stream_perchannel_t;
 
+// frames decoded per step, small enough that the mixer never waits long on it
+#define OGG_DECODECHUNK 4096
 
 static const ov_callbacks callbacks = {ovcb_read, ovcb_seek, ovcb_close, ovcb_tell};
 
+static ogg_stream_persfx_t *ogg_streams = NULL;
+static void *ogg_streams_mutex = NULL;
+static void *ogg_decodethread = NULL;
+static volatile qboolean ogg_decodethread_quit = false;
+
+static void OGG_LockStreams(void)
+{
+	if (ogg_streams_mutex)
+		Thread_LockMutex(ogg_streams_mutex);
+}
+
+static void OGG_UnlockStreams(void)
+{
+	if (ogg_streams_mutex)
+		Thread_UnlockMutex(ogg_streams_mutex);
+}
+
+/*
+====================
+OGG_Decoder_Open
+
+Opens a new decoder on a streamed sound, the caller links it to the sfx
+====================
+*/
+static ogg_stream_decoder_t *OGG_Decoder_Open(sfx_t *sfx)
+{
+	ogg_stream_persfx_t *per_sfx = (ogg_stream_persfx_t *)sfx->fetcher_data;
+	ogg_stream_decoder_t *d;
+	unsigned int maxframes;
+
+	d = (ogg_stream_decoder_t *)Mem_Alloc(snd_mempool, sizeof(*d));
+	d->sfx = sfx;
+	d->ov_decode.buffer = per_sfx->file;
+	d->ov_decode.ind = 0;
+	d->ov_decode.buffsize = per_sfx->filesize;
+	if (qov_open_callbacks(&d->ov_decode, &d->vf, NULL, 0, callbacks) < 0)
+	{
+		// this never happens - this function succeeded earlier on the same data
+		Mem_Free(d);
+		return NULL;
+	}
+	// room for the read-ahead plus what the mixer is still reading
+	maxframes = (unsigned int)((bound(0.1f, snd_streaming_readahead.value, 10.0f) + 0.5f) * sfx->format.speed);
+	maxframes = max(maxframes, (unsigned int)STREAM_BUFFERSIZE);
+	d->ringbuffer = Snd_CreateRingBuffer(&sfx->format, maxframes, NULL);
+	d->lastused = Sys_DirtyTime();
+	return d;
+}
+
+static void OGG_Decoder_Free(ogg_stream_decoder_t *d)
+{
+	ogg_stream_persfx_t *per_sfx = (ogg_stream_persfx_t *)d->sfx->fetcher_data;
+	ogg_stream_decoder_t **link;
+
+	for (link = &per_sfx->decoders;*link;link = &(*link)->next)
+	{
+		if (*link == d)
+		{
+			*link = d->next;
+			break;
+		}
+	}
+	// release the vorbis decompressor
+	qov_clear(&d->vf);
+	Mem_Free(d->ringbuffer->ring);
+	Mem_Free(d->ringbuffer);
+	Mem_Free(d);
+}
+
+static qboolean OGG_Decoder_Seek(ogg_stream_decoder_t *d, unsigned int frame)
+{
+	// we expect to decode forward from here so this will be our new buffer start
+	d->ringbuffer->startframe = 0;
+	d->ringbuffer->endframe = 0;
+	d->position = frame;
+	d->eof = frame >= d->sfx->total_length;
+	return qov_pcm_seek(&d->vf, (ogg_int64_t)frame) == 0;
+}
+
+// frame after the last decoded one
+static unsigned int OGG_Decoder_EndFrame(const ogg_stream_decoder_t *d)
+{
+	return d->position + d->ringbuffer->endframe - d->ringbuffer->startframe;
+}
+
+// whether a channel reading from this frame on can use this decoder
+// (reading at the end of the buffer is expected, the decoder just goes on)
+static qboolean OGG_Decoder_Covers(const ogg_stream_decoder_t *d, unsigned int frame)
+{
+	return d->position <= frame && frame <= OGG_Decoder_EndFrame(d);
+}
+
+// earliest frame still needed by the channels reading from this decoder
+static unsigned int OGG_Decoder_ReadFrame(const ogg_stream_decoder_t *d)
+{
+	const ogg_stream_perchannel_t *per_ch;
+	unsigned int frame = d->channels ? OGG_Decoder_EndFrame(d) : d->position;
+	for (per_ch = d->channels;per_ch;per_ch = per_ch->next)
+		frame = min(frame, per_ch->readframe);
+	return max(frame, d->position);
+}
+
+// discards the frames preceding the given one
+static void OGG_Decoder_Trim(ogg_stream_decoder_t *d, unsigned int frame)
+{
+	unsigned int drop;
+	if (frame <= d->position)
+		return;
+	drop = min(frame, OGG_Decoder_EndFrame(d)) - d->position;
+	d->ringbuffer->startframe += drop;
+	d->position += drop;
+}
+
+// number of frames that can be decoded in one go without wrapping the ring,
+// overwriting buffered frames, or going past the end of the sound
+static int OGG_Decoder_Space(const ogg_stream_decoder_t *d)
+{
+	const snd_ringbuffer_t *rb = d->ringbuffer;
+	unsigned int space = rb->maxframes - rb->endframe % rb->maxframes;
+	space = min(space, rb->maxframes - (rb->endframe - rb->startframe));
+	space = min(space, d->sfx->total_length - min(d->sfx->total_length, OGG_Decoder_EndFrame(d)));
+	return (int)space;
+}
+
+/*
+====================
+OGG_Decoder_Fill
+
+Decodes frames into the ring buffer after endframe without publishing them,
+called by the decode thread without the lock while the decoder is busy
+====================
+*/
+static int OGG_Decoder_Fill(ogg_stream_decoder_t *d, int numframes)
+{
+	snd_ringbuffer_t *rb = d->ringbuffer;
+	int f = rb->format.width * rb->format.channels; // bytes per frame in the buffer
+	unsigned char *out = rb->ring + (rb->endframe % rb->maxframes) * f;
+	int len = numframes * f;
+	int done = 0, ret;
+	while (len > done && (ret = qov_read(&d->vf, (char *)out + done, len - done, mem_bigendian, 2, 1, &d->bs)) > 0)
+		done += ret;
+	return done / f;
+}
+
+// publishes the frames written by OGG_Decoder_Fill
+static void OGG_Decoder_Commit(ogg_stream_decoder_t *d, int wanted, int done)
+{
+	d->ringbuffer->endframe += done;
+	if (done < wanted || OGG_Decoder_EndFrame(d) >= d->sfx->total_length)
+		d->eof = true;
+}
+
+// decodes up to numframes synchronously, the lock must be held
+static void OGG_Decoder_Decode(ogg_stream_decoder_t *d, int numframes)
+{
+	int wanted;
+	while (numframes > 0 && !d->eof && (wanted = min(numframes, OGG_Decoder_Space(d))) > 0)
+	{
+		OGG_Decoder_Commit(d, wanted, OGG_Decoder_Fill(d, wanted));
+		numframes -= wanted;
+	}
+	if (!d->eof && OGG_Decoder_EndFrame(d) >= d->sfx->total_length)
+		d->eof = true;
+}
+
+static ogg_stream_decoder_t *OGG_FindDecoder(ogg_stream_persfx_t *per_sfx, unsigned int frame)
+{
+	ogg_stream_decoder_t *d;
+	for (d = per_sfx->decoders;d;d = d->next)
+		if (OGG_Decoder_Covers(d, frame))
+			return d;
+	return NULL;
+}
+
+// moves a channel to another decoder (or none), the lock must be held
+static void OGG_Decoder_Attach(ogg_stream_perchannel_t *per_ch, ogg_stream_decoder_t *d)
+{
+	ogg_stream_decoder_t *old = per_ch->decoder;
+	ogg_stream_perchannel_t **link;
+
+	if (old == d)
+		return;
+	if (old)
+	{
+		for (link = &old->channels;*link;link = &(*link)->next)
+		{
+			if (*link == per_ch)
+			{
+				*link = per_ch->next;
+				break;
+			}
+		}
+		old->lastused = Sys_DirtyTime();
+		// without a decode thread nobody else would free it (with one it
+		// stays around for a moment in case the sound is restarted)
+		if (!old->channels && !old->busy && !ogg_decodethread)
+			OGG_Decoder_Free(old);
+	}
+	per_ch->decoder = d;
+	per_ch->next = NULL;
+	if (d)
+	{
+		per_ch->next = d->channels;
+		d->channels = per_ch;
+	}
+}
+
 /*
 ====================
 OGG_GetSamplesFloat
@@ -424,87 +653,106 @@ static void OGG_GetSamplesFloat (channel_t *ch, sfx_t *sfx, int firstsampleframe
 {
 	ogg_stream_perchannel_t *per_ch = (ogg_stream_perchannel_t *)ch->fetcher_data;
 	ogg_stream_persfx_t *per_sfx = (ogg_stream_persfx_t *)sfx->fetcher_data;
-	int f = sfx->format.width * sfx->format.channels; // bytes per frame in the buffer
+	ogg_stream_decoder_t *d;
+	snd_ringbuffer_t *rb;
 	short *buf;
-	int i, len;
-	int newlength, done, ret;
+	int i, len, done, wanted, available, channels = sfx->format.channels;
+	unsigned int frame, endframe;
 
 	// if this channel does not yet have a channel fetcher, make one
 	if (per_ch == NULL)
 	{
-		// allocate a struct to keep track of our file position and buffer
 		per_ch = (ogg_stream_perchannel_t *)Mem_Alloc(snd_mempool, sizeof(*per_ch));
-		// begin decoding the file
-		per_ch->ov_decode.buffer = per_sfx->file;
-		per_ch->ov_decode.ind = 0;
-		per_ch->ov_decode.buffsize = per_sfx->filesize;
-		if (qov_open_callbacks(&per_ch->ov_decode, &per_ch->vf, NULL, 0, callbacks) < 0)
-		{
-			// this never happens - this function succeeded earlier on the same data
-			Mem_Free(per_ch);
-			return;
-		}
-		per_ch->bs = 0;
-		per_ch->buffer_firstframe = 0;
-		per_ch->buffer_numframes = 0;
 		// attach the struct to our channel
 		ch->fetcher_data = (void *)per_ch;
 	}
+	per_ch->looping = sfx->loopstart < sfx->total_length || (ch->flags & CHANNELFLAG_FORCELOOP);
+	per_ch->priority = (sfx->flags & SFXFLAG_MENUSOUND) || (ch->flags & (CHANNELFLAG_LOCALSOUND | CHANNELFLAG_FULLVOLUME));
 
-	// if the request is too large for our buffer, loop...
-	while (numsampleframes * f > (int)sizeof(per_ch->buffer))
+	// if the request is too large for a read-ahead buffer, loop...
+	while (numsampleframes > STREAM_BUFFERSIZE / 4)
 	{
-		done = sizeof(per_ch->buffer) / f;
+		done = STREAM_BUFFERSIZE / 4;
 		OGG_GetSamplesFloat(ch, sfx, firstsampleframe, done, outsamplesfloat);
 		firstsampleframe += done;
 		numsampleframes -= done;
-		outsamplesfloat += done * sfx->format.channels;
+		outsamplesfloat += done * channels;
 	}
 
-	// seek if the request is before the current buffer (loop back)
-	// seek if the request starts beyond the current buffer by at least one frame (channel was zero volume for a while)
-	// do not seek if the request overlaps the buffer end at all (expected behavior)
-	if (per_ch->buffer_firstframe > firstsampleframe || per_ch->buffer_firstframe + per_ch->buffer_numframes < firstsampleframe)
+	OGG_LockStreams();
+	frame = (unsigned int)firstsampleframe;
+	endframe = frame + numsampleframes;
+	per_ch->readframe = frame;
+
+	// switch decoder if the request is not where this one is decoding, this
+	// picks up another channel's decoder if it is already there (restarted
+	// or simultaneous sounds, the loop start prepared by the decode thread)
+	d = per_ch->decoder;
+	if (!d || !OGG_Decoder_Covers(d, frame))
 	{
-		// we expect to decode forward from here so this will be our new buffer start
-		per_ch->buffer_firstframe = firstsampleframe;
-		per_ch->buffer_numframes = 0;
-		ret = qov_pcm_seek(&per_ch->vf, (ogg_int64_t)firstsampleframe);
-		if (ret != 0)
+		d = OGG_FindDecoder(per_sfx, frame);
+		if (!d && (d = OGG_Decoder_Open(sfx)))
 		{
-			// LordHavoc: we can't Con_Printf here, not thread safe...
-			//Con_Printf("OGG_FetchSound: qov_pcm_seek(..., %d) returned %d\n", firstsampleframe, ret);
+			if (OGG_Decoder_Seek(d, frame))
+			{
+				d->next = per_sfx->decoders;
+				per_sfx->decoders = d;
+			}
+			else
+			{
+				// LordHavoc: we can't Con_Printf here, not thread safe...
+				OGG_Decoder_Free(d);
+				d = NULL;
+			}
+		}
+		OGG_Decoder_Attach(per_ch, d);
+		if (!d)
+		{
+			OGG_UnlockStreams();
 			return;
 		}
 	}
 
-	// decompress the file as needed
-	if (firstsampleframe + numsampleframes > per_ch->buffer_firstframe + per_ch->buffer_numframes)
+	// decompress the file as needed, normally the decode thread has already
+	// done it and this is skipped
+	while (!d->eof && OGG_Decoder_EndFrame(d) < endframe)
 	{
-		// first slide the buffer back, discarding any data preceding the range we care about
-		int offset = firstsampleframe - per_ch->buffer_firstframe;
-		int keeplength = per_ch->buffer_numframes - offset;
-		if (keeplength > 0)
-			memmove(per_ch->buffer, per_ch->buffer + offset * sfx->format.width * sfx->format.channels, keeplength * sfx->format.width * sfx->format.channels);
-		per_ch->buffer_firstframe = firstsampleframe;
-		per_ch->buffer_numframes -= offset;
-		// decompress as much as we can fit in the buffer
-		newlength = sizeof(per_ch->buffer) - per_ch->buffer_numframes * f;
-		done = 0;
-		while (newlength > done && (ret = qov_read(&per_ch->vf, (char *)per_ch->buffer + per_ch->buffer_numframes * f + done, (int)(newlength - done), mem_bigendian, 2, 1, &per_ch->bs)) > 0)
-			done += ret;
-		// clear the missing space if any
-		if (done < newlength)
-			memset(per_ch->buffer + done, 0, newlength - done);
-		// we now have more data in the buffer
-		per_ch->buffer_numframes += done / f;
+		if (d->busy)
+		{
+			// the decode thread is working on this one, wait for it
+			OGG_UnlockStreams();
+			Sys_Sleep(100);
+			OGG_LockStreams();
+			continue;
+		}
+		// make room, if a channel lags too far behind it gets its own decoder
+		OGG_Decoder_Trim(d, OGG_Decoder_ReadFrame(d));
+		if (endframe - d->position > d->ringbuffer->maxframes)
+			OGG_Decoder_Trim(d, frame);
+		// without a decode thread decompress ahead as much as we always did
+		if (ogg_decodethread)
+			OGG_Decoder_Decode(d, endframe - OGG_Decoder_EndFrame(d));
+		else
+			OGG_Decoder_Decode(d, STREAM_BUFFERSIZE);
 	}
 
-	// convert the sample format for the caller
-	buf = (short *)((char *)per_ch->buffer + (firstsampleframe - per_ch->buffer_firstframe) * f);
-	len = numsampleframes * sfx->format.channels;
-	for (i = 0;i < len;i++)
-		outsamplesfloat[i] = buf[i] * (1.0f / 32768.0f);
+	// convert the sample format for the caller, the buffer may wrap once
+	// (if the file ended early the caller's buffer is already silent)
+	rb = d->ringbuffer;
+	available = (int)(min(endframe, OGG_Decoder_EndFrame(d)) - frame);
+	done = 0;
+	while (done < available)
+	{
+		i = (rb->startframe + frame + done - d->position) % rb->maxframes;
+		wanted = min(available - done, (int)rb->maxframes - i);
+		buf = (short *)rb->ring + i * channels;
+		len = wanted * channels;
+		for (i = 0;i < len;i++)
+			outsamplesfloat[i] = buf[i] * (1.0f / 32768.0f);
+		outsamplesfloat += len;
+		done += wanted;
+	}
+	OGG_UnlockStreams();
 }
 
 
@@ -518,8 +766,9 @@ static void OGG_StopChannel(channel_t *ch)
 	ogg_stream_perchannel_t *per_ch = (ogg_stream_perchannel_t *)ch->fetcher_data;
 	if (per_ch != NULL)
 	{
-		// release the vorbis decompressor
-		qov_clear(&per_ch->vf);
+		OGG_LockStreams();
+		OGG_Decoder_Attach(per_ch, NULL);
+		OGG_UnlockStreams();
 		Mem_Free(per_ch);
 	}
 }
@@ -533,6 +782,34 @@ OGG_FreeSfx
 static void OGG_FreeSfx(sfx_t *sfx)
 {
 	ogg_stream_persfx_t *per_sfx = (ogg_stream_persfx_t *)sfx->fetcher_data;
+	ogg_stream_persfx_t **link;
+	ogg_stream_decoder_t *d;
+
+	OGG_LockStreams();
+	// wait for the decode thread to be done with this sound
+	for (;;)
+	{
+		for (d = per_sfx->decoders;d;d = d->next)
+			if (d->busy)
+				break;
+		if (!d)
+			break;
+		OGG_UnlockStreams();
+		Sys_Sleep(1000);
+		OGG_LockStreams();
+	}
+	for (link = &ogg_streams;*link;link = &(*link)->next)
+	{
+		if (*link == per_sfx)
+		{
+			*link = per_sfx->next;
+			break;
+		}
+	}
+	// all channels have been stopped by now, only idle decoders are left
+	while (per_sfx->decoders)
+		OGG_Decoder_Free(per_sfx->decoders);
+	OGG_UnlockStreams();
 	// free the complete file we were keeping around
 	Mem_Free(per_sfx->file);
 	// free the file information structure
@@ -542,6 +819,172 @@ static void OGG_FreeSfx(sfx_t *sfx)
 
 static const snd_fetcher_t ogg_fetcher = {OGG_GetSamplesFloat, OGG_StopChannel, OGG_FreeSfx};
 
+/*
+====================
+OGG_DecodeThread_Step
+
+Does one step of read-ahead work on the stream that needs it most (the one
+with the least decoded ahead of its channels, with music, menu and local
+sounds counting double) and returns false if all streams are full
+====================
+*/
+static qboolean OGG_DecodeThread_Step(void)
+{
+	ogg_stream_persfx_t *per_sfx, *bestsfx = NULL;
+	ogg_stream_decoder_t *d, *next, *best = NULL, *loopdecoder;
+	ogg_stream_perchannel_t *per_ch;
+	qboolean priority, looping;
+	unsigned int loopframe;
+	double now = Sys_DirtyTime(), readahead = bound(0.1f, snd_streaming_readahead.value, 10.0f);
+	double lead, bestlead = readahead;
+	int wanted, done;
+
+	OGG_LockStreams();
+	for (per_sfx = ogg_streams;per_sfx;per_sfx = per_sfx->next)
+	{
+		for (d = per_sfx->decoders;d;d = next)
+		{
+			next = d->next;
+			if (d->busy)
+				continue;
+			if (!d->channels)
+			{
+				// a decoder prepared at a loop start or just left by a
+				// channel only keeps what it has, and goes away unless a
+				// channel picks it up soon
+				if (now - d->lastused > readahead + 1)
+					OGG_Decoder_Free(d);
+				continue;
+			}
+			priority = (per_sfx->sfx->flags & SFXFLAG_MENUSOUND) != 0;
+			looping = false;
+			for (per_ch = d->channels;per_ch;per_ch = per_ch->next)
+			{
+				priority |= per_ch->priority;
+				looping |= per_ch->looping;
+			}
+			if (d->eof)
+			{
+				// decode the loop start in advance so the channels can
+				// switch to it without the mixer seeking
+				if (!looping)
+					continue;
+				loopframe = per_sfx->sfx->loopstart < per_sfx->sfx->total_length ? per_sfx->sfx->loopstart : 0;
+				if (OGG_FindDecoder(per_sfx, loopframe))
+					continue;
+			}
+			else if (OGG_Decoder_Space(d) <= 0 && OGG_Decoder_ReadFrame(d) == d->position)
+				continue;
+			lead = (double)(OGG_Decoder_EndFrame(d) - OGG_Decoder_ReadFrame(d)) / per_sfx->sfx->format.speed;
+			if (priority)
+				lead *= 0.5;
+			if (bestlead > lead)
+			{
+				bestlead = lead;
+				best = d;
+				bestsfx = per_sfx;
+			}
+		}
+	}
+	if (!best)
+	{
+		OGG_UnlockStreams();
+		return false;
+	}
+
+	// work on it without the lock, the mixer keeps reading the decoded
+	// frames but leaves the decoder alone while it is busy
+	d = best;
+	d->busy = true;
+	if (d->eof)
+	{
+		OGG_UnlockStreams();
+		loopframe = bestsfx->sfx->loopstart < bestsfx->sfx->total_length ? bestsfx->sfx->loopstart : 0;
+		loopdecoder = OGG_Decoder_Open(bestsfx->sfx);
+		if (loopdecoder && OGG_Decoder_Seek(loopdecoder, loopframe))
+			OGG_Decoder_Decode(loopdecoder, OGG_DECODECHUNK);
+		OGG_LockStreams();
+		if (loopdecoder)
+		{
+			loopdecoder->next = bestsfx->decoders;
+			bestsfx->decoders = loopdecoder;
+		}
+	}
+	else
+	{
+		OGG_Decoder_Trim(d, OGG_Decoder_ReadFrame(d));
+		wanted = min(OGG_DECODECHUNK, OGG_Decoder_Space(d));
+		OGG_UnlockStreams();
+		done = OGG_Decoder_Fill(d, wanted);
+		OGG_LockStreams();
+		OGG_Decoder_Commit(d, wanted, done);
+	}
+	d->busy = false;
+	OGG_UnlockStreams();
+	return true;
+}
+
+static int OGG_DecodeThread(void *unused)
+{
+	while (!ogg_decodethread_quit)
+		if (!OGG_DecodeThread_Step())
+			Sys_Sleep(5000);
+	return 0;
+}
+
+/*
+====================
+OGG_StartDecodeThread
+
+Starts decoding streamed sounds ahead of the mixer, the caller makes sure
+the mixer is not running
+====================
+*/
+void OGG_StartDecodeThread(void)
+{
+	if (ogg_decodethread || !snd_streaming_thread.integer || !Thread_HasThreads())
+		return;
+	ogg_decodethread_quit = false;
+	ogg_streams_mutex = Thread_CreateMutex();
+	ogg_decodethread = Thread_CreateThread(OGG_DecodeThread, NULL);
+	if (!ogg_decodethread)
+	{
+		Thread_DestroyMutex(ogg_streams_mutex);
+		ogg_streams_mutex = NULL;
+	}
+}
+
+/*
+====================
+OGG_StopDecodeThread
+
+The caller makes sure the mixer is not running
+====================
+*/
+void OGG_StopDecodeThread(void)
+{
+	ogg_stream_persfx_t *per_sfx;
+	ogg_stream_decoder_t *d, *next;
+
+	if (!ogg_decodethread)
+		return;
+	ogg_decodethread_quit = true;
+	Thread_WaitThread(ogg_decodethread, 0);
+	Thread_DestroyMutex(ogg_streams_mutex);
+	ogg_decodethread = NULL;
+	ogg_streams_mutex = NULL;
+	// idle decoders were left for the thread to free
+	for (per_sfx = ogg_streams;per_sfx;per_sfx = per_sfx->next)
+	{
+		for (d = per_sfx->decoders;d;d = next)
+		{
+			next = d->next;
+			if (!d->channels)
+				OGG_Decoder_Free(d);
+		}
+	}
+}
+
 static void OGG_DecodeTags(vorbis_comment *vc, unsigned int *start, unsigned int *length, unsigned int numsamples, double *peak, double *gaindb)
 {
 	const char *startcomment = NULL, *lengthcomment = NULL, *endcomment = NULL, *thiscomment = NULL;
@@ -655,19 +1098,25 @@ qboolean OGG_LoadVorbisFile(const char *filename, sfx_t *sfx)
 
 	sfx->total_length = qov_pcm_total(&vf, -1);
 
-	if (snd_streaming.integer && (snd_streaming.integer >= 2 || sfx->total_length > max(sizeof(ogg_stream_perchannel_t), snd_streaming_length.value * sfx->format.speed)))
+	if (snd_streaming.integer && (snd_streaming.integer >= 2 || sfx->total_length > max(STREAM_BUFFERSIZE, snd_streaming_length.value * sfx->format.speed)))
 	{
-		// large sounds use the OGG fetcher to decode the file on demand (but the entire file is held in memory)
+		// large sounds use the OGG fetcher to decode the file on demand, ahead of the mixer if there is a decode thread (but the entire file is held in memory)
 		ogg_stream_persfx_t* per_sfx;
 		if (developer_loading.integer >= 2)
 			Con_Printf("Ogg sound file \"%s\" will be streamed\n", filename);
 		per_sfx = (ogg_stream_persfx_t *)Mem_Alloc(snd_mempool, sizeof(*per_sfx));
 		sfx->memsize += sizeof (*per_sfx);
+		per_sfx->sfx = sfx;
 		per_sfx->file = data;
 		per_sfx->filesize = filesize;
 		sfx->memsize += filesize;
 		sfx->fetcher_data = per_sfx;
 		sfx->fetcher = &ogg_fetcher;
+		// let the decode thread see it
+		OGG_LockStreams();
+		per_sfx->next = ogg_streams;
+		ogg_streams = per_sfx;
+		OGG_UnlockStreams();
 		sfx->flags |= SFXFLAG_STREAMED;
 		vc = qov_comment(&vf, -1);
 		OGG_DecodeTags(vc, &sfx->loopstart, &sfx->total_length, sfx->total_length, &peak, &gaindb);
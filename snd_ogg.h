@@ -28,6 +28,8 @@
 qboolean OGG_OpenLibrary (void);
 void OGG_CloseLibrary (void);
 qboolean OGG_LoadVorbisFile (const char *filename, sfx_t *sfx);
+void OGG_StartDecodeThread (void);
+void OGG_StopDecodeThread (void);
 
 
 #endif
@@ -2856,6 +2856,35 @@ SERVER SPAWNING
 ==============================================================================
 */
 
+/*
+================
+SV_PrecacheHash_Find
+
+returns the index of name in a precache list, or 0 if it is not in it
+================
+*/
+static int SV_PrecacheHash_Find(const unsigned short *hash, const unsigned short *next, char (*names)[MAX_QPATH], const char *name)
+{
+	int i;
+	for (i = hash[CRC_Block((const unsigned char *)name, strlen(name)) & (SV_PRECACHEHASHSIZE - 1)];i;i = next[i])
+		if (!strcmp(names[i], name))
+			return i;
+	return 0;
+}
+
+/*
+================
+SV_PrecacheHash_Link
+
+================
+*/
+void SV_PrecacheHash_Link(unsigned short *hash, unsigned short *next, char (*names)[MAX_QPATH], int index)
+{
+	int bucket = CRC_Block((const unsigned char *)names[index], strlen(names[index])) & (SV_PRECACHEHASHSIZE - 1);
+	next[index] = hash[bucket];
+	hash[bucket] = index;
+}
+
 /*
 ================
 SV_ModelIndex
@@ -2872,6 +2901,11 @@ int SV_ModelIndex(const char *s, int precachemode)
 	//if (precachemode == 2)
 	//	return 0;
 	strlcpy(filename, s, sizeof(filename));
+	// setmodel is called constantly by some mods, so look the name up in the
+	// hash rather than comparing it to every precache
+	i = SV_PrecacheHash_Find(sv.model_precachehash, sv.model_precachenext, sv.model_precache, filename);
+	if (i >= 2 && i < limit)
+		return i;
 	for (i = 2;i < limit;i++)
 	{
 		if (!sv.model_precache[i][0])
@@ -2886,6 +2920,7 @@ int SV_ModelIndex(const char *s, int precachemode)
 				if (precachemode == 1)
 					Con_Printf("SV_ModelIndex(\"%s\"): not precached (fix your code), precaching anyway\n", filename);
 				strlcpy(sv.model_precache[i], filename, sizeof(sv.model_precache[i]));
+				SV_PrecacheHash_Link(sv.model_precachehash, sv.model_precachenext, sv.model_precache, i);
 				if (sv.state == ss_loading)
 				{
 					// running from SV_SpawnServer which is launched from the client console command interpreter
@@ -2912,8 +2947,6 @@ int SV_ModelIndex(const char *s, int precachemode)
 			Con_Printf("SV_ModelIndex(\"%s\"): not precached\n", filename);
 			return 0;
 		}
-		if (!strcmp(sv.model_precache[i], filename))
-			return i;
 	}
 	Con_Printf("SV_ModelIndex(\"%s\"): i (%i) == MAX_MODELS (%i)\n", filename, i, MAX_MODELS);
 	return 0;
@@ -2935,6 +2968,9 @@ int SV_SoundIndex(const char *s, int precachemode)
 	//if (precachemode == 2)
 	//	return 0;
 	strlcpy(filename, s, sizeof(filename));
+	i = SV_PrecacheHash_Find(sv.sound_precachehash, sv.sound_precachenext, sv.sound_precache, filename);
+	if (i >= 1 && i < limit)
+		return i;
 	for (i = 1;i < limit;i++)
 	{
 		if (!sv.sound_precache[i][0])
@@ -2949,6 +2985,7 @@ int SV_SoundIndex(const char *s, int precachemode)
 				if (precachemode == 1)
 					Con_Printf("SV_SoundIndex(\"%s\"): not precached (fix your code), precaching anyway\n", filename);
 				strlcpy(sv.sound_precache[i], filename, sizeof(sv.sound_precache[i]));
+				SV_PrecacheHash_Link(sv.sound_precachehash, sv.sound_precachenext, sv.sound_precache, i);
 				if (sv.state != ss_loading)
 				{
 					MSG_WriteByte(&sv.reliable_datagram, svc_precache);
@@ -2960,8 +2997,6 @@ int SV_SoundIndex(const char *s, int precachemode)
 			Con_Printf("SV_SoundIndex(\"%s\"): not precached\n", filename);
 			return 0;
 		}
-		if (!strcmp(sv.sound_precache[i], filename))
-			return i;
 	}
 	Con_Printf("SV_SoundIndex(\"%s\"): i (%i) == MAX_SOUNDS (%i)\n", filename, i, MAX_SOUNDS);
 	return 0;
@@ -2988,8 +3023,13 @@ int SV_ParticleEffectIndex(const char *name)
 	{
 		sv.particleeffectnamesloaded = true;
 		memset(sv.particleeffectname, 0, sizeof(sv.particleeffectname));
+		memset(sv.particleeffectnamehash, 0, sizeof(sv.particleeffectnamehash));
 		for (i = 0;i < EFFECT_TOTAL;i++)
+		{
 			strlcpy(sv.particleeffectname[i], standardeffectnames[i], sizeof(sv.particleeffectname[i]));
+			if (i > 0)
+				SV_PrecacheHash_Link(sv.particleeffectnamehash, sv.particleeffectnamenext, sv.particleeffectname, i);
+		}
 		for (filepass = 0;;filepass++)
 		{
 			if (filepass == 0)
@@ -3023,18 +3063,14 @@ int SV_ParticleEffectIndex(const char *name)
 					continue;
 				if (!strcmp(argv[0], "effect"))
 				{
-					if (argc == 2)
+					if (argc == 2 && !SV_PrecacheHash_Find(sv.particleeffectnamehash, sv.particleeffectnamenext, sv.particleeffectname, argv[1]))
 					{
 						for (effectnameindex = 1;effectnameindex < MAX_PARTICLEEFFECTNAME;effectnameindex++)
 						{
-							if (sv.particleeffectname[effectnameindex][0])
-							{
-								if (!strcmp(sv.particleeffectname[effectnameindex], argv[1]))
-									break;
-							}
-							else
+							if (!sv.particleeffectname[effectnameindex][0])
 							{
 								strlcpy(sv.particleeffectname[effectnameindex], argv[1], sizeof(sv.particleeffectname[effectnameindex]));
+								SV_PrecacheHash_Link(sv.particleeffectnamehash, sv.particleeffectnamenext, sv.particleeffectname, effectnameindex);
 								break;
 							}
 						}
@@ -3050,12 +3086,8 @@ int SV_ParticleEffectIndex(const char *name)
 			Mem_Free(filedata);
 		}
 	}
-	// search for the name
-	for (effectnameindex = 1;effectnameindex < MAX_PARTICLEEFFECTNAME && sv.particleeffectname[effectnameindex][0];effectnameindex++)
-		if (!strcmp(sv.particleeffectname[effectnameindex], name))
-			return effectnameindex;
-	// return 0 if we couldn't find it
-	return 0;
+	// search for the name, returns 0 if we couldn't find it
+	return SV_PrecacheHash_Find(sv.particleeffectnamehash, sv.particleeffectnamenext, sv.particleeffectname, name);
 }
 
 dp_model_t *SV_GetModelByIndex(int modelindex)
@@ -3432,6 +3464,7 @@ void SV_SpawnServer (const char *server)
 	for (i = 1;i < sv.worldmodel->brush.numsubmodels && i+1 < MAX_MODELS;i++)
 	{
 		dpsnprintf(sv.model_precache[i+1], sizeof(sv.model_precache[i+1]), "*%i", i);
+		SV_PrecacheHash_Link(sv.model_precachehash, sv.model_precachenext, sv.model_precache, i+1);
 		sv.models[i+1] = Mod_ForName (sv.model_precache[i+1], false, false, sv.worldname);
 	}
 	if(i < sv.worldmodel->brush.numsubmodels)
@@ -20,10 +20,23 @@
 #define Thread_CreateBarrier(count)       (_Thread_CreateBarrier(count, __FILE__, __LINE__))
 #define Thread_DestroyBarrier(barrier)    (_Thread_DestroyBarrier(barrier, __FILE__, __LINE__))
 #define Thread_WaitBarrier(barrier)       (_Thread_WaitBarrier(barrier, __FILE__, __LINE__))
+#define Thread_AtomicGet(a)               (_Thread_AtomicGet(a, __FILE__, __LINE__))
+#define Thread_AtomicExchange(a, v)       (_Thread_AtomicExchange(a, v, __FILE__, __LINE__))
+
+// an int handed between threads without a mutex, Thread_AtomicExchange is a
+// full memory barrier, so what a thread wrote before exchanging the value is
+// visible to the thread that gets it
+typedef struct thread_atomic_s
+{
+	volatile int value;
+}
+thread_atomic_t;
 
 int Thread_Init(void);
 void Thread_Shutdown(void);
 qboolean Thread_HasThreads(void);
+// number of logical processors, used to pick default worker thread counts
+int Thread_GetNumCPUs(void);
 void *_Thread_CreateMutex(const char *filename, int fileline);
 void _Thread_DestroyMutex(void *mutex, const char *filename, int fileline);
 int _Thread_LockMutex(void *mutex, const char *filename, int fileline);
@@ -38,5 +51,8 @@ int _Thread_WaitThread(void *thread, int retval, const char *filename, int filel
 void *_Thread_CreateBarrier(unsigned int count, const char *filename, int fileline);
 void _Thread_DestroyBarrier(void *barrier, const char *filename, int fileline);
 void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline);
+int _Thread_AtomicGet(thread_atomic_t *a, const char *filename, int fileline);
+// sets the value and returns the previous one
+int _Thread_AtomicExchange(thread_atomic_t *a, int v, const char *filename, int fileline);
 
 #endif
@@ -15,6 +15,11 @@ qboolean Thread_HasThreads(void)
 	return false;
 }
 
+int Thread_GetNumCPUs(void)
+{
+	return 1;
+}
+
 void *_Thread_CreateMutex(const char *filename, int fileline)
 {
 	return NULL;
@@ -80,3 +85,15 @@ void _Thread_DestroyBarrier(void *barrier, const char *filename, int fileline)
 void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 {
 }
+
+int _Thread_AtomicGet(thread_atomic_t *a, const char *filename, int fileline)
+{
+	return a->value;
+}
+
+int _Thread_AtomicExchange(thread_atomic_t *a, int v, const char *filename, int fileline)
+{
+	int old = a->value;
+	a->value = v;
+	return old;
+}
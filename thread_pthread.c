@@ -5,6 +5,7 @@
 #include <pthread.h>
 #endif
 #include <stdint.h>
+#include <unistd.h>
 
 
 int Thread_Init(void)
@@ -21,6 +22,15 @@ qboolean Thread_HasThreads(void)
 	return true;
 }
 
+int Thread_GetNumCPUs(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+#else
+	return 1;
+#endif
+}
+
 void *_Thread_CreateMutex(const char *filename, int fileline)
 {
 #ifdef THREADRECURSIVE
@@ -224,3 +234,18 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	Thread_UnlockMutex(b->mutex);
 }
 #endif
+
+int _Thread_AtomicGet(thread_atomic_t *a, const char *filename, int fileline)
+{
+	return __sync_fetch_and_add(&a->value, 0);
+}
+
+int _Thread_AtomicExchange(thread_atomic_t *a, int v, const char *filename, int fileline)
+{
+	// __sync_lock_test_and_set is only an acquire barrier
+	int old;
+	do
+		old = a->value;
+	while (!__sync_bool_compare_and_swap(&a->value, old, v));
+	return old;
+}
@@ -24,6 +24,11 @@ qboolean Thread_HasThreads(void)
 #endif
 }
 
+int Thread_GetNumCPUs(void)
+{
+	return max(1, SDL_GetCPUCount());
+}
+
 void *_Thread_CreateMutex(const char *filename, int fileline)
 {
 	void *mutex = SDL_CreateMutex();
@@ -171,3 +176,14 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	}
 	Thread_UnlockMutex(b->mutex);
 }
+
+// thread_atomic_t has the layout of SDL_atomic_t
+int _Thread_AtomicGet(thread_atomic_t *a, const char *filename, int fileline)
+{
+	return SDL_AtomicGet((SDL_atomic_t *)a);
+}
+
+int _Thread_AtomicExchange(thread_atomic_t *a, int v, const char *filename, int fileline)
+{
+	return SDL_AtomicSet((SDL_atomic_t *)a, v);
+}
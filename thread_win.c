@@ -23,6 +23,13 @@ qboolean Thread_HasThreads(void)
 #endif
 }
 
+int Thread_GetNumCPUs(void)
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return max(1, (int)info.dwNumberOfProcessors);
+}
+
 void *_Thread_CreateMutex(const char *filename, int fileline)
 {
 	void *mutex = (void *)CreateMutex(NULL, FALSE, NULL);
@@ -301,3 +308,13 @@ void _Thread_WaitBarrier(void *barrier, const char *filename, int fileline)
 	}
 	Thread_UnlockMutex(b->mutex);
 }
+
+int _Thread_AtomicGet(thread_atomic_t *a, const char *filename, int fileline)
+{
+	return (int)InterlockedCompareExchange((volatile LONG *)&a->value, 0, 0);
+}
+
+int _Thread_AtomicExchange(thread_atomic_t *a, int v, const char *filename, int fileline)
+{
+	return (int)InterlockedExchange((volatile LONG *)&a->value, (LONG)v);
+}
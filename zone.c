@@ -95,11 +95,55 @@ static memclump_t *clumpchain = NULL;
 
 cvar_t developer_memory = {0, "developer_memory", "0", "prints debugging information about memory allocations"};
 cvar_t developer_memorydebug = {0, "developer_memorydebug", "0", "enables memory corruption checks (very slow)"};
+cvar_t developer_memorytrack = {0, "developer_memorytrack", "0", "counts allocations per file and line (see memtrack command), only allocations made while this is on are counted"};
+cvar_t developer_memorytrack_log = {0, "developer_memorytrack_log", "0", "if non-zero prints the pools and allocation sites with the highest allocation rates every this many seconds (to console and log)"};
 cvar_t sys_memsize_physical = {CVAR_READONLY, "sys_memsize_physical", "", "physical memory size in MB (or empty if unknown)"};
 cvar_t sys_memsize_virtual = {CVAR_READONLY, "sys_memsize_virtual", "", "virtual memory size in MB (or empty if unknown)"};
 
 static mempool_t *poolchain = NULL;
 
+#if MEMSLABS
+// size of each slab, small allocations of one pool and size class are
+// carved from these so they cost no low-level allocation of their own
+#define MEMSLAB_SIZE 65536
+// largest block (including memheader_t, alignment and sentinel) taken from a slab
+#define MEMSLAB_MAXBLOCKSIZE 1024
+// block sizes of the MEMSLAB_CLASSES size classes are these steps added to the
+// smallest block that holds a 16 byte allocation (which depends on the size of
+// memheader_t), all multiples of 32, the last class is MEMSLAB_MAXBLOCKSIZE
+static const size_t mem_slabclassstep[MEMSLAB_CLASSES] = {0, 32, 64, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 896};
+static size_t mem_slabclasssize[MEMSLAB_CLASSES];
+// size class of a block size in units of 32 bytes (rounded up)
+static unsigned char mem_slabclassforsize[MEMSLAB_MAXBLOCKSIZE / 32 + 1];
+
+typedef struct memslab_s
+{
+	// next and previous slab with free blocks in the same pool and size class
+	struct memslab_s *next;
+	struct memslab_s *prev;
+	// pool this slab belongs to
+	struct mempool_s *pool;
+	// freed blocks, linked through their first bytes
+	void *freeblocks;
+	// blocks that were never handed out start here (carved on demand)
+	unsigned char *unused;
+	unsigned char *end;
+	size_t blocksize;
+	int sizeclass;
+	// blocks handed out, the slab is released when this drops to 0
+	int numused;
+	// should always be equal to MEMHEADER_SENTINEL_FOR_ADDRESS()
+	unsigned int sentinel;
+}
+memslab_t;
+
+// empty slabs are kept for reuse up to this many (so emptying and refilling
+// pools on level changes doesn't hand the memory back and forth with malloc)
+#define MEMSLAB_MAXCACHED 256
+static memslab_t *mem_slabcache = NULL;
+static int mem_numslabscached = 0;
+#endif
+
 void Mem_PrintStats(void);
 void Mem_PrintList(size_t minallocationsize);
 
@@ -364,6 +408,234 @@ static void Clump_FreeBlock(void *base, size_t size)
 #endif
 }
 
+#if MEMSLABS
+static void Mem_SlabUnlink(memslab_t *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		slab->pool->slabs[slab->sizeclass] = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	slab->next = slab->prev = NULL;
+}
+
+// takes a block from a slab of the pool, creating one if they are all full,
+// mem_mutex must be held
+static void *Mem_SlabAllocBlock(mempool_t *pool, int sizeclass, memslab_t **slabpointer)
+{
+	memslab_t *slab;
+	unsigned char *base;
+
+	slab = pool->slabs[sizeclass];
+	if (!slab)
+	{
+		if (mem_slabcache)
+		{
+			slab = mem_slabcache;
+			mem_slabcache = slab->next;
+			mem_numslabscached--;
+		}
+		else if (!(slab = (memslab_t *)Clump_AllocBlock(MEMSLAB_SIZE)))
+			return NULL;
+		memset(slab, 0, sizeof(*slab));
+		slab->pool = pool;
+		slab->sizeclass = sizeclass;
+		slab->blocksize = mem_slabclasssize[sizeclass];
+		slab->unused = (unsigned char *)(((size_t)(slab + 1) + 15) & ~(size_t)15);
+		slab->end = (unsigned char *)slab + MEMSLAB_SIZE;
+		slab->sentinel = MEMHEADER_SENTINEL_FOR_ADDRESS(&slab->sentinel);
+		pool->slabs[sizeclass] = slab;
+		pool->realsize += MEMSLAB_SIZE;
+	}
+	if (slab->freeblocks)
+	{
+		base = (unsigned char *)slab->freeblocks;
+		slab->freeblocks = *(void **)base;
+	}
+	else
+	{
+		base = slab->unused;
+		slab->unused += slab->blocksize;
+	}
+	slab->numused++;
+	// a full slab leaves the list until a block is freed
+	if (!slab->freeblocks && slab->unused + slab->blocksize > slab->end)
+		Mem_SlabUnlink(slab);
+	if (developer_memorydebug.integer)
+		memset(base, 0xBF, slab->blocksize);
+	*slabpointer = slab;
+	return base;
+}
+
+// releases an empty slab that has been unlinked from its pool
+static void Mem_SlabRelease(memslab_t *slab)
+{
+	slab->pool->realsize -= MEMSLAB_SIZE;
+	if (mem_numslabscached < MEMSLAB_MAXCACHED)
+	{
+		if (developer_memorydebug.integer)
+			memset(slab, 0xFF, MEMSLAB_SIZE);
+		slab->next = mem_slabcache;
+		mem_slabcache = slab;
+		mem_numslabscached++;
+	}
+	else
+		Clump_FreeBlock(slab, MEMSLAB_SIZE);
+}
+
+// returns a block to its slab and releases the slab once it is empty (unless
+// it is the only one of its size class with free blocks), mem_mutex must be held
+static void Mem_SlabFreeBlock(memslab_t *slab, void *base)
+{
+	mempool_t *pool = slab->pool;
+	qboolean wasfull;
+
+	if (slab->sentinel != MEMHEADER_SENTINEL_FOR_ADDRESS(&slab->sentinel))
+		Sys_Error("Mem_SlabFreeBlock: trashed slab sentinel\n");
+	if (developer_memorydebug.integer)
+		memset(base, 0xFF, slab->blocksize);
+	wasfull = !slab->freeblocks && slab->unused + slab->blocksize > slab->end;
+	*(void **)base = slab->freeblocks;
+	slab->freeblocks = base;
+	slab->numused--;
+	if (wasfull)
+	{
+		slab->prev = NULL;
+		slab->next = pool->slabs[slab->sizeclass];
+		if (slab->next)
+			slab->next->prev = slab;
+		pool->slabs[slab->sizeclass] = slab;
+	}
+	else if (slab->numused == 0 && (slab->prev || slab->next))
+	{
+		Mem_SlabUnlink(slab);
+		Mem_SlabRelease(slab);
+	}
+}
+
+// releases the empty slabs kept around by a pool that has been emptied
+static void Mem_FreeSlabs(mempool_t *pool)
+{
+	int i;
+	memslab_t *slab;
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	for (i = 0;i < MEMSLAB_CLASSES;i++)
+	{
+		while ((slab = pool->slabs[i]))
+		{
+			if (slab->numused)
+				Sys_Error("Mem_FreeSlabs: slab still in use in pool %s\n", pool->name);
+			Mem_SlabUnlink(slab);
+			Mem_SlabRelease(slab);
+		}
+	}
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+}
+#endif
+
+// allocation site table for developer_memorytrack, records are never removed
+// (until restart) so freeing a tracked allocation finds the same record again
+#define MEMTRACK_MAXCALLSITES 4096
+#define MEMTRACK_HASHSIZE 8192
+// number of allocation sites listed by the periodic developer_memorytrack_log report
+#define MEMTRACK_LOGCOUNT 10
+
+typedef struct memcallsite_s
+{
+	// file name and line where Mem_Alloc was called (filename is compared by pointer)
+	const char *filename;
+	int fileline;
+	memtrackstats_t track;
+	// allocations from this site that have not been freed yet
+	size_t livecount;
+	size_t livebytes;
+	size_t peaklivebytes;
+}
+memcallsite_t;
+
+static memcallsite_t mem_callsites[MEMTRACK_MAXCALLSITES];
+static int mem_numcallsites;
+// index + 1 into mem_callsites, 0 is an empty slot
+static int mem_callsitehash[MEMTRACK_HASHSIZE];
+// frames counted since the last memtrack reset and since the last periodic report
+static int mem_trackframes;
+static int mem_trackwindowframes;
+static double mem_trackwindowtime;
+
+// finds or adds the record of an allocation site, caller must hold mem_mutex
+static memcallsite_t *Mem_TrackCallSite(const char *filename, int fileline)
+{
+	unsigned int hashindex;
+	int index;
+	memcallsite_t *callsite;
+	hashindex = ((unsigned int)((uintptr_t)filename >> 3) ^ ((unsigned int)fileline * 2654435761u)) & (MEMTRACK_HASHSIZE - 1);
+	for (;;hashindex = (hashindex + 1) & (MEMTRACK_HASHSIZE - 1))
+	{
+		index = mem_callsitehash[hashindex];
+		if (!index)
+			break;
+		callsite = mem_callsites + index - 1;
+		if (callsite->filename == filename && callsite->fileline == fileline)
+			return callsite;
+	}
+	// if the table is full all further sites are counted in the last record
+	if (mem_numcallsites >= MEMTRACK_MAXCALLSITES - 1)
+	{
+		callsite = mem_callsites + MEMTRACK_MAXCALLSITES - 1;
+		callsite->filename = "(other)";
+		callsite->fileline = 0;
+		return callsite;
+	}
+	callsite = mem_callsites + mem_numcallsites++;
+	callsite->filename = filename;
+	callsite->fileline = fileline;
+	mem_callsitehash[hashindex] = mem_numcallsites;
+	return callsite;
+}
+
+static void Mem_TrackAlloc(memtrackstats_t *track, size_t size)
+{
+	track->allocs++;
+	track->allocbytes += size;
+	track->windowallocs++;
+	track->windowallocbytes += size;
+	track->frameallocs++;
+	track->frameallocbytes += size;
+}
+
+static void Mem_TrackFree(memtrackstats_t *track)
+{
+	track->frees++;
+	track->windowfrees++;
+}
+
+static void Mem_TrackEndFrame(memtrackstats_t *track)
+{
+	track->peakframeallocs = max(track->peakframeallocs, track->frameallocs);
+	track->peakframeallocbytes = max(track->peakframeallocbytes, track->frameallocbytes);
+	track->frameallocs = 0;
+	track->frameallocbytes = 0;
+}
+
+static void Mem_TrackResetWindow(memtrackstats_t *track)
+{
+	track->windowallocs = 0;
+	track->windowfrees = 0;
+	track->windowallocbytes = 0;
+}
+
+static void Mem_TrackReset(memtrackstats_t *track)
+{
+	track->allocs = 0;
+	track->frees = 0;
+	track->allocbytes = 0;
+	track->peakframeallocs = 0;
+	track->peakframeallocbytes = 0;
+}
+
 void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment, const char *filename, int fileline)
 {
 	unsigned int sentinel1;
@@ -374,6 +646,10 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	memheader_t *mem;
 	memheader_t *oldmem;
 	unsigned char *base;
+	memcallsite_t *callsite;
+#if MEMSLABS
+	struct memslab_s *slab;
+#endif
 
 	if (size <= 0)
 	{
@@ -395,9 +671,20 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	//if (developer.integer > 0 && developer_memorydebug.integer)
 	//	_Mem_CheckSentinelsGlobal(filename, fileline);
 	pool->totalsize += size;
+	pool->peaksize = max(pool->peaksize, pool->totalsize);
+	Mem_TrackAlloc(&pool->track, size);
 	realsize = alignment + sizeof(memheader_t) + size + sizeof(sentinel2);
-	pool->realsize += realsize;
-	base = (unsigned char *)Clump_AllocBlock(realsize);
+#if MEMSLABS
+	slab = NULL;
+	// slab blocks are aligned to 16 bytes, which is enough for most uses
+	if (realsize <= MEMSLAB_MAXBLOCKSIZE && alignment <= 16)
+		base = (unsigned char *)Mem_SlabAllocBlock(pool, mem_slabclassforsize[(realsize + 31) / 32], &slab);
+	else
+#endif
+	{
+		pool->realsize += realsize;
+		base = (unsigned char *)Clump_AllocBlock(realsize);
+	}
 	if (base== NULL)
 	{
 		Mem_PrintList(0);
@@ -413,6 +700,18 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 	mem->fileline = fileline;
 	mem->size = size;
 	mem->pool = pool;
+#if MEMSLABS
+	mem->slab = slab;
+#endif
+	mem->tracked = developer_memorytrack.integer != 0;
+	if (mem->tracked)
+	{
+		callsite = Mem_TrackCallSite(filename, fileline);
+		Mem_TrackAlloc(&callsite->track, size);
+		callsite->livecount++;
+		callsite->livebytes += size;
+		callsite->peaklivebytes = max(callsite->peaklivebytes, callsite->livebytes);
+	}
 
 	// calculate sentinels (detects buffer overruns, in a way that is hard to exploit)
 	sentinel1 = MEMHEADER_SENTINEL_FOR_ADDRESS(&mem->sentinel);
@@ -449,6 +748,7 @@ void *_Mem_Alloc(mempool_t *pool, void *olddata, size_t size, size_t alignment,
 static void _Mem_FreeBlock(memheader_t *mem, const char *filename, int fileline)
 {
 	mempool_t *pool;
+	memcallsite_t *callsite;
 	size_t size;
 	size_t realsize;
 	unsigned int sentinel1;
@@ -478,10 +778,25 @@ static void _Mem_FreeBlock(memheader_t *mem, const char *filename, int fileline)
 		mem->next->prev = mem->prev;
 	// memheader has been unlinked, do the actual free now
 	size = mem->size;
-	realsize = sizeof(memheader_t) + size + sizeof(sentinel2);
 	pool->totalsize -= size;
-	pool->realsize -= realsize;
-	Clump_FreeBlock(mem->baseaddress, realsize);
+	Mem_TrackFree(&pool->track);
+	if (mem->tracked)
+	{
+		callsite = Mem_TrackCallSite(mem->filename, mem->fileline);
+		Mem_TrackFree(&callsite->track);
+		callsite->livecount--;
+		callsite->livebytes -= size;
+	}
+#if MEMSLABS
+	if (mem->slab)
+		Mem_SlabFreeBlock(mem->slab, mem->baseaddress);
+	else
+#endif
+	{
+		realsize = sizeof(memheader_t) + size + sizeof(sentinel2);
+		pool->realsize -= realsize;
+		Clump_FreeBlock(mem->baseaddress, realsize);
+	}
 	if (mem_mutex)
 		Thread_UnlockMutex(mem_mutex);
 }
@@ -556,6 +871,9 @@ void _Mem_FreePool(mempool_t **poolpointer, const char *filename, int fileline)
 		// free memory owned by the pool
 		while (pool->chain)
 			_Mem_FreeBlock(pool->chain, filename, fileline);
+#if MEMSLABS
+		Mem_FreeSlabs(pool);
+#endif
 
 		// free child pools, too
 		for(iter = poolchain; iter; iter = temp) {
@@ -595,6 +913,9 @@ void _Mem_EmptyPool(mempool_t *pool, const char *filename, int fileline)
 	// free memory owned by the pool
 	while (pool->chain)
 		_Mem_FreeBlock(pool->chain, filename, fileline);
+#if MEMSLABS
+	Mem_FreeSlabs(pool);
+#endif
 
 	// empty child pools, too
 	for(chainaddress = poolchain; chainaddress; chainaddress = chainaddress->next)
@@ -870,6 +1191,188 @@ static void MemStats_f(void)
 	Mem_PrintStats();
 }
 
+static int Mem_TrackCompareCallSites(const void *a, const void *b)
+{
+	const memcallsite_t *ca = (const memcallsite_t *)a;
+	const memcallsite_t *cb = (const memcallsite_t *)b;
+	if (ca->track.allocbytes != cb->track.allocbytes)
+		return ca->track.allocbytes > cb->track.allocbytes ? -1 : 1;
+	if (ca->track.allocs != cb->track.allocs)
+		return ca->track.allocs > cb->track.allocs ? -1 : 1;
+	return 0;
+}
+
+// prints allocation rates of pools and the busiest allocation sites, either
+// since the last memtrack reset or since the last periodic report (window)
+static void Mem_PrintTrack(int count, qboolean window)
+{
+	int i, numpools, maxpools, numcallsites, frames;
+	double scale;
+	size_t allocs, frees, allocbytes;
+	mempool_t *pool;
+	mempool_t *pools, *poolcopy;
+	memcallsite_t *callsites, *callsite;
+
+	// copy the pool counters under mem_mutex as well, pools are created and
+	// freed by other threads, the copy is allocated first as that takes the
+	// mutex too (a pool created in between is left out of this report)
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	for (pool = poolchain, maxpools = 0;pool;pool = pool->next)
+		maxpools++;
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+	pools = (mempool_t *)Mem_Alloc(tempmempool, max(maxpools, 1) * sizeof(mempool_t));
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	for (pool = poolchain, numpools = 0;pool && numpools < maxpools;pool = pool->next)
+		pools[numpools++] = *pool;
+	frames = window ? mem_trackwindowframes : mem_trackframes;
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+
+	scale = 1.0 / max(frames, 1);
+	Con_Printf("memory allocations per frame over %i frames:\n"
+	           "  allocs/f     bytes/f   frees/f  peak allocs   peak bytes       size  high-water name\n", frames);
+	for (i = 0, poolcopy = pools;i < numpools;i++, poolcopy++)
+	{
+		allocs = window ? poolcopy->track.windowallocs : poolcopy->track.allocs;
+		frees = window ? poolcopy->track.windowfrees : poolcopy->track.frees;
+		allocbytes = window ? poolcopy->track.windowallocbytes : poolcopy->track.allocbytes;
+		if (!allocs && !frees)
+			continue;
+		Con_Printf("%10.1f %11.0f %9.1f %12lu %12lu %9luk %10luk %s\n", allocs * scale, allocbytes * scale, frees * scale, (unsigned long)poolcopy->track.peakframeallocs, (unsigned long)poolcopy->track.peakframeallocbytes, (unsigned long)((poolcopy->totalsize + 1023) / 1024), (unsigned long)((poolcopy->peaksize + 1023) / 1024), poolcopy->name);
+	}
+	Mem_Free(pools);
+
+	if (count < 1)
+		return;
+	if (!mem_numcallsites)
+	{
+		if (!developer_memorytrack.integer)
+			Con_Print("set developer_memorytrack 1 to list allocation sites\n");
+		return;
+	}
+
+	// copy the records (including the overflow record) so they can be sorted
+	// without holding mem_mutex, the copy may itself add a record
+	numcallsites = min(mem_numcallsites + 1, MEMTRACK_MAXCALLSITES);
+	callsites = (memcallsite_t *)Mem_Alloc(tempmempool, numcallsites * sizeof(memcallsite_t));
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	memcpy(callsites, mem_callsites, (numcallsites - 1) * sizeof(memcallsite_t));
+	callsites[numcallsites - 1] = mem_callsites[MEMTRACK_MAXCALLSITES - 1];
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+	if (window)
+	{
+		for (i = 0, callsite = callsites;i < numcallsites;i++, callsite++)
+		{
+			callsite->track.allocs = callsite->track.windowallocs;
+			callsite->track.frees = callsite->track.windowfrees;
+			callsite->track.allocbytes = callsite->track.windowallocbytes;
+		}
+	}
+	qsort(callsites, numcallsites, sizeof(memcallsite_t), Mem_TrackCompareCallSites);
+
+	Con_Print("busiest allocation sites:\n"
+	          "  allocs/f     bytes/f   frees/f  peak allocs   peak bytes       live   live size  peak live site\n");
+	for (i = 0, callsite = callsites;i < numcallsites && i < count;i++, callsite++)
+	{
+		if (!callsite->filename || (!callsite->track.allocs && !callsite->track.frees))
+			break;
+		Con_Printf("%10.1f %11.0f %9.1f %12lu %12lu %10lu %10luk %9luk %s:%i\n", callsite->track.allocs * scale, callsite->track.allocbytes * scale, callsite->track.frees * scale, (unsigned long)callsite->track.peakframeallocs, (unsigned long)callsite->track.peakframeallocbytes, (unsigned long)callsite->livecount, (unsigned long)((callsite->livebytes + 1023) / 1024), (unsigned long)((callsite->peaklivebytes + 1023) / 1024), callsite->filename, callsite->fileline);
+	}
+	Mem_Free(callsites);
+}
+
+// clears the periodic report counters, or everything except live allocations
+static void Mem_ResetTrack(qboolean windowonly)
+{
+	int i;
+	mempool_t *pool;
+	memcallsite_t *callsite;
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	for (pool = poolchain;pool;pool = pool->next)
+	{
+		Mem_TrackResetWindow(&pool->track);
+		if (!windowonly)
+		{
+			Mem_TrackReset(&pool->track);
+			pool->peaksize = pool->totalsize;
+		}
+	}
+	for (i = 0, callsite = mem_callsites;i < MEMTRACK_MAXCALLSITES;i++, callsite++)
+	{
+		// skip the unused records, but not the overflow record at the end
+		if (i >= mem_numcallsites && i < MEMTRACK_MAXCALLSITES - 1)
+			continue;
+		Mem_TrackResetWindow(&callsite->track);
+		if (!windowonly)
+		{
+			Mem_TrackReset(&callsite->track);
+			callsite->peaklivebytes = callsite->livebytes;
+		}
+	}
+	mem_trackwindowframes = 0;
+	if (!windowonly)
+		mem_trackframes = 0;
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+}
+
+/*
+========================
+Mem_EndFrame
+
+folds this frame's allocation counts into the peaks and prints the periodic
+report if developer_memorytrack_log is set
+========================
+*/
+void Mem_EndFrame(void)
+{
+	int i;
+	mempool_t *pool;
+	if (mem_mutex)
+		Thread_LockMutex(mem_mutex);
+	for (pool = poolchain;pool;pool = pool->next)
+		Mem_TrackEndFrame(&pool->track);
+	for (i = 0;i < mem_numcallsites;i++)
+		Mem_TrackEndFrame(&mem_callsites[i].track);
+	Mem_TrackEndFrame(&mem_callsites[MEMTRACK_MAXCALLSITES - 1].track);
+	mem_trackframes++;
+	mem_trackwindowframes++;
+	if (mem_mutex)
+		Thread_UnlockMutex(mem_mutex);
+
+	if (developer_memorytrack_log.value > 0 && realtime >= mem_trackwindowtime + developer_memorytrack_log.value)
+	{
+		Mem_PrintTrack(MEMTRACK_LOGCOUNT, true);
+		Mem_ResetTrack(true);
+		mem_trackwindowtime = realtime;
+	}
+}
+
+static void MemTrack_f(void)
+{
+	switch(Cmd_Argc())
+	{
+	case 1:
+		Mem_PrintTrack(20, false);
+		break;
+	case 2:
+		if (!strcmp(Cmd_Argv(1), "reset"))
+			Mem_ResetTrack(false);
+		else
+			Mem_PrintTrack(atoi(Cmd_Argv(1)), false);
+		break;
+	default:
+		Con_Print("MemTrack_f: unrecognized options\nusage: memtrack [count|reset]\n");
+		break;
+	}
+}
+
 
 char* Mem_strdup (mempool_t *pool, const char* s)
 {
@@ -895,6 +1398,22 @@ void Memory_Init (void)
 	mem_bigendian = u.b[0] != 0;
 
 	sentinel_seed = rand();
+#if MEMSLABS
+	{
+		int i, sizeclass;
+		// same worst case as realsize in _Mem_Alloc (16 byte alignment and the tail sentinel)
+		size_t smallest = (16 + sizeof(memheader_t) + 16 + sizeof(unsigned int) + 31) & ~(size_t)31;
+		for (i = 0;i < MEMSLAB_CLASSES;i++)
+			mem_slabclasssize[i] = min(smallest + mem_slabclassstep[i], (size_t)MEMSLAB_MAXBLOCKSIZE);
+		mem_slabclasssize[MEMSLAB_CLASSES - 1] = MEMSLAB_MAXBLOCKSIZE;
+		for (i = 0, sizeclass = 0;i <= MEMSLAB_MAXBLOCKSIZE / 32;i++)
+		{
+			while (mem_slabclasssize[sizeclass] < (size_t)i * 32)
+				sizeclass++;
+			mem_slabclassforsize[i] = sizeclass;
+		}
+	}
+#endif
 	poolchain = NULL;
 	tempmempool = Mem_AllocPool("Temporary Memory", POOLFLAG_TEMP, NULL);
 	zonemempool = Mem_AllocPool("Zone", 0, NULL);
@@ -917,8 +1436,11 @@ void Memory_Init_Commands (void)
 {
 	Cmd_AddCommand ("memstats", MemStats_f, "prints memory system statistics");
 	Cmd_AddCommand ("memlist", MemList_f, "prints memory pool information (or if used as memlist 5 lists individual allocations of 5K or larger, 0 lists all allocations)");
+	Cmd_AddCommand ("memtrack", MemTrack_f, "prints allocations per frame of each memory pool and (with developer_memorytrack 1) of the busiest allocation sites, memtrack 50 lists 50 sites, memtrack reset clears the counters and peaks");
 	Cvar_RegisterVariable (&developer_memory);
 	Cvar_RegisterVariable (&developer_memorydebug);
+	Cvar_RegisterVariable (&developer_memorytrack);
+	Cvar_RegisterVariable (&developer_memorytrack_log);
 	Cvar_RegisterVariable (&sys_memsize_physical);
 	Cvar_RegisterVariable (&sys_memsize_virtual);
 
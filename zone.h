@@ -29,6 +29,31 @@ extern qboolean mem_bigendian;
 #define POOLNAMESIZE 128
 // if set this pool will be printed in memlist reports
 #define POOLFLAG_TEMP 1
+// LordHavoc: enables per-pool slabs for small allocations (instead of one low-level allocation each)
+#ifndef MEMSLABS
+# define MEMSLABS 1
+#endif
+// number of small allocation size classes served from slabs (see zone.c)
+#define MEMSLAB_CLASSES 14
+
+// allocation counters kept per pool and per allocation site, printed by memtrack
+typedef struct memtrackstats_s
+{
+	// totals since the last memtrack reset
+	size_t allocs;
+	size_t frees;
+	size_t allocbytes;
+	// totals since the last periodic report (developer_memorytrack_log)
+	size_t windowallocs;
+	size_t windowfrees;
+	size_t windowallocbytes;
+	// current frame, and the busiest frame since the last memtrack reset
+	size_t frameallocs;
+	size_t frameallocbytes;
+	size_t peakframeallocs;
+	size_t peakframeallocbytes;
+}
+memtrackstats_t;
 
 typedef struct memheader_s
 {
@@ -44,6 +69,12 @@ typedef struct memheader_s
 	// file name and line where Mem_Alloc was called
 	const char *filename;
 	int fileline;
+	// counted in the allocation site record of filename:fileline (developer_memorytrack was on at allocation time)
+	int tracked;
+#if MEMSLABS
+	// slab the allocation was carved from (NULL if it was allocated directly)
+	struct memslab_s *slab;
+#endif
 	// should always be equal to MEMHEADER_SENTINEL_FOR_ADDRESS()
 	unsigned int sentinel;
 	// immediately followed by data, which is followed by another copy of mem_sentinel[]
@@ -64,10 +95,18 @@ typedef struct mempool_s
 	size_t realsize;
 	// updated each time the pool is displayed by memlist, shows change from previous time (unless pool was freed)
 	size_t lastchecksize;
+	// largest totalsize since the pool was created (or since memtrack reset)
+	size_t peaksize;
+	// allocation rates of this pool
+	memtrackstats_t track;
 	// linked into global mempool list
 	struct mempool_s *next;
 	// parent object (used for nested memory pools)
 	struct mempool_s *parent;
+#if MEMSLABS
+	// slabs of each size class that still have free blocks
+	struct memslab_s *slabs[MEMSLAB_CLASSES];
+#endif
 	// file name and line where Mem_AllocPool was called
 	const char *filename;
 	int fileline;
@@ -132,6 +171,8 @@ extern mempool_t *tempmempool;
 void Memory_Init (void);
 void Memory_Shutdown (void);
 void Memory_Init_Commands (void);
+// called once per host frame to update the allocation rates shown by memtrack
+void Mem_EndFrame (void);
 
 extern mempool_t *zonemempool;
 #define Z_Malloc(size) Mem_Alloc(zonemempool,size)
@@ -139,6 +180,7 @@ extern mempool_t *zonemempool;
 
 extern struct cvar_s developer_memory;
 extern struct cvar_s developer_memorydebug;
+extern struct cvar_s developer_memorytrack;
 
 #endif
 